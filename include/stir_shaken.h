@@ -2,10 +2,13 @@
 #define __STIR_SHAKEN
 
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdint.h>
+#include <stddef.h>
 #include <inttypes.h>
 #include <sys/stat.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <libks/ks.h>
@@ -14,6 +17,7 @@
 #include <jwt.h>
 
 #include <pthread.h>
+#include <sched.h>
 
 #include <openssl/crypto.h>
 #include <openssl/pem.h>
@@ -29,6 +33,7 @@
 #include <openssl/ssl.h>
 #include <openssl/err.h>
 #include <openssl/bio.h>
+#include <openssl/ocsp.h>
 #include <openssl/conf_api.h>
 #include <libgen.h>
 
@@ -101,6 +106,33 @@ typedef struct stir_shaken_csr_s {
 	char		*pem;
 } stir_shaken_csr_t;
 
+// TNAuthList (RFC 8226) decoded from certificate, made once per cert.
+// TNs and TN ranges are kept as sorted, disjoint intervals of keys (see STIR_SHAKEN_TN_KEY), so cert coverage of a TN is a binary search.
+#define STIR_SHAKEN_TN_MAX_DIGITS	15
+#define STIR_SHAKEN_TN_KEY(len, value)	((uint64_t) (len) * 1000000000000000ULL + (value))
+
+typedef struct stir_shaken_tn_authlist_s {
+	char		**spc;				// Service Provider Codes
+	int			spc_n;
+	char		*uri;				// authority check URL (extension made by stir_shaken_x509_add_tnauthlist_extension_uri)
+	uint64_t	*ranges;			// pairs of keys: first, last
+	int			ranges_n;
+} stir_shaken_tn_authlist_t;
+
+// Compact, reference counted certificate used on verification path and by x5u cache.
+// X509, chain and @len never change after creation, so one object is shared by all threads verifying with it.
+typedef struct stir_shaken_cert_ref_s {
+	X509			*x;						// X509 end-entity Certificate
+	STACK_OF(X509)	*xchain;				// Certificate chain
+	size_t			len;					// size of downloaded payload
+	void			*pub_raw;				// public key in raw format (as used for JWT), made on first use
+	stir_shaken_tn_authlist_t	*tn_authlist;	// decoded TNAuthList, made on first use
+	uint64_t		verified_generation;	// trust store generation cert passed X509 cert path validation with, 0 - not validated
+	int64_t			valid_from;				// latest notBefore in validated path
+	int64_t			valid_until;			// earliest notAfter in validated path, validation doesn't count outside of these
+	int				refs;
+} stir_shaken_cert_ref_t;
+
 // Note:
 //
 // if X509 gets destroyed then notBefore_ASN1 and notAfter_ASN1
@@ -124,7 +156,8 @@ typedef struct stir_shaken_cert_s {
 	char			hashstr[STIR_SHAKEN_BUFLEN];	// hashed name as string
 	char			cert_name_hashed[STIR_SHAKEN_BUFLEN];	// hashed name with .0 appended - ready to save in CA dir for usage with X509 cert path validation check
 
-	// Cert info retrieved with stir_shaken_read_cert
+	// Cert info retrieved with stir_shaken_read_cert_fields (ASN1 times),
+	// version and string fields are read on first access with stir_shaken_cert_get_*
 	char *serialHex;
 	char *serialDec;
 	ASN1_TIME *notBefore_ASN1;
@@ -135,6 +168,11 @@ typedef struct stir_shaken_cert_s {
 	char subject[STIR_SHAKEN_SSL_BUF_LEN];
 	int version;
 
+	uint8_t		path_verified;				// cert (served from x5u cache) already passed X509 cert path validation
+	uint64_t	verified_generation;		// generation of trust store that cert path has been validated against
+
+	stir_shaken_cert_ref_t	*ref;			// compact cert this one wraps (if made from it), shares its public key and TNAuthList
+	stir_shaken_tn_authlist_t	*tn_authlist;	// decoded TNAuthList (if not wrapping compact cert), made on first use
 } stir_shaken_cert_t;
 
 // ACME credentials
@@ -302,6 +340,9 @@ typedef enum stir_shaken_error {
 	STIR_SHAKEN_ERROR_FILE_OPEN,
 	STIR_SHAKEN_ERROR_FILE_READ,
 	STIR_SHAKEN_ERROR_FILE_WRITE,
+	STIR_SHAKEN_ERROR_HTTP_TIMEOUT,
+	STIR_SHAKEN_ERROR_CERT_REVOKED,
+	STIR_SHAKEN_ERROR_OCSP,
 } stir_shaken_error_t;
 
 #define STIR_SHAKEN_HTTP_REQ_404_INVALID "404"
@@ -314,22 +355,116 @@ typedef enum stir_shaken_http_req_type {
 	STIR_SHAKEN_HTTP_REQ_TYPE_HEAD
 } stir_shaken_http_req_type_t;
 
+#define STIR_SHAKEN_ERROR_RING 4		// most recent errors kept in context
+#define STIR_SHAKEN_ERROR_TEXT_LEN 256	// copied (not static) description, longer is truncated
+
+typedef struct stir_shaken_error_entry_s {
+	stir_shaken_error_t	error;
+	int					line;
+	const char			*file;
+	const char			*description;						// static string, NULL if copied into @text
+	char				text[STIR_SHAKEN_ERROR_TEXT_LEN];	// copy of description which is not static
+} stir_shaken_error_entry_t;
+
+/*
+ * Errors are recorded as they are set (code, description, file, line) and formatted only when asked for
+ * with stir_shaken_get_error. Clearing only resets the count.
+ * Context holds no pointers into itself and can be copied by value.
+ */
 typedef struct stir_shaken_context_s {
-	char err_buf0[STIR_SHAKEN_ERROR_BUF_LEN];
-	char err_buf1[STIR_SHAKEN_ERROR_BUF_LEN];
-	char err_buf2[STIR_SHAKEN_ERROR_BUF_LEN];
-	char err_buf3[STIR_SHAKEN_ERROR_BUF_LEN];
-	char err[4*STIR_SHAKEN_ERROR_BUF_LEN];
-	stir_shaken_error_t error;
-	uint8_t got_error;
+	stir_shaken_error_entry_t	errors[STIR_SHAKEN_ERROR_RING];	// ring, most recent at (n - 1) % STIR_SHAKEN_ERROR_RING
+	unsigned int				n;								// errors set since cleared, 0 - no error
 } stir_shaken_context_t;
 
 typedef struct mem_chunk_s {
 	char    *mem;
 	size_t  size;
 	stir_shaken_context_t	*ss;
+	size_t	capacity;		// allocated size of @mem (0 if unknown, e.g. @mem set by application)
+	size_t	max;			// max allowed @size, 0 - no limit
 } mem_chunk_t;
 
+/*
+ * Expiry scheduler: cache entries ordered by time they must be dropped at (min-heap), so that expired entries
+ * are evicted without scanning the cache. Node is embedded in cache entry and guarded by the cache's lock.
+ */
+
+#define STIR_SHAKEN_EXPIRY_MIN	64
+
+typedef struct stir_shaken_expiry_node_s {
+	time_t		at;
+	size_t		pos;		// position in heap + 1, 0 - not scheduled
+} stir_shaken_expiry_node_t;
+
+typedef struct stir_shaken_expiry_s {
+	stir_shaken_expiry_node_t	**heap;
+	size_t						n;
+	size_t						capacity;
+} stir_shaken_expiry_t;
+
+#define STIR_SHAKEN_EXPIRY_ENTRY(node, type, member) ((type *) ((char *) (node) - offsetof(type, member)))
+
+/*
+ * Logging: records are delivered on the logging thread, to user callback or as is to stderr.
+ * Background writer is opt-in (stir_shaken_log_start): once started, records are written by the logging thread
+ * into its own ring (single producer, no locks) and delivered by writer. When ring is full records are dropped and counted.
+ */
+
+#define STIR_SHAKEN_LOG_RING_SIZE	128		// records per logging thread, power of 2
+#define STIR_SHAKEN_LOG_MSG_LEN		512		// longer messages are truncated (except written to stderr on logging thread)
+#define STIR_SHAKEN_LOG_SPIN		64		// passes over empty rings before writer sleeps
+
+typedef enum stir_shaken_log_subsystem_e {
+	STIR_SHAKEN_LOG_GENERAL,
+	STIR_SHAKEN_LOG_SSL,
+	STIR_SHAKEN_LOG_CERT_STORE,
+	STIR_SHAKEN_LOG_OCSP,
+	STIR_SHAKEN_LOG_HTTP,
+	STIR_SHAKEN_LOG_VERIFY,
+	STIR_SHAKEN_LOG_ACME,
+	STIR_SHAKEN_LOG_SP,
+} stir_shaken_log_subsystem_t;
+
+typedef struct stir_shaken_log_record_s {
+	int								level;
+	stir_shaken_log_subsystem_t		subsystem;
+	uint64_t						call_id;		// set on logging thread with stir_shaken_log_set_call_id, 0 - none
+	struct timespec					ts;				// CLOCK_REALTIME
+	const char						*file;
+	int								line;
+	size_t							len;
+	char							msg[STIR_SHAKEN_LOG_MSG_LEN];
+} stir_shaken_log_record_t;
+
+// Called on writer thread (or logging thread if writer is not running), @record is valid only during the call
+typedef void (*stir_shaken_log_callback_t)(const stir_shaken_log_record_t *record, void *user_data);
+
+typedef struct stir_shaken_log_ring_s {
+	stir_shaken_log_record_t		records[STIR_SHAKEN_LOG_RING_SIZE];
+	uint64_t						head;			// next to write, owning thread only
+	uint64_t						tail;			// next to deliver, writer only
+	uint64_t						dropped;		// not yet reported
+	pthread_t						owner;
+	uint8_t							orphaned;		// owning thread exited, freed once drained
+	struct stir_shaken_log_ring_s	*next;
+} stir_shaken_log_ring_t;
+
+// x5u certificate cache
+
+#define STIR_SHAKEN_X5U_CACHE_BUCKETS	256
+#define STIR_SHAKEN_X5U_CACHE_MAX		4096
+
+typedef struct stir_shaken_x5u_cache_entry_s {
+	char			*url;
+	stir_shaken_cert_ref_t	*ref;				// shared with certs served from this entry
+	char			*etag;						// validators from last full response, used for conditional GET when entry gets stale
+	char			*last_modified;
+	time_t			expires;					// fresh until
+	time_t			not_after;					// of the cert, entry is never served past it
+	stir_shaken_expiry_node_t	expiry;			// dropped when stale (or at @not_after if it can be revalidated)
+	struct stir_shaken_x5u_cache_entry_s *next;
+} stir_shaken_x5u_cache_entry_t;
+
 // HTTP
 
 typedef enum stir_shaken_http_req_content_type {
@@ -337,15 +472,66 @@ typedef enum stir_shaken_http_req_content_type {
 	STIR_SHAKEN_HTTP_REQ_CONTENT_TYPE_URLENCODED
 } stir_shaken_http_req_content_type_t;
 
+// Slots in response header index (power of 2), at most 3/4 of them are used
+#define STIR_SHAKEN_HTTP_HEADER_INDEX_SIZE 64
+
+// Entry in response header index, offsets are into response's header buffer
+typedef struct stir_shaken_http_header_s {
+	uint32_t	hash;		// 0 - empty slot
+	uint32_t	name;
+	uint32_t	value;
+} stir_shaken_http_header_t;
+
 typedef struct stir_shaken_http_response_s {
 	long			code;
 	char			error[STIR_SHAKEN_BUFLEN];
 	mem_chunk_t		mem;
-	curl_slist_t	*headers;
+	curl_slist_t	*headers;		// not filled by library, application/mocks may set it, searched by stir_shaken_get_http_header if no headers received
+
+	// Received headers, stored as status line and then name\0value\0 pairs
+	char						*header_buf;
+	size_t						header_buf_len;
+	size_t						header_buf_capacity;
+	stir_shaken_http_header_t	header_index[STIR_SHAKEN_HTTP_HEADER_INDEX_SIZE];
+	int							header_n;
+	uint8_t						header_index_full;
+
+	long						num_connects;	// new connections made for this transfer (0 if existing connection was reused)
+	long						http_version;	// HTTP version used, CURL_HTTP_VERSION_1_1, CURL_HTTP_VERSION_2_0, etc.
 } stir_shaken_http_response_t;
 
 #define STIR_SHAKEN_HTTP_DEFAULT_REMOTE_PORT 80u
 
+// Max number of idle CURL handles kept for reuse (with their live connections)
+#define STIR_SHAKEN_HTTP_POOL_SIZE 32
+
+// Number of locks for CURL share (one per curl_lock_data)
+#define STIR_SHAKEN_HTTP_SHARE_LOCKS 16
+
+// Response buffers grow geometrically starting from this size
+#define STIR_SHAKEN_HTTP_RESPONSE_BUF_MIN		4096
+
+// Default max size of HTTP response body
+#define STIR_SHAKEN_HTTP_MAX_RESPONSE_SIZE		(1024 * 1024)
+
+// Max size of certificate (chain) downloaded from x5u
+#define STIR_SHAKEN_CERT_MAX_SIZE				(64 * 1024)
+
+// Default HTTP timeouts (can be changed with stir_shaken_http_set_timeouts and overridden per request)
+#define STIR_SHAKEN_HTTP_CONNECT_TIMEOUT_MS		3000
+#define STIR_SHAKEN_HTTP_TIMEOUT_MS				10000
+#define STIR_SHAKEN_HTTP_LOW_SPEED_LIMIT		512		// bytes per second...
+#define STIR_SHAKEN_HTTP_LOW_SPEED_TIME			5		// ...for that many seconds aborts the transfer
+
+// Request hedging (see stir_shaken_make_http_get_req_hedged)
+#define STIR_SHAKEN_HTTP_LATENCY_SAMPLES		128		// recent request latencies kept
+#define STIR_SHAKEN_HTTP_LATENCY_SAMPLES_MIN	16		// below that many samples default delay is used
+#define STIR_SHAKEN_HTTP_HEDGE_PERCENTILE		95
+#define STIR_SHAKEN_HTTP_HEDGE_MIN_DELAY_MS		10
+#define STIR_SHAKEN_HTTP_HEDGE_DEFAULT_DELAY_MS	100
+#define STIR_SHAKEN_HTTP_HEDGE_BUDGET			0.1		// max hedges per request (<= 1, so load never more than doubles)
+#define STIR_SHAKEN_HTTP_HEDGE_BURST			10		// max hedges saved up
+
 typedef enum stir_shaken_action_type {
 	STIR_SHAKEN_ACTION_TYPE_SP_CERT_REQ_SP_INIT,
 	STIR_SHAKEN_ACTION_TYPE_SP_CERT_REQ_CA_REPLY_CHALLENGE,
@@ -364,8 +550,26 @@ typedef struct stir_shaken_http_req_s {
 	stir_shaken_http_req_content_type_t content_type;
 	stir_shaken_http_response_t	response;
 	stir_shaken_action_type_t   action;
+	long						connect_timeout_ms;	// 0 - use library default
+	long						timeout_ms;			// 0 - use library default
+	uint64_t					deadline_ms;		// 0 - none, otherwise absolute time (stir_shaken_now_ms) by which request must complete
+	size_t						max_response_size;	// 0 - use library default, transfer is aborted if response body is bigger
+	uint8_t						reuse_buffer;		// keep response buffer allocated for next request made with this http_req (do not replace response.mem.mem then)
 } stir_shaken_http_req_t;
 
+// HTTP transport (backend making requests: curl, directory, in-memory...)
+
+#define STIR_SHAKEN_HTTP_TRANSPORTS_MAX 8
+
+typedef stir_shaken_status_t (*stir_shaken_http_transport_make_req_t)(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req, void *user_data);
+
+typedef struct stir_shaken_http_transport_s {
+	char									name[64];
+	stir_shaken_http_transport_make_req_t	make_req;
+	void									(*destroy)(void *user_data);
+	void									*user_data;
+} stir_shaken_http_transport_t;
+
 
 /**
  * https://tools.ietf.org/html/rfc8225, 3. PASSporT Overview
@@ -432,14 +636,16 @@ typedef struct stir_shaken_passport_params_s {
  * .
  * {
  *	"attest": "B",
- *	"dest": "{\"tn\":\"shaken\"}",
+ *	"dest": {"tn":["12155551213"]},
  *	"iat": 1234567890,
- *	"orig": "{\"tn\":\"9005551212\"}",
+ *	"orig": {"tn":"9005551212"},
  *	"origid": "986279842-79894328-45254-42543525243"
  * }
  */
 typedef struct stir_shaken_passport {
 	jwt_t *jwt;			// PASSport JSON Web Token
+	ks_json_t *orig;	// @orig claim, parsed once and owned by PASSporT (do not free)
+	ks_json_t *dest;	// @dest claim, parsed once and owned by PASSporT (do not free)
 } stir_shaken_passport_t;
 
 stir_shaken_status_t		stir_shaken_passport_jwt_init(stir_shaken_context_t *ss, jwt_t *jwt, stir_shaken_passport_params_t *params, unsigned char *key, uint32_t keylen);
@@ -451,9 +657,29 @@ void						stir_shaken_passport_destroy(stir_shaken_passport_t *passport);
 stir_shaken_status_t		stir_shaken_passport_sign(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, unsigned char *key, uint32_t keylen, char **out);
 const char*					stir_shaken_passport_get_header(stir_shaken_passport_t *passport, const char* key);
 const char*					stir_shaken_passport_get_headers_json(stir_shaken_passport_t *passport, const char* key);
+
+/**
+ * Get string grant. For @orig and @dest (JSON objects) this is their telephone number or URI,
+ * as returned by stir_shaken_passport_get_tn_or_uri.
+ */
 const char*					stir_shaken_passport_get_grant(stir_shaken_passport_t *passport, const char* key);
 long int					stir_shaken_passport_get_grant_int(stir_shaken_passport_t *passport, const char* key);
 char*						stir_shaken_passport_get_identity(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, int *is_tn);
+
+/**
+ * Get @orig or @dest claim as JSON object.
+ *
+ * Claim is parsed only once (on first access) and kept in @passport. Returned object is owned by @passport and is valid until the PASSporT is destroyed.
+ */
+ks_json_t*					stir_shaken_passport_get_grant_json(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, const char *key);
+
+/**
+ * Get telephone number or URI from @orig or @dest claim (first entry if @dest holds array).
+ * No parsing nor copying is done once claim is cached, returned string is owned by @passport.
+ *
+ * @is_tn - (out) set to 1 if claim is in 'tn' form, 0 if in 'uri' form
+ */
+const char*					stir_shaken_passport_get_tn_or_uri(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, const char *key, int *is_tn);
 void						stir_shaken_http_add_header(stir_shaken_http_req_t *http_req, const char *h);
 
 /**
@@ -530,9 +756,140 @@ stir_shaken_status_t stir_shaken_jwt_authenticate(stir_shaken_context_t *ss, cha
 
 char* stir_shaken_passport_dump_str(stir_shaken_passport_t *passport, uint8_t pretty);
 void stir_shaken_free_jwt_str(char *s);
+
+/**
+ * Canonical form of PASSporT JOSE header and payload (RFC 8225, 9: keys in lexicographic order, no whitespace).
+ *
+ * Only the fixed PASSporT/SHAKEN claim set is serialized:
+ *		header:		alg, ppt, typ, x5u
+ *		payload:	attest, dest, iat, orig, origid
+ * Claims that are not present are skipped, other claims are not serialized. Output is byte-identical for identical claims,
+ * regardless of the order in which the claims were added to the JWT.
+ * This is separate from signing: stir_shaken_passport_sign encodes all claims with libjwt.
+ *
+ * @buf - (out) preallocated buffer, result is 0-terminated
+ * @buflen - (in) size of @buf
+ * @outlen - (out) length of the result (excluding terminating 0), or length of the buffer that would be needed
+ *           (excluding terminating 0) if @buf is too small (then STIR_SHAKEN_STATUS_FALSE is returned)
+ */
+stir_shaken_status_t stir_shaken_passport_canonical_header(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, char *buf, size_t buflen, size_t *outlen);
+stir_shaken_status_t stir_shaken_passport_canonical_payload(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, char *buf, size_t buflen, size_t *outlen);
 void stir_shaken_jwt_move_to_passport(jwt_t *jwt, stir_shaken_passport_t *passport);
 
 /* Global Values */
+
+// Revocation index, built from CRLs
+
+#define STIR_SHAKEN_SERIAL_MAX_LEN		20		// RFC 5280 4.1.2.2
+#define STIR_SHAKEN_CRL_SET_MIN			64
+
+typedef struct stir_shaken_revoked_serial_s {
+	uint32_t		hash;						// 0 - empty slot
+	uint8_t			len;						// 0 in used slot - deleted
+	unsigned char	data[STIR_SHAKEN_SERIAL_MAX_LEN];
+} stir_shaken_revoked_serial_t;
+
+// Revoked serials of one issuer (open addressing hash set)
+typedef struct stir_shaken_crl_issuer_s {
+	X509_NAME						*name;
+	unsigned long					name_hash;
+	long							crl_number;		// of last full CRL applied, -1 if CRL had none
+	long							delta_number;	// of last delta CRL applied, -1 none
+	time_t							next_update;	// of last CRL applied, 0 - none. Revocation status is unknown past it.
+	stir_shaken_revoked_serial_t	*serials;
+	size_t							n;
+	size_t							used;			// @n + deleted slots
+	size_t							capacity;		// power of 2
+	struct stir_shaken_crl_issuer_s	*next;
+} stir_shaken_crl_issuer_t;
+
+typedef struct stir_shaken_crl_index_s {
+	pthread_rwlock_t			lock;				// delta CRLs are applied in place
+	stir_shaken_crl_issuer_t	*issuers;
+} stir_shaken_crl_index_t;
+
+// Trust anchor index, by subject name hash. Built when trust store is loaded, so chain building never looks CAs up on disk.
+
+#define STIR_SHAKEN_CA_INDEX_MIN		64
+
+typedef struct stir_shaken_ca_index_entry_s {
+	X509								*x;
+	unsigned long						name_hash;
+	const ASN1_OCTET_STRING				*skid;		// owned by @x, NULL if cert has no SKI
+	struct stir_shaken_ca_index_entry_s	*next;
+} stir_shaken_ca_index_entry_t;
+
+typedef struct stir_shaken_ca_index_s {
+	stir_shaken_ca_index_entry_t	**buckets;
+	size_t							capacity;		// power of 2
+	size_t							n;
+} stir_shaken_ca_index_t;
+
+// CA dir load: files are parsed in parallel (if there are many of them), then merged into the snapshot in order
+
+#define STIR_SHAKEN_CA_LOAD_THREADS_MAX		8
+#define STIR_SHAKEN_CA_LOAD_PARALLEL_MIN	64		// files below which dir is parsed on calling thread only
+
+typedef struct stir_shaken_ca_load_file_s {
+	char			*name;
+	STACK_OF(X509)	*certs;		// NULL if file cannot be read
+} stir_shaken_ca_load_file_t;
+
+typedef struct stir_shaken_ca_load_s {
+	stir_shaken_ca_load_file_t	*files;
+	size_t						n;
+	size_t						next;		// next file to parse, taken by workers atomically
+} stir_shaken_ca_load_t;
+
+/*
+ * Intermediate pool: untrusted CA certs learnt from validated chains, offered to chain building of later verifications
+ * (peers often publish x5u with end entity cert only). Indexed like trust anchors, oldest evicted when full.
+ */
+
+#define STIR_SHAKEN_INTERMEDIATE_POOL_MAX	1024
+#define STIR_SHAKEN_INTERMEDIATE_CHAIN_MAX	10		// issuers looked up in pool for one cert
+
+// Immutable snapshot, readers hold a reference and look up issuers without lock, changes publish new snapshot
+typedef struct stir_shaken_intermediate_pool_s {
+	stir_shaken_ca_index_t	index;
+	int						refs;
+} stir_shaken_intermediate_pool_t;
+
+// OCSP
+
+#define STIR_SHAKEN_OCSP_CACHE_BUCKETS	1024
+#define STIR_SHAKEN_OCSP_CACHE_MAX		10000
+#define STIR_SHAKEN_OCSP_MAX_SKEW		300		// seconds of clock skew tolerated on thisUpdate/nextUpdate
+#define STIR_SHAKEN_OCSP_FAIL_TTL		5		// seconds failed lookup is remembered, so that a down responder is not hammered
+#define STIR_SHAKEN_OCSP_STATUS_FAILED	-1		// no usable response (responder unreachable, bad signature, etc.)
+#define STIR_SHAKEN_OCSP_CHAIN_MAX		10		// issuers walked for cert validated before
+
+// Status of one certificate, keyed by (issuer, serial): DER of OCSP CertID
+typedef struct stir_shaken_ocsp_cache_entry_s {
+	unsigned char	*id;
+	int				id_len;
+	uint32_t		hash;
+	int				status;			// V_OCSP_CERTSTATUS_GOOD, V_OCSP_CERTSTATUS_REVOKED, V_OCSP_CERTSTATUS_UNKNOWN or STIR_SHAKEN_OCSP_STATUS_FAILED
+	time_t			expires;		// nextUpdate
+	uint8_t			pending;		// lookup in progress, others wait for it instead of making own request
+	stir_shaken_expiry_node_t	expiry;	// dropped at @expires, not scheduled while pending
+	struct stir_shaken_ocsp_cache_entry_s *next;
+} stir_shaken_ocsp_cache_entry_t;
+
+/*
+ * Trust store snapshot. Never modified once published, so any number of verifications can use it in parallel.
+ * Verifications hold a reference (stir_shaken_cert_store_get/put) and a reload swaps in new snapshot,
+ * the old one is freed when last verification using it is done.
+ * Only the revocation index can change (CRL updates), under its own lock.
+ */
+typedef struct stir_shaken_cert_store_s {
+	X509_STORE				*store;
+	stir_shaken_ca_index_t	ca_index;		// trusted CAs, the only issuer lookup of @store (which holds no certs)
+	stir_shaken_crl_index_t	*crl_index;		// NULL if no CRLs configured
+	int						refs;
+	uint64_t				generation;
+} stir_shaken_cert_store_t;
+
 typedef struct stir_shaken_globals_s {
 
 	pthread_mutexattr_t		attr;	
@@ -546,8 +903,88 @@ typedef struct stir_shaken_globals_s {
 	int                 curve_nid;                  // id of the curve in OpenSSL
 	int					tn_authlist_nid;			// OID for ext-tnAuthList
 	//ASN1_OBJECT				*tn_authlist_obj;
-	X509_STORE			*store;						// Container for CA list (list of approved CAs from STI-PA) and CRL (revocation list)
+	pthread_mutex_t				cert_store_mutex;		// Guards swapping of @cert_store only, not held during verification
+	stir_shaken_cert_store_t	*cert_store;			// Current trust store snapshot, CA list (list of approved CAs from STI-PA) and CRL (revocation list)
+	uint64_t					cert_store_generation;	// Bumped on every swap, results derived from older snapshot are stale
+	char						*cert_store_ca_list;	// Locations current snapshot was loaded from, used by reload
+	char						*cert_store_ca_dir;
+	char						*cert_store_crl_list;
+	char						*cert_store_crl_dir;
+	pthread_mutex_t				cert_store_crls_mutex;	// Serialises adding CRLs with building new snapshot
+	STACK_OF(X509_CRL)			*cert_store_crls;		// Added with stir_shaken_crl_add, applied again to every new snapshot
+	int							ca_index_ex_idx;		// X509_STORE ex_data index of CA index + 1, 0 until allocated
+	pthread_t					cert_store_watcher;
+	uint8_t						cert_store_watching;
+	int							cert_store_watch_fd;
+	int							cert_store_watch_pipe[2];
 	int					loglevel;
+
+	/** HTTP */
+	uint8_t				http_initialised;
+	pthread_mutex_t		http_pool_mutex;
+	void				*http_pool[STIR_SHAKEN_HTTP_POOL_SIZE];	// Idle CURL easy handles
+	int					http_pool_n;
+	void				*http_share;								// CURLSH: DNS, TLS session and connection caches shared by all handles
+	uint8_t				http2;										// Use HTTP/2 (over TLS) and multiplex requests to the same origin
+	long				http_connect_timeout_ms;
+	long				http_timeout_ms;
+	long				http_low_speed_limit;
+	long				http_low_speed_time;
+	size_t				http_max_response_size;
+	char				http_ca_file[STIR_SHAKEN_BUFLEN];			// CA bundle for HTTPS peer verification, system default if empty
+	pthread_mutex_t		http_hedge_mutex;
+	uint8_t				http_hedge;									// Hedge GET requests (x5u downloads)
+	int					http_hedge_percentile;
+	long				http_hedge_min_delay_ms;
+	double				http_hedge_budget;
+	double				http_hedge_tokens;
+	uint32_t			http_latency[STIR_SHAKEN_HTTP_LATENCY_SAMPLES];	// ms, ring
+	int					http_latency_n;
+	int					http_latency_pos;
+	stir_shaken_http_transport_t	http_transports[STIR_SHAKEN_HTTP_TRANSPORTS_MAX];
+	int								http_transports_n;
+	stir_shaken_http_transport_t	*http_transport;	// selected transport, NULL - curl
+	pthread_mutex_t		http_share_mutex[STIR_SHAKEN_HTTP_SHARE_LOCKS];
+
+	/** x5u cache */
+	pthread_mutex_t					x5u_cache_mutex;
+	stir_shaken_x5u_cache_entry_t	*x5u_cache[STIR_SHAKEN_X5U_CACHE_BUCKETS];
+	int								x5u_cache_n;
+	time_t							x5u_cache_ttl;		// seconds, 0 - cache disabled
+	int								x5u_cache_max;		// 0 - STIR_SHAKEN_X5U_CACHE_MAX
+	stir_shaken_expiry_t			x5u_cache_expiry;
+
+	/** OCSP */
+	pthread_mutex_t					ocsp_mutex;
+	pthread_cond_t					ocsp_cond;			// signalled when pending lookup completes
+	uint8_t							ocsp_enabled;
+	uint8_t							ocsp_hard_fail;
+	char							*ocsp_responder;	// overrides responder from AIA extension
+	stir_shaken_ocsp_cache_entry_t	*ocsp_cache[STIR_SHAKEN_OCSP_CACHE_BUCKETS];
+	int								ocsp_cache_n;
+	stir_shaken_expiry_t			ocsp_cache_expiry;
+
+	/** Intermediate pool */
+	pthread_mutex_t					intermediate_pool_mutex;		// serialises changes (new snapshot is made and swapped in)
+	pthread_mutex_t					intermediate_pool_get_mutex;	// held only to take reference to @intermediate_pool
+	stir_shaken_intermediate_pool_t	*intermediate_pool;				// current snapshot, NULL if pool is empty
+	X509							*intermediate_pool_fifo[STIR_SHAKEN_INTERMEDIATE_POOL_MAX];	// insertion order, owned by @intermediate_pool
+	size_t							intermediate_pool_first;	// oldest in @intermediate_pool_fifo
+	size_t							intermediate_pool_max;		// 0 - pool disabled
+
+	/** Logging */
+	pthread_mutex_t					log_mutex;			// guards @log_rings and delivery
+	pthread_cond_t					log_cond;			// writer waits on it when all rings are empty
+	uint8_t							log_sleeping;		// writer waits (or is about to), producers signal @log_cond
+	pthread_key_t					log_key;			// marks ring of exiting thread orphaned
+	uint8_t							log_initialised;
+	stir_shaken_log_ring_t			*log_rings;
+	uint64_t						log_generation;		// bumped when rings are freed by stir_shaken_log_deinit
+	uint8_t							log_running;
+	pthread_t						log_writer;
+	pthread_mutex_t					log_callback_mutex;	// guards @log_callback and @log_callback_data (statically initialised)
+	stir_shaken_log_callback_t		log_callback;		// NULL - stderr
+	void							*log_callback_data;
 } stir_shaken_globals_t;
 
 extern stir_shaken_globals_t stir_shaken_globals;
@@ -624,7 +1061,93 @@ void stir_shaken_cert_name_hashed_2_string(unsigned long hash, char *buf, int bu
 void stir_shaken_hash_cert_name(stir_shaken_context_t *ss, stir_shaken_cert_t *cert);
 stir_shaken_status_t stir_shaken_init_cert_store(stir_shaken_context_t *ss, const char *ca_list, const char *ca_dir, const char *crl_list, const char *crl_dir);
 void stir_shaken_cert_store_cleanup(void);
+stir_shaken_cert_store_t* stir_shaken_cert_store_get(void);
+void stir_shaken_cert_store_put(stir_shaken_cert_store_t *cert_store);
+uint64_t stir_shaken_cert_store_generation(void);
+
+/*
+ * Rebuild trust store from the locations it was last loaded from and swap it in.
+ * Verifications in progress finish with old snapshot, results derived from it (x5u cache path validation) are invalidated.
+ */
+stir_shaken_status_t stir_shaken_cert_store_reload(stir_shaken_context_t *ss);
+
+/*
+ * Watch CA and CRL locations (inotify, Linux only) and reload trust store when they change,
+ * once there were no more changes for @debounce_ms.
+ */
+stir_shaken_status_t stir_shaken_cert_store_watch_start(stir_shaken_context_t *ss, long debounce_ms);
+void stir_shaken_cert_store_watch_stop(void);
+
+/*
+ * Apply CRL to revocation index of current trust store. CRL signature must verify with issuer from the trust store,
+ * or with intermediate CA from the intermediate pool (see stir_shaken_intermediate_pool_add) whose path validates against it.
+ * Full CRL replaces revoked serials of its issuer (unless older than the one applied), delta CRL
+ * is applied incrementally on top of its base (entries with reason removeFromCRL are unrevoked).
+ * CRLs applied are kept and applied again when trust store is reloaded. Certs from issuer whose CRL
+ * is past its nextUpdate fail revocation check.
+ */
+stir_shaken_status_t stir_shaken_crl_add(stir_shaken_context_t *ss, X509_CRL *crl);
+
+// Apply all CRLs (PEM or DER) from file
+stir_shaken_status_t stir_shaken_crl_load(stir_shaken_context_t *ss, const char *name);
+
+// Check @cert and its chain against revocation index (and OCSP if enabled), STIR_SHAKEN_ERROR_CERT_REVOKED if revoked
+stir_shaken_status_t stir_shaken_cert_check_revocation(stir_shaken_context_t *ss, stir_shaken_cert_t *cert);
+
+stir_shaken_status_t stir_shaken_intermediate_pool_init(stir_shaken_context_t *ss);
+void stir_shaken_intermediate_pool_deinit(void);
+
+/*
+ * Add untrusted intermediate CA cert to the pool (certs not being CA or self-issued are skipped, STIR_SHAKEN_STATUS_NOOP).
+ * Verifications add intermediates of every path they validate, pool certs are used to build paths
+ * of later ones, in addition to the chain cert was downloaded with. They are never trusted by themselves.
+ */
+stir_shaken_status_t stir_shaken_intermediate_pool_add(stir_shaken_context_t *ss, X509 *x);
+
+// Max number of certs kept (capped at STIR_SHAKEN_INTERMEDIATE_POOL_MAX), oldest are evicted, 0 - disable pool
+void stir_shaken_intermediate_pool_set_max(size_t max);
+size_t stir_shaken_intermediate_pool_size(void);
+void stir_shaken_intermediate_pool_flush(void);
+
+stir_shaken_status_t stir_shaken_ocsp_init(stir_shaken_context_t *ss);
+void stir_shaken_ocsp_deinit(void);
+
+/*
+ * Check status of certificates with OCSP (RFC 6960) during path validation, all but trust anchor.
+ * Responses are cached per (issuer, serial) until their nextUpdate, concurrent lookups of the same certificate
+ * share one request. Requests are sent with GET (RFC 6960, A.1) so they go through selected HTTP transport.
+ *
+ * @responder - URL of responder used for all certificates, NULL - use responder from AIA extension of each certificate
+ *				(certificates without one are not checked)
+ * @hard_fail - fail validation also when status cannot be obtained (no usable response, status unknown),
+ *				otherwise only revoked status fails it
+ */
+stir_shaken_status_t stir_shaken_ocsp_enable(stir_shaken_context_t *ss, const char *responder, uint8_t hard_fail);
+void stir_shaken_ocsp_disable(void);
+void stir_shaken_ocsp_cache_flush(void);
+
+// Drop OCSP statuses past their nextUpdate
+void stir_shaken_ocsp_cache_expire(void);
+
+// Status of @x issued by @issuer, from cache or responder. Revoked - STIR_SHAKEN_ERROR_CERT_REVOKED, no status - STIR_SHAKEN_ERROR_OCSP.
+stir_shaken_status_t stir_shaken_ocsp_check(stir_shaken_context_t *ss, X509 *x, X509 *issuer);
 stir_shaken_status_t stir_shaken_register_tnauthlist_extension(stir_shaken_context_t *ss, int *nidp);
+
+/**
+ * Decode TNAuthList extension of @x: SPCs, TN ranges and TNs (RFC 8226), or authority check URL put there by
+ * stir_shaken_x509_add_tnauthlist_extension_uri. TNs with '#' or '*' are not indexed (E.164 caller ID never has them).
+ * Must be destroyed with stir_shaken_tn_authlist_destroy.
+ */
+stir_shaken_tn_authlist_t* stir_shaken_tn_authlist_decode(stir_shaken_context_t *ss, X509 *x);
+void stir_shaken_tn_authlist_destroy(stir_shaken_tn_authlist_t *tn_authlist);
+
+// OK if @tn (digits, optional leading '+') is in TNAuthList's TNs or TN ranges, FALSE otherwise
+stir_shaken_status_t stir_shaken_tn_authlist_covers_tn(stir_shaken_context_t *ss, const stir_shaken_tn_authlist_t *tn_authlist, const char *tn);
+
+// TNAuthList of cert, decoded on first call and kept with the cert (owned by cert)
+const stir_shaken_tn_authlist_t* stir_shaken_cert_get_tn_authlist(stir_shaken_context_t *ss, stir_shaken_cert_t *cert);
+const stir_shaken_tn_authlist_t* stir_shaken_cert_ref_get_tn_authlist(stir_shaken_context_t *ss, stir_shaken_cert_ref_t *ref);
+
 stir_shaken_status_t stir_shaken_verify_cert_tn_authlist_extension(stir_shaken_context_t *ss, stir_shaken_cert_t *cert);
 stir_shaken_status_t stir_shaken_verify_cert_path(stir_shaken_context_t *ss, stir_shaken_cert_t *cert);
 stir_shaken_status_t stir_shaken_verify_cert(stir_shaken_context_t *ss, stir_shaken_cert_t *cert);
@@ -636,8 +1159,35 @@ char* stir_shaken_cert_get_issuer(stir_shaken_cert_t *cert);
 char* stir_shaken_cert_get_subject(stir_shaken_cert_t *cert);
 int stir_shaken_cert_get_version(stir_shaken_cert_t *cert);
 
+/**
+ * Compact certificate, takes ownership of @x and @xchain. Must be released with stir_shaken_cert_ref_put.
+ */
+stir_shaken_cert_ref_t* stir_shaken_cert_ref_create(stir_shaken_context_t *ss, X509 *x, STACK_OF(X509) *xchain, size_t len);
+stir_shaken_cert_ref_t* stir_shaken_cert_ref_get(stir_shaken_cert_ref_t *ref);
+void stir_shaken_cert_ref_put(stir_shaken_cert_ref_t *ref);
+
+// Public key in raw format, owned by @ref (valid while reference is held)
+stir_shaken_status_t stir_shaken_cert_ref_get_pubkey_raw(stir_shaken_context_t *ss, stir_shaken_cert_ref_t *ref, const unsigned char **key, int *key_len);
+
+// X509 cert path validation against current trust store, result is shared by all holders of @ref
+// until trust store changes or any cert in validated path expires (or is not yet valid)
+stir_shaken_status_t stir_shaken_cert_ref_verify_path(stir_shaken_context_t *ss, stir_shaken_cert_ref_t *ref);
+int stir_shaken_cert_ref_path_verified(stir_shaken_cert_ref_t *ref);
+stir_shaken_status_t stir_shaken_cert_ref_check_revocation(stir_shaken_context_t *ss, stir_shaken_cert_ref_t *ref);
+
+// Wrap @ref into stir_shaken_cert_t for API using it. Must be destroyed with stir_shaken_destroy_cert and freed.
+stir_shaken_cert_t* stir_shaken_cert_ref_to_cert(stir_shaken_context_t *ss, stir_shaken_cert_ref_t *ref);
+
 EVP_PKEY* stir_shaken_load_pubkey_from_file(stir_shaken_context_t *ss, const char *file);
 EVP_PKEY* stir_shaken_load_privkey_from_file(stir_shaken_context_t *ss, const char *file);
+/*
+ * Load end-entity cert into @x and the rest (if any and @xchain is set) into @xchain.
+ * Format is detected: PEM, DER (one or more concatenated certs) or PKCS#7 certs-only (application/pkcs7-mime, DER or PEM),
+ * where end-entity cert is the one that did not issue any other. @mem does not need to be 0-terminated.
+ */
+stir_shaken_status_t stir_shaken_load_x509_from_mem_ex(stir_shaken_context_t *ss, X509 **x, STACK_OF(X509) **xchain, const void *mem, size_t len);
+
+// Same for 0-terminated @mem
 stir_shaken_status_t stir_shaken_load_x509_from_mem(stir_shaken_context_t *ss, X509 **x, STACK_OF(X509) **xchain, void *mem);
 X509* stir_shaken_load_x509_from_file(stir_shaken_context_t *ss, const char *name);
 stir_shaken_status_t stir_shaken_load_x509_req_from_mem(stir_shaken_context_t *ss, X509_REQ **req, void *mem);
@@ -668,6 +1218,23 @@ int stir_shaken_do_verify_data(stir_shaken_context_t *ss, const void *data, size
 
 stir_shaken_status_t stir_shaken_download_cert(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req);
 
+stir_shaken_status_t stir_shaken_x5u_cache_init(stir_shaken_context_t *ss);
+void stir_shaken_x5u_cache_deinit(void);
+
+/**
+ * Cache certificates downloaded from x5u for @ttl seconds (0 - disable cache, default).
+ * Stale entries are revalidated with conditional GET (If-None-Match/If-Modified-Since) if server sent ETag or Last-Modified,
+ * 304 Not Modified extends entry's lifetime without parsing the PEM again or repeating X509 cert path validation.
+ */
+void stir_shaken_x5u_cache_set_ttl(time_t ttl);
+
+// Max number of x5u cache entries (0 - STIR_SHAKEN_X5U_CACHE_MAX). When full, entry due first is dropped.
+void stir_shaken_x5u_cache_set_max(int max);
+void stir_shaken_x5u_cache_flush(void);
+
+// Drop x5u cache entries which are stale and cannot be revalidated, or whose cert is past notAfter
+void stir_shaken_x5u_cache_expire(void);
+
 stir_shaken_status_t stir_shaken_check_authority_over_number(stir_shaken_context_t *ss, stir_shaken_cert_t *cert, stir_shaken_passport_t *passport);
 stir_shaken_status_t stir_shaken_sih_verify_with_cert(stir_shaken_context_t *ss, const char *identity_header, stir_shaken_cert_t *cert, stir_shaken_passport_t *passport);
 
@@ -677,12 +1244,17 @@ stir_shaken_status_t stir_shaken_sih_verify_with_cert(stir_shaken_context_t *ss,
  * Optionally get cert and/or JWT out of the method.
  */
 stir_shaken_status_t stir_shaken_jwt_verify(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_t **cert_out, jwt_t **jwt_out);
+stir_shaken_status_t stir_shaken_jwt_verify_ex(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_t **cert_out, jwt_t **jwt_out, uint64_t deadline_ms);
 
 /**
  * This will call stir_shaken_jwt_verify and will also perform X509 cert path verification on downloaded cert.
  * Optionally get cert and/or JWT out of the method.
  */
 stir_shaken_status_t stir_shaken_jwt_verify_and_check_x509_cert_path(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_t **cert_out, jwt_t **jwt_out);
+stir_shaken_status_t stir_shaken_jwt_verify_and_check_x509_cert_path_ex(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_t **cert_out, jwt_t **jwt_out, uint64_t deadline_ms);
+
+// Same, but cert is returned as compact cert (shared with x5u cache), must be released with stir_shaken_cert_ref_put
+stir_shaken_status_t stir_shaken_jwt_verify_and_check_x509_cert_path_ref(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_ref_t **ref_out, jwt_t **jwt_out, uint64_t deadline_ms);
 
 /**
  * Perform STIR-Shaken verification of the SIP @identity_header.
@@ -696,6 +1268,13 @@ stir_shaken_status_t stir_shaken_jwt_verify_and_check_x509_cert_path(stir_shaken
  */
 stir_shaken_status_t stir_shaken_sih_verify(stir_shaken_context_t *ss, const char *sih, stir_shaken_passport_t *passport, stir_shaken_cert_t **cert_out, time_t iat_freshness);
 
+/**
+ * Same as stir_shaken_sih_verify, but verification must complete by @deadline_ms (absolute time, see stir_shaken_now_ms,
+ * e.g. stir_shaken_now_ms() + 2000). Certificate download is aborted when the deadline expires and the call ends
+ * with STIR_SHAKEN_ERROR_SIP_436_BAD_IDENTITY_INFO. 0 means no deadline (only default HTTP timeouts apply).
+ */
+stir_shaken_status_t stir_shaken_sih_verify_ex(stir_shaken_context_t *ss, const char *sih, stir_shaken_passport_t *passport, stir_shaken_cert_t **cert_out, time_t iat_freshness, uint64_t deadline_ms);
+
 /**
  * Check PASSporT is technically correct and validate it's expiry.
  */
@@ -803,6 +1382,82 @@ stir_shaken_status_t    stir_shaken_make_http_req_real(stir_shaken_context_t *ss
 extern stir_shaken_status_t    stir_shaken_make_http_req_mock(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req);
 void					stir_shaken_destroy_http_request(stir_shaken_http_req_t *http_req);
 
+/**
+ * Init/deinit HTTP transport: curl global init (once per library init) and pool of reusable CURL handles.
+ * Handles are kept between requests so connections (keep-alive) and TLS sessions are reused.
+ * All handles use the same CURL share, so DNS, TLS sessions and connections are shared between threads.
+ * Called from stir_shaken_do_init/stir_shaken_do_deinit.
+ */
+stir_shaken_status_t	stir_shaken_init_http(stir_shaken_context_t *ss);
+void					stir_shaken_deinit_http(void);
+
+/**
+ * Enable/disable HTTP/2 mode (enabled by default). In HTTP/2 mode HTTP/2 is negotiated over TLS and
+ * concurrent requests to the same origin made with stir_shaken_make_http_reqs are multiplexed over a single connection.
+ */
+void					stir_shaken_http_set_http2(uint8_t enable);
+
+/**
+ * Set default HTTP timeouts: @connect_timeout_ms, total @timeout_ms, and abort transfer if it is slower than
+ * @low_speed_limit bytes per second for @low_speed_time seconds.
+ * 0 disables given limit, negative value leaves it unchanged.
+ * Per request timeouts can be set in stir_shaken_http_req_t.
+ */
+void					stir_shaken_http_set_timeouts(long connect_timeout_ms, long timeout_ms, long low_speed_limit, long low_speed_time);
+
+/**
+ * Set default max size of HTTP response body (0 - no limit). Can be overridden per request with http_req->max_response_size.
+ */
+void					stir_shaken_http_set_max_response_size(size_t max);
+
+/**
+ * Set CA bundle (PEM file) used to verify HTTPS servers, instead of the system default. NULL or empty @ca_file restores the default.
+ * Should be set before making requests.
+ */
+void					stir_shaken_http_set_ca_file(const char *ca_file);
+
+/*
+ * Enable/disable hedging of GET requests made with stir_shaken_make_http_get_req_hedged (x5u downloads).
+ * If request hasn't completed after @percentile of recent latencies (but at least @min_delay_ms), second request is sent.
+ * @budget is max number of hedges per request (0-1). Negative values (and @percentile outside 1-99) keep current settings.
+ */
+void					stir_shaken_http_set_hedging(uint8_t enable, int percentile, long min_delay_ms, double budget);
+
+/**
+ * HTTP transports. All requests made with stir_shaken_make_http_req go to the transport selected with
+ * stir_shaken_http_transport_use ("curl" by default, always registered).
+ * Transports are registered after stir_shaken_do_init and are destroyed by stir_shaken_do_deinit.
+ * Registering or selecting transport is not thread safe, do it before making requests.
+ *
+ * Transport's @make_req must complete request with stir_shaken_http_transport_respond or stir_shaken_http_transport_fail.
+ */
+stir_shaken_status_t	stir_shaken_http_transport_register(stir_shaken_context_t *ss, const char *name, stir_shaken_http_transport_make_req_t make_req, void (*destroy)(void *user_data), void *user_data);
+stir_shaken_status_t	stir_shaken_http_transport_use(stir_shaken_context_t *ss, const char *name);
+stir_shaken_status_t	stir_shaken_http_transport_respond(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req, long code, const char *body, size_t len);
+stir_shaken_status_t	stir_shaken_http_transport_fail(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req, long res);
+
+/**
+ * Register directory backed transport (GET/HEAD only): http(s)://host[:port]/path is served from file @root/host/path,
+ * file:// URLs from their path. Missing file is 404.
+ */
+stir_shaken_status_t	stir_shaken_http_transport_register_dir(stir_shaken_context_t *ss, const char *name, const char *root);
+
+/**
+ * Register in-memory transport, responses are set with stir_shaken_http_transport_memory_set (other URLs are 404).
+ * Each request takes @latency_ms plus random 0-@jitter_ms, and fails with connection error with probability @error_rate (0-1).
+ * Request timeouts and deadline are respected (request fails with timeout if latency is bigger).
+ * @seed makes the random sequence reproducible.
+ */
+stir_shaken_status_t	stir_shaken_http_transport_register_memory(stir_shaken_context_t *ss, const char *name, uint32_t latency_ms, uint32_t jitter_ms, double error_rate, unsigned int seed);
+stir_shaken_status_t	stir_shaken_http_transport_memory_set(stir_shaken_context_t *ss, const char *name, const char *url, long code, const char *body, size_t len);
+
+/**
+ * Make @n HTTP requests concurrently (e.g. x5u downloads for many calls).
+ * Result of each request is stored in its http_req->response just like with stir_shaken_make_http_req.
+ * Returns STIR_SHAKEN_STATUS_OK if all transfers completed.
+ */
+stir_shaken_status_t	stir_shaken_make_http_reqs(stir_shaken_context_t *ss, stir_shaken_http_req_t **http_reqs, int n);
+
 /**
  * @http_req - (out) will contain HTTP response
  */
@@ -819,6 +1474,7 @@ stir_shaken_status_t stir_shaken_as_make_code_token_request(stir_shaken_context_
 stir_shaken_status_t stir_shaken_as_make_stica_list_request(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req, const char *url);
 
 stir_shaken_status_t	stir_shaken_make_http_get_req(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req);
+stir_shaken_status_t	stir_shaken_make_http_get_req_hedged(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req);
 stir_shaken_status_t	stir_shaken_make_http_post_req(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req, char *data, uint8_t json);
 stir_shaken_status_t	stir_shaken_make_http_head_req(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req, char *data, uint8_t is_json);
 char*					stir_shaken_get_http_header(stir_shaken_http_req_t *http_req, char *name);
@@ -846,12 +1502,59 @@ int stir_shaken_zstr(const char *str);
 stir_shaken_error_t stir_shaken_get_error_code(stir_shaken_context_t *ss) __attribute__((nonnull(1)));
 void stir_shaken_do_set_error(stir_shaken_context_t *ss, const char *description, stir_shaken_error_t error, char *file, int line);
 void stir_shaken_do_set_error_if_clear(stir_shaken_context_t *ss, const char *description, stir_shaken_error_t error, char *file, int line);
+
+// @is_static - @description is a string literal (kept by pointer), otherwise it is copied
+void stir_shaken_do_set_error_ex(stir_shaken_context_t *ss, const char *description, uint8_t is_static, stir_shaken_error_t error, const char *file, int line);
+void stir_shaken_do_set_error_if_clear_ex(stir_shaken_context_t *ss, const char *description, uint8_t is_static, stir_shaken_error_t error, const char *file, int line);
+
 void stir_shaken_clear_error(stir_shaken_context_t *ss);
 uint8_t stir_shaken_is_error_set(stir_shaken_context_t *ss);
+
+// Whether @error is among errors kept in @ss (most recent STIR_SHAKEN_ERROR_RING set since cleared)
+uint8_t stir_shaken_is_error_recorded(stir_shaken_context_t *ss, stir_shaken_error_t error);
+/*
+ * Format error stack of @ss (most recent first). Returned string is thread local,
+ * valid until next call to stir_shaken_get_error in the same thread.
+ */
 const char* stir_shaken_get_error(stir_shaken_context_t *ss, stir_shaken_error_t *error);
 
-#define stir_shaken_set_error(ss, description, error) stir_shaken_do_set_error(ss, description, error, __FILE__, __LINE__)
-#define stir_shaken_set_error_if_clear(ss, description, error) stir_shaken_do_set_error_if_clear(ss, description, error, __FILE__, __LINE__)
+#if defined(__GNUC__)
+#define STIR_SHAKEN_IS_STATIC_STRING(s) __builtin_constant_p(s)
+#else
+#define STIR_SHAKEN_IS_STATIC_STRING(s) 0
+#endif
+
+#define stir_shaken_set_error(ss, description, error) stir_shaken_do_set_error_ex(ss, description, STIR_SHAKEN_IS_STATIC_STRING(description), error, __FILE__, __LINE__)
+#define stir_shaken_set_error_if_clear(ss, description, error) stir_shaken_do_set_error_if_clear_ex(ss, description, STIR_SHAKEN_IS_STATIC_STRING(description), error, __FILE__, __LINE__)
+
+stir_shaken_status_t stir_shaken_log_init(stir_shaken_context_t *ss);
+
+// Stop writer and free all rings. Must not race with threads logging.
+void stir_shaken_log_deinit(void);
+
+// Start background writer (not started by stir_shaken_do_init). Logging threads only write into their rings from now on.
+stir_shaken_status_t stir_shaken_log_start(stir_shaken_context_t *ss);
+
+// Stop writer and deliver what is left. Threads may keep logging: their rings are kept (and reused if writer
+// is started again), record written just as writer stops is delivered by next stir_shaken_log_flush.
+// Only rings of exited threads are freed.
+void stir_shaken_log_stop(void);
+
+// Deliver all records logged so far (on calling thread)
+void stir_shaken_log_flush(void);
+
+// Sink for records, NULL - stderr. Callback and its data are replaced together.
+void stir_shaken_log_set_callback(stir_shaken_log_callback_t callback, void *user_data);
+
+// Id of the call handled by the calling thread, attached to records it logs
+void stir_shaken_log_set_call_id(uint64_t call_id);
+
+void stir_shaken_do_log(int level, stir_shaken_log_subsystem_t subsystem, const char *file, int line, const char *fmt, ...) __attribute__ ((format (printf, 5, 6)));
+
+#define stir_shaken_log(level, subsystem, fmt, ...)		\
+	if (stir_shaken_globals.loglevel >= level) {							\
+		stir_shaken_do_log(level, subsystem, __FILE__, __LINE__, (fmt), ##__VA_ARGS__);	\
+	}
 
 #define fprintif(level, fmt, ...)		\
 	if (stir_shaken_globals.loglevel >= level) {							\
@@ -882,8 +1585,27 @@ void stir_shaken_hash_destroy(stir_shaken_hash_entry_t **hash, size_t hashsize,
 
 #define STI_CA_SESSION_EXPIRY_SECONDS 30
 
+// (Re)schedule @node to expire @at. Fails only if heap cannot grow.
+stir_shaken_status_t stir_shaken_expiry_schedule(stir_shaken_expiry_t *expiry, stir_shaken_expiry_node_t *node, time_t at);
+void stir_shaken_expiry_cancel(stir_shaken_expiry_t *expiry, stir_shaken_expiry_node_t *node);
+
+// Node expiring first (not removed), NULL if none scheduled
+stir_shaken_expiry_node_t* stir_shaken_expiry_first(stir_shaken_expiry_t *expiry);
+
+// Drops all nodes (entries themselves are owned by cache)
+void stir_shaken_expiry_destroy(stir_shaken_expiry_t *expiry);
+
+/*
+ * Maintenance tick: evict expired entries from x5u and OCSP caches. Cost is proportional to number of entries evicted.
+ * Caches also evict on insert, so calling this only keeps memory down when there are no new entries for a while.
+ */
+void stir_shaken_cache_maintenance(void);
+
 time_t stir_shaken_time_elapsed_s(time_t ts, time_t now);
 
+// Monotonic clock in milliseconds (for deadlines)
+uint64_t stir_shaken_now_ms(void);
+
 #define STI_CA_SESSIONS_MAX 1000
 
 #define STI_CA_SESSION_STATE_INIT				0
@@ -1,7 +1,7 @@
 #include "stir_shaken.h"
 
 
-stir_shaken_globals_t stir_shaken_globals;
+stir_shaken_globals_t stir_shaken_globals = { .log_callback_mutex = PTHREAD_MUTEX_INITIALIZER };
 stir_shaken_status_t	(*stir_shaken_make_http_req)(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req) = stir_shaken_make_http_req_real;
 
 static void stir_shaken_init(void)
@@ -40,11 +40,80 @@ stir_shaken_status_t stir_shaken_do_init(stir_shaken_context_t *ss, const char *
 		goto err;
 	}
 
+	if (pthread_mutex_init(&stir_shaken_globals.cert_store_mutex, NULL) != 0) {
+
+		stir_shaken_set_error(ss, "Init cert store mutex failed", STIR_SHAKEN_ERROR_GENERAL);
+		status = STIR_SHAKEN_STATUS_FALSE;
+		goto err;
+	}
+
+	if (pthread_mutex_init(&stir_shaken_globals.cert_store_crls_mutex, NULL) != 0) {
+
+		stir_shaken_set_error(ss, "Init cert store CRLs mutex failed", STIR_SHAKEN_ERROR_GENERAL);
+		status = STIR_SHAKEN_STATUS_FALSE;
+		goto err;
+	}
+
+	status = stir_shaken_log_init(ss);
+	if (status != STIR_SHAKEN_STATUS_OK && status != STIR_SHAKEN_STATUS_NOOP) {
+
+		stir_shaken_set_error_if_clear(ss, "Init logging failed\n", STIR_SHAKEN_ERROR_GENERAL);
+		status = STIR_SHAKEN_STATUS_FALSE;
+		goto err;
+	}
+
 	// TODO CA list and CRL will be passed here
 	status = stir_shaken_init_ssl(ss, ca_dir, crl_dir);
 	if (status != STIR_SHAKEN_STATUS_OK && status != STIR_SHAKEN_STATUS_NOOP) {
 	
 		stir_shaken_set_error_if_clear(ss, "Init SSL failed\n", STIR_SHAKEN_ERROR_GENERAL);
+		stir_shaken_log_deinit();
+		status = STIR_SHAKEN_STATUS_FALSE;
+		goto err;
+	}
+
+	status = stir_shaken_init_http(ss);
+	if (status != STIR_SHAKEN_STATUS_OK) {
+
+		stir_shaken_set_error_if_clear(ss, "Init HTTP failed\n", STIR_SHAKEN_ERROR_GENERAL);
+		stir_shaken_deinit_ssl();
+		stir_shaken_log_deinit();
+		status = STIR_SHAKEN_STATUS_FALSE;
+		goto err;
+	}
+
+	status = stir_shaken_x5u_cache_init(ss);
+	if (status != STIR_SHAKEN_STATUS_OK) {
+
+		stir_shaken_set_error_if_clear(ss, "Init x5u cache failed\n", STIR_SHAKEN_ERROR_GENERAL);
+		stir_shaken_deinit_http();
+		stir_shaken_deinit_ssl();
+		stir_shaken_log_deinit();
+		status = STIR_SHAKEN_STATUS_FALSE;
+		goto err;
+	}
+
+	status = stir_shaken_ocsp_init(ss);
+	if (status != STIR_SHAKEN_STATUS_OK) {
+
+		stir_shaken_set_error_if_clear(ss, "Init OCSP failed\n", STIR_SHAKEN_ERROR_GENERAL);
+		stir_shaken_x5u_cache_deinit();
+		stir_shaken_deinit_http();
+		stir_shaken_deinit_ssl();
+		stir_shaken_log_deinit();
+		status = STIR_SHAKEN_STATUS_FALSE;
+		goto err;
+	}
+
+	status = stir_shaken_intermediate_pool_init(ss);
+	if (status != STIR_SHAKEN_STATUS_OK) {
+
+		stir_shaken_set_error_if_clear(ss, "Init intermediate pool failed\n", STIR_SHAKEN_ERROR_GENERAL);
+		stir_shaken_ocsp_deinit();
+		stir_shaken_x5u_cache_deinit();
+		stir_shaken_deinit_http();
+		stir_shaken_deinit_ssl();
+		stir_shaken_log_deinit();
 		status = STIR_SHAKEN_STATUS_FALSE;
 		goto err;
 	}
@@ -76,7 +145,14 @@ void stir_shaken_do_deinit(void)
 
     // TODO deinit settings (path, etc)
 
+    stir_shaken_intermediate_pool_deinit();
+    stir_shaken_ocsp_deinit();
+    stir_shaken_x5u_cache_deinit();
+    stir_shaken_deinit_http();
     stir_shaken_deinit_ssl();
+    stir_shaken_log_deinit();
+    pthread_mutex_destroy(&stir_shaken_globals.cert_store_crls_mutex);
+    pthread_mutex_destroy(&stir_shaken_globals.cert_store_mutex);
 
     pthread_mutex_unlock(&stir_shaken_globals.mutex);
     pthread_mutex_destroy(&stir_shaken_globals.mutex);
@@ -381,75 +457,97 @@ int stir_shaken_zstr(const char *str)
     return 0;
 }
 
-static void shift_errors(stir_shaken_context_t *ss) {
-    if (!ss) return;
-    strncpy(ss->err_buf3, ss->err_buf2, STIR_SHAKEN_ERROR_BUF_LEN);
-    strncpy(ss->err_buf2, ss->err_buf1, STIR_SHAKEN_ERROR_BUF_LEN);
-    strncpy(ss->err_buf1, ss->err_buf0, STIR_SHAKEN_ERROR_BUF_LEN);
-}
-
-void stir_shaken_do_set_error(stir_shaken_context_t *ss, const char *description, stir_shaken_error_t error, char *file, int line)
+void stir_shaken_do_set_error_ex(stir_shaken_context_t *ss, const char *description, uint8_t is_static, stir_shaken_error_t error, const char *file, int line)
 {
-    int i = 0, j = 0;
+    stir_shaken_error_entry_t *e = NULL;
+    size_t len = 0;
 
     if (!ss) return;
 
-    shift_errors(ss);
+    e = &ss->errors[ss->n % STIR_SHAKEN_ERROR_RING];
+
+    // Count never wraps to 0 (no error), position in ring is kept
+    ss->n = (ss->n < 2 * STIR_SHAKEN_ERROR_RING) ? ss->n + 1 : ss->n + 1 - STIR_SHAKEN_ERROR_RING;
 
-    memset(ss->err_buf0, 0, STIR_SHAKEN_ERROR_BUF_LEN);
-    sprintf(ss->err_buf0, "%s:%d: ", file, line);
-    i = strlen(ss->err_buf0);
+    e->error = error;
+    e->file = file;
+    e->line = line;
 
-    while ((i < STIR_SHAKEN_ERROR_BUF_LEN - 1) && (description[j] != '\0')) {
-        ss->err_buf0[i] = description[j];
-        ++i;
-        ++j;
+    if (is_static || !description) {
+        e->description = description;
+        e->text[0] = '\0';
+        return;
     }
 
-    ss->err_buf0[i] = '\0';
-    ss->error = error;
-    ss->got_error = 1;
+    len = strnlen(description, sizeof(e->text) - 1);
+    memcpy(e->text, description, len);
+    e->text[len] = '\0';
+    e->description = NULL;
 }
 
-void stir_shaken_do_set_error_if_clear(stir_shaken_context_t *ss, const char *description, stir_shaken_error_t error, char *file, int line)
+void stir_shaken_do_set_error_if_clear_ex(stir_shaken_context_t *ss, const char *description, uint8_t is_static, stir_shaken_error_t error, const char *file, int line)
 {
-    if (ss) {
-
-        if (!ss->got_error) {
-            stir_shaken_do_set_error(ss, description, error, file, line);
-        }
+    if (ss && !ss->n) {
+        stir_shaken_do_set_error_ex(ss, description, is_static, error, file, line);
     }
 }
 
+void stir_shaken_do_set_error(stir_shaken_context_t *ss, const char *description, stir_shaken_error_t error, char *file, int line)
+{
+    stir_shaken_do_set_error_ex(ss, description, 0, error, file, line);
+}
+
+void stir_shaken_do_set_error_if_clear(stir_shaken_context_t *ss, const char *description, stir_shaken_error_t error, char *file, int line)
+{
+    stir_shaken_do_set_error_if_clear_ex(ss, description, 0, error, file, line);
+}
+
 void stir_shaken_clear_error(stir_shaken_context_t *ss)
 {
     if (!ss) return;
-    memset(ss, 0, sizeof(*ss));
+    ss->n = 0;
 }
 
 uint8_t stir_shaken_is_error_set(stir_shaken_context_t *ss)
 {
     if (!ss) return 0;
-    return (ss->got_error ? 1 : 0);
+    return (ss->n ? 1 : 0);
 }
 
+// Most recent error is i = 0
+static stir_shaken_error_entry_t* stir_shaken_get_error_entry(stir_shaken_context_t *ss, unsigned int i)
+{
+    return &ss->errors[(ss->n - 1 - i) % STIR_SHAKEN_ERROR_RING];
+}
+
+// Formatted error stack, per thread so that context needs no buffer of its own
+static __thread char stir_shaken_error_string[STIR_SHAKEN_ERROR_RING * (STIR_SHAKEN_ERROR_TEXT_LEN + 256)];
+
 static const char* stir_shaken_get_error_string(stir_shaken_context_t *ss)
 {
+    stir_shaken_error_entry_t *e = NULL;
+    char *err = stir_shaken_error_string;
+    size_t err_len = sizeof(stir_shaken_error_string);
+    unsigned int i = 0, n = 0;
+    int len = 0;
+
     if (!ss) return NULL;
 
     if (stir_shaken_is_error_set(ss)) {
 
-        if (!stir_shaken_zstr(ss->err_buf3)) {
-            snprintf(ss->err, sizeof(ss->err), "Error stack (top to bottom):\n[ERR 0] %s\n[ERR 1] %s\n[ERR 2] %s\n[ERR 3] %s\n", ss->err_buf0, ss->err_buf1, ss->err_buf2, ss->err_buf3);
-        } else if (!stir_shaken_zstr(ss->err_buf2)) {
-            snprintf(ss->err, sizeof(ss->err), "Error stack (top to bottom):\n[ERR 0] %s\n[ERR 1] %s\n[ERR 2] %s\n", ss->err_buf0, ss->err_buf1, ss->err_buf2);
-        } else if (!stir_shaken_zstr(ss->err_buf1)) {
-            snprintf(ss->err, sizeof(ss->err), "Error stack (top to bottom):\n[ERR 0] %s\n[ERR 1] %s\n", ss->err_buf0, ss->err_buf1);
-        } else {
-            snprintf(ss->err, sizeof(ss->err), "[ERR 0] %s\n", ss->err_buf0);
+        n = ss->n < STIR_SHAKEN_ERROR_RING ? ss->n : STIR_SHAKEN_ERROR_RING;
+        err[0] = '\0';
+
+        if (n > 1) {
+            len = snprintf(err, err_len, "Error stack (top to bottom):\n");
+        }
+
+        for (i = 0; i < n && len >= 0 && (size_t) len < err_len; i++) {
+            e = stir_shaken_get_error_entry(ss, i);
+            len += snprintf(err + len, err_len - len, "[ERR %u] %s:%d: %s\n", i, e->file, e->line, e->description ? e->description : e->text);
         }
 
-        return ss->err;
+        return err;
     }
 
     return "No description provided";
@@ -463,7 +561,20 @@ stir_shaken_error_t stir_shaken_get_error_code(stir_shaken_context_t *ss)
         return STIR_SHAKEN_ERROR_GENERAL;
     }
 
-    return ss->error;
+    return stir_shaken_get_error_entry(ss, 0)->error;
+}
+
+uint8_t stir_shaken_is_error_recorded(stir_shaken_context_t *ss, stir_shaken_error_t error)
+{
+    unsigned int i = 0;
+
+    if (!stir_shaken_is_error_set(ss)) return 0;
+
+    for (i = 0; i < ss->n && i < STIR_SHAKEN_ERROR_RING; i++) {
+        if (stir_shaken_get_error_entry(ss, i)->error == error) return 1;
+    }
+
+    return 0;
 }
 
 const char* stir_shaken_get_error(stir_shaken_context_t *ss, stir_shaken_error_t *error)
@@ -630,12 +741,502 @@ void stir_shaken_hash_destroy(stir_shaken_hash_entry_t **hash, size_t hashsize,
     memset(hash, 0, sizeof(stir_shaken_hash_entry_t*) * hashsize);
 }
 
+static void stir_shaken_expiry_set(stir_shaken_expiry_t *expiry, size_t i, stir_shaken_expiry_node_t *node)
+{
+    expiry->heap[i] = node;
+    node->pos = i + 1;
+}
+
+static void stir_shaken_expiry_up(stir_shaken_expiry_t *expiry, size_t i)
+{
+    stir_shaken_expiry_node_t *node = expiry->heap[i];
+    size_t parent = 0;
+
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (expiry->heap[parent]->at <= node->at) break;
+        stir_shaken_expiry_set(expiry, i, expiry->heap[parent]);
+        i = parent;
+    }
+
+    stir_shaken_expiry_set(expiry, i, node);
+}
+
+static void stir_shaken_expiry_down(stir_shaken_expiry_t *expiry, size_t i)
+{
+    stir_shaken_expiry_node_t *node = expiry->heap[i];
+    size_t child = 0;
+
+    while ((child = 2 * i + 1) < expiry->n) {
+        if (child + 1 < expiry->n && expiry->heap[child + 1]->at < expiry->heap[child]->at) child++;
+        if (node->at <= expiry->heap[child]->at) break;
+        stir_shaken_expiry_set(expiry, i, expiry->heap[child]);
+        i = child;
+    }
+
+    stir_shaken_expiry_set(expiry, i, node);
+}
+
+stir_shaken_status_t stir_shaken_expiry_schedule(stir_shaken_expiry_t *expiry, stir_shaken_expiry_node_t *node, time_t at)
+{
+    stir_shaken_expiry_node_t **heap = NULL;
+    size_t capacity = 0;
+
+    if (node->pos) {
+        node->at = at;
+        stir_shaken_expiry_up(expiry, node->pos - 1);
+        stir_shaken_expiry_down(expiry, node->pos - 1);
+        return STIR_SHAKEN_STATUS_OK;
+    }
+
+    if (expiry->n == expiry->capacity) {
+
+        capacity = expiry->capacity ? expiry->capacity * 2 : STIR_SHAKEN_EXPIRY_MIN;
+        heap = realloc(expiry->heap, capacity * sizeof(*heap));
+        if (!heap) return STIR_SHAKEN_STATUS_FALSE;
+
+        expiry->heap = heap;
+        expiry->capacity = capacity;
+    }
+
+    node->at = at;
+    expiry->heap[expiry->n++] = node;
+    stir_shaken_expiry_up(expiry, expiry->n - 1);
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+void stir_shaken_expiry_cancel(stir_shaken_expiry_t *expiry, stir_shaken_expiry_node_t *node)
+{
+    stir_shaken_expiry_node_t *last = NULL;
+    size_t i = 0;
+
+    if (!node->pos) return;
+
+    i = node->pos - 1;
+    node->pos = 0;
+
+    // Last one takes its place
+    last = expiry->heap[--expiry->n];
+    if (last != node) {
+        expiry->heap[i] = last;
+        stir_shaken_expiry_up(expiry, i);
+        stir_shaken_expiry_down(expiry, last->pos - 1);
+    }
+}
+
+stir_shaken_expiry_node_t* stir_shaken_expiry_first(stir_shaken_expiry_t *expiry)
+{
+    return expiry->n ? expiry->heap[0] : NULL;
+}
+
+void stir_shaken_expiry_destroy(stir_shaken_expiry_t *expiry)
+{
+    size_t i = 0;
+
+    for (i = 0; i < expiry->n; i++) {
+        expiry->heap[i]->pos = 0;
+    }
+
+    free(expiry->heap);
+    memset(expiry, 0, sizeof(*expiry));
+}
+
+void stir_shaken_cache_maintenance(void)
+{
+    stir_shaken_x5u_cache_expire();
+    stir_shaken_ocsp_cache_expire();
+}
+
 time_t stir_shaken_time_elapsed_s(time_t ts, time_t now)
 {
     if (ts >= now) return 0;
     return now - ts;
 }
 
+uint64_t stir_shaken_now_ms(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** Logging */
+
+static __thread stir_shaken_log_ring_t	*stir_shaken_log_ring;
+static __thread uint64_t				stir_shaken_log_ring_generation;
+static __thread uint64_t				stir_shaken_log_call_id;
+static __thread uint8_t					stir_shaken_log_delivering;		// records logged from within callback go straight to stderr
+
+static void stir_shaken_log_record_vprintf(stir_shaken_log_record_t *record, int level, stir_shaken_log_subsystem_t subsystem, const char *file, int line, const char *fmt, va_list ap)
+{
+    int len = 0;
+
+    record->level = level;
+    record->subsystem = subsystem;
+    record->call_id = stir_shaken_log_call_id;
+    record->file = file;
+    record->line = line;
+    clock_gettime(CLOCK_REALTIME, &record->ts);
+
+    len = vsnprintf(record->msg, sizeof(record->msg), fmt, ap);
+    if (len < 0) len = 0;
+    record->len = (size_t) len < sizeof(record->msg) ? (size_t) len : sizeof(record->msg) - 1;
+}
+
+static void stir_shaken_log_record_printf(stir_shaken_log_record_t *record, int level, stir_shaken_log_subsystem_t subsystem, const char *file, int line, const char *fmt, ...)
+{
+    va_list ap;
+
+    va_start(ap, fmt);
+    stir_shaken_log_record_vprintf(record, level, subsystem, file, line, fmt, ap);
+    va_end(ap);
+}
+
+static void stir_shaken_log_callback_get(stir_shaken_log_callback_t *callback, void **user_data)
+{
+    pthread_mutex_lock(&stir_shaken_globals.log_callback_mutex);
+    *callback = stir_shaken_globals.log_callback;
+    *user_data = stir_shaken_globals.log_callback_data;
+    pthread_mutex_unlock(&stir_shaken_globals.log_callback_mutex);
+}
+
+static void stir_shaken_log_deliver(const stir_shaken_log_record_t *record, stir_shaken_log_callback_t callback, void *user_data)
+{
+    uint8_t delivering = stir_shaken_log_delivering;
+
+    if (!callback || delivering) {
+        fwrite(record->msg, 1, record->len, stderr);
+        return;
+    }
+
+    stir_shaken_log_delivering = 1;
+    callback(record, user_data);
+    stir_shaken_log_delivering = delivering;
+}
+
+// Deliver records from all rings, free rings of threads which exited. Called with log mutex held.
+static size_t stir_shaken_log_drain(void)
+{
+    stir_shaken_log_ring_t **prev = &stir_shaken_globals.log_rings, *ring = NULL;
+    stir_shaken_log_record_t dropped_record = { 0 };
+    stir_shaken_log_callback_t callback = NULL;
+    void *user_data = NULL;
+    uint64_t head = 0, tail = 0, dropped = 0;
+    uint8_t orphaned = 0;
+    size_t n = 0;
+
+    stir_shaken_log_callback_get(&callback, &user_data);
+
+    while ((ring = *prev)) {
+
+        // Owner's last record is visible once it is seen to have exited
+        orphaned = __atomic_load_n(&ring->orphaned, __ATOMIC_ACQUIRE);
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+        for (tail = ring->tail; tail != head; tail++, n++) {
+            stir_shaken_log_deliver(&ring->records[tail & (STIR_SHAKEN_LOG_RING_SIZE - 1)], callback, user_data);
+            __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+        }
+
+        dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED);
+        if (dropped) {
+            stir_shaken_log_record_printf(&dropped_record, STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_GENERAL, __FILE__, __LINE__, "STIR-Shaken: Log: dropped %" PRIu64 " records\n", dropped);
+            dropped_record.call_id = 0;
+            stir_shaken_log_deliver(&dropped_record, callback, user_data);
+            n++;
+        }
+
+        if (orphaned) {
+            *prev = ring->next;
+            free(ring);
+            continue;
+        }
+
+        prev = &ring->next;
+    }
+
+    return n;
+}
+
+static void* stir_shaken_log_writer(void *arg)
+{
+    int idle = 0;
+
+    (void) arg;
+
+    pthread_mutex_lock(&stir_shaken_globals.log_mutex);
+
+    while (__atomic_load_n(&stir_shaken_globals.log_running, __ATOMIC_ACQUIRE)) {
+
+        if (stir_shaken_log_drain()) {
+            idle = 0;
+        }
+
+        if (idle++ < STIR_SHAKEN_LOG_SPIN) {
+
+            // Let threads register rings and flush in between, do not sleep (and so make producers signal) on short gaps
+            pthread_mutex_unlock(&stir_shaken_globals.log_mutex);
+            sched_yield();
+            pthread_mutex_lock(&stir_shaken_globals.log_mutex);
+            continue;
+        }
+
+        // Announce sleep before last look at rings: producer either is seen there or sees the flag and signals
+        __atomic_store_n(&stir_shaken_globals.log_sleeping, 1, __ATOMIC_SEQ_CST);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+        if (!stir_shaken_log_drain() && __atomic_load_n(&stir_shaken_globals.log_running, __ATOMIC_ACQUIRE)) {
+            pthread_cond_wait(&stir_shaken_globals.log_cond, &stir_shaken_globals.log_mutex);
+        }
+
+        __atomic_store_n(&stir_shaken_globals.log_sleeping, 0, __ATOMIC_RELAXED);
+        idle = 0;
+    }
+
+    pthread_mutex_unlock(&stir_shaken_globals.log_mutex);
+
+    return NULL;
+}
+
+// Thread exit: ring is freed once drained (ring may be gone already if logging was deinitialised)
+static void stir_shaken_log_thread_exit(void *arg)
+{
+    stir_shaken_log_ring_t *ring = NULL;
+
+    pthread_mutex_lock(&stir_shaken_globals.log_mutex);
+
+    for (ring = stir_shaken_globals.log_rings; ring; ring = ring->next) {
+
+        if (ring == arg && pthread_equal(ring->owner, pthread_self())) {
+            __atomic_store_n(&ring->orphaned, 1, __ATOMIC_RELEASE);
+            break;
+        }
+    }
+
+    pthread_mutex_unlock(&stir_shaken_globals.log_mutex);
+}
+
+static stir_shaken_log_ring_t* stir_shaken_log_ring_get(void)
+{
+    stir_shaken_log_ring_t *ring = NULL;
+    uint64_t generation = __atomic_load_n(&stir_shaken_globals.log_generation, __ATOMIC_ACQUIRE);
+
+    if (stir_shaken_log_ring && stir_shaken_log_ring_generation == generation) {
+        return stir_shaken_log_ring;
+    }
+
+    ring = calloc(1, sizeof(*ring));
+    if (!ring) return NULL;
+
+    ring->owner = pthread_self();
+
+    pthread_mutex_lock(&stir_shaken_globals.log_mutex);
+
+    if (!stir_shaken_globals.log_running) {
+        pthread_mutex_unlock(&stir_shaken_globals.log_mutex);
+        free(ring);
+        return NULL;
+    }
+
+    ring->next = stir_shaken_globals.log_rings;
+    stir_shaken_globals.log_rings = ring;
+    generation = stir_shaken_globals.log_generation;
+
+    pthread_mutex_unlock(&stir_shaken_globals.log_mutex);
+
+    pthread_setspecific(stir_shaken_globals.log_key, ring);
+    stir_shaken_log_ring = ring;
+    stir_shaken_log_ring_generation = generation;
+
+    return ring;
+}
+
+void stir_shaken_do_log(int level, stir_shaken_log_subsystem_t subsystem, const char *file, int line, const char *fmt, ...)
+{
+    stir_shaken_log_ring_t *ring = NULL;
+    stir_shaken_log_record_t *record = NULL, local = { 0 };
+    stir_shaken_log_callback_t callback = NULL;
+    void *user_data = NULL;
+    uint64_t head = 0;
+    va_list ap;
+
+    if (__atomic_load_n(&stir_shaken_globals.log_running, __ATOMIC_ACQUIRE) && !stir_shaken_log_delivering) {
+        ring = stir_shaken_log_ring_get();
+    }
+
+    if (!ring) {
+
+        // Writer not running, deliver now
+        stir_shaken_log_callback_get(&callback, &user_data);
+
+        if (!callback || stir_shaken_log_delivering) {
+            va_start(ap, fmt);
+            vfprintf(stderr, fmt, ap);
+            va_end(ap);
+            return;
+        }
+
+        va_start(ap, fmt);
+        stir_shaken_log_record_vprintf(&local, level, subsystem, file, line, fmt, ap);
+        va_end(ap);
+
+        stir_shaken_log_deliver(&local, callback, user_data);
+        return;
+    }
+
+    head = ring->head;
+    if (head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= STIR_SHAKEN_LOG_RING_SIZE) {
+        __atomic_add_fetch(&ring->dropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    record = &ring->records[head & (STIR_SHAKEN_LOG_RING_SIZE - 1)];
+
+    va_start(ap, fmt);
+    stir_shaken_log_record_vprintf(record, level, subsystem, file, line, fmt, ap);
+    va_end(ap);
+
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+    // Wake writer only if it sleeps (see stir_shaken_log_writer)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&stir_shaken_globals.log_sleeping, __ATOMIC_RELAXED)) {
+        pthread_mutex_lock(&stir_shaken_globals.log_mutex);
+        pthread_cond_signal(&stir_shaken_globals.log_cond);
+        pthread_mutex_unlock(&stir_shaken_globals.log_mutex);
+    }
+}
+
+stir_shaken_status_t stir_shaken_log_init(stir_shaken_context_t *ss)
+{
+    if (stir_shaken_globals.log_initialised) {
+        return STIR_SHAKEN_STATUS_NOOP;
+    }
+
+    if (pthread_mutex_init(&stir_shaken_globals.log_mutex, NULL) != 0) {
+        stir_shaken_set_error(ss, "Init log mutex failed", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (pthread_cond_init(&stir_shaken_globals.log_cond, NULL) != 0) {
+        pthread_mutex_destroy(&stir_shaken_globals.log_mutex);
+        stir_shaken_set_error(ss, "Init log condition failed", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (pthread_key_create(&stir_shaken_globals.log_key, stir_shaken_log_thread_exit) != 0) {
+        pthread_cond_destroy(&stir_shaken_globals.log_cond);
+        pthread_mutex_destroy(&stir_shaken_globals.log_mutex);
+        stir_shaken_set_error(ss, "Init log thread key failed", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    stir_shaken_globals.log_initialised = 1;
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+void stir_shaken_log_deinit(void)
+{
+    stir_shaken_log_ring_t *ring = NULL;
+
+    if (!stir_shaken_globals.log_initialised) return;
+
+    stir_shaken_log_stop();
+
+    // No thread logs anymore, rings of live threads can go too
+    pthread_mutex_lock(&stir_shaken_globals.log_mutex);
+
+    stir_shaken_log_drain();
+
+    while ((ring = stir_shaken_globals.log_rings)) {
+        stir_shaken_globals.log_rings = ring->next;
+        free(ring);
+    }
+
+    // Threads still holding a ring get a new one if logging is initialised again
+    __atomic_add_fetch(&stir_shaken_globals.log_generation, 1, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&stir_shaken_globals.log_mutex);
+
+    pthread_key_delete(stir_shaken_globals.log_key);
+    pthread_cond_destroy(&stir_shaken_globals.log_cond);
+    pthread_mutex_destroy(&stir_shaken_globals.log_mutex);
+    stir_shaken_globals.log_initialised = 0;
+}
+
+stir_shaken_status_t stir_shaken_log_start(stir_shaken_context_t *ss)
+{
+    if (!stir_shaken_globals.log_initialised) {
+        stir_shaken_set_error(ss, "Logging not initialised", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    pthread_mutex_lock(&stir_shaken_globals.log_mutex);
+
+    if (stir_shaken_globals.log_running) {
+        pthread_mutex_unlock(&stir_shaken_globals.log_mutex);
+        return STIR_SHAKEN_STATUS_NOOP;
+    }
+
+    __atomic_store_n(&stir_shaken_globals.log_running, 1, __ATOMIC_RELEASE);
+
+    if (pthread_create(&stir_shaken_globals.log_writer, NULL, stir_shaken_log_writer, NULL) != 0) {
+        __atomic_store_n(&stir_shaken_globals.log_running, 0, __ATOMIC_RELEASE);
+        pthread_mutex_unlock(&stir_shaken_globals.log_mutex);
+        stir_shaken_set_error(ss, "Cannot start log writer", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    pthread_mutex_unlock(&stir_shaken_globals.log_mutex);
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+void stir_shaken_log_stop(void)
+{
+    if (!stir_shaken_globals.log_initialised) return;
+
+    pthread_mutex_lock(&stir_shaken_globals.log_mutex);
+
+    if (!stir_shaken_globals.log_running) {
+        pthread_mutex_unlock(&stir_shaken_globals.log_mutex);
+        return;
+    }
+
+    __atomic_store_n(&stir_shaken_globals.log_running, 0, __ATOMIC_RELEASE);
+    pthread_cond_signal(&stir_shaken_globals.log_cond);
+    pthread_mutex_unlock(&stir_shaken_globals.log_mutex);
+
+    pthread_join(stir_shaken_globals.log_writer, NULL);
+
+    // Rings stay with their threads, which may be writing into them right now (seen writer running just before stop).
+    // Such late records are delivered by next flush or start. Only rings of exited threads are freed.
+    stir_shaken_log_flush();
+}
+
+void stir_shaken_log_flush(void)
+{
+    if (!stir_shaken_globals.log_initialised) return;
+
+    pthread_mutex_lock(&stir_shaken_globals.log_mutex);
+    stir_shaken_log_drain();
+    pthread_mutex_unlock(&stir_shaken_globals.log_mutex);
+}
+
+void stir_shaken_log_set_callback(stir_shaken_log_callback_t callback, void *user_data)
+{
+    pthread_mutex_lock(&stir_shaken_globals.log_callback_mutex);
+    stir_shaken_globals.log_callback = callback;
+    stir_shaken_globals.log_callback_data = user_data;
+    pthread_mutex_unlock(&stir_shaken_globals.log_callback_mutex);
+}
+
+void stir_shaken_log_set_call_id(uint64_t call_id)
+{
+    stir_shaken_log_call_id = call_id;
+}
+
 stir_shaken_status_t stir_shaken_test_die(const char *reason, const char *file, int line)
 {
     fprintif(STIR_SHAKEN_LOGLEVEL_HIGH, "FAIL: %s. %s:%d\n", reason, file, line);
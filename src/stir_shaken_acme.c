@@ -540,6 +540,7 @@ stir_shaken_status_t stir_shaken_acme_retrieve_auth_challenge_details(stir_shake
         free(http_req->response.mem.mem);
         http_req->response.mem.mem = NULL;
         http_req->response.mem.size = 0;
+        http_req->response.mem.capacity = 0;
     }
     ss_status = stir_shaken_make_http_get_req(ss, http_req);
 
@@ -802,27 +803,27 @@ stir_shaken_status_t stir_shaken_acme_poll(stir_shaken_context_t *ss, void *data
 
             // Authorization completed
             status_is_valid = 1;
-            fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "\t-> Got 'valid' polling status\n");
+            stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_ACME, "\t-> Got 'valid' polling status\n");
 
         } else {
 
             if (strcmp("pending", ks_json_value_string(auth_status)) != 0) {
 
                 if (0 == strcmp("failed", ks_json_value_string(auth_status))) {
-                    fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "\t-> Got 'failed' polling status");
+                    stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_ACME, "\t-> Got 'failed' polling status");
                     snprintf(err_buf, STIR_SHAKEN_BUFLEN, "\t-> Got 'failed' polling status (%s): ACME authorization unsuccessful\n", ks_json_value_string(auth_status));
                     stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_ACME_AUTHZ_UNSUCCESSFUL);
                     goto fail;
                 }
 
-                fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "\t-> Got malformed polling status\n");
+                stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_ACME, "\t-> Got malformed polling status\n");
 
                 snprintf(err_buf, STIR_SHAKEN_BUFLEN, "ACME auth status malformed, 'status' field is neither 'valid' nor 'pending' nor 'failed' (status is: '%s')\n", ks_json_value_string(auth_status));
                 stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_ACME);
                 goto fail;
             }
 
-            fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "\t-> Got 'pending' polling status, continue polling...\n");
+            stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_ACME, "\t-> Got 'pending' polling status, continue polling...\n");
 
             // ACME authorization is still pending, poll again after some delay
             // Wait before next HTTP request
@@ -838,6 +839,7 @@ stir_shaken_status_t stir_shaken_acme_poll(stir_shaken_context_t *ss, void *data
         free(http_req.response.mem.mem);
         http_req.response.mem.mem = NULL;
         http_req.response.mem.size = 0;
+        http_req.response.mem.capacity = 0;
     }
 
     stir_shaken_destroy_http_request(&http_req);
@@ -907,13 +909,13 @@ stir_shaken_status_t stir_shaken_acme_perform_authorization(stir_shaken_context_
         goto fail;
     }
 
-    fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "-> Processing authorization challenge...\n");
+    stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_ACME, "-> Processing authorization challenge...\n");
 
     // If status is "valid" authorization is completed and can proceed to cert acquisition
     if (strcmp("valid", ks_json_value_string(auth_status)) == 0) {
 
         // Authorization completed
-        fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "-> Authorization completed\n");
+        stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_ACME, "-> Authorization completed\n");
 
     } else {
 
@@ -930,7 +932,7 @@ stir_shaken_status_t stir_shaken_acme_perform_authorization(stir_shaken_context_
         // ACME authorization is pending
         // Retrieve authorization challenge details
 
-        fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "\t-> Authorization is pending\n");
+        stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_ACME, "\t-> Authorization is pending\n");
 
         auth_arr = ks_json_get_object_item(json, "authorizations");
         if (!auth_arr) {
@@ -964,12 +966,13 @@ stir_shaken_status_t stir_shaken_acme_perform_authorization(stir_shaken_context_
         http_req.url = strdup(auth_url);
         http_req.remote_port = remote_port;
 
-        fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "\t-> Requesting authorization challenge details...\n");
+        stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_ACME, "\t-> Requesting authorization challenge details...\n");
 
         if (http_req.response.mem.mem) {
             free(http_req.response.mem.mem);
             http_req.response.mem.mem = NULL;
             http_req.response.mem.size = 0;
+            http_req.response.mem.capacity = 0;
         }
 
         if (STIR_SHAKEN_STATUS_OK != stir_shaken_acme_retrieve_auth_challenge_details(ss, &http_req)) {
@@ -989,8 +992,8 @@ stir_shaken_status_t stir_shaken_acme_perform_authorization(stir_shaken_context_
                 goto fail;
             }
 
-            fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "\t-> Got authorization challenge details from CA:\n%s\n", http_req.response.mem.mem);
-            fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "\t-> Sending a response to authorization challenge details...\n");
+            stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_ACME, "\t-> Got authorization challenge details from CA:\n%s\n", http_req.response.mem.mem);
+            stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_ACME, "\t-> Sending a response to authorization challenge details...\n");
 
             if (STIR_SHAKEN_STATUS_OK != stir_shaken_acme_respond_to_challenge(ss, http_req.response.mem.mem, spc_token, key, keylen, &polling_url, remote_port)) {
                 stir_shaken_set_error(ss, " ACME failed at authorization challenge response step. STI-SP cert cannot be downloaded.", STIR_SHAKEN_ERROR_ACME);
@@ -1002,7 +1005,7 @@ stir_shaken_status_t stir_shaken_acme_perform_authorization(stir_shaken_context_
              * Polling.
              */
 
-            fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "\t-> Polling...\n");
+            stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_ACME, "\t-> Polling...\n");
 
             if (STIR_SHAKEN_STATUS_OK != stir_shaken_acme_poll(ss, http_req.response.mem.mem, polling_url, remote_port)) {
                 stir_shaken_set_error(ss, "ACME polling failed. STI-SP cert cannot be downloaded.", STIR_SHAKEN_ERROR_ACME);
@@ -1011,7 +1014,7 @@ stir_shaken_status_t stir_shaken_acme_perform_authorization(stir_shaken_context_
             }
 
             free(polling_url);
-            fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "\t-> Polling finished...\n");
+            stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_ACME, "\t-> Polling finished...\n");
             stir_shaken_destroy_http_request(&http_req);
         }
     }
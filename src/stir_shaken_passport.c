@@ -1,6 +1,105 @@
 #include "stir_shaken.h"
 
 
+/*
+ * Compact JSON writer into preallocated buffer, used for PASSporT claims and canonical form.
+ */
+typedef struct stir_shaken_canon_s {
+	char	*buf;
+	size_t	buflen;
+	size_t	pos;		// number of bytes written, or needed if buffer is too small
+} stir_shaken_canon_t;
+
+static void stir_shaken_canon_putc(stir_shaken_canon_t *c, char ch)
+{
+	if (c->pos + 1 < c->buflen) {
+		c->buf[c->pos] = ch;
+	}
+	c->pos++;
+}
+
+static void stir_shaken_canon_puts(stir_shaken_canon_t *c, const char *s)
+{
+	while (*s) {
+		stir_shaken_canon_putc(c, *s++);
+	}
+}
+
+static void stir_shaken_canon_put_string(stir_shaken_canon_t *c, const char *s)
+{
+	static const char hex[] = "0123456789abcdef";
+	const unsigned char *p = (const unsigned char *) s;
+
+	stir_shaken_canon_putc(c, '"');
+
+	for (; *p; p++) {
+
+		switch (*p) {
+
+			case '"':	stir_shaken_canon_puts(c, "\\\""); break;
+			case '\\':	stir_shaken_canon_puts(c, "\\\\"); break;
+			case '\b':	stir_shaken_canon_puts(c, "\\b"); break;
+			case '\f':	stir_shaken_canon_puts(c, "\\f"); break;
+			case '\n':	stir_shaken_canon_puts(c, "\\n"); break;
+			case '\r':	stir_shaken_canon_puts(c, "\\r"); break;
+			case '\t':	stir_shaken_canon_puts(c, "\\t"); break;
+
+			default:
+				if (*p < 0x20) {
+					stir_shaken_canon_puts(c, "\\u00");
+					stir_shaken_canon_putc(c, hex[*p >> 4]);
+					stir_shaken_canon_putc(c, hex[*p & 0xf]);
+				} else {
+					stir_shaken_canon_putc(c, *p);
+				}
+				break;
+		}
+	}
+
+	stir_shaken_canon_putc(c, '"');
+}
+
+static void stir_shaken_canon_put_key(stir_shaken_canon_t *c, const char *key, uint8_t *first)
+{
+	if (!*first) stir_shaken_canon_putc(c, ',');
+	*first = 0;
+	stir_shaken_canon_put_string(c, key);
+	stir_shaken_canon_putc(c, ':');
+}
+
+static stir_shaken_status_t stir_shaken_canon_finish(stir_shaken_context_t *ss, stir_shaken_canon_t *c, size_t *outlen)
+{
+	if (outlen) *outlen = c->pos;
+
+	if (c->pos >= c->buflen) {
+		if (c->buflen) c->buf[c->buflen - 1] = '\0';
+		stir_shaken_set_error(ss, "PASSporT canonical form: buffer too small", STIR_SHAKEN_ERROR_GENERAL);
+		return STIR_SHAKEN_STATUS_FALSE;
+	}
+
+	c->buf[c->pos] = '\0';
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+/*
+ * Write new @orig or @dest claim in RFC 8225 shape.
+ *
+ * @orig holds single identity, e.g. {"tn":"12155551212"} or {"uri":"sip:alice@example.com"}
+ * @dest holds array of identities, e.g. {"tn":["12155551213"]} or {"uri":["sip:bob@example.com"]}
+ */
+static void stir_shaken_canon_put_new_identity(stir_shaken_canon_t *c, const char *key, const char *val, uint8_t is_array)
+{
+	const char *form = (key && !strcmp(key, "uri")) ? "uri" : "tn";
+	uint8_t first = 1;
+
+	stir_shaken_canon_putc(c, '{');
+	stir_shaken_canon_put_key(c, form, &first);
+	if (is_array) stir_shaken_canon_putc(c, '[');
+	stir_shaken_canon_put_string(c, val);
+	if (is_array) stir_shaken_canon_putc(c, ']');
+	stir_shaken_canon_putc(c, '}');
+}
+
 /* Produce JWT.
  *
  * The Personal Assertion Token, PASSporT: https://tools.ietf.org/html/rfc8225.
@@ -35,7 +134,9 @@ stir_shaken_status_t stir_shaken_passport_jwt_init(stir_shaken_context_t *ss, jw
 		const char *origtn_key = params->origtn_key;
 		const char *origtn_val = params->origtn_val;
 		const char *origid = params->origid;
-
+		char claims[STIR_SHAKEN_BUFLEN] = { 0 };
+		stir_shaken_canon_t c = { .buf = claims, .buflen = sizeof(claims), .pos = 0 };
+		uint8_t first = 1;
 
 		// Header
 
@@ -64,6 +165,11 @@ stir_shaken_status_t stir_shaken_passport_jwt_init(stir_shaken_context_t *ss, jw
 
 		// Payload
 
+		if (iat < 0) {
+			stir_shaken_set_error(ss, "Passport @iat is negative", STIR_SHAKEN_ERROR_PASSPORT_INVALID);
+			return STIR_SHAKEN_STATUS_ERR;
+		}
+
 		if (jwt_add_grant_int(jwt, "iat", iat) != 0) {
 			stir_shaken_set_error(ss, "Failed to add @iat to PASSporT", STIR_SHAKEN_ERROR_KSJSON);
 			return STIR_SHAKEN_STATUS_ERR;
@@ -94,98 +200,27 @@ stir_shaken_status_t stir_shaken_passport_jwt_init(stir_shaken_context_t *ss, jw
 			return STIR_SHAKEN_STATUS_ERR;
 		}
 
-		if (!origtn_key || !origtn_val) {
-
+		if (!origtn_key || !origtn_val || !desttn_key || !desttn_val) {
 			return STIR_SHAKEN_STATUS_ERR;
+		}
 
-		} else {
-
-			ks_json_t *orig = NULL, *tn = NULL, *e = NULL;
-			char *jstr = NULL;
-
-			orig = ks_json_create_object();
-			if (!orig) {
-				stir_shaken_set_error(ss, "Passport create json: Error in ks_json, @orig", STIR_SHAKEN_ERROR_KSJSON);
-				return STIR_SHAKEN_STATUS_ERR;
-			}
-
-			if (!strcmp(origtn_key, "uri")) {
-			
-				tn = ks_json_create_array();
-				if (!tn) {
-					stir_shaken_set_error(ss, "Passport create json: Error in ks_json, @origtn [key]", STIR_SHAKEN_ERROR_KSJSON);
-					ks_json_delete(&orig);
-					return STIR_SHAKEN_STATUS_ERR;
-				}
-				ks_json_add_item_to_object(orig, origtn_key, tn);
-
-				e = ks_json_create_string(origtn_val);
-				if (!e) {
-					stir_shaken_set_error(ss, "Passport create json: Error in ks_json, @origtn [val]", STIR_SHAKEN_ERROR_KSJSON);
-					ks_json_delete(&orig);
-					return STIR_SHAKEN_STATUS_ERR;
-				}
-				ks_json_add_item_to_array(tn, e);
-			
-			} else {
-			
-				ks_json_add_string_to_object(orig, "tn", origtn_val);
-			}
+		// @dest and @orig are JSON objects, written directly in one go (claims are parsed from JWT later, only if asked for)
 
-			jstr = ks_json_print_unformatted(orig);
-			if (!jstr || (jwt_add_grant(jwt, "orig", jstr) != 0)) {
-				ks_json_delete(&orig);
-				return STIR_SHAKEN_STATUS_ERR;
-			}
+		stir_shaken_canon_putc(&c, '{');
+		stir_shaken_canon_put_key(&c, "dest", &first);
+		stir_shaken_canon_put_new_identity(&c, desttn_key, desttn_val, 1);
+		stir_shaken_canon_put_key(&c, "orig", &first);
+		stir_shaken_canon_put_new_identity(&c, origtn_key, origtn_val, 0);
+		stir_shaken_canon_putc(&c, '}');
 
-			ks_json_delete(&orig);
+		if (STIR_SHAKEN_STATUS_OK != stir_shaken_canon_finish(ss, &c, NULL)) {
+			stir_shaken_set_error(ss, "Passport create json: @orig/@dest too long", STIR_SHAKEN_ERROR_KSJSON);
+			return STIR_SHAKEN_STATUS_ERR;
 		}
-	
-		if (!desttn_key || !desttn_val) {
 
+		if (jwt_add_grants_json(jwt, claims) != 0) {
+			stir_shaken_set_error(ss, "Failed to add @orig/@dest to PASSporT", STIR_SHAKEN_ERROR_KSJSON);
 			return STIR_SHAKEN_STATUS_ERR;
-
-		} else {
-
-			ks_json_t *dest = NULL, *tn = NULL, *e = NULL;
-			char *jstr = NULL;
-
-			dest = ks_json_create_object();
-			if (!dest) {
-				stir_shaken_set_error(ss, "Passport create json: Error in ks_json, @dest", STIR_SHAKEN_ERROR_KSJSON);
-				return STIR_SHAKEN_STATUS_ERR;
-			}
-
-			if (!strcmp(desttn_key, "uri")) {
-
-				tn = ks_json_create_array();
-				if (!tn) {
-					stir_shaken_set_error(ss, "Passport create json: Error in ks_json, @desttn [key]", STIR_SHAKEN_ERROR_KSJSON);
-					ks_json_delete(&dest);
-					return STIR_SHAKEN_STATUS_ERR;
-				}
-				ks_json_add_item_to_object(dest, desttn_key, tn);
-
-				e = ks_json_create_string(desttn_val);
-				if (!e) {
-					stir_shaken_set_error(ss, "Passport create json: Error in ks_json, @desttn [val]", STIR_SHAKEN_ERROR_KSJSON);
-					ks_json_delete(&dest);
-					return STIR_SHAKEN_STATUS_ERR;
-				}
-				ks_json_add_item_to_array(tn, e);
-
-			} else {
-
-				ks_json_add_string_to_object(dest, "tn", desttn_val);
-			}
-
-			jstr = ks_json_print_unformatted(dest);
-			if (!jstr || (jwt_add_grant(jwt, "dest", jstr) != 0)) {
-				ks_json_delete(&dest);
-				return STIR_SHAKEN_STATUS_ERR;
-			}
-
-			ks_json_delete(&dest);
 		}
 	}
 
@@ -238,6 +273,14 @@ jwt_t* stir_shaken_passport_jwt_create_new(stir_shaken_context_t *ss)
 	return jwt;
 }
 
+static void stir_shaken_passport_clear_claims(stir_shaken_passport_t *passport)
+{
+	if (passport->orig) ks_json_delete(&passport->orig);
+	if (passport->dest) ks_json_delete(&passport->dest);
+	passport->orig = NULL;
+	passport->dest = NULL;
+}
+
 stir_shaken_status_t stir_shaken_passport_init(stir_shaken_context_t *ss, stir_shaken_passport_t *where, stir_shaken_passport_params_t *params, unsigned char *key, uint32_t keylen)
 {
 	if (!where) return STIR_SHAKEN_STATUS_TERM;
@@ -253,6 +296,8 @@ stir_shaken_status_t stir_shaken_passport_init(stir_shaken_context_t *ss, stir_s
 
 	if (params) {
 
+		stir_shaken_passport_clear_claims(where);
+
 		if (stir_shaken_passport_jwt_init(ss, where->jwt, params, key, keylen) != STIR_SHAKEN_STATUS_OK) {
 			stir_shaken_set_error_if_clear(ss, "Cannot init JWT", STIR_SHAKEN_ERROR_GENERAL);
 			return STIR_SHAKEN_STATUS_FALSE;
@@ -271,6 +316,7 @@ stir_shaken_passport_t*	stir_shaken_passport_create_new(stir_shaken_context_t *s
 		stir_shaken_set_error(ss, "Out of memory", STIR_SHAKEN_ERROR_GENERAL);
 		return NULL;
 	}
+	memset(passport, 0, sizeof(*passport));
 
 	passport->jwt = stir_shaken_passport_jwt_create_new(ss);
 	if (!passport->jwt) {
@@ -300,10 +346,18 @@ void stir_shaken_passport_destroy(stir_shaken_passport_t *passport)
 	if (!passport) return;
 	if (passport->jwt) jwt_free(passport->jwt);
 	passport->jwt = NULL;
+	stir_shaken_passport_clear_claims(passport);
 }
 
+/*
+ * Sign PASSporT. JWT is encoded by libjwt, with all headers and grants (libjwt writes JSON with sorted keys and without whitespace,
+ * so for PASSporT with only the baseline and SHAKEN claims the signed header and payload are the same as their canonical form,
+ * see stir_shaken_passport_canonical_header/payload). PASSporT without positive @iat is refused.
+ */
 stir_shaken_status_t stir_shaken_passport_sign(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, unsigned char *key, uint32_t keylen, char **out)
 {
+	long int iat = 0;
+
 	if (!passport || !passport->jwt) return STIR_SHAKEN_STATUS_TERM;
 
 	if (key && keylen) {
@@ -316,6 +370,12 @@ stir_shaken_status_t stir_shaken_passport_sign(stir_shaken_context_t *ss, stir_s
 		}
 	}
 
+	iat = stir_shaken_passport_get_grant_int(passport, "iat");
+	if (errno == ENOENT || iat <= 0) {
+		stir_shaken_set_error(ss, "JWT PASSporT Sign: @iat must be set and positive", STIR_SHAKEN_ERROR_PASSPORT_INVALID);
+		return STIR_SHAKEN_STATUS_ERR;
+	}
+
 	*out = jwt_encode_str(passport->jwt);
 	if (!*out) {
 		stir_shaken_set_error(ss, "JWT PASSporT Sign: Failed to encode JWT", STIR_SHAKEN_ERROR_GENERAL);
@@ -437,6 +497,154 @@ void stir_shaken_free_jwt_str(char *s)
 	jwt_free_str(s);
 }
 
+/*
+ * Write identity claim, {"tn":...} and/or {"uri":...}, with values being either string or array of strings.
+ */
+static stir_shaken_status_t stir_shaken_canon_put_identity(stir_shaken_context_t *ss, stir_shaken_canon_t *c, ks_json_t *claim)
+{
+	const char *forms[] = { "tn", "uri" };		// lexicographic order
+	uint8_t first = 1;
+	int i = 0;
+
+	stir_shaken_canon_putc(c, '{');
+
+	for (i = 0; i < 2; i++) {
+
+		ks_json_t *item = ks_json_get_object_item(claim, forms[i]);
+		if (!item) continue;
+
+		stir_shaken_canon_put_key(c, forms[i], &first);
+
+		if (ks_json_type_get(item) == KS_JSON_TYPE_STRING) {
+
+			stir_shaken_canon_put_string(c, ks_json_value_string(item));
+
+		} else if (ks_json_type_get(item) == KS_JSON_TYPE_ARRAY) {
+
+			ks_json_t *e = NULL;
+			uint8_t first_in_array = 1;
+
+			stir_shaken_canon_putc(c, '[');
+
+			KS_JSON_ARRAY_FOREACH(e, item) {
+
+				if (ks_json_type_get(e) != KS_JSON_TYPE_STRING) {
+					stir_shaken_set_error(ss, "PASSporT canonical form: identity array must hold strings only", STIR_SHAKEN_ERROR_PASSPORT_INVALID);
+					return STIR_SHAKEN_STATUS_FALSE;
+				}
+
+				if (!first_in_array) stir_shaken_canon_putc(c, ',');
+				first_in_array = 0;
+				stir_shaken_canon_put_string(c, ks_json_value_string(e));
+			}
+
+			stir_shaken_canon_putc(c, ']');
+
+		} else {
+
+			stir_shaken_set_error(ss, "PASSporT canonical form: identity must be string or array", STIR_SHAKEN_ERROR_PASSPORT_INVALID);
+			return STIR_SHAKEN_STATUS_FALSE;
+		}
+	}
+
+	stir_shaken_canon_putc(c, '}');
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_passport_canonical_header(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, char *buf, size_t buflen, size_t *outlen)
+{
+	stir_shaken_canon_t c = { .buf = buf, .buflen = buflen, .pos = 0 };
+	const char *names[] = { "alg", "ppt", "typ", "x5u" };		// lexicographic order
+	uint8_t first = 1;
+	int i = 0;
+
+	if (!passport || !passport->jwt || (!buf && buflen)) {
+		stir_shaken_set_error(ss, "PASSporT canonical form: Bad params", STIR_SHAKEN_ERROR_GENERAL);
+		return STIR_SHAKEN_STATUS_TERM;
+	}
+
+	stir_shaken_canon_putc(&c, '{');
+
+	for (i = 0; i < 4; i++) {
+
+		const char *v = jwt_get_header(passport->jwt, names[i]);
+
+		if (!v && !strcmp(names[i], "alg") && jwt_get_alg(passport->jwt) != JWT_ALG_NONE) {
+
+			// @alg is moved to the headers only when JWT is encoded
+			v = jwt_alg_str(jwt_get_alg(passport->jwt));
+		}
+
+		if (!v) continue;
+
+		stir_shaken_canon_put_key(&c, names[i], &first);
+		stir_shaken_canon_put_string(&c, v);
+	}
+
+	stir_shaken_canon_putc(&c, '}');
+
+	return stir_shaken_canon_finish(ss, &c, outlen);
+}
+
+stir_shaken_status_t stir_shaken_passport_canonical_payload(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, char *buf, size_t buflen, size_t *outlen)
+{
+	stir_shaken_canon_t c = { .buf = buf, .buflen = buflen, .pos = 0 };
+	const char *v = NULL;
+	ks_json_t *claim = NULL;
+	long int iat = 0;
+	char iatbuf[32] = { 0 };
+	uint8_t first = 1;
+
+	if (!passport || !passport->jwt || (!buf && buflen)) {
+		stir_shaken_set_error(ss, "PASSporT canonical form: Bad params", STIR_SHAKEN_ERROR_GENERAL);
+		return STIR_SHAKEN_STATUS_TERM;
+	}
+
+	stir_shaken_canon_putc(&c, '{');
+
+	v = jwt_get_grant(passport->jwt, "attest");
+	if (v) {
+		stir_shaken_canon_put_key(&c, "attest", &first);
+		stir_shaken_canon_put_string(&c, v);
+	}
+
+	claim = stir_shaken_passport_get_grant_json(ss, passport, "dest");
+	if (claim) {
+		stir_shaken_canon_put_key(&c, "dest", &first);
+		if (STIR_SHAKEN_STATUS_OK != stir_shaken_canon_put_identity(ss, &c, claim)) {
+			return STIR_SHAKEN_STATUS_FALSE;
+		}
+	}
+
+	iat = stir_shaken_passport_get_grant_int(passport, "iat");
+	if (errno == ENOENT || iat <= 0) {
+		stir_shaken_set_error(ss, "PASSporT canonical form: @iat must be set and positive", STIR_SHAKEN_ERROR_PASSPORT_INVALID);
+		return STIR_SHAKEN_STATUS_FALSE;
+	}
+	snprintf(iatbuf, sizeof(iatbuf), "%ld", iat);
+	stir_shaken_canon_put_key(&c, "iat", &first);
+	stir_shaken_canon_puts(&c, iatbuf);
+
+	claim = stir_shaken_passport_get_grant_json(ss, passport, "orig");
+	if (claim) {
+		stir_shaken_canon_put_key(&c, "orig", &first);
+		if (STIR_SHAKEN_STATUS_OK != stir_shaken_canon_put_identity(ss, &c, claim)) {
+			return STIR_SHAKEN_STATUS_FALSE;
+		}
+	}
+
+	v = jwt_get_grant(passport->jwt, "origid");
+	if (v) {
+		stir_shaken_canon_put_key(&c, "origid", &first);
+		stir_shaken_canon_put_string(&c, v);
+	}
+
+	stir_shaken_canon_putc(&c, '}');
+
+	return stir_shaken_canon_finish(ss, &c, outlen);
+}
+
 /*
  * NOTE: @passport takes sownership of @jwt.
  */
@@ -445,6 +653,7 @@ void stir_shaken_jwt_move_to_passport(jwt_t *jwt, stir_shaken_passport_t *passpo
 	if (!passport) return;
 	if (passport->jwt) jwt_free(passport->jwt);
 	passport->jwt = jwt;
+	stir_shaken_passport_clear_claims(passport);
 }
 
 const char* stir_shaken_passport_get_header(stir_shaken_passport_t *passport, const char* key)
@@ -463,6 +672,13 @@ const char* stir_shaken_passport_get_headers_json(stir_shaken_passport_t *passpo
 const char* stir_shaken_passport_get_grant(stir_shaken_passport_t *passport, const char* key)
 {
 	if (!passport || !key) return NULL;
+
+	if (!strcmp(key, "orig") || !strcmp(key, "dest")) {
+
+		// JSON object claims, return their tn/uri
+		return stir_shaken_passport_get_tn_or_uri(NULL, passport, key, NULL);
+	}
+
 	return jwt_get_grant(passport->jwt, key);
 }
 
@@ -476,72 +692,103 @@ long int stir_shaken_passport_get_grant_int(stir_shaken_passport_t *passport, co
 	return jwt_get_grant_int(passport->jwt, key);
 }
 
-/**
- * Returns id if found. Must be freed by caller.
+/*
+ * Load @orig or @dest claim from JWT.
+ * Claim is stored as JSON object, but older PASSporTs may carry it as a string holding JSON.
  */
-char* stir_shaken_passport_get_identity(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, int *is_tn)
+static ks_json_t* stir_shaken_passport_load_claim(stir_shaken_context_t *ss, jwt_t *jwt, const char *key)
 {
-	char *id = NULL;
-	const char *orig = NULL;
-	int tn_form = 0;
-
-	if (!passport) return NULL;
-
-	orig = stir_shaken_passport_get_grant(passport, "orig");
-	if (orig) {
-
-		ks_json_t *origjson = ks_json_parse(orig);
-		if (!origjson) {
-			stir_shaken_set_error(ss, "Failed to convert 'orig'to JSON", STIR_SHAKEN_ERROR_KSJSON);
+	ks_json_t *claim = NULL;
+	const char *str = NULL;
+	char *jstr = NULL;
+
+	str = jwt_get_grant(jwt, key);
+	if (str) {
+		claim = ks_json_parse(str);
+	} else {
+		jstr = jwt_get_grants_json(jwt, key);
+		if (!jstr) {
 			return NULL;
 		}
+		claim = ks_json_parse(jstr);
+		jwt_free_str(jstr);
+	}
 
-		if (ks_json_type_get(origjson) == KS_JSON_TYPE_ARRAY) {
+	if (!claim || ks_json_type_get(claim) != KS_JSON_TYPE_OBJECT) {
+		stir_shaken_set_error(ss, "PASSporT claim is not a JSON object", STIR_SHAKEN_ERROR_KSJSON);
+		if (claim) ks_json_delete(&claim);
+		return NULL;
+	}
 
-			// uri form
-			ks_json_t *uri = ks_json_get_array_item(origjson, 0);
+	return claim;
+}
 
-			if (!uri) {
-				stir_shaken_set_error(ss, "No 'uri' in 'orig' but it's an array. Array should have 'uri' item", STIR_SHAKEN_ERROR_GENERAL);
-				ks_json_delete(&origjson);
-				return NULL;
-			}
+ks_json_t* stir_shaken_passport_get_grant_json(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, const char *key)
+{
+	ks_json_t **cached = NULL;
 
-			if (ks_json_type_get(uri) != KS_JSON_TYPE_STRING) {
-				stir_shaken_set_error(ss, "'uri' in 'orig' array is not a string", STIR_SHAKEN_ERROR_GENERAL);
-				ks_json_delete(&origjson);
-				return NULL;
-			}
+	if (!passport || !passport->jwt || !key) return NULL;
 
-			id = strdup(ks_json_value_string(uri));
-			tn_form = 0;
+	if (!strcmp(key, "orig")) {
+		cached = &passport->orig;
+	} else if (!strcmp(key, "dest")) {
+		cached = &passport->dest;
+	} else {
+		stir_shaken_set_error(ss, "Only @orig and @dest claims can be retrieved as JSON", STIR_SHAKEN_ERROR_GENERAL);
+		return NULL;
+	}
 
-		} else {
+	if (!*cached) {
+		*cached = stir_shaken_passport_load_claim(ss, passport->jwt, key);
+	}
 
-			// tn form
+	return *cached;
+}
 
-			ks_json_t *tn = ks_json_get_object_item(origjson, "tn");
-			if (!tn) {
-				stir_shaken_set_error(ss, "No 'tn' in 'orig'", STIR_SHAKEN_ERROR_GENERAL);
-				ks_json_delete(&origjson);
-				return NULL;
-			}
+const char* stir_shaken_passport_get_tn_or_uri(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, const char *key, int *is_tn)
+{
+	ks_json_t *claim = NULL, *item = NULL;
+	int tn_form = 1;
 
-			if (ks_json_type_get(tn) != KS_JSON_TYPE_STRING) {
-				stir_shaken_set_error(ss, "'tn' in 'orig' is not a string", STIR_SHAKEN_ERROR_GENERAL);
-				ks_json_delete(&origjson);
-				return NULL;
-			}
+	claim = stir_shaken_passport_get_grant_json(ss, passport, key);
+	if (!claim) return NULL;
 
-			id = strdup(ks_json_value_string(tn));
-			tn_form = 1;
-		}
+	item = ks_json_get_object_item(claim, "tn");
+	if (!item) {
+		item = ks_json_get_object_item(claim, "uri");
+		tn_form = 0;
+	}
 
-		if (is_tn) *is_tn = tn_form;
-		ks_json_delete(&origjson);
-		return id;
+	if (!item) {
+		stir_shaken_set_error(ss, "PASSporT claim has neither 'tn' nor 'uri'", STIR_SHAKEN_ERROR_GENERAL);
+		return NULL;
 	}
-	return NULL;
+
+	if (ks_json_type_get(item) == KS_JSON_TYPE_ARRAY) {
+		item = ks_json_get_array_item(item, 0);
+	}
+
+	if (!item || ks_json_type_get(item) != KS_JSON_TYPE_STRING) {
+		stir_shaken_set_error(ss, "PASSporT claim 'tn'/'uri' is not a string", STIR_SHAKEN_ERROR_GENERAL);
+		return NULL;
+	}
+
+	if (is_tn) *is_tn = tn_form;
+	return ks_json_value_string(item);
+}
+
+/**
+ * Returns id if found. Must be freed by caller.
+ * Use stir_shaken_passport_get_tn_or_uri to avoid the copy.
+ */
+char* stir_shaken_passport_get_identity(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, int *is_tn)
+{
+	const char *id = NULL;
+
+	id = stir_shaken_passport_get_tn_or_uri(ss, passport, "orig", is_tn);
+	if (!id) return NULL;
+
+	return strdup(id);
 }
 
 /**
@@ -623,14 +870,14 @@ stir_shaken_status_t stir_shaken_passport_validate_grants(stir_shaken_context_t
 		return STIR_SHAKEN_STATUS_FALSE;
 	}
 
-	h = stir_shaken_passport_get_grant(passport, "orig");
+	h = stir_shaken_passport_get_tn_or_uri(ss, passport, "orig", NULL);
 	if (!h || !strcmp(h, "")) {
 		sprintf(err_buf, "PASSporT Invalid. @orig is missing");  
 		stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_PASSPORT_INVALID);	
 		return STIR_SHAKEN_STATUS_FALSE;
 	}
 
-	h = stir_shaken_passport_get_grant(passport, "dest");
+	h = stir_shaken_passport_get_tn_or_uri(ss, passport, "dest", NULL);
 	if (!h || !strcmp(h, "")) {
 		sprintf(err_buf, "PASSporT Invalid. @dest is missing");  
 		stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_PASSPORT_INVALID);	
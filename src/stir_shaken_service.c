@@ -1,51 +1,666 @@
 #include "stir_shaken.h"
 #include <curl/curl.h>
+#include <ctype.h>
+#include <strings.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
 
 static size_t stir_shaken_curl_write_callback(void *contents, size_t size, size_t nmemb, void *p)
 {
 	char *m = NULL;
 	size_t realsize = size * nmemb;
+	size_t needed = 0;
 	stir_shaken_http_req_t *http_req = (stir_shaken_http_req_t *) p;
 	mem_chunk_t *mem = &http_req->response.mem;
 
-	stir_shaken_clear_error(mem->ss);
+	stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_HTTP, "STIR-Shaken: CURL: Download progress: got %zu bytes (%zu total)\n", realsize, realsize + mem->size);
 
-	fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "STIR-Shaken: CURL: Download progress: got %zu bytes (%zu total)\n", realsize, realsize + mem->size);
+	if (mem->max && mem->size + realsize > mem->max) {
+		stir_shaken_set_error(mem->ss, "HTTP response too big", STIR_SHAKEN_ERROR_HTTP_GENERAL);
+		return 0;
+	}
+
+	needed = mem->size + realsize + 1;
+
+	if (!mem->mem || needed > mem->capacity) {
+
+		size_t capacity = mem->capacity ? mem->capacity : STIR_SHAKEN_HTTP_RESPONSE_BUF_MIN;
+
+		while (capacity < needed) {
+			capacity *= 2;
+		}
+
+		if (mem->max && capacity > mem->max + 1) {
+			capacity = mem->max + 1;
+		}
+
+		m = realloc(mem->mem, capacity);
+		if(!m) {
+			stir_shaken_set_error(mem->ss, "realloc returned NULL", STIR_SHAKEN_ERROR_GENERAL);
+			return 0;
+		}
+
+		mem->mem = m;
+		mem->capacity = capacity;
+	}
+
+	memcpy(&(mem->mem[mem->size]), contents, realsize);
+	mem->size += realsize;
+	mem->mem[mem->size] = 0;
+
+	return realsize;
+}
+
+// Case insensitive FNV-1a, never 0 (0 marks empty slot)
+static uint32_t stir_shaken_http_header_hash(const char *name, size_t len)
+{
+	uint32_t h = 2166136261u;
+	size_t i = 0;
+
+	for (i = 0; i < len; i++) {
+		h ^= (uint32_t) tolower((unsigned char) name[i]);
+		h *= 16777619u;
+	}
+
+	return h ? h : 1;
+}
+
+static void stir_shaken_http_response_headers_reset(stir_shaken_http_response_t *response)
+{
+	response->header_buf_len = 0;
+	response->header_n = 0;
+	response->header_index_full = 0;
+	memset(response->header_index, 0, sizeof(response->header_index));
+}
+
+static char* stir_shaken_http_response_headers_append(stir_shaken_http_response_t *response, const char *s, size_t len)
+{
+	char *p = NULL;
+
+	if (response->header_buf_len + len + 1 > response->header_buf_capacity) {
+
+		size_t capacity = response->header_buf_capacity ? response->header_buf_capacity : 1024;
+
+		while (capacity < response->header_buf_len + len + 1) {
+			capacity *= 2;
+		}
+
+		p = realloc(response->header_buf, capacity);
+		if (!p) return NULL;
+
+		response->header_buf = p;
+		response->header_buf_capacity = capacity;
+	}
+
+	p = response->header_buf + response->header_buf_len;
+	memcpy(p, s, len);
+	p[len] = '\0';
+	response->header_buf_len += len + 1;
+
+	return p;
+}
+
+static void stir_shaken_http_response_headers_index(stir_shaken_http_response_t *response, uint32_t name, uint32_t value, size_t name_len)
+{
+	uint32_t hash = stir_shaken_http_header_hash(response->header_buf + name, name_len);
+	uint32_t i = hash & (STIR_SHAKEN_HTTP_HEADER_INDEX_SIZE - 1);
+	stir_shaken_http_header_t *slot = NULL;
+
+	while ((slot = &response->header_index[i])->hash) {
+
+		if (slot->hash == hash && !strcasecmp(response->header_buf + slot->name, response->header_buf + name)) {
+
+			// Repeated header, last one wins
+			slot->name = name;
+			slot->value = value;
+			return;
+		}
+
+		i = (i + 1) & (STIR_SHAKEN_HTTP_HEADER_INDEX_SIZE - 1);
+	}
+
+	if (response->header_n >= STIR_SHAKEN_HTTP_HEADER_INDEX_SIZE * 3 / 4) {
+
+		// Still in buffer, found by scan
+		response->header_index_full = 1;
+		return;
+	}
+
+	slot->hash = hash;
+	slot->name = name;
+	slot->value = value;
+	response->header_n++;
+}
+
+static size_t stir_shaken_curl_header_callback(void *ptr, size_t size, size_t nmemb, void *data)
+{
+	size_t realsize = size * nmemb;
+	stir_shaken_http_req_t *http_req = data;
+	stir_shaken_http_response_t *response = &http_req->response;
+	const char *line = ptr, *colon = NULL, *value = NULL;
+	size_t len = realsize, name_len = 0, value_len = 0;
+	uint32_t name_off = 0, value_off = 0;
+
+	while (len > 0 && (line[len - 1] == '\r' || line[len - 1] == '\n')) {
+		len--;
+	}
+
+	if (len == 0) {
+
+		// End of headers
+		return realsize;
+	}
+
+	if (len > 5 && !strncmp(line, "HTTP/", 5)) {
+
+		// Status line starts new response (redirect, 100 Continue...), keep headers of last one only
+		stir_shaken_http_response_headers_reset(response);
+		if (!stir_shaken_http_response_headers_append(response, line, len)) {
+			return 0;
+		}
+		return realsize;
+	}
+
+	colon = memchr(line, ':', len);
+	if (!colon || colon == line || line[0] == ' ' || line[0] == '\t') {
+		stir_shaken_log(STIR_SHAKEN_LOGLEVEL_HIGH, STIR_SHAKEN_LOG_HTTP, "Unparsable header: %.*s\n", (int) len, line);
+		return realsize;
+	}
+
+	name_len = colon - line;
+	value = colon + 1;
+	value_len = len - name_len - 1;
+
+	while (value_len > 0 && (*value == ' ' || *value == '\t')) {
+		value++;
+		value_len--;
+	}
+
+	while (value_len > 0 && (value[value_len - 1] == ' ' || value[value_len - 1] == '\t')) {
+		value_len--;
+	}
+
+	name_off = (uint32_t) response->header_buf_len;
+	if (!stir_shaken_http_response_headers_append(response, line, name_len)) {
+		return 0;
+	}
+
+	value_off = (uint32_t) response->header_buf_len;
+	if (!stir_shaken_http_response_headers_append(response, value, value_len)) {
+		return 0;
+	}
+
+	stir_shaken_http_response_headers_index(response, name_off, value_off, name_len);
+
+	return realsize;
+}
+
+#if CURL_LOCK_DATA_LAST > STIR_SHAKEN_HTTP_SHARE_LOCKS
+#error "STIR_SHAKEN_HTTP_SHARE_LOCKS too small for this libcurl"
+#endif
+
+static void stir_shaken_http_share_lock(CURL *handle, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+	(void) handle;
+	(void) access;
+	(void) userptr;
+	pthread_mutex_lock(&stir_shaken_globals.http_share_mutex[data]);
+}
+
+static void stir_shaken_http_share_unlock(CURL *handle, curl_lock_data data, void *userptr)
+{
+	(void) handle;
+	(void) userptr;
+	pthread_mutex_unlock(&stir_shaken_globals.http_share_mutex[data]);
+}
+
+static stir_shaken_status_t stir_shaken_http_share_init(stir_shaken_context_t *ss)
+{
+	CURLSH *share = NULL;
+	int i = 0;
+
+	for (i = 0; i < STIR_SHAKEN_HTTP_SHARE_LOCKS; i++) {
+		if (pthread_mutex_init(&stir_shaken_globals.http_share_mutex[i], NULL) != 0) {
+			while (i-- > 0) pthread_mutex_destroy(&stir_shaken_globals.http_share_mutex[i]);
+			stir_shaken_set_error(ss, "Init HTTP share mutex failed", STIR_SHAKEN_ERROR_GENERAL);
+			return STIR_SHAKEN_STATUS_FALSE;
+		}
+	}
+
+	share = curl_share_init();
+	if (!share) {
+		for (i = 0; i < STIR_SHAKEN_HTTP_SHARE_LOCKS; i++) pthread_mutex_destroy(&stir_shaken_globals.http_share_mutex[i]);
+		stir_shaken_set_error(ss, "CURL share init failed", STIR_SHAKEN_ERROR_CURL);
+		return STIR_SHAKEN_STATUS_FALSE;
+	}
+
+	curl_share_setopt(share, CURLSHOPT_LOCKFUNC, stir_shaken_http_share_lock);
+	curl_share_setopt(share, CURLSHOPT_UNLOCKFUNC, stir_shaken_http_share_unlock);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+	// Connection cache can be shared since 7.57.0
+	curl_share_setopt(share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+
+	stir_shaken_globals.http_share = share;
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+static void stir_shaken_http_share_deinit(void)
+{
+	int i = 0;
+
+	if (!stir_shaken_globals.http_share) return;
+
+	// All easy handles using the share must be gone by now
+	curl_share_cleanup(stir_shaken_globals.http_share);
+	stir_shaken_globals.http_share = NULL;
+
+	for (i = 0; i < STIR_SHAKEN_HTTP_SHARE_LOCKS; i++) {
+		pthread_mutex_destroy(&stir_shaken_globals.http_share_mutex[i]);
+	}
+}
+
+static stir_shaken_status_t stir_shaken_http_transport_curl(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req, void *user_data)
+{
+	return stir_shaken_make_http_req_real(ss, http_req);
+}
+
+stir_shaken_status_t stir_shaken_init_http(stir_shaken_context_t *ss)
+{
+	if (stir_shaken_globals.http_initialised) {
+		return STIR_SHAKEN_STATUS_OK;
+	}
+
+	if (curl_global_init(CURL_GLOBAL_ALL) != CURLE_OK) {
+		stir_shaken_set_error(ss, "CURL global init failed", STIR_SHAKEN_ERROR_CURL);
+		return STIR_SHAKEN_STATUS_FALSE;
+	}
+
+	if (pthread_mutex_init(&stir_shaken_globals.http_pool_mutex, NULL) != 0) {
+		stir_shaken_set_error(ss, "Init HTTP pool mutex failed", STIR_SHAKEN_ERROR_GENERAL);
+		curl_global_cleanup();
+		return STIR_SHAKEN_STATUS_FALSE;
+	}
+
+	if (pthread_mutex_init(&stir_shaken_globals.http_hedge_mutex, NULL) != 0) {
+		stir_shaken_set_error(ss, "Init HTTP hedge mutex failed", STIR_SHAKEN_ERROR_GENERAL);
+		pthread_mutex_destroy(&stir_shaken_globals.http_pool_mutex);
+		curl_global_cleanup();
+		return STIR_SHAKEN_STATUS_FALSE;
+	}
+
+	if (stir_shaken_http_share_init(ss) != STIR_SHAKEN_STATUS_OK) {
+		pthread_mutex_destroy(&stir_shaken_globals.http_hedge_mutex);
+		pthread_mutex_destroy(&stir_shaken_globals.http_pool_mutex);
+		curl_global_cleanup();
+		return STIR_SHAKEN_STATUS_FALSE;
+	}
+
+	stir_shaken_globals.http_pool_n = 0;
+	stir_shaken_globals.http2 = 1;
+	stir_shaken_globals.http_connect_timeout_ms = STIR_SHAKEN_HTTP_CONNECT_TIMEOUT_MS;
+	stir_shaken_globals.http_timeout_ms = STIR_SHAKEN_HTTP_TIMEOUT_MS;
+	stir_shaken_globals.http_low_speed_limit = STIR_SHAKEN_HTTP_LOW_SPEED_LIMIT;
+	stir_shaken_globals.http_low_speed_time = STIR_SHAKEN_HTTP_LOW_SPEED_TIME;
+	stir_shaken_globals.http_max_response_size = STIR_SHAKEN_HTTP_MAX_RESPONSE_SIZE;
+	stir_shaken_globals.http_ca_file[0] = '\0';
+	stir_shaken_globals.http_hedge = 0;
+	stir_shaken_globals.http_hedge_percentile = STIR_SHAKEN_HTTP_HEDGE_PERCENTILE;
+	stir_shaken_globals.http_hedge_min_delay_ms = STIR_SHAKEN_HTTP_HEDGE_MIN_DELAY_MS;
+	stir_shaken_globals.http_hedge_budget = STIR_SHAKEN_HTTP_HEDGE_BUDGET;
+	stir_shaken_globals.http_hedge_tokens = 0;
+	stir_shaken_globals.http_latency_n = 0;
+	stir_shaken_globals.http_latency_pos = 0;
+	stir_shaken_globals.http_transport = NULL;
+	stir_shaken_globals.http_transports_n = 0;
+	stir_shaken_globals.http_initialised = 1;
+
+	stir_shaken_http_transport_register(ss, "curl", stir_shaken_http_transport_curl, NULL, NULL);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+void stir_shaken_deinit_http(void)
+{
+	if (!stir_shaken_globals.http_initialised) {
+		return;
+	}
+
+	pthread_mutex_lock(&stir_shaken_globals.http_pool_mutex);
+	while (stir_shaken_globals.http_pool_n > 0) {
+		curl_easy_cleanup(stir_shaken_globals.http_pool[--stir_shaken_globals.http_pool_n]);
+		stir_shaken_globals.http_pool[stir_shaken_globals.http_pool_n] = NULL;
+	}
+	stir_shaken_globals.http_initialised = 0;
+	pthread_mutex_unlock(&stir_shaken_globals.http_pool_mutex);
+	pthread_mutex_destroy(&stir_shaken_globals.http_pool_mutex);
+	pthread_mutex_destroy(&stir_shaken_globals.http_hedge_mutex);
+
+	stir_shaken_http_share_deinit();
+
+	stir_shaken_make_http_req = stir_shaken_make_http_req_real;
+	stir_shaken_globals.http_transport = NULL;
+	while (stir_shaken_globals.http_transports_n > 0) {
+
+		stir_shaken_http_transport_t *t = &stir_shaken_globals.http_transports[--stir_shaken_globals.http_transports_n];
+
+		if (t->destroy) {
+			t->destroy(t->user_data);
+		}
+		memset(t, 0, sizeof(*t));
+	}
+
+	curl_global_cleanup();
+}
+
+void stir_shaken_http_set_http2(uint8_t enable)
+{
+	stir_shaken_globals.http2 = enable;
+}
+
+void stir_shaken_http_set_hedging(uint8_t enable, int percentile, long min_delay_ms, double budget)
+{
+	pthread_mutex_lock(&stir_shaken_globals.http_hedge_mutex);
+
+	stir_shaken_globals.http_hedge = enable;
+	if (percentile > 0 && percentile < 100) stir_shaken_globals.http_hedge_percentile = percentile;
+	if (min_delay_ms >= 0) stir_shaken_globals.http_hedge_min_delay_ms = min_delay_ms;
+	if (budget >= 0) stir_shaken_globals.http_hedge_budget = budget > 1 ? 1 : budget;
+	stir_shaken_globals.http_hedge_tokens = 0;
+
+	pthread_mutex_unlock(&stir_shaken_globals.http_hedge_mutex);
+}
+
+void stir_shaken_http_set_max_response_size(size_t max)
+{
+	stir_shaken_globals.http_max_response_size = max;
+}
+
+void stir_shaken_http_set_ca_file(const char *ca_file)
+{
+	snprintf(stir_shaken_globals.http_ca_file, sizeof(stir_shaken_globals.http_ca_file), "%s", ca_file ? ca_file : "");
+}
+
+void stir_shaken_http_set_timeouts(long connect_timeout_ms, long timeout_ms, long low_speed_limit, long low_speed_time)
+{
+	if (connect_timeout_ms >= 0) stir_shaken_globals.http_connect_timeout_ms = connect_timeout_ms;
+	if (timeout_ms >= 0) stir_shaken_globals.http_timeout_ms = timeout_ms;
+	if (low_speed_limit >= 0) stir_shaken_globals.http_low_speed_limit = low_speed_limit;
+	if (low_speed_time >= 0) stir_shaken_globals.http_low_speed_time = low_speed_time;
+}
+
+/*
+ * Get idle handle from the pool, or create new one if pool is empty.
+ * Handle keeps its connection cache, so request to the same host reuses the connection (keep-alive).
+ */
+static CURL* stir_shaken_http_handle_acquire(void)
+{
+	CURL *curl_handle = NULL;
+
+	if (stir_shaken_globals.http_initialised) {
+
+		pthread_mutex_lock(&stir_shaken_globals.http_pool_mutex);
+		if (stir_shaken_globals.http_pool_n > 0) {
+			curl_handle = stir_shaken_globals.http_pool[--stir_shaken_globals.http_pool_n];
+			stir_shaken_globals.http_pool[stir_shaken_globals.http_pool_n] = NULL;
+		}
+		pthread_mutex_unlock(&stir_shaken_globals.http_pool_mutex);
+	}
+
+	if (!curl_handle) {
+		curl_handle = curl_easy_init();
+	}
+
+	return curl_handle;
+}
+
+/*
+ * Return handle to the pool. Options are reset, but live connections, DNS and TLS session caches are kept.
+ * Handle is destroyed if pool is full.
+ */
+static void stir_shaken_http_handle_release(CURL *curl_handle)
+{
+	if (!curl_handle) return;
+
+	curl_easy_reset(curl_handle);
+
+	if (stir_shaken_globals.http_initialised) {
+
+		pthread_mutex_lock(&stir_shaken_globals.http_pool_mutex);
+		if (stir_shaken_globals.http_pool_n < STIR_SHAKEN_HTTP_POOL_SIZE) {
+			stir_shaken_globals.http_pool[stir_shaken_globals.http_pool_n++] = curl_handle;
+			curl_handle = NULL;
+		}
+		pthread_mutex_unlock(&stir_shaken_globals.http_pool_mutex);
+	}
+
+	if (curl_handle) {
+		curl_easy_cleanup(curl_handle);
+	}
+}
+
+// Reset response (body buffer, headers) before request, done by every transport
+static void stir_shaken_http_response_prepare(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req)
+{
+	if (http_req->response.mem.mem && http_req->reuse_buffer && http_req->response.mem.capacity) {
+
+		// Keep the buffer for this response
+		http_req->response.mem.size = 0;
+		http_req->response.mem.mem[0] = '\0';
+
+	} else if (http_req->response.mem.mem) {
+
+		free(http_req->response.mem.mem);
+		http_req->response.mem.mem = NULL;
+		http_req->response.mem.size = 0;
+		http_req->response.mem.capacity = 0;
+	}
+
+	http_req->response.mem.ss = ss;
+	stir_shaken_http_response_headers_reset(&http_req->response);
+	http_req->response.num_connects = 0;
+	http_req->response.http_version = 0;
+	http_req->response.mem.max = http_req->max_response_size ? http_req->max_response_size : stir_shaken_globals.http_max_response_size;
+}
+
+/*
+ * Set options on @curl_handle for @http_req. Used for both single (easy) and batch (multi) requests.
+ */
+static stir_shaken_status_t stir_shaken_http_setup_handle(stir_shaken_context_t *ss, CURL *curl_handle, stir_shaken_http_req_t *http_req)
+{
+	char			user_agent[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
+	long			connect_timeout_ms = http_req->connect_timeout_ms > 0 ? http_req->connect_timeout_ms : stir_shaken_globals.http_connect_timeout_ms;
+	long			timeout_ms = http_req->timeout_ms > 0 ? http_req->timeout_ms : stir_shaken_globals.http_timeout_ms;
+
+	if (http_req->deadline_ms) {
+
+		uint64_t now = stir_shaken_now_ms();
+		long left = 0;
+
+		if (now >= http_req->deadline_ms) {
+			http_req->response.code = CURLE_OPERATION_TIMEDOUT;
+			stir_shaken_set_error(ss, "HTTP request deadline expired", STIR_SHAKEN_ERROR_HTTP_TIMEOUT);
+			return STIR_SHAKEN_STATUS_FALSE;
+		}
+
+		left = (long) (http_req->deadline_ms - now);
+		if (timeout_ms <= 0 || timeout_ms > left) timeout_ms = left;
+		if (connect_timeout_ms <= 0 || connect_timeout_ms > left) connect_timeout_ms = left;
+	}
+
+	curl_easy_setopt(curl_handle, CURLOPT_URL, http_req->url);
+	curl_easy_setopt(curl_handle, CURLOPT_CONNECTTIMEOUT_MS, connect_timeout_ms > 0 ? connect_timeout_ms : 0L);
+	curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT_MS, timeout_ms > 0 ? timeout_ms : 0L);
+	curl_easy_setopt(curl_handle, CURLOPT_LOW_SPEED_LIMIT, stir_shaken_globals.http_low_speed_limit);
+	curl_easy_setopt(curl_handle, CURLOPT_LOW_SPEED_TIME, stir_shaken_globals.http_low_speed_time);
+	curl_easy_setopt(curl_handle, CURLOPT_TCP_KEEPALIVE, 1L);
+	curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1L);
+
+	if (stir_shaken_globals.http_share) {
+		curl_easy_setopt(curl_handle, CURLOPT_SHARE, stir_shaken_globals.http_share);
+	}
+
+#if LIBCURL_VERSION_NUM >= 0x072f00
+	if (stir_shaken_globals.http2) {
+
+		// Negotiate HTTP/2 over TLS (ALPN), stay with HTTP/1.1 for plain http.
+		// Transfers to the same origin wait for the connection to be known as HTTP/2 capable and then multiplex over it,
+		// rather than opening new connections in parallel.
+		curl_easy_setopt(curl_handle, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+		curl_easy_setopt(curl_handle, CURLOPT_PIPEWAIT, 1L);
+	}
+#endif
+
+	if (stir_shaken_globals.http_ca_file[0]) {
+		curl_easy_setopt(curl_handle, CURLOPT_CAINFO, stir_shaken_globals.http_ca_file);
+	}
+
+#if STIR_SHAKEN_HTTPS_SKIP_PEER_VERIFICATION
+	/*
+	 * If you want to connect to a site who isn't using a certificate that is
+	 * signed by one of the certs in the CA bundle you have, you can skip the
+	 * verification of the server's certificate. This makes the connection
+	 * A LOT LESS SECURE.
+	 *
+	 * If you have a CA cert for the server stored someplace else than in the
+	 * default bundle, then the CURLOPT_CAPATH option might come handy for
+	 * you.
+	 */ 
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+#endif
+
+#if STIR_SHAKEN_HTTPS_SKIP_HOSTNAME_VERIFICATION
+	/*
+	 * If the site you're connecting to uses a different host name that what
+	 * they have mentioned in their server certificate's commonName (or
+	 * subjectAltName) fields, libcurl will refuse to connect. You can skip
+	 * this check, but this will make the connection less secure.
+	 */ 
+	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+#endif
+
+	// Shared stuff
+	curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, stir_shaken_curl_write_callback);
+	curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *) http_req);
+	curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, stir_shaken_curl_header_callback);
+	curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, (void *) http_req);
+
+	stir_shaken_http_response_prepare(ss, http_req);
+
+	if (http_req->response.mem.max) {
+
+		// Abort early if server announces too big Content-Length
+		curl_easy_setopt(curl_handle, CURLOPT_MAXFILESIZE_LARGE, (curl_off_t) http_req->response.mem.max);
+	}
+
+	if (http_req->remote_port) {
+		curl_easy_setopt(curl_handle, CURLOPT_PORT, http_req->remote_port);
+	} else {
+		// Port from URL, or scheme's default (x5u URLs carry no separate port)
+		stir_shaken_log(STIR_SHAKEN_LOGLEVEL_HIGH, STIR_SHAKEN_LOG_HTTP, "STIR-Shaken: remote port not set, using port from URL\n");
+	}
+
+	// Some pple say, some servers don't like requests that are made without a user-agent field, so we provide one.
+	snprintf(user_agent, STIR_SHAKEN_ERROR_BUF_LEN, "freeswitch-stir-shaken/%s", STIR_SHAKEN_VERSION);
+	curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, user_agent);
+
+	switch (http_req->type) {
+
+		case STIR_SHAKEN_HTTP_REQ_TYPE_GET:	
+
+			curl_easy_setopt(curl_handle, CURLOPT_HTTPGET, 1);
+			break;
+
+		case STIR_SHAKEN_HTTP_REQ_TYPE_POST:
+
+			if (http_req->data) {
+				curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDSIZE, strlen(http_req->data));
+				curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDS, (void *) http_req->data);
+			}
+
+			// Curl will send form urlencoded by default, so for json the Content-Type header must be explicitly set
+			switch (http_req->content_type) {
+
+				case STIR_SHAKEN_HTTP_REQ_CONTENT_TYPE_JSON:
+
+					http_req->tx_headers = curl_slist_append(http_req->tx_headers, "Content-Type: application/json");
+					break;
+
+				case STIR_SHAKEN_HTTP_REQ_CONTENT_TYPE_URLENCODED:
+				default:
+					break;
+			}
 
-	m = realloc(mem->mem, mem->size + realsize + 1);
-	if(!m) {
-		stir_shaken_set_error(mem->ss, "realloc returned NULL", STIR_SHAKEN_ERROR_GENERAL);
-		return 0;
+			break;
+
+		case STIR_SHAKEN_HTTP_REQ_TYPE_PUT:
+			break;
+
+		case STIR_SHAKEN_HTTP_REQ_TYPE_HEAD:	
+
+			// TODO check if this is necessary to make HEAD req
+			//curl_easy_setopt(curl_handle, CURLOPT_CUSTOMREQUEST, "HEAD");
+
+			// Get the resource without a body
+			curl_easy_setopt(curl_handle, CURLOPT_NOBODY, 1L);
+
+			break;
+
+		default:
+			stir_shaken_set_error(ss, "Unknown HTTP type Request", STIR_SHAKEN_ERROR_HTTP_GENERAL);
+			return STIR_SHAKEN_STATUS_FALSE;
 	}
 
-	mem->mem = m;
-	memcpy(&(mem->mem[mem->size]), contents, realsize);
-	mem->size += realsize;
-	mem->mem[mem->size] = 0;
+	if (http_req->tx_headers) {
+		curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, http_req->tx_headers);
+	}
 
-	return realsize;
+	// TODO remove
+	if (http_req->data) {
+		stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_HTTP, "STIR-Shaken: making HTTP (%s) call:\nurl:\t%s\nport:\t%u\ndata:\t%s\n", http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_GET ? "GET" : (http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_POST ? "POST" : (http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_PUT ? "PUT" : (http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_HEAD ? "HEAD" : "BAD REQUEST"))), http_req->url, http_req->remote_port, http_req->data);
+	} else {
+		stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_HTTP, "STIR-Shaken: making HTTP (%s) call:\nurl:\t%s\nport:\t%u\n", http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_GET ? "GET" : http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_POST ? "POST" : http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_PUT ? "PUT" : http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_HEAD ? "HEAD" : "BAD REQUEST", http_req->url, http_req->remote_port);
+	}
+
+	return STIR_SHAKEN_STATUS_OK;
 }
 
-static size_t stir_shaken_curl_header_callback(void *ptr, size_t size, size_t nmemb, void *data)
+/*
+ * Process result of transfer made with @curl_handle for @http_req.
+ */
+static stir_shaken_status_t stir_shaken_http_process_result(stir_shaken_context_t *ss, CURL *curl_handle, stir_shaken_http_req_t *http_req, CURLcode res)
 {
-	register unsigned int realsize = (unsigned int) (size * nmemb);
-	stir_shaken_http_req_t *http_req = data;
-	char *header = NULL;
+	char			err_buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
 
-	header = malloc(realsize + 1);
-	if (!header) {
-		fprintif(STIR_SHAKEN_LOGLEVEL_HIGH, "STIR-Shaken: CURL: Received empty header... skipping\n");
-		return 0;
+	http_req->response.code = res;
+
+	if (res != CURLE_OK) {
+
+		sprintf(err_buf, "Error in CURL: %s", curl_easy_strerror(res));
+		stir_shaken_set_error(ss, err_buf, res == CURLE_OPERATION_TIMEDOUT ? STIR_SHAKEN_ERROR_HTTP_TIMEOUT : STIR_SHAKEN_ERROR_CURL); 
+
+		return STIR_SHAKEN_STATUS_FALSE;
 	}
-	memcpy(header, ptr, realsize);
-	header[realsize] = '\0';
 
-	http_req->response.headers = curl_slist_append(http_req->response.headers, header);
-	free(header);
+	curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &http_req->response.code);
+	curl_easy_getinfo(curl_handle, CURLINFO_NUM_CONNECTS, &http_req->response.num_connects);
+#if LIBCURL_VERSION_NUM >= 0x073200
+	curl_easy_getinfo(curl_handle, CURLINFO_HTTP_VERSION, &http_req->response.http_version);
+#endif
+	if (http_req->response.code != 200 && http_req->response.code != 201) {
+		sprintf(http_req->response.error, "HTTP response code: %ld (%s%s), HTTP response phrase: %s", http_req->response.code, curl_easy_strerror(http_req->response.code), (http_req->response.code == 400 || http_req->response.code == 404) ? " [Bad URL or API call not handled?]" : "", http_req->response.header_buf_len ? http_req->response.header_buf : "");
+	}
+	// fprintf(stdout, "\n//////////////// HTTP GOT:\n%s\n///////////////////////\n", http_req->response.mem.mem);	
 
-	return realsize;
+	// On success, http_req->response.code is HTTP response code (200, 403, 404, etc...)
+	return STIR_SHAKEN_STATUS_OK;
 }
 
+
 /*
  * Make HTTP request with CURL.
  *
@@ -115,149 +730,614 @@ stir_shaken_status_t stir_shaken_make_http_req_real(stir_shaken_context_t *ss, s
 {
 	CURLcode		res = 0;
 	CURL			*curl_handle = NULL;
-	char			err_buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
-	char			user_agent[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
+	stir_shaken_status_t	status = STIR_SHAKEN_STATUS_FALSE;
 
 	if (!http_req || !http_req->url) return STIR_SHAKEN_STATUS_RESTART;
 
 	if (ss) stir_shaken_clear_error(ss);
 
-	curl_global_init(CURL_GLOBAL_ALL);
-	curl_handle = curl_easy_init();
+	curl_handle = stir_shaken_http_handle_acquire();
 	if (!curl_handle) return STIR_SHAKEN_STATUS_TERM;
 
-	curl_easy_setopt(curl_handle, CURLOPT_URL, http_req->url);
+	status = stir_shaken_http_setup_handle(ss, curl_handle, http_req);
+	if (status != STIR_SHAKEN_STATUS_OK) {
+		stir_shaken_http_handle_release(curl_handle);
+		return status;
+	}
 
-#if STIR_SHAKEN_HTTPS_SKIP_PEER_VERIFICATION
-	/*
-	 * If you want to connect to a site who isn't using a certificate that is
-	 * signed by one of the certs in the CA bundle you have, you can skip the
-	 * verification of the server's certificate. This makes the connection
-	 * A LOT LESS SECURE.
-	 *
-	 * If you have a CA cert for the server stored someplace else than in the
-	 * default bundle, then the CURLOPT_CAPATH option might come handy for
-	 * you.
-	 */ 
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-#endif
+	res = curl_easy_perform(curl_handle);
 
-#if STIR_SHAKEN_HTTPS_SKIP_HOSTNAME_VERIFICATION
-	/*
-	 * If the site you're connecting to uses a different host name that what
-	 * they have mentioned in their server certificate's commonName (or
-	 * subjectAltName) fields, libcurl will refuse to connect. You can skip
-	 * this check, but this will make the connection less secure.
-	 */ 
-	curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+	status = stir_shaken_http_process_result(ss, curl_handle, http_req, res);
+	stir_shaken_http_handle_release(curl_handle);
+
+	return status;
+}
+
+/*
+ * Make @n HTTP requests concurrently (CURL multi).
+ *
+ * With HTTP/2 enabled (default) requests to the same origin are multiplexed over a single connection.
+ * Each request gets its result just like with stir_shaken_make_http_req_real (http_req->response.code etc.).
+ *
+ * Returns STIR_SHAKEN_STATUS_OK if all transfers completed, STIR_SHAKEN_STATUS_FALSE if any of them failed
+ * (error from the first failed transfer is set in @ss).
+ */
+stir_shaken_status_t stir_shaken_make_http_reqs(stir_shaken_context_t *ss, stir_shaken_http_req_t **http_reqs, int n)
+{
+	CURLM			*multi = NULL;
+	CURL			**handles = NULL;
+	CURLMsg			*msg = NULL;
+	int				i = 0, running = 0, msgs_left = 0;
+	stir_shaken_status_t	status = STIR_SHAKEN_STATUS_OK;
+
+	if (!http_reqs || n <= 0) return STIR_SHAKEN_STATUS_RESTART;
+
+	if (ss) stir_shaken_clear_error(ss);
+
+	for (i = 0; i < n; i++) {
+		if (!http_reqs[i] || !http_reqs[i]->url) return STIR_SHAKEN_STATUS_RESTART;
+	}
+
+	if (stir_shaken_make_http_req != stir_shaken_make_http_req_real) {
+
+		// Other transport (or mock), one by one
+		for (i = 0; i < n; i++) {
+			if (stir_shaken_make_http_req(status == STIR_SHAKEN_STATUS_OK ? ss : NULL, http_reqs[i]) != STIR_SHAKEN_STATUS_OK) {
+				status = STIR_SHAKEN_STATUS_FALSE;
+			}
+		}
+
+		return status;
+	}
+
+	handles = calloc(n, sizeof(CURL *));
+	if (!handles) {
+		stir_shaken_set_error(ss, "Out of memory", STIR_SHAKEN_ERROR_GENERAL);
+		return STIR_SHAKEN_STATUS_TERM;
+	}
+
+	multi = curl_multi_init();
+	if (!multi) {
+		free(handles);
+		stir_shaken_set_error(ss, "CURL multi init failed", STIR_SHAKEN_ERROR_CURL);
+		return STIR_SHAKEN_STATUS_TERM;
+	}
+
+#if LIBCURL_VERSION_NUM >= 0x072b00
+	if (stir_shaken_globals.http2) {
+		curl_multi_setopt(multi, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+	}
 #endif
 
-	// Shared stuff
-	curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, stir_shaken_curl_write_callback);
-	curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, (void *) http_req);
-	curl_easy_setopt(curl_handle, CURLOPT_HEADERFUNCTION, stir_shaken_curl_header_callback);
-	curl_easy_setopt(curl_handle, CURLOPT_HEADERDATA, (void *) http_req);
+	for (i = 0; i < n; i++) {
+
+		handles[i] = stir_shaken_http_handle_acquire();
+		if (!handles[i]) {
+			stir_shaken_set_error(ss, "Cannot get CURL handle", STIR_SHAKEN_ERROR_CURL);
+			status = STIR_SHAKEN_STATUS_TERM;
+			goto done;
+		}
+
+		if (stir_shaken_http_setup_handle(ss, handles[i], http_reqs[i]) != STIR_SHAKEN_STATUS_OK) {
+			status = STIR_SHAKEN_STATUS_FALSE;
+			goto done;
+		}
+
+		curl_easy_setopt(handles[i], CURLOPT_PRIVATE, (void *) http_reqs[i]);
+		curl_multi_add_handle(multi, handles[i]);
+	}
+
+	do {
+		CURLMcode mc = curl_multi_perform(multi, &running);
+
+		if (mc == CURLM_OK && running) {
+			mc = curl_multi_wait(multi, NULL, 0, 1000, NULL);
+		}
+
+		if (mc != CURLM_OK) {
+			stir_shaken_set_error(ss, curl_multi_strerror(mc), STIR_SHAKEN_ERROR_CURL);
+			status = STIR_SHAKEN_STATUS_FALSE;
+			goto done;
+		}
+
+		while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+
+			stir_shaken_http_req_t *http_req = NULL;
+
+			if (msg->msg != CURLMSG_DONE) continue;
+
+			curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, (char **) &http_req);
+			if (!http_req) continue;
+
+			if (stir_shaken_http_process_result(status == STIR_SHAKEN_STATUS_OK ? ss : NULL, msg->easy_handle, http_req, msg->data.result) != STIR_SHAKEN_STATUS_OK) {
+				status = STIR_SHAKEN_STATUS_FALSE;
+			}
+		}
+
+	} while (running);
+
+done:
+	for (i = 0; i < n; i++) {
+		if (handles[i]) {
+			curl_multi_remove_handle(multi, handles[i]);
+			stir_shaken_http_handle_release(handles[i]);
+		}
+	}
+	curl_multi_cleanup(multi);
+	free(handles);
+
+	return status;
+}
+
+/*
+ * HTTP transports.
+ *
+ * Requests made with stir_shaken_make_http_req go to the transport selected with stir_shaken_http_transport_use
+ * (curl by default). Other transports fill http_req->response the same way curl does (code, body, headers),
+ * so the rest of the library (x5u download, ACME) works unchanged on top of them.
+ */
+
+static stir_shaken_status_t stir_shaken_http_transport_make_req(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req)
+{
+	stir_shaken_http_transport_t *t = stir_shaken_globals.http_transport;
+
+	if (!http_req || !http_req->url) return STIR_SHAKEN_STATUS_RESTART;
+
+	if (!t) {
+		return stir_shaken_make_http_req_real(ss, http_req);
+	}
+
+	if (ss) stir_shaken_clear_error(ss);
+
+	return t->make_req(ss, http_req, t->user_data);
+}
+
+static stir_shaken_http_transport_t* stir_shaken_http_transport_find(const char *name)
+{
+	int i = 0;
+
+	for (i = 0; i < stir_shaken_globals.http_transports_n; i++) {
+		if (!strcmp(stir_shaken_globals.http_transports[i].name, name)) {
+			return &stir_shaken_globals.http_transports[i];
+		}
+	}
+
+	return NULL;
+}
+
+stir_shaken_status_t stir_shaken_http_transport_register(stir_shaken_context_t *ss, const char *name, stir_shaken_http_transport_make_req_t make_req, void (*destroy)(void *user_data), void *user_data)
+{
+	stir_shaken_http_transport_t *t = NULL;
+
+	if (stir_shaken_zstr(name) || !make_req || strlen(name) >= sizeof(t->name)) {
+		stir_shaken_set_error(ss, "Bad params", STIR_SHAKEN_ERROR_HTTP_PARAMS);
+		return STIR_SHAKEN_STATUS_TERM;
+	}
+
+	if (stir_shaken_http_transport_find(name)) {
+		stir_shaken_set_error(ss, "HTTP transport with this name already registered", STIR_SHAKEN_ERROR_HTTP_PARAMS);
+		return STIR_SHAKEN_STATUS_FALSE;
+	}
+
+	if (stir_shaken_globals.http_transports_n >= STIR_SHAKEN_HTTP_TRANSPORTS_MAX) {
+		stir_shaken_set_error(ss, "Too many HTTP transports", STIR_SHAKEN_ERROR_HTTP_PARAMS);
+		return STIR_SHAKEN_STATUS_FALSE;
+	}
+
+	t = &stir_shaken_globals.http_transports[stir_shaken_globals.http_transports_n++];
+	strcpy(t->name, name);
+	t->make_req = make_req;
+	t->destroy = destroy;
+	t->user_data = user_data;
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_http_transport_use(stir_shaken_context_t *ss, const char *name)
+{
+	stir_shaken_http_transport_t *t = NULL;
+
+	if (stir_shaken_zstr(name) || !(t = stir_shaken_http_transport_find(name))) {
+		stir_shaken_set_error(ss, "No such HTTP transport", STIR_SHAKEN_ERROR_HTTP_PARAMS);
+		return STIR_SHAKEN_STATUS_FALSE;
+	}
+
+	if (t->make_req == stir_shaken_http_transport_curl) {
+
+		stir_shaken_globals.http_transport = NULL;
+		stir_shaken_make_http_req = stir_shaken_make_http_req_real;
+
+	} else {
+
+		stir_shaken_globals.http_transport = t;
+		stir_shaken_make_http_req = stir_shaken_http_transport_make_req;
+	}
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+/*
+ * Complete @http_req with response @code and @body, as if it was received from network.
+ * To be used by transports (@http_req->response must not be used by them before this is called).
+ */
+stir_shaken_status_t stir_shaken_http_transport_respond(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req, long code, const char *body, size_t len)
+{
+	char line[STIR_SHAKEN_BUFLEN] = { 0 };
+
+	stir_shaken_http_response_prepare(ss, http_req);
+
+	snprintf(line, sizeof(line), "HTTP/1.1 %ld\r\n", code);
+	stir_shaken_curl_header_callback(line, 1, strlen(line), http_req);
+	snprintf(line, sizeof(line), "Content-Length: %zu\r\n", len);
+	stir_shaken_curl_header_callback(line, 1, strlen(line), http_req);
+
+	if (body && len && http_req->type != STIR_SHAKEN_HTTP_REQ_TYPE_HEAD) {
+
+		if (stir_shaken_curl_write_callback((void *) body, 1, len, http_req) != len) {
+			http_req->response.code = CURLE_WRITE_ERROR;
+			stir_shaken_set_error_if_clear(ss, "Cannot store HTTP response", STIR_SHAKEN_ERROR_HTTP_GENERAL);
+			return STIR_SHAKEN_STATUS_FALSE;
+		}
+	}
+
+	http_req->response.code = code;
+	if (code != 200 && code != 201) {
+		snprintf(http_req->response.error, sizeof(http_req->response.error), "HTTP response code: %ld", code);
+	}
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+/*
+ * Fail @http_req with transport error @res (as if curl failed with it).
+ */
+stir_shaken_status_t stir_shaken_http_transport_fail(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req, long res)
+{
+	char err_buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
+
+	stir_shaken_http_response_prepare(ss, http_req);
+	http_req->response.code = res;
+
+	snprintf(err_buf, sizeof(err_buf), "Error in CURL: %s", curl_easy_strerror(res));
+	stir_shaken_set_error(ss, err_buf, res == CURLE_OPERATION_TIMEDOUT ? STIR_SHAKEN_ERROR_HTTP_TIMEOUT : STIR_SHAKEN_ERROR_CURL);
+
+	return STIR_SHAKEN_STATUS_FALSE;
+}
+
+// Time left for @http_req in ms (request timeout and deadline), -1 if no limit
+static long stir_shaken_http_req_time_left(stir_shaken_http_req_t *http_req)
+{
+	long left = http_req->timeout_ms > 0 ? http_req->timeout_ms : stir_shaken_globals.http_timeout_ms;
+	uint64_t now = 0;
+
+	if (left <= 0) left = -1;
+
+	if (http_req->deadline_ms) {
+
+		now = stir_shaken_now_ms();
+		if (now >= http_req->deadline_ms) return 0;
+		if (left < 0 || (uint64_t) left > http_req->deadline_ms - now) left = (long) (http_req->deadline_ms - now);
+	}
+
+	return left;
+}
+
+// Directory transport: http(s)://host[:port]/path is served from root/host/path, file:// URLs from their path
+
+typedef struct stir_shaken_http_transport_dir_s {
+	char	root[STIR_SHAKEN_BUFLEN];
+} stir_shaken_http_transport_dir_t;
+
+// Any ".." path segment, including a trailing "/.."
+static int stir_shaken_http_transport_dir_has_dotdot(const char *name)
+{
+	const char *p = name, *end = NULL;
+
+	while (*p) {
+
+		end = strchr(p, '/');
+		if (!end) end = p + strlen(p);
+		if (end - p == 2 && p[0] == '.' && p[1] == '.') return 1;
+		p = *end ? end + 1 : end;
+	}
+
+	return 0;
+}
+
+static stir_shaken_status_t stir_shaken_http_transport_dir_make_req(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req, void *user_data)
+{
+	stir_shaken_http_transport_dir_t *dir = user_data;
+	char name[STIR_SHAKEN_BUFLEN] = { 0 };
+	const char *p = NULL, *host = NULL, *path = NULL;
+	char *body = NULL;
+	FILE *f = NULL;
+	struct stat st = { 0 };
+	int fd = -1;
+	long len = 0;
+	size_t max = 0;
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+
+	if (http_req->type != STIR_SHAKEN_HTTP_REQ_TYPE_GET && http_req->type != STIR_SHAKEN_HTTP_REQ_TYPE_HEAD) {
+		return stir_shaken_http_transport_respond(ss, http_req, 405, NULL, 0);
+	}
+
+	if (!(p = strstr(http_req->url, "://"))) {
+		return stir_shaken_http_transport_fail(ss, http_req, CURLE_URL_MALFORMAT);
+	}
+
+	if (!strncmp(http_req->url, "file://", 7)) {
+
+		snprintf(name, sizeof(name), "%s", p + 3);
+
+	} else {
+
+		host = p + 3;
+		path = strchr(host, '/');
+		if (!path) path = "/";
+		p = memchr(host, ':', path - host);
+		snprintf(name, sizeof(name), "%s/%.*s%s", dir->root, (int) ((p ? p : path) - host), host, path);
+	}
+
+	if ((p = strpbrk(name, "?#"))) {
+		name[p - name] = '\0';
+	}
+
+	if (stir_shaken_http_transport_dir_has_dotdot(name)) {
+		return stir_shaken_http_transport_respond(ss, http_req, 403, NULL, 0);
+	}
+
+	// Nonblocking open so a FIFO cannot stall the request, then serve regular files only
+	fd = open(name, O_RDONLY | O_NONBLOCK);
+	if (fd < 0) {
+		return stir_shaken_http_transport_respond(ss, http_req, 404, NULL, 0);
+	}
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return stir_shaken_http_transport_respond(ss, http_req, 403, NULL, 0);
+	}
+
+	f = fdopen(fd, "rb");
+	if (!f) {
+		close(fd);
+		return stir_shaken_http_transport_fail(ss, http_req, CURLE_READ_ERROR);
+	}
+
+	if (fseek(f, 0, SEEK_END) != 0 || (len = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+		fclose(f);
+		return stir_shaken_http_transport_fail(ss, http_req, CURLE_READ_ERROR);
+	}
+
+	max = http_req->max_response_size ? http_req->max_response_size : stir_shaken_globals.http_max_response_size;
+	if (max && (size_t) len > max) {
+		fclose(f);
+		return stir_shaken_http_transport_fail(ss, http_req, CURLE_FILESIZE_EXCEEDED);
+	}
+
+	body = malloc(len + 1);
+	if (!body || (len && fread(body, 1, len, f) != (size_t) len)) {
+		free(body);
+		fclose(f);
+		return stir_shaken_http_transport_fail(ss, http_req, CURLE_READ_ERROR);
+	}
+	fclose(f);
+
+	status = stir_shaken_http_transport_respond(ss, http_req, 200, body, len);
+	free(body);
 
-	if (http_req->response.mem.mem) {
-		free(http_req->response.mem.mem);
-		http_req->response.mem.mem = NULL;
-		http_req->response.mem.size = 0;
+	return status;
+}
+
+stir_shaken_status_t stir_shaken_http_transport_register_dir(stir_shaken_context_t *ss, const char *name, const char *root)
+{
+	stir_shaken_http_transport_dir_t *dir = NULL;
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+
+	if (stir_shaken_zstr(root) || strlen(root) >= sizeof(dir->root)) {
+		stir_shaken_set_error(ss, "Bad params", STIR_SHAKEN_ERROR_HTTP_PARAMS);
+		return STIR_SHAKEN_STATUS_TERM;
 	}
 
-	if (http_req->remote_port == 0) {
-		http_req->remote_port = STIR_SHAKEN_HTTP_DEFAULT_REMOTE_PORT;
-		fprintif(STIR_SHAKEN_LOGLEVEL_HIGH, "STIR-Shaken: changing remote port to DEFAULT %u cause port not set\n", http_req->remote_port);
+	dir = calloc(1, sizeof(*dir));
+	if (!dir) {
+		stir_shaken_set_error(ss, "Out of memory", STIR_SHAKEN_ERROR_GENERAL);
+		return STIR_SHAKEN_STATUS_TERM;
 	}
+	strcpy(dir->root, root);
 
-	curl_easy_setopt(curl_handle, CURLOPT_PORT, http_req->remote_port);
+	status = stir_shaken_http_transport_register(ss, name, stir_shaken_http_transport_dir_make_req, free, dir);
+	if (status != STIR_SHAKEN_STATUS_OK) {
+		free(dir);
+	}
 
-	// Some pple say, some servers don't like requests that are made without a user-agent field, so we provide one.
-	snprintf(user_agent, STIR_SHAKEN_ERROR_BUF_LEN, "freeswitch-stir-shaken/%s", STIR_SHAKEN_VERSION);
-	curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, user_agent);
+	return status;
+}
 
-	switch (http_req->type) {
+// In-memory transport: URL -> response map, with injected latency and errors
 
-		case STIR_SHAKEN_HTTP_REQ_TYPE_GET:	
+#define STIR_SHAKEN_HTTP_TRANSPORT_MEMORY_BUCKETS 256
 
-			curl_easy_setopt(curl_handle, CURLOPT_HTTPGET, 1);
-			break;
+typedef struct stir_shaken_http_transport_memory_entry_s {
+	char	*url;
+	long	code;
+	char	*body;
+	size_t	len;
+	struct stir_shaken_http_transport_memory_entry_s *next;
+} stir_shaken_http_transport_memory_entry_t;
 
-		case STIR_SHAKEN_HTTP_REQ_TYPE_POST:
+typedef struct stir_shaken_http_transport_memory_s {
+	pthread_mutex_t	mutex;
+	stir_shaken_http_transport_memory_entry_t *buckets[STIR_SHAKEN_HTTP_TRANSPORT_MEMORY_BUCKETS];
+	uint32_t		latency_ms;
+	uint32_t		jitter_ms;
+	double			error_rate;
+	unsigned int	seed;
+} stir_shaken_http_transport_memory_t;
 
-			if (http_req->data) {
-				curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDSIZE, strlen(http_req->data));
-				curl_easy_setopt(curl_handle, CURLOPT_POSTFIELDS, (void *) http_req->data);
-			}
+static unsigned long stir_shaken_http_transport_memory_hash(const char *url)
+{
+	unsigned long h = 5381;
 
-			// Curl will send form urlencoded by default, so for json the Content-Type header must be explicitly set
-			switch (http_req->content_type) {
+	while (*url) {
+		h = h * 33 + (unsigned char) *url++;
+	}
 
-				case STIR_SHAKEN_HTTP_REQ_CONTENT_TYPE_JSON:
+	return h % STIR_SHAKEN_HTTP_TRANSPORT_MEMORY_BUCKETS;
+}
 
-					http_req->tx_headers = curl_slist_append(http_req->tx_headers, "Content-Type: application/json");
-					break;
+static stir_shaken_http_transport_memory_entry_t** stir_shaken_http_transport_memory_find(stir_shaken_http_transport_memory_t *m, const char *url)
+{
+	stir_shaken_http_transport_memory_entry_t **pe = &m->buckets[stir_shaken_http_transport_memory_hash(url)];
 
-				case STIR_SHAKEN_HTTP_REQ_CONTENT_TYPE_URLENCODED:
-				default:
-					break;
-			}
+	while (*pe && strcmp((*pe)->url, url)) {
+		pe = &(*pe)->next;
+	}
 
-			break;
+	return pe;
+}
 
-		case STIR_SHAKEN_HTTP_REQ_TYPE_PUT:
-			break;
+static void stir_shaken_http_transport_memory_destroy(void *user_data)
+{
+	stir_shaken_http_transport_memory_t *m = user_data;
+	stir_shaken_http_transport_memory_entry_t *e = NULL;
+	int i = 0;
 
-		case STIR_SHAKEN_HTTP_REQ_TYPE_HEAD:	
+	if (!m) return;
 
-			// TODO check if this is necessary to make HEAD req
-			//curl_easy_setopt(curl_handle, CURLOPT_CUSTOMREQUEST, "HEAD");
+	for (i = 0; i < STIR_SHAKEN_HTTP_TRANSPORT_MEMORY_BUCKETS; i++) {
 
-			// Get the resource without a body
-			curl_easy_setopt(curl_handle, CURLOPT_NOBODY, 1L);
+		while ((e = m->buckets[i])) {
+			m->buckets[i] = e->next;
+			free(e->url);
+			free(e->body);
+			free(e);
+		}
+	}
 
-			break;
+	pthread_mutex_destroy(&m->mutex);
+	free(m);
+}
 
-		default:
-			stir_shaken_set_error(ss, "Unknown HTTP type Request", STIR_SHAKEN_ERROR_HTTP_GENERAL);
-			return STIR_SHAKEN_STATUS_FALSE;
+static stir_shaken_status_t stir_shaken_http_transport_memory_make_req(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req, void *user_data)
+{
+	stir_shaken_http_transport_memory_t *m = user_data;
+	stir_shaken_http_transport_memory_entry_t *e = NULL;
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	long delay = 0, left = 0;
+	int fail = 0;
+
+	pthread_mutex_lock(&m->mutex);
+	delay = m->latency_ms + (m->jitter_ms ? rand_r(&m->seed) % (m->jitter_ms + 1) : 0);
+	fail = m->error_rate > 0 && (double) rand_r(&m->seed) / RAND_MAX < m->error_rate;
+	pthread_mutex_unlock(&m->mutex);
+
+	left = stir_shaken_http_req_time_left(http_req);
+	if (left >= 0 && delay >= left) {
+
+		if (left) usleep(left * 1000);
+		return stir_shaken_http_transport_fail(ss, http_req, CURLE_OPERATION_TIMEDOUT);
 	}
 
-	if (http_req->tx_headers) {
-		curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, http_req->tx_headers);
+	if (delay) usleep(delay * 1000);
+
+	if (fail) {
+		return stir_shaken_http_transport_fail(ss, http_req, CURLE_COULDNT_CONNECT);
 	}
 
-	// TODO remove
-	if (http_req->data) {
-		fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "STIR-Shaken: making HTTP (%s) call:\nurl:\t%s\nport:\t%u\ndata:\t%s\n", http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_GET ? "GET" : (http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_POST ? "POST" : (http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_PUT ? "PUT" : (http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_HEAD ? "HEAD" : "BAD REQUEST"))), http_req->url, http_req->remote_port, http_req->data);
+	pthread_mutex_lock(&m->mutex);
+
+	e = *stir_shaken_http_transport_memory_find(m, http_req->url);
+	if (e) {
+		status = stir_shaken_http_transport_respond(ss, http_req, e->code, e->body, e->len);
 	} else {
-		fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "STIR-Shaken: making HTTP (%s) call:\nurl:\t%s\nport:\t%u\n", http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_GET ? "GET" : http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_POST ? "POST" : http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_PUT ? "PUT" : http_req->type == STIR_SHAKEN_HTTP_REQ_TYPE_HEAD ? "HEAD" : "BAD REQUEST", http_req->url, http_req->remote_port);
+		status = stir_shaken_http_transport_respond(ss, http_req, 404, NULL, 0);
 	}
 
-	res = curl_easy_perform(curl_handle);
-	http_req->response.code = res;
+	pthread_mutex_unlock(&m->mutex);
 
-	if (res != CURLE_OK) {
+	return status;
+}
 
-		sprintf(err_buf, "Error in CURL: %s", curl_easy_strerror(res));
-		stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_CURL); 
+stir_shaken_status_t stir_shaken_http_transport_register_memory(stir_shaken_context_t *ss, const char *name, uint32_t latency_ms, uint32_t jitter_ms, double error_rate, unsigned int seed)
+{
+	stir_shaken_http_transport_memory_t *m = NULL;
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
 
-		// Do not curl_global_cleanup in case of error, cause otherwise (if also curl_global_cleanup) SSL starts to mulfunction ???? (EVP_get_digestbyname("sha256") in stir_shaken_do_verify_data returns NULL)
-		curl_easy_cleanup(curl_handle);
-		curl_global_cleanup();
+	m = calloc(1, sizeof(*m));
+	if (!m) {
+		stir_shaken_set_error(ss, "Out of memory", STIR_SHAKEN_ERROR_GENERAL);
+		return STIR_SHAKEN_STATUS_TERM;
+	}
+
+	if (pthread_mutex_init(&m->mutex, NULL) != 0) {
+		free(m);
+		stir_shaken_set_error(ss, "Init mutex failed", STIR_SHAKEN_ERROR_GENERAL);
+		return STIR_SHAKEN_STATUS_TERM;
+	}
+
+	m->latency_ms = latency_ms;
+	m->jitter_ms = jitter_ms;
+	m->error_rate = error_rate;
+	m->seed = seed;
+
+	status = stir_shaken_http_transport_register(ss, name, stir_shaken_http_transport_memory_make_req, stir_shaken_http_transport_memory_destroy, m);
+	if (status != STIR_SHAKEN_STATUS_OK) {
+		stir_shaken_http_transport_memory_destroy(m);
+	}
+
+	return status;
+}
+
+stir_shaken_status_t stir_shaken_http_transport_memory_set(stir_shaken_context_t *ss, const char *name, const char *url, long code, const char *body, size_t len)
+{
+	stir_shaken_http_transport_t *t = NULL;
+	stir_shaken_http_transport_memory_t *m = NULL;
+	stir_shaken_http_transport_memory_entry_t *e = NULL, **pe = NULL;
+	char *copy = NULL;
 
+	if (stir_shaken_zstr(name) || stir_shaken_zstr(url) || (len && !body)) {
+		stir_shaken_set_error(ss, "Bad params", STIR_SHAKEN_ERROR_HTTP_PARAMS);
+		return STIR_SHAKEN_STATUS_TERM;
+	}
+
+	t = stir_shaken_http_transport_find(name);
+	if (!t || t->make_req != stir_shaken_http_transport_memory_make_req) {
+		stir_shaken_set_error(ss, "No such in-memory HTTP transport", STIR_SHAKEN_ERROR_HTTP_PARAMS);
 		return STIR_SHAKEN_STATUS_FALSE;
 	}
+	m = t->user_data;
 
-	curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &http_req->response.code);
-	if (http_req->response.code != 200 && http_req->response.code != 201) {
-		sprintf(http_req->response.error, "HTTP response code: %ld (%s%s), HTTP response phrase: %s", http_req->response.code, curl_easy_strerror(http_req->response.code), (http_req->response.code == 400 || http_req->response.code == 404) ? " [Bad URL or API call not handled?]" : "", http_req->response.headers && http_req->response.headers->data ? http_req->response.headers->data : "");
+	copy = malloc(len + 1);
+	if (!copy) {
+		stir_shaken_set_error(ss, "Out of memory", STIR_SHAKEN_ERROR_GENERAL);
+		return STIR_SHAKEN_STATUS_TERM;
 	}
-	curl_easy_cleanup(curl_handle);
-	curl_global_cleanup();
+	if (len) memcpy(copy, body, len);
+	copy[len] = '\0';
 
-	// fprintf(stdout, "\n//////////////// HTTP GOT:\n%s\n///////////////////////\n", http_req->response.mem.mem);	
+	pthread_mutex_lock(&m->mutex);
+
+	pe = stir_shaken_http_transport_memory_find(m, url);
+	if (!(e = *pe)) {
+
+		e = calloc(1, sizeof(*e));
+		if (!e || !(e->url = strdup(url))) {
+			pthread_mutex_unlock(&m->mutex);
+			free(e);
+			free(copy);
+			stir_shaken_set_error(ss, "Out of memory", STIR_SHAKEN_ERROR_GENERAL);
+			return STIR_SHAKEN_STATUS_TERM;
+		}
+		*pe = e;
+	}
+
+	free(e->body);
+	e->body = copy;
+	e->len = len;
+	e->code = code;
+
+	pthread_mutex_unlock(&m->mutex);
 
-	// On success, http_req->response.code is HTTP response code (200, 403, 404, etc...)
 	return STIR_SHAKEN_STATUS_OK;
 }
 
@@ -278,6 +1358,7 @@ void stir_shaken_destroy_http_request(stir_shaken_http_req_t *http_req)
 	if (http_req->response.mem.mem) {
 		free(http_req->response.mem.mem);
 		http_req->response.mem.mem = NULL;
+		http_req->response.mem.capacity = 0;
 	}
 
 	if (http_req->tx_headers) {
@@ -289,6 +1370,11 @@ void stir_shaken_destroy_http_request(stir_shaken_http_req_t *http_req)
 		curl_slist_free_all(http_req->response.headers);
 		http_req->response.headers = NULL;
 	}
+
+	if (http_req->response.header_buf) {
+		free(http_req->response.header_buf);
+		http_req->response.header_buf = NULL;
+	}
 	memset(http_req, 0, sizeof(*http_req));
 }
 
@@ -434,6 +1520,361 @@ stir_shaken_status_t stir_shaken_make_http_get_req(stir_shaken_context_t *ss, st
 	return stir_shaken_make_http_req(ss, http_req);
 }
 
+static int stir_shaken_http_latency_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+
+	return x < y ? -1 : x > y;
+}
+
+// Delay after which request is hedged: configured percentile of recent latencies (at least min delay), -1 if no hedge allowed now
+static long stir_shaken_http_hedge_delay(void)
+{
+	uint32_t samples[STIR_SHAKEN_HTTP_LATENCY_SAMPLES];
+	int n = 0, percentile = 0;
+	long min_delay = 0, delay = 0;
+
+	pthread_mutex_lock(&stir_shaken_globals.http_hedge_mutex);
+
+	// Budget: each request earns @budget of a hedge, so hedges never exceed @budget x requests
+	stir_shaken_globals.http_hedge_tokens += stir_shaken_globals.http_hedge_budget;
+	if (stir_shaken_globals.http_hedge_tokens > STIR_SHAKEN_HTTP_HEDGE_BURST) {
+		stir_shaken_globals.http_hedge_tokens = STIR_SHAKEN_HTTP_HEDGE_BURST;
+	}
+
+	n = stir_shaken_globals.http_latency_n;
+	memcpy(samples, stir_shaken_globals.http_latency, n * sizeof(uint32_t));
+	percentile = stir_shaken_globals.http_hedge_percentile;
+	min_delay = stir_shaken_globals.http_hedge_min_delay_ms;
+
+	pthread_mutex_unlock(&stir_shaken_globals.http_hedge_mutex);
+
+	if (n < STIR_SHAKEN_HTTP_LATENCY_SAMPLES_MIN) {
+		return min_delay > STIR_SHAKEN_HTTP_HEDGE_DEFAULT_DELAY_MS ? min_delay : STIR_SHAKEN_HTTP_HEDGE_DEFAULT_DELAY_MS;
+	}
+
+	qsort(samples, n, sizeof(uint32_t), stir_shaken_http_latency_cmp);
+	delay = samples[(n - 1) * percentile / 100];
+
+	return delay > min_delay ? delay : min_delay;
+}
+
+static uint8_t stir_shaken_http_hedge_take_token(void)
+{
+	uint8_t ok = 0;
+
+	pthread_mutex_lock(&stir_shaken_globals.http_hedge_mutex);
+	if (stir_shaken_globals.http_hedge_tokens >= 1) {
+		stir_shaken_globals.http_hedge_tokens -= 1;
+		ok = 1;
+	}
+	pthread_mutex_unlock(&stir_shaken_globals.http_hedge_mutex);
+
+	return ok;
+}
+
+static uint8_t stir_shaken_http_hedge_has_token(void)
+{
+	uint8_t ok = 0;
+
+	pthread_mutex_lock(&stir_shaken_globals.http_hedge_mutex);
+	ok = (stir_shaken_globals.http_hedge_tokens >= 1);
+	pthread_mutex_unlock(&stir_shaken_globals.http_hedge_mutex);
+
+	return ok;
+}
+
+static void stir_shaken_http_latency_add(uint64_t ms)
+{
+	pthread_mutex_lock(&stir_shaken_globals.http_hedge_mutex);
+
+	stir_shaken_globals.http_latency[stir_shaken_globals.http_latency_pos] = ms > UINT32_MAX ? UINT32_MAX : (uint32_t) ms;
+	stir_shaken_globals.http_latency_pos = (stir_shaken_globals.http_latency_pos + 1) % STIR_SHAKEN_HTTP_LATENCY_SAMPLES;
+	if (stir_shaken_globals.http_latency_n < STIR_SHAKEN_HTTP_LATENCY_SAMPLES) {
+		stir_shaken_globals.http_latency_n++;
+	}
+
+	pthread_mutex_unlock(&stir_shaken_globals.http_hedge_mutex);
+}
+
+// Alternate address lookup for hedge, run in detached thread so that multi loop never blocks on DNS
+typedef struct stir_shaken_http_hedge_resolve_s {
+	int				refs;
+	uint8_t			done;
+	char			*host;
+	char			*port;
+	struct addrinfo	*res;
+} stir_shaken_http_hedge_resolve_t;
+
+static void stir_shaken_http_hedge_resolve_unref(stir_shaken_http_hedge_resolve_t *r)
+{
+	if (!r || __atomic_sub_fetch(&r->refs, 1, __ATOMIC_ACQ_REL) > 0) return;
+
+	if (r->res) freeaddrinfo(r->res);
+	curl_free(r->host);
+	curl_free(r->port);
+	free(r);
+}
+
+static void* stir_shaken_http_hedge_resolve_thread(void *arg)
+{
+	stir_shaken_http_hedge_resolve_t *r = arg;
+	struct addrinfo hints = { 0 }, *res = NULL;
+
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(r->host, r->port, &hints, &res) == 0) {
+		r->res = res;
+	}
+	__atomic_store_n(&r->done, 1, __ATOMIC_RELEASE);
+
+	stir_shaken_http_hedge_resolve_unref(r);
+	return NULL;
+}
+
+/*
+ * Start lookup of @url's host addresses. Returns NULL if there is nothing to look up (literal IP) or lookup cannot be started.
+ * Result is used only if it is ready by the time request is hedged, see stir_shaken_http_hedge_connect_to.
+ */
+static stir_shaken_http_hedge_resolve_t* stir_shaken_http_hedge_resolve_start(const char *url)
+{
+	stir_shaken_http_hedge_resolve_t *r = NULL;
+	CURLU *u = NULL;
+	unsigned char buf[sizeof(struct in6_addr)];
+	pthread_attr_t attr;
+	pthread_t thread;
+	int ok = 0;
+
+	r = calloc(1, sizeof(*r));
+	u = curl_url();
+	if (!r || !u) goto done;
+
+	if (curl_url_set(u, CURLUPART_URL, url, 0) != CURLUE_OK
+			|| curl_url_get(u, CURLUPART_HOST, &r->host, 0) != CURLUE_OK
+			|| curl_url_get(u, CURLUPART_PORT, &r->port, CURLU_DEFAULT_PORT) != CURLUE_OK) {
+		goto done;
+	}
+
+	// Literal IP resolves to itself only (IPv6 host comes in brackets)
+	if (r->host[0] == '[' || inet_pton(AF_INET, r->host, buf) == 1) goto done;
+
+	// One reference for the thread, one for the caller
+	r->refs = 2;
+
+	if (pthread_attr_init(&attr) != 0) goto done;
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	ok = (pthread_create(&thread, &attr, stir_shaken_http_hedge_resolve_thread, r) == 0);
+	pthread_attr_destroy(&attr);
+
+done:
+	curl_url_cleanup(u);
+	if (!ok && r) {
+		r->refs = 1;
+		stir_shaken_http_hedge_resolve_unref(r);
+		r = NULL;
+	}
+	return r;
+}
+
+/*
+ * Point hedge @curl_handle to another address of the host than @avoid_ip (the one first attempt uses, from CURLINFO_PRIMARY_IP),
+ * if lookup @r has completed and host has more addresses. Otherwise hedge resolves through the shared DNS cache like any request.
+ * Connection is made to that address while the URL (Host, TLS SNI, cert check) stays the same.
+ */
+static void stir_shaken_http_hedge_connect_to(CURL *curl_handle, stir_shaken_http_hedge_resolve_t *r, const char *avoid_ip, struct curl_slist **connect_to)
+{
+	struct addrinfo *ai = NULL;
+	char ip[INET6_ADDRSTRLEN] = { 0 };
+	char entry[STIR_SHAKEN_BUFLEN] = { 0 };
+	void *addr = NULL;
+
+	if (!r || !__atomic_load_n(&r->done, __ATOMIC_ACQUIRE)) return;
+
+	for (ai = r->res; ai; ai = ai->ai_next) {
+
+		addr = ai->ai_family == AF_INET6 ? (void *) &((struct sockaddr_in6 *) ai->ai_addr)->sin6_addr : (void *) &((struct sockaddr_in *) ai->ai_addr)->sin_addr;
+		if (!inet_ntop(ai->ai_family, addr, ip, sizeof(ip))) continue;
+
+		if (!stir_shaken_zstr(avoid_ip) && !strcmp(ip, avoid_ip)) continue;
+
+		snprintf(entry, sizeof(entry), ai->ai_family == AF_INET6 ? "%s:%s:[%s]:%s" : "%s:%s:%s:%s", r->host, r->port, ip, r->port);
+		*connect_to = curl_slist_append(NULL, entry);
+		if (*connect_to) {
+			curl_easy_setopt(curl_handle, CURLOPT_CONNECT_TO, *connect_to);
+		}
+		break;
+	}
+}
+
+/*
+ * GET with hedging (if enabled, see stir_shaken_http_set_hedging): if the request hasn't completed after delay
+ * (percentile of recent latencies), second request is sent over new connection (to other address of the host if available)
+ * and the first one to complete wins. Otherwise same as stir_shaken_make_http_get_req.
+ */
+stir_shaken_status_t stir_shaken_make_http_get_req_hedged(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req)
+{
+	CURLM			*multi = NULL;
+	CURL			*handles[2] = { NULL, NULL };
+	stir_shaken_http_req_t	hedge = { 0 };
+	struct curl_slist	*connect_to = NULL;
+	stir_shaken_http_hedge_resolve_t	*resolve = NULL;
+	CURLMsg			*msg = NULL;
+	CURLcode		results[2] = { CURLE_OK, CURLE_OK };
+	uint8_t			done[2] = { 0, 0 };
+	int				i = 0, running = 0, msgs_left = 0, winner = -1;
+	long			delay = 0;
+	uint64_t		start = 0;
+	char			*ip = NULL;
+	curl_slist_t	*app_headers = NULL;
+	stir_shaken_status_t	status = STIR_SHAKEN_STATUS_FALSE;
+
+	if (!http_req || stir_shaken_zstr(http_req->url)) {
+		stir_shaken_set_error(ss, "Bad params", STIR_SHAKEN_ERROR_HTTP_PARAMS);
+		return STIR_SHAKEN_STATUS_FALSE;
+	}
+
+	if (!stir_shaken_globals.http_hedge || stir_shaken_make_http_req != stir_shaken_make_http_req_real) {
+		return stir_shaken_make_http_get_req(ss, http_req);
+	}
+
+	if (ss) stir_shaken_clear_error(ss);
+
+	http_req->type = STIR_SHAKEN_HTTP_REQ_TYPE_GET;
+	delay = stir_shaken_http_hedge_delay();
+
+	multi = curl_multi_init();
+	if (!multi) {
+		stir_shaken_set_error(ss, "CURL multi init failed", STIR_SHAKEN_ERROR_CURL);
+		return STIR_SHAKEN_STATUS_TERM;
+	}
+
+	handles[0] = stir_shaken_http_handle_acquire();
+	if (!handles[0]) {
+		stir_shaken_set_error(ss, "Cannot get CURL handle", STIR_SHAKEN_ERROR_CURL);
+		status = STIR_SHAKEN_STATUS_TERM;
+		goto done;
+	}
+
+	status = stir_shaken_http_setup_handle(ss, handles[0], http_req);
+	if (status != STIR_SHAKEN_STATUS_OK) {
+		goto done;
+	}
+	curl_multi_add_handle(multi, handles[0]);
+	start = stir_shaken_now_ms();
+
+	if (stir_shaken_http_hedge_has_token()) {
+		resolve = stir_shaken_http_hedge_resolve_start(http_req->url);
+	}
+
+	do {
+		CURLMcode mc = curl_multi_perform(multi, &running);
+		uint64_t elapsed = stir_shaken_now_ms() - start;
+
+		if (mc != CURLM_OK) {
+			stir_shaken_set_error(ss, curl_multi_strerror(mc), STIR_SHAKEN_ERROR_CURL);
+			status = STIR_SHAKEN_STATUS_FALSE;
+			goto done;
+		}
+
+		while ((msg = curl_multi_info_read(multi, &msgs_left))) {
+
+			if (msg->msg != CURLMSG_DONE) continue;
+
+			i = (msg->easy_handle == handles[0]) ? 0 : 1;
+			done[i] = 1;
+			results[i] = msg->data.result;
+			curl_multi_remove_handle(multi, msg->easy_handle);
+
+			// First success wins, failure wins only if there is no other attempt left
+			if (results[i] == CURLE_OK || !handles[1 - i] || done[1 - i]) {
+				winner = i;
+				break;
+			}
+		}
+
+		if (winner >= 0) break;
+
+		if (!handles[1] && !done[0] && (long) elapsed >= delay) {
+
+			if (stir_shaken_http_hedge_take_token() && (handles[1] = stir_shaken_http_handle_acquire())) {
+
+				hedge = *http_req;
+				memset(&hedge.response, 0, sizeof(hedge.response));
+				hedge.reuse_buffer = 0;
+
+				if (stir_shaken_http_setup_handle(NULL, handles[1], &hedge) == STIR_SHAKEN_STATUS_OK) {
+
+					curl_easy_getinfo(handles[0], CURLINFO_PRIMARY_IP, &ip);
+					stir_shaken_http_hedge_connect_to(handles[1], resolve, ip, &connect_to);
+					curl_easy_setopt(handles[1], CURLOPT_FRESH_CONNECT, 1L);
+					curl_multi_add_handle(multi, handles[1]);
+					stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_HTTP, "STIR-Shaken: HTTP: no response from %s after %" PRIu64 " ms, hedging\n", http_req->url, elapsed);
+					continue;
+				}
+
+				stir_shaken_http_handle_release(handles[1]);
+				handles[1] = NULL;
+				delay = LONG_MAX;
+
+			} else {
+
+				// No budget, wait for the first attempt only
+				delay = LONG_MAX;
+			}
+		}
+
+		if (running) {
+
+			long wait_ms = 1000;
+
+			if (!handles[1] && delay != LONG_MAX && (long) elapsed < delay) {
+				wait_ms = delay - (long) elapsed;
+				if (wait_ms > 1000) wait_ms = 1000;
+			}
+
+			mc = curl_multi_wait(multi, NULL, 0, (int) wait_ms, NULL);
+			if (mc != CURLM_OK) {
+				stir_shaken_set_error(ss, curl_multi_strerror(mc), STIR_SHAKEN_ERROR_CURL);
+				status = STIR_SHAKEN_STATUS_FALSE;
+				goto done;
+			}
+		}
+
+	} while (running || winner < 0);
+
+	stir_shaken_http_latency_add(stir_shaken_now_ms() - start);
+
+	if (winner == 1) {
+
+		// Hedge won, move its response to @http_req (keeping headers set by application)
+		app_headers = http_req->response.headers;
+		free(http_req->response.mem.mem);
+		free(http_req->response.header_buf);
+		http_req->response = hedge.response;
+		http_req->response.headers = app_headers;
+		http_req->response.mem.ss = ss;
+		memset(&hedge.response, 0, sizeof(hedge.response));
+	}
+
+	status = stir_shaken_http_process_result(ss, handles[winner], http_req, results[winner]);
+
+done:
+	for (i = 0; i < 2; i++) {
+		if (handles[i]) {
+			curl_multi_remove_handle(multi, handles[i]);
+			stir_shaken_http_handle_release(handles[i]);
+		}
+	}
+	curl_multi_cleanup(multi);
+	curl_slist_free_all(connect_to);
+	stir_shaken_http_hedge_resolve_unref(resolve);
+	free(hedge.response.mem.mem);
+	free(hedge.response.header_buf);
+
+	return status;
+}
+
 stir_shaken_status_t stir_shaken_make_http_post_req(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req, char *data, uint8_t is_json)
 {
 	if (!http_req) {
@@ -452,6 +1893,7 @@ stir_shaken_status_t stir_shaken_make_http_post_req(stir_shaken_context_t *ss, s
 			free(http_req->response.mem.mem);
 			http_req->response.mem.mem = NULL;
 			http_req->response.mem.size = 0;
+			http_req->response.mem.capacity = 0;
 		}
 		http_req->data = strdup(data);
 	}
@@ -499,9 +1941,47 @@ void stir_shaken_http_add_header(stir_shaken_http_req_t *http_req, const char *h
 	http_req->tx_headers = curl_slist_append(http_req->tx_headers, h);
 }
 
+static char* stir_shaken_get_http_header_from_index(stir_shaken_http_response_t *response, const char *name)
+{
+	uint32_t hash = stir_shaken_http_header_hash(name, strlen(name));
+	uint32_t i = hash & (STIR_SHAKEN_HTTP_HEADER_INDEX_SIZE - 1);
+	stir_shaken_http_header_t *slot = NULL;
+	size_t pos = 0;
+	char *found = NULL;
+
+	while ((slot = &response->header_index[i])->hash) {
+
+		if (slot->hash == hash && !strcasecmp(response->header_buf + slot->name, name)) {
+			return response->header_buf + slot->value;
+		}
+
+		i = (i + 1) & (STIR_SHAKEN_HTTP_HEADER_INDEX_SIZE - 1);
+	}
+
+	if (!response->header_index_full) {
+		return NULL;
+	}
+
+	// Index overflowed, scan name/value pairs after status line
+	pos = strlen(response->header_buf) + 1;
+	while (pos < response->header_buf_len) {
+
+		char *n = response->header_buf + pos;
+		char *v = n + strlen(n) + 1;
+
+		if (!strcasecmp(n, name)) {
+			found = v;
+		}
+
+		pos = v + strlen(v) + 1 - response->header_buf;
+	}
+
+	return found;
+}
+
 /**
- * Return header's value if found.
- * Note: pointer is valid as long as http_req's headers are valid.
+ * Return header's value if found (case insensitive, last one if header is repeated).
+ * Note: pointer is valid as long as http_req's headers are valid (until next request made with this http_req).
  */ 
 char* stir_shaken_get_http_header(stir_shaken_http_req_t *http_req, char *name)
 {
@@ -511,6 +1991,11 @@ char* stir_shaken_get_http_header(stir_shaken_http_req_t *http_req, char *name)
 
 	if (!http_req || !name) return NULL;
 
+	if (http_req->response.header_buf_len) {
+		return stir_shaken_get_http_header_from_index(&http_req->response, name);
+	}
+
+	// Headers set by application
 	header = http_req->response.headers;
 
 	// Parse header data
@@ -534,10 +2019,10 @@ char* stir_shaken_get_http_header(stir_shaken_http_req_t *http_req, char *name)
 				data++;
 			}
 
-			fprintif(STIR_SHAKEN_LOGLEVEL_HIGH, "key:\t\t%s\n", header->data);
-			fprintif(STIR_SHAKEN_LOGLEVEL_HIGH, "value:\t\t%s\n\n", data);
+			stir_shaken_log(STIR_SHAKEN_LOGLEVEL_HIGH, STIR_SHAKEN_LOG_HTTP, "key:\t\t%s\n", header->data);
+			stir_shaken_log(STIR_SHAKEN_LOGLEVEL_HIGH, STIR_SHAKEN_LOG_HTTP, "value:\t\t%s\n\n", data);
 
-			if (!strcmp(header->data, name)) {
+			if (!strcasecmp(header->data, name)) {
 
 				// found
 				found = data;
@@ -546,9 +2031,9 @@ char* stir_shaken_get_http_header(stir_shaken_http_req_t *http_req, char *name)
 		} else {
 
 			if (!strncmp("HTTP", header->data, 4)) {
-				fprintif(STIR_SHAKEN_LOGLEVEL_HIGH, "Starts with HTTP: %s\n", header->data);
+				stir_shaken_log(STIR_SHAKEN_LOGLEVEL_HIGH, STIR_SHAKEN_LOG_HTTP, "Starts with HTTP: %s\n", header->data);
 			} else {
-				fprintif(STIR_SHAKEN_LOGLEVEL_HIGH, "Unparsable header: %s\n", header->data);
+				stir_shaken_log(STIR_SHAKEN_LOGLEVEL_HIGH, STIR_SHAKEN_LOG_HTTP, "Unparsable header: %s\n", header->data);
 			}
 		}
 		header = header->next;
@@ -164,7 +164,7 @@ stir_shaken_status_t stir_shaken_sp_cert_req_ex(stir_shaken_context_t *ss, stir_
         goto exit;
     }
 
-    fprintif(STIR_SHAKEN_LOGLEVEL_MEDIUM, "-> Got STI certificate from CA:\n%s\n", http_req->response.mem.mem);
+    stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_SP, "-> Got STI certificate from CA:\n%s\n", http_req->response.mem.mem);
 
     if (json) {
         *json = jwt_decoded;
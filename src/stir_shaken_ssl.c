@@ -1,4 +1,12 @@
 #include "stir_shaken.h"
+#include <poll.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <ctype.h>
+#include <limits.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
 
 
 static int do_sign_init(EVP_MD_CTX *ctx, EVP_PKEY *pkey,
@@ -1173,18 +1181,10 @@ static int stir_shaken_convert_ASN1TIME(stir_shaken_context_t *ss, ASN1_TIME *t,
     return EXIT_SUCCESS;
 }
 
+// Only validity times are read here, version and string fields are read on first access by stir_shaken_cert_get_*
 stir_shaken_status_t stir_shaken_read_cert_fields(stir_shaken_context_t *ss, stir_shaken_cert_t *cert)
 {
     X509			*x = NULL;
-    ASN1_INTEGER	*serial = NULL;
-    BIGNUM			*bnser = NULL;
-    char			*serialHex = NULL;
-    char			*serialDec = NULL;
-    char			*issuer = NULL;
-    char			*subject = NULL;
-    ASN1_TIME		*notBefore = NULL;
-    ASN1_TIME		*notAfter = NULL;
-    int				version = -1;
 
     stir_shaken_clear_error(ss);
 
@@ -1201,37 +1201,33 @@ stir_shaken_status_t stir_shaken_read_cert_fields(stir_shaken_context_t *ss, sti
 
     stir_shaken_destroy_cert_fields(cert);
 
-    serial = X509_get_serialNumber(x);
-    if (!serial) {
+    if (!X509_get_serialNumber(x)) {
         stir_shaken_set_error(ss, "Cannot get serial number from cert", STIR_SHAKEN_ERROR_GENERAL);
         return STIR_SHAKEN_STATUS_TERM;
     }
 
-    bnser = ASN1_INTEGER_to_BN(serial, NULL);
-
-    serialHex = BN_bn2hex(bnser);
-    cert->serialHex = serialHex;
-
-    serialDec = BN_bn2dec(bnser);
-    BN_free(bnser);
-    cert->serialDec = serialDec;
+    cert->notBefore_ASN1 = X509_get_notBefore(x);
+    cert->notAfter_ASN1 = X509_get_notAfter(x);
 
-    X509_NAME_oneline(X509_get_issuer_name(x), cert->issuer, sizeof(cert->issuer));
-    X509_NAME_oneline(X509_get_subject_name(x), cert->subject, sizeof(cert->subject));
+    return STIR_SHAKEN_STATUS_OK;
+}
 
-    notBefore = X509_get_notBefore(x);
-    cert->notBefore_ASN1 = notBefore;
+static void stir_shaken_cert_read_serial(stir_shaken_cert_t *cert)
+{
+    ASN1_INTEGER	*serial = NULL;
+    BIGNUM			*bnser = NULL;
 
-    notAfter = X509_get_notAfter(x);
-    cert->notAfter_ASN1 = notAfter;
+    if (!cert->x || cert->serialHex) return;
 
-    stir_shaken_convert_ASN1TIME(ss, notBefore, cert->notBefore, ASN1_DATE_LEN);
-    stir_shaken_convert_ASN1TIME(ss, notAfter, cert->notAfter, ASN1_DATE_LEN);
+    serial = X509_get_serialNumber(cert->x);
+    if (!serial) return;
 
-    version = ((int) X509_get_version(x)) + 1;
-    cert->version = version;
+    bnser = ASN1_INTEGER_to_BN(serial, NULL);
+    if (!bnser) return;
 
-    return STIR_SHAKEN_STATUS_OK;
+    cert->serialHex = BN_bn2hex(bnser);
+    cert->serialDec = BN_bn2dec(bnser);
+    BN_free(bnser);
 }
 
 void stir_shaken_destroy_cert_fields(stir_shaken_cert_t *cert)
@@ -1248,8 +1244,11 @@ void stir_shaken_destroy_cert_fields(stir_shaken_cert_t *cert)
             cert->serialDec = NULL;
         }
 
-        memset(cert->issuer, 0, sizeof(cert->issuer));
-        memset(cert->subject, 0, sizeof(cert->subject));
+        cert->issuer[0] = '\0';
+        cert->subject[0] = '\0';
+        cert->notBefore[0] = '\0';
+        cert->notAfter[0] = '\0';
+        cert->version = 0;
 
         if (cert->notBefore_ASN1) {
             //ASN1_TIME_free(cert->notBefore_ASN1); SSL returns internal pointers from cert to this, so DO NOT FREE this
@@ -1276,7 +1275,8 @@ static int stir_shaken_verify_callback(int ok, X509_STORE_CTX *ctx)
 
     if (file) fprintf(file, "===[depth: %d] X509 cert path validation: got error: %d ===\n", depth, err);
 
-    if (err_cert) {
+    // Cert fields are only printed, don't read them for every cert in the path otherwise
+    if (err_cert && file) {
 
         stir_shaken_cert_t cert = { .x = err_cert };
 
@@ -1289,9 +1289,9 @@ static int stir_shaken_verify_callback(int ok, X509_STORE_CTX *ctx)
         if (file) stir_shaken_print_cert_fields(file, &cert);
 
         stir_shaken_destroy_cert_fields(&cert);
-    } else {
+    } else if (file) {
 
-        if (file) fprintf(file, "===[depth: %d] = No cert for this error:\n", depth);
+        fprintf(file, "===[depth: %d] = No cert for this error:\n", depth);
     }
 
 handle_error:
@@ -1422,7 +1422,7 @@ unsigned long stir_shaken_get_cert_name_hashed(stir_shaken_context_t *ss, X509 *
 void stir_shaken_cert_name_hashed_2_string(unsigned long hash, char *buf, int buflen)
 {
     if (!buf) return;
-    snprintf(buf, buflen, "%8lx", hash);
+    snprintf(buf, buflen, "%08lx", hash);
 }
 
 void stir_shaken_hash_cert_name(stir_shaken_context_t *ss, stir_shaken_cert_t *cert)
@@ -1436,309 +1436,2826 @@ void stir_shaken_hash_cert_name(stir_shaken_context_t *ss, stir_shaken_cert_t *c
     sprintf(cert->cert_name_hashed, "%s.0", cert->hashstr);
 }
 
-stir_shaken_status_t stir_shaken_init_cert_store(stir_shaken_context_t *ss, const char *ca_list, const char *ca_dir, const char *crl_list, const char *crl_dir)
+static uint32_t stir_shaken_serial_hash(const unsigned char *data, int len)
 {
-    stir_shaken_globals_t *g = &stir_shaken_globals;
-
-    if (g->store) {
-        X509_STORE_free(g->store);
-        g->store = NULL;
-    }
+    uint32_t h = 2166136261u;
+    int i = 0;
 
-    g->store = X509_STORE_new();
-    if (!g->store) {
-        stir_shaken_set_error(ss, "Failed to create X509_STORE", STIR_SHAKEN_ERROR_SSL);
-        return STIR_SHAKEN_STATUS_FALSE;
+    for (i = 0; i < len; i++) {
+        h = (h ^ data[i]) * 16777619u;
     }
 
-    X509_STORE_set_verify_cb_func(g->store, stir_shaken_verify_callback);
+    return h ? h : 1;
+}
 
-    if (ca_list || ca_dir) {
+// Slot holding @data or -1
+static long stir_shaken_crl_set_find(stir_shaken_crl_issuer_t *is, const unsigned char *data, int len, uint32_t h)
+{
+    size_t i = 0, mask = is->capacity - 1;
+    stir_shaken_revoked_serial_t *s = NULL;
 
-        if (X509_STORE_load_locations(g->store, ca_list, ca_dir) != 1) {
-            stir_shaken_set_error(ss, "Failed to load trusted CAs", STIR_SHAKEN_ERROR_LOAD_CA);
-            goto fail;
-        }
+    if (!is->capacity) return -1;
 
-        if (STIR_SHAKEN_LOAD_CA_FROM_DEFAULT_OS_PATHS && (X509_STORE_set_default_paths(g->store) != 1)) {
-            stir_shaken_set_error(ss, "Failed to load the system-wide CA certificates", STIR_SHAKEN_ERROR_SET_DEFAULT_PATHS);
-            goto fail;
+    for (i = h & mask; (s = &is->serials[i])->hash; i = (i + 1) & mask) {
+        if (s->hash == h && s->len == len && !memcmp(s->data, data, len)) {
+            return (long) i;
         }
     }
 
-    if (crl_list || crl_dir) {
+    return -1;
+}
 
-        if (X509_STORE_load_locations(g->store, crl_list, crl_dir) != 1) {
-            stir_shaken_set_error(ss, "Failed to load CRLs", STIR_SHAKEN_ERROR_LOAD_CRL);
-            goto fail;
-        }
+// Rehash to keep load factor under 1/2, dropping deleted slots
+static stir_shaken_status_t stir_shaken_crl_set_grow(stir_shaken_crl_issuer_t *is)
+{
+    stir_shaken_revoked_serial_t *serials = NULL, *s = NULL;
+    size_t capacity = STIR_SHAKEN_CRL_SET_MIN, i = 0, j = 0, mask = 0;
 
-        // TODO Probably?
-        X509_STORE_set_flags(g->store, X509_V_FLAG_CRL_CHECK | X509_V_FLAG_CRL_CHECK_ALL);
+    while (capacity < (is->n + 1) * 2) {
+        capacity *= 2;
     }
 
-    return STIR_SHAKEN_STATUS_OK;
+    serials = calloc(capacity, sizeof(*serials));
+    if (!serials) return STIR_SHAKEN_STATUS_FALSE;
 
-fail:
-    if (g->store) {
-        X509_STORE_free(g->store);
-        g->store = NULL;
-    }
-    return STIR_SHAKEN_STATUS_FALSE;
-}
+    mask = capacity - 1;
+    for (i = 0; i < is->capacity; i++) {
 
-void stir_shaken_cert_store_cleanup(void)
-{
-    stir_shaken_globals_t *g = &stir_shaken_globals; 
+        s = &is->serials[i];
+        if (!s->hash || !s->len) continue;
 
-    if (g->store) {
-        X509_STORE_free(g->store);
-        g->store = NULL;
+        for (j = s->hash & mask; serials[j].hash; j = (j + 1) & mask);
+        serials[j] = *s;
     }
+
+    free(is->serials);
+    is->serials = serials;
+    is->capacity = capacity;
+    is->used = is->n;
+
+    return STIR_SHAKEN_STATUS_OK;
 }
 
-stir_shaken_status_t stir_shaken_verify_cert_path(stir_shaken_context_t *ss, stir_shaken_cert_t *cert)
+static stir_shaken_status_t stir_shaken_crl_set_add(stir_shaken_crl_issuer_t *is, const ASN1_INTEGER *serial)
 {
-    X509            *x = NULL;
-    stir_shaken_globals_t *g = &stir_shaken_globals; 
-    int rc = 1;
-    char err_buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
-    int verify_error = -1;
-    FILE *file = NULL; // set to something if want verification callback to print to it
+    const unsigned char *data = ASN1_STRING_get0_data(serial);
+    int len = ASN1_STRING_length(serial);
+    uint32_t h = 0;
+    size_t i = 0, mask = 0;
+    long deleted = -1;
+    stir_shaken_revoked_serial_t *s = NULL;
 
-    stir_shaken_clear_error(ss);
+    if (len <= 0 || len > STIR_SHAKEN_SERIAL_MAX_LEN) return STIR_SHAKEN_STATUS_FALSE;
 
-    if (!cert) {
-        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
-        return STIR_SHAKEN_STATUS_TERM;
+    if ((is->used + 1) * 4 > is->capacity * 3) {
+        if (stir_shaken_crl_set_grow(is) != STIR_SHAKEN_STATUS_OK) return STIR_SHAKEN_STATUS_FALSE;
     }
 
-    if (!g->store) {
-        stir_shaken_set_error(ss, "Cert store not set", STIR_SHAKEN_ERROR_CERT_STORE);
-        return STIR_SHAKEN_STATUS_TERM;
-    }
+    h = stir_shaken_serial_hash(data, len);
+    mask = is->capacity - 1;
 
-    if (cert->verify_ctx) {
-        X509_STORE_CTX_cleanup(cert->verify_ctx);
-        X509_STORE_CTX_free(cert->verify_ctx);
-        cert->verify_ctx = NULL;
+    for (i = h & mask; (s = &is->serials[i])->hash; i = (i + 1) & mask) {
+
+        if (s->hash == h && s->len == len && !memcmp(s->data, data, len)) {
+            return STIR_SHAKEN_STATUS_OK;
+        }
+
+        if (!s->len && deleted < 0) deleted = (long) i;
     }
 
-    if (!(cert->verify_ctx = X509_STORE_CTX_new())) {
-        stir_shaken_set_error(ss, "Failed to create X509_STORE_CTX object", STIR_SHAKEN_ERROR_SSL);
-        return STIR_SHAKEN_STATUS_TERM;
+    if (deleted >= 0) {
+        s = &is->serials[deleted];
+    } else {
+        is->used++;
     }
 
-    pthread_mutex_lock(&g->mutex); // Can use X509_STORE_lock(g->store) for more fine grained locking later
+    s->hash = h;
+    s->len = len;
+    memcpy(s->data, data, len);
+    is->n++;
 
-    if (X509_STORE_CTX_init(cert->verify_ctx, g->store, cert->x, cert->xchain) != 1) {
+    return STIR_SHAKEN_STATUS_OK;
+}
 
-        X509_STORE_CTX_cleanup(cert->verify_ctx);
-        X509_STORE_CTX_free(cert->verify_ctx);
-        cert->verify_ctx = NULL;
-        stir_shaken_set_error(ss, "SSL: Error initializing verification context", STIR_SHAKEN_ERROR_SSL);
+static void stir_shaken_crl_set_remove(stir_shaken_crl_issuer_t *is, const ASN1_INTEGER *serial)
+{
+    const unsigned char *data = ASN1_STRING_get0_data(serial);
+    int len = ASN1_STRING_length(serial);
+    long i = -1;
 
-        // Can use X509_STORE_unlock(g->store); for more fine grained locking later
-        pthread_mutex_unlock(&g->mutex);
-        return STIR_SHAKEN_STATUS_TERM;
+    if (len <= 0 || len > STIR_SHAKEN_SERIAL_MAX_LEN) return;
+
+    i = stir_shaken_crl_set_find(is, data, len, stir_shaken_serial_hash(data, len));
+    if (i >= 0) {
+        is->serials[i].len = 0;		// deleted, probing continues past it
+        is->n--;
     }
+}
 
-    X509_STORE_CTX_set_ex_data(cert->verify_ctx, 0, file);
+static stir_shaken_crl_issuer_t* stir_shaken_crl_issuer_find(stir_shaken_crl_index_t *index, X509_NAME *name)
+{
+    stir_shaken_crl_issuer_t *is = NULL;
+    unsigned long h = X509_NAME_hash(name);
 
-    rc = X509_verify_cert(cert->verify_ctx);
-    if (rc != 1) {
-        // TODO double check if it's a good idea to read verification error from ctx here, outside of verification callback
-        verify_error = X509_STORE_CTX_get_error(cert->verify_ctx);
-        sprintf(err_buf, "SSL: Bad X509 certificate path: SSL reason: %s\n", X509_verify_cert_error_string(verify_error));
-        stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_CERT_INVALID);
+    for (is = index->issuers; is; is = is->next) {
+        if (is->name_hash == h && !X509_NAME_cmp(is->name, name)) {
+            return is;
+        }
     }
 
-    X509_STORE_CTX_cleanup(cert->verify_ctx);
-    X509_STORE_CTX_free(cert->verify_ctx);
-    cert->verify_ctx = NULL;
+    return NULL;
+}
 
-    // Can use X509_STORE_unlock(g->store); for more fine grained locking later
-    pthread_mutex_unlock(&g->mutex);
-    return rc == 1 ? STIR_SHAKEN_STATUS_OK : STIR_SHAKEN_STATUS_FALSE;
+static stir_shaken_crl_index_t* stir_shaken_crl_index_create(void)
+{
+    stir_shaken_crl_index_t *index = calloc(1, sizeof(*index));
+
+    if (!index) return NULL;
+
+    if (pthread_rwlock_init(&index->lock, NULL) != 0) {
+        free(index);
+        return NULL;
+    }
+
+    return index;
 }
 
-stir_shaken_status_t stir_shaken_register_tnauthlist_extension(stir_shaken_context_t *ss, int *nidp)
+static void stir_shaken_crl_index_destroy(stir_shaken_crl_index_t *index)
 {
-    int nid = NID_undef;
+    stir_shaken_crl_issuer_t *is = NULL;
 
-    nid = OBJ_ln2nid(TN_AUTH_LIST_LN);
+    if (!index) return;
 
-    if (nid == NID_undef) {
+    while ((is = index->issuers)) {
+        index->issuers = is->next;
+        X509_NAME_free(is->name);
+        free(is->serials);
+        free(is);
+    }
 
-        // TNAuthList is not registered yet, register
+    pthread_rwlock_destroy(&index->lock);
+    free(index);
+}
 
-        nid = OBJ_create(TN_AUTH_LIST_OID, TN_AUTH_LIST_SN, TN_AUTH_LIST_LN);
-        if (nid == NID_undef) {
-            stir_shaken_set_error(ss, "Cannot register TNAuthList extension (OID 1.3.6.1.5.5.7.1.26: http://oid-info.com/get/1.3.6.1.5.5.7.1.26)", STIR_SHAKEN_ERROR_TNAUTHLIST);
-            return STIR_SHAKEN_STATUS_FALSE;
-        }
-        X509V3_EXT_add_alias(nid, NID_netscape_comment);
+static long stir_shaken_crl_get_number(X509_CRL *crl, int nid)
+{
+    ASN1_INTEGER *i = X509_CRL_get_ext_d2i(crl, nid, NULL, NULL);
+    long n = -1;
+
+    if (i) {
+        n = ASN1_INTEGER_get(i);
+        ASN1_INTEGER_free(i);
     }
 
-    *nidp = nid;
-    //stir_shaken_globals.tn_authlist_obj = OBJ_nid2obj(nid);
+    return n;
+}
 
-    return STIR_SHAKEN_STATUS_OK;
+static time_t stir_shaken_crl_next_update(X509_CRL *crl)
+{
+    const ASN1_TIME *next_update = X509_CRL_get0_nextUpdate(crl);
+    struct tm tm = { 0 };
+
+    if (!next_update || ASN1_TIME_to_tm(next_update, &tm) != 1) return 0;
+    return timegm(&tm);
 }
 
-stir_shaken_status_t stir_shaken_verify_cert_tn_authlist_extension(stir_shaken_context_t *ss, stir_shaken_cert_t *cert)
+// Defined with intermediate pool
+static stir_shaken_status_t stir_shaken_intermediate_pool_verify_crl(X509_STORE *store, X509_CRL *crl);
+
+// CRL must be signed by (one of) trusted CAs with CRL issuer's name, or by intermediate CA whose path validates against them
+static stir_shaken_status_t stir_shaken_crl_verify_signature(stir_shaken_cert_store_t *cert_store, X509_CRL *crl)
 {
-    X509            *x = NULL;
-    int i = -1;
+    stir_shaken_ca_index_t *ca_index = &cert_store->ca_index;
+    stir_shaken_ca_index_entry_t *e = NULL;
+    X509_NAME *name = X509_CRL_get_issuer(crl);
+    unsigned long h = X509_NAME_hash(name);
+    stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
 
-    stir_shaken_clear_error(ss);
+    if (!ca_index->capacity) return STIR_SHAKEN_STATUS_FALSE;
 
-    if (!cert || !cert->x) {
+    for (e = ca_index->buckets[h & (ca_index->capacity - 1)]; e; e = e->next) {
 
-        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
-        return STIR_SHAKEN_STATUS_TERM;
+        if (e->name_hash != h || X509_NAME_cmp(X509_get_subject_name(e->x), name)) continue;
+
+        if (X509_CRL_verify(crl, X509_get0_pubkey(e->x)) == 1) {
+            status = STIR_SHAKEN_STATUS_OK;
+            break;
+        }
     }
 
-    i = X509_get_ext_by_NID(cert->x, stir_shaken_globals.tn_authlist_nid, -1);
-    if (i == -1) {
+    ERR_clear_error();
 
-        stir_shaken_set_error(ss, "Cert must have ext-tnAuthList extension (OID 1.3.6.1.5.5.7.1.26: http://oid-info.com/get/1.3.6.1.5.5.7.1.26) but it is missing", STIR_SHAKEN_ERROR_TNAUTHLIST);
-        return STIR_SHAKEN_STATUS_FALSE;
+    if (status != STIR_SHAKEN_STATUS_OK) {
+        status = stir_shaken_intermediate_pool_verify_crl(cert_store->store, crl);
     }
 
-    return STIR_SHAKEN_STATUS_OK;
+    return status;
 }
 
-stir_shaken_status_t stir_shaken_verify_cert(stir_shaken_context_t *ss, stir_shaken_cert_t *cert)
+// Must be called with @index write locked (or not yet published)
+static stir_shaken_status_t stir_shaken_crl_index_apply(stir_shaken_context_t *ss, stir_shaken_crl_index_t *index, stir_shaken_cert_store_t *cert_store, X509_CRL *crl)
 {
-    X509            *x = NULL;
+    STACK_OF(X509_REVOKED) *revoked = X509_CRL_get_REVOKED(crl);
+    stir_shaken_crl_issuer_t *is = NULL, fresh = { 0 };
+    X509_REVOKED *r = NULL;
+    ASN1_ENUMERATED *reason = NULL;
+    long number = stir_shaken_crl_get_number(crl, NID_crl_number);
+    long base = stir_shaken_crl_get_number(crl, NID_delta_crl);
+    int i = 0;
 
-    stir_shaken_clear_error(ss);
+    if (stir_shaken_crl_verify_signature(cert_store, crl) != STIR_SHAKEN_STATUS_OK) {
+        stir_shaken_set_error(ss, "CRL signature does not verify with any trusted CA or intermediate CA with valid path", STIR_SHAKEN_ERROR_LOAD_CRL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
 
-    if (!cert) {
-        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
-        return STIR_SHAKEN_STATUS_TERM;
+    is = stir_shaken_crl_issuer_find(index, X509_CRL_get_issuer(crl));
+
+    if (base < 0) {
+
+        // Full CRL, replaces what we have from this issuer unless it's older
+        if (is && number >= 0 && is->crl_number >= number) {
+            return STIR_SHAKEN_STATUS_NOOP;
+        }
+
+        for (i = 0; i < sk_X509_REVOKED_num(revoked); i++) {
+            if (stir_shaken_crl_set_add(&fresh, X509_REVOKED_get0_serialNumber(sk_X509_REVOKED_value(revoked, i))) != STIR_SHAKEN_STATUS_OK) {
+                free(fresh.serials);
+                stir_shaken_set_error(ss, "Cannot index CRL (bad serial or out of memory)", STIR_SHAKEN_ERROR_LOAD_CRL);
+                return STIR_SHAKEN_STATUS_FALSE;
+            }
+        }
+
+        if (!is) {
+
+            is = calloc(1, sizeof(*is));
+            if (!is || !(is->name = X509_NAME_dup(X509_CRL_get_issuer(crl)))) {
+                free(is);
+                free(fresh.serials);
+                stir_shaken_set_error(ss, "Out of memory", STIR_SHAKEN_ERROR_GENERAL);
+                return STIR_SHAKEN_STATUS_FALSE;
+            }
+            is->name_hash = X509_NAME_hash(is->name);
+            is->next = index->issuers;
+            index->issuers = is;
+        }
+
+        free(is->serials);
+        is->serials = fresh.serials;
+        is->n = fresh.n;
+        is->used = fresh.used;
+        is->capacity = fresh.capacity;
+        is->crl_number = number;
+        is->delta_number = -1;
+        is->next_update = stir_shaken_crl_next_update(crl);
+
+        return STIR_SHAKEN_STATUS_OK;
     }
 
-    if (STIR_SHAKEN_STATUS_OK != stir_shaken_verify_cert_tn_authlist_extension(ss, cert)) {
-        stir_shaken_set_error(ss, "Cert must have ext-tnAuthList extension (OID 1.3.6.1.5.5.7.1.26: http://oid-info.com/get/1.3.6.1.5.5.7.1.26) but it is missing", STIR_SHAKEN_ERROR_TNAUTHLIST);
+    // Delta CRL, only on top of its base (or newer) full CRL
+    if (!is || is->crl_number < base) {
+        stir_shaken_set_error(ss, "Delta CRL: base CRL has not been applied", STIR_SHAKEN_ERROR_LOAD_CRL);
         return STIR_SHAKEN_STATUS_FALSE;
     }
 
-    if (!STIR_SHAKEN_MOCK_VERIFY_CERT_CHAIN 
-            && (STIR_SHAKEN_STATUS_OK != stir_shaken_verify_cert_path(ss, cert))) {
-        stir_shaken_set_error_if_clear(ss, "Cert did not pass X509 path validation against CA list and CRL", STIR_SHAKEN_ERROR_CERT_INVALID);
-        return STIR_SHAKEN_STATUS_FALSE;
+    if (number >= 0 && (number <= is->crl_number || number <= is->delta_number)) {
+        return STIR_SHAKEN_STATUS_NOOP;
+    }
+
+    for (i = 0; i < sk_X509_REVOKED_num(revoked); i++) {
+
+        r = sk_X509_REVOKED_value(revoked, i);
+        reason = X509_REVOKED_get_ext_d2i(r, NID_crl_reason, NULL, NULL);
+
+        if (reason && ASN1_ENUMERATED_get(reason) == CRL_REASON_REMOVE_FROM_CRL) {
+            stir_shaken_crl_set_remove(is, X509_REVOKED_get0_serialNumber(r));
+        } else if (stir_shaken_crl_set_add(is, X509_REVOKED_get0_serialNumber(r)) != STIR_SHAKEN_STATUS_OK) {
+            ASN1_ENUMERATED_free(reason);
+            stir_shaken_set_error(ss, "Cannot index delta CRL (bad serial or out of memory)", STIR_SHAKEN_ERROR_LOAD_CRL);
+            return STIR_SHAKEN_STATUS_FALSE;
+        }
+
+        ASN1_ENUMERATED_free(reason);
     }
 
+    is->delta_number = number;
+    is->next_update = stir_shaken_crl_next_update(crl);
+
     return STIR_SHAKEN_STATUS_OK;
 }
 
-char* stir_shaken_cert_get_serialHex(stir_shaken_cert_t *cert)
+static stir_shaken_status_t stir_shaken_crl_index_load_file(stir_shaken_context_t *ss, stir_shaken_crl_index_t *index, stir_shaken_cert_store_t *cert_store, const char *name)
 {
-    if (!cert) return NULL;
-    return cert->serialHex;
-}
+    BIO *bio = NULL;
+    X509_CRL *crl = NULL;
+    int n = 0, failed = 0;
+    char err_buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
 
-char* stir_shaken_cert_get_serialDec(stir_shaken_cert_t *cert)
-{
-    if (!cert) return NULL;
-    return cert->serialDec;
-}
+    bio = BIO_new_file(name, "rb");
+    if (!bio) {
+        snprintf(err_buf, sizeof(err_buf), "Cannot open CRL file %s", name);
+        stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_LOAD_CRL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
 
-char* stir_shaken_cert_get_notBefore(stir_shaken_cert_t *cert)
-{
-    if (!cert) return NULL;
-    return cert->notBefore;
-}
+    while ((crl = PEM_read_bio_X509_CRL(bio, NULL, NULL, NULL))) {
+        if (stir_shaken_crl_index_apply(ss, index, cert_store, crl) == STIR_SHAKEN_STATUS_FALSE) failed++;
+        X509_CRL_free(crl);
+        n++;
+    }
 
-char* stir_shaken_cert_get_notAfter(stir_shaken_cert_t *cert)
-{
-    if (!cert) return NULL;
-    return cert->notAfter;
-}
+    if (!n) {
 
-char* stir_shaken_cert_get_issuer(stir_shaken_cert_t *cert)
-{
-    if (!cert) return NULL;
-    return cert->issuer;
-}
+        // Not PEM, try DER
+        (void) BIO_reset(bio);
+        if ((crl = d2i_X509_CRL_bio(bio, NULL))) {
+            if (stir_shaken_crl_index_apply(ss, index, cert_store, crl) == STIR_SHAKEN_STATUS_FALSE) failed++;
+            X509_CRL_free(crl);
+            n++;
+        }
+    }
 
-char* stir_shaken_cert_get_subject(stir_shaken_cert_t *cert)
-{
-    if (!cert) return NULL;
-    return cert->subject;
-}
+    ERR_clear_error();
+    BIO_free(bio);
 
-int stir_shaken_cert_get_version(stir_shaken_cert_t *cert)
-{
-    if (!cert) return -1;
-    return cert->version;
+    if (!n) {
+        snprintf(err_buf, sizeof(err_buf), "No CRL in file %s", name);
+        stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_LOAD_CRL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    return failed ? STIR_SHAKEN_STATUS_FALSE : STIR_SHAKEN_STATUS_OK;
 }
 
-/**
- * @buf - (out) will contain fingerprint, must be of size at least 3*EVP_MAX_MD_SIZE bytes
- * @buflen - (out) will contain string len including '\0'
- */
-stir_shaken_status_t stir_shaken_extract_fingerprint(stir_shaken_context_t *ss, X509* x509, const char *digest_name, char *buf, unsigned int *buflen)
+// Files which aren't (valid) CRLs are skipped, missing dir is no CRLs (as with OpenSSL's lazy dir lookup)
+static stir_shaken_status_t stir_shaken_crl_index_load_dir(stir_shaken_context_t *ss, stir_shaken_crl_index_t *index, stir_shaken_cert_store_t *cert_store, const char *dir)
 {
-    const EVP_MD *evp = NULL;
-    unsigned int i = 0, j = 0;
-    uint8_t raw[EVP_MAX_MD_SIZE] = { 0 };
+    DIR *d = NULL;
+    struct dirent *de = NULL;
+    struct stat sb = { 0 };
+    char name[STIR_SHAKEN_BUFLEN] = { 0 };
+    stir_shaken_context_t ss_file;
+    size_t n = 0;
 
-    if (!x509 || !buf || !buflen || !(evp = EVP_get_digestbyname(digest_name))) {
-        return STIR_SHAKEN_STATUS_FALSE;
+    d = opendir(dir);
+    if (!d) {
+        stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_CERT_STORE, "STIR-Shaken: Cannot open CRL dir %s, no CRLs loaded from it\n", dir);
+        return STIR_SHAKEN_STATUS_OK;
     }
 
-    if (X509_digest(x509, evp, raw, buflen) != 1 ||  buflen <= 0) {
+    while ((de = readdir(d))) {
 
-        stir_shaken_set_error(ss, "Extract_fingerprint: Error in SSL while extracting digest", STIR_SHAKEN_ERROR_SSL);
-        return STIR_SHAKEN_STATUS_FALSE;
-    }
+        if (de->d_name[0] == '.') continue;
 
-    for (i = 0, j = 0; i < *buflen; ++i, j += 3) {
-        sprintf((char*) &buf[j], (i == (*buflen - 1)) ? "%.2X" : "%.2X:", raw[i] & 0xff);
+        snprintf(name, sizeof(name), "%s/%s", dir, de->d_name);
+        if (stat(name, &sb) != 0 || !S_ISREG(sb.st_mode)) continue;
+
+        stir_shaken_clear_error(&ss_file);
+        if (stir_shaken_crl_index_load_file(&ss_file, index, cert_store, name) != STIR_SHAKEN_STATUS_OK) {
+            stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_CERT_STORE, "STIR-Shaken: Skipping CRL file %s: %s\n", name, stir_shaken_is_error_set(&ss_file) ? stir_shaken_get_error(&ss_file, NULL) : "");
+            continue;
+        }
+        n++;
     }
-    *(&buf[j - 1]) = '\0';
 
-    *buflen = j;
+    closedir(d);
+
+    if (!n) {
+        stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_CERT_STORE, "STIR-Shaken: No CRLs in CRL dir %s\n", dir);
+    }
 
     return STIR_SHAKEN_STATUS_OK;
 }
 
-X509* stir_shaken_make_cert_from_public_key(stir_shaken_context_t *ss, EVP_PKEY *pkey)
+// @stale is set if CRL of @x's issuer is past its nextUpdate
+static uint8_t stir_shaken_crl_index_is_revoked(stir_shaken_crl_index_t *index, X509 *x, time_t now, uint8_t *stale)
 {
-    X509 *x = X509_new();
-    if (!x) {
+    const ASN1_INTEGER *serial = X509_get0_serialNumber(x);
+    const unsigned char *data = ASN1_STRING_get0_data(serial);
+    int len = ASN1_STRING_length(serial);
+    stir_shaken_crl_issuer_t *is = NULL;
+    uint8_t revoked = 0;
 
-        stir_shaken_set_error(ss, "Make cert from public key: Failed to  create new X509 certificate", STIR_SHAKEN_ERROR_SSL);
-        return NULL;
+    if (len <= 0 || len > STIR_SHAKEN_SERIAL_MAX_LEN) return 0;
+
+    pthread_rwlock_rdlock(&index->lock);
+    is = stir_shaken_crl_issuer_find(index, X509_get_issuer_name(x));
+    if (is) {
+        *stale = is->next_update && now > is->next_update;
+        revoked = stir_shaken_crl_set_find(is, data, len, stir_shaken_serial_hash(data, len)) >= 0;
     }
+    pthread_rwlock_unlock(&index->lock);
 
-    X509_set_pubkey(x, pkey);
-    return x;
+    return revoked;
 }
 
-stir_shaken_status_t stir_shaken_x509_to_disk(stir_shaken_context_t *ss, X509 *x, const char *cert_full_name)
+// Check all certs in @chain, except trust anchor at the end if @skip_last
+static stir_shaken_status_t stir_shaken_crl_index_check_chain(stir_shaken_context_t *ss, stir_shaken_crl_index_t *index, X509 *x, STACK_OF(X509) *chain, uint8_t skip_last)
 {
-    int				i = 0;
-    char			err_buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
-    FILE			*fp = NULL;
+    char err_buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
+    char subject[STIR_SHAKEN_SSL_BUF_LEN] = { 0 };
+    int i = 0, n = chain ? sk_X509_num(chain) : 0;
+    time_t now = time(NULL);
+    uint8_t stale = 0;
 
-    if (!x || !cert_full_name) goto fail;	
+    if (skip_last && n) n--;
 
-    stir_shaken_clear_error(ss);
+    for (i = -1; i < n; i++) {
 
-    if (cert_full_name) {
+        X509 *c = (i < 0) ? x : sk_X509_value(chain, i);
 
-        fp = fopen(cert_full_name, "w");
-        if (!fp) {
-            sprintf(err_buf, "Failed to create file %s", cert_full_name);
-            stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_GENERAL);
-            goto fail;
+        if (!c) continue;
+
+        if (stir_shaken_crl_index_is_revoked(index, c, now, &stale)) {
+            X509_NAME_oneline(X509_get_subject_name(c), subject, sizeof(subject));
+            snprintf(err_buf, sizeof(err_buf), "Certificate revoked: %s", subject);
+            stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_CERT_REVOKED);
+            return STIR_SHAKEN_STATUS_FALSE;
         }
 
-        i = PEM_write_X509(fp, x);
+        // As OpenSSL's CRL check would (X509_V_ERR_CRL_HAS_EXPIRED)
+        if (stale) {
+            X509_NAME_oneline(X509_get_issuer_name(c), subject, sizeof(subject));
+            snprintf(err_buf, sizeof(err_buf), "CRL of %s is past its nextUpdate", subject);
+            stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_CERT_INVALID);
+            return STIR_SHAKEN_STATUS_FALSE;
+        }
+    }
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+static void stir_shaken_ca_index_clean(stir_shaken_ca_index_t *index)
+{
+    stir_shaken_ca_index_entry_t *e = NULL;
+    size_t i = 0;
+
+    for (i = 0; i < index->capacity; i++) {
+        while ((e = index->buckets[i])) {
+            index->buckets[i] = e->next;
+            X509_free(e->x);
+            free(e);
+        }
+    }
+
+    free(index->buckets);
+    memset(index, 0, sizeof(*index));
+}
+
+static stir_shaken_status_t stir_shaken_ca_index_grow(stir_shaken_ca_index_t *index)
+{
+    stir_shaken_ca_index_entry_t **buckets = NULL, *e = NULL;
+    size_t capacity = index->capacity ? index->capacity * 2 : STIR_SHAKEN_CA_INDEX_MIN, i = 0;
+
+    buckets = calloc(capacity, sizeof(*buckets));
+    if (!buckets) return STIR_SHAKEN_STATUS_FALSE;
+
+    for (i = 0; i < index->capacity; i++) {
+        while ((e = index->buckets[i])) {
+            index->buckets[i] = e->next;
+            e->next = buckets[e->name_hash & (capacity - 1)];
+            buckets[e->name_hash & (capacity - 1)] = e;
+        }
+    }
+
+    free(index->buckets);
+    index->buckets = buckets;
+    index->capacity = capacity;
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+static uint8_t stir_shaken_ca_index_has(stir_shaken_ca_index_t *index, X509 *x, unsigned long h)
+{
+    stir_shaken_ca_index_entry_t *e = NULL;
+
+    if (!index->capacity) return 0;
+
+    for (e = index->buckets[h & (index->capacity - 1)]; e; e = e->next) {
+        if (e->name_hash == h && !X509_cmp(e->x, x)) return 1;
+    }
+
+    return 0;
+}
+
+// Takes own reference to @x. NOOP if the same cert is indexed already.
+static stir_shaken_status_t stir_shaken_ca_index_add(stir_shaken_ca_index_t *index, X509 *x)
+{
+    stir_shaken_ca_index_entry_t *e = NULL;
+    unsigned long h = X509_NAME_hash(X509_get_subject_name(x));
+
+    if (stir_shaken_ca_index_has(index, x, h)) return STIR_SHAKEN_STATUS_NOOP;
+
+    if (index->n >= index->capacity && stir_shaken_ca_index_grow(index) != STIR_SHAKEN_STATUS_OK) {
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    e = calloc(1, sizeof(*e));
+    if (!e) return STIR_SHAKEN_STATUS_FALSE;
+
+    X509_up_ref(x);
+    e->x = x;
+    e->name_hash = h;
+    e->skid = X509_get0_subject_key_id(x);
+    e->next = index->buckets[h & (index->capacity - 1)];
+    index->buckets[h & (index->capacity - 1)] = e;
+    index->n++;
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+// Trusted issuer of @x (no reference taken), preferring one that is currently valid
+static X509* stir_shaken_ca_index_find_issuer(stir_shaken_ca_index_t *index, X509 *x)
+{
+    stir_shaken_ca_index_entry_t *e = NULL;
+    const ASN1_OCTET_STRING *akid = NULL;
+    X509 *found = NULL;
+    unsigned long h = 0;
+
+    if (!index->capacity) return NULL;
+
+    h = X509_NAME_hash(X509_get_issuer_name(x));
+    akid = X509_get0_authority_key_id(x);
+
+    for (e = index->buckets[h & (index->capacity - 1)]; e; e = e->next) {
+
+        if (e->name_hash != h) continue;
+
+        // Cheap reject on key identifier before full issuer check
+        if (akid && e->skid && ASN1_OCTET_STRING_cmp(akid, e->skid)) continue;
+
+        if (X509_check_issued(e->x, x) != X509_V_OK) continue;
+
+        if (X509_cmp_current_time(X509_get0_notBefore(e->x)) < 0 && X509_cmp_current_time(X509_get0_notAfter(e->x)) > 0) {
+            return e->x;
+        }
+
+        if (!found) found = e->x;
+    }
+
+    return found;
+}
+
+// ex_data index the snapshot's CA index is attached to X509_STORE under, allocated once (kept as index + 1, 0 while not allocated)
+static int stir_shaken_ca_index_ex_idx(void)
+{
+    int idx = __atomic_load_n(&stir_shaken_globals.ca_index_ex_idx, __ATOMIC_ACQUIRE), expected = 0;
+
+    if (idx) return idx - 1;
+
+    idx = X509_STORE_get_ex_new_index(0, NULL, NULL, NULL, NULL);
+    if (idx < 0) return -1;
+
+    if (!__atomic_compare_exchange_n(&stir_shaken_globals.ca_index_ex_idx, &expected, idx + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        return expected - 1;
+    }
+
+    return idx;
+}
+
+// X509_STORE get_issuer method: issuer from in-memory index of the snapshot, instead of store lookups (which lock the store)
+static int stir_shaken_ca_index_get_issuer(X509 **issuer, X509_STORE_CTX *ctx, X509 *x)
+{
+    stir_shaken_ca_index_t *index = X509_STORE_get_ex_data(X509_STORE_CTX_get0_store(ctx), stir_shaken_ca_index_ex_idx());
+    X509 *c = index ? stir_shaken_ca_index_find_issuer(index, x) : NULL;
+
+    if (!c) return 0;
+    if (X509_up_ref(c) != 1) return -1;
+
+    *issuer = c;
+    return 1;
+}
+
+// Drop @x from index (with index reference to it)
+static void stir_shaken_ca_index_remove(stir_shaken_ca_index_t *index, X509 *x)
+{
+    stir_shaken_ca_index_entry_t *e = NULL, **pe = NULL;
+    unsigned long h = 0;
+
+    if (!index->capacity) return;
+
+    h = X509_NAME_hash(X509_get_subject_name(x));
+
+    for (pe = &index->buckets[h & (index->capacity - 1)]; (e = *pe); pe = &e->next) {
+        if (e->x == x) {
+            *pe = e->next;
+            X509_free(e->x);
+            free(e);
+            index->n--;
+            return;
+        }
+    }
+}
+
+stir_shaken_status_t stir_shaken_intermediate_pool_init(stir_shaken_context_t *ss)
+{
+    if (pthread_mutex_init(&stir_shaken_globals.intermediate_pool_mutex, NULL) != 0) {
+        stir_shaken_set_error(ss, "Init intermediate pool mutex failed", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (pthread_mutex_init(&stir_shaken_globals.intermediate_pool_get_mutex, NULL) != 0) {
+        pthread_mutex_destroy(&stir_shaken_globals.intermediate_pool_mutex);
+        stir_shaken_set_error(ss, "Init intermediate pool mutex failed", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    stir_shaken_globals.intermediate_pool_max = STIR_SHAKEN_INTERMEDIATE_POOL_MAX;
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+void stir_shaken_intermediate_pool_deinit(void)
+{
+    stir_shaken_intermediate_pool_flush();
+    pthread_mutex_destroy(&stir_shaken_globals.intermediate_pool_get_mutex);
+    pthread_mutex_destroy(&stir_shaken_globals.intermediate_pool_mutex);
+}
+
+// Reference to current pool snapshot, NULL if pool is empty. Snapshot is immutable, no lock needed while using it.
+static stir_shaken_intermediate_pool_t* stir_shaken_intermediate_pool_get(void)
+{
+    stir_shaken_globals_t *g = &stir_shaken_globals;
+    stir_shaken_intermediate_pool_t *pool = NULL;
+
+    if (!__atomic_load_n(&g->intermediate_pool, __ATOMIC_ACQUIRE)) return NULL;
+
+    pthread_mutex_lock(&g->intermediate_pool_get_mutex);
+    pool = g->intermediate_pool;
+    if (pool) {
+        __atomic_add_fetch(&pool->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&g->intermediate_pool_get_mutex);
+
+    return pool;
+}
+
+static void stir_shaken_intermediate_pool_put(stir_shaken_intermediate_pool_t *pool)
+{
+    if (!pool) return;
+
+    if (__atomic_sub_fetch(&pool->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        stir_shaken_ca_index_clean(&pool->index);
+        free(pool);
+    }
+}
+
+// Publish @pool as current snapshot (empty one as NULL), release the old one. Must be called with intermediate_pool_mutex locked.
+static void stir_shaken_intermediate_pool_swap(stir_shaken_intermediate_pool_t *pool)
+{
+    stir_shaken_globals_t *g = &stir_shaken_globals;
+    stir_shaken_intermediate_pool_t *old = NULL;
+
+    if (pool && !pool->index.n) {
+        stir_shaken_intermediate_pool_put(pool);
+        pool = NULL;
+    }
+
+    pthread_mutex_lock(&g->intermediate_pool_get_mutex);
+    old = g->intermediate_pool;
+    __atomic_store_n(&g->intermediate_pool, pool, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&g->intermediate_pool_get_mutex);
+
+    stir_shaken_intermediate_pool_put(old);
+}
+
+// Copy of current snapshot to be changed and published. Must be called with intermediate_pool_mutex locked (only writers swap snapshot).
+static stir_shaken_intermediate_pool_t* stir_shaken_intermediate_pool_copy(void)
+{
+    stir_shaken_intermediate_pool_t *cur = stir_shaken_globals.intermediate_pool, *pool = NULL;
+    stir_shaken_ca_index_entry_t *e = NULL;
+    size_t i = 0;
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool) return NULL;
+    pool->refs = 1;
+
+    for (i = 0; cur && i < cur->index.capacity; i++) {
+        for (e = cur->index.buckets[i]; e; e = e->next) {
+            if (stir_shaken_ca_index_add(&pool->index, e->x) == STIR_SHAKEN_STATUS_FALSE) {
+                stir_shaken_intermediate_pool_put(pool);
+                return NULL;
+            }
+        }
+    }
+
+    return pool;
+}
+
+// Must be called with intermediate_pool_mutex locked, @pool not published yet
+static void stir_shaken_intermediate_pool_evict(stir_shaken_intermediate_pool_t *pool, size_t max)
+{
+    size_t *first = &stir_shaken_globals.intermediate_pool_first;
+
+    while (pool->index.n > max) {
+        stir_shaken_ca_index_remove(&pool->index, stir_shaken_globals.intermediate_pool_fifo[*first]);
+        stir_shaken_globals.intermediate_pool_fifo[*first] = NULL;
+        *first = (*first + 1) % STIR_SHAKEN_INTERMEDIATE_POOL_MAX;
+    }
+}
+
+stir_shaken_status_t stir_shaken_intermediate_pool_add(stir_shaken_context_t *ss, X509 *x)
+{
+    stir_shaken_intermediate_pool_t *cur = NULL, *pool = NULL;
+    stir_shaken_status_t status = STIR_SHAKEN_STATUS_NOOP;
+    size_t max = 0;
+
+    if (!x) {
+        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    // Only certs that can be in the middle of a path
+    if (X509_check_ca(x) == 0 || X509_check_issued(x, x) == X509_V_OK) {
+        ERR_clear_error();
+        return STIR_SHAKEN_STATUS_NOOP;
+    }
+
+    pthread_mutex_lock(&stir_shaken_globals.intermediate_pool_mutex);
+
+    max = stir_shaken_globals.intermediate_pool_max;
+    cur = stir_shaken_globals.intermediate_pool;
+
+    // Already known one (learnt again with every path it is in) makes no new snapshot
+    if (!max || (cur && stir_shaken_ca_index_has(&cur->index, x, X509_NAME_hash(X509_get_subject_name(x))))) {
+        goto done;
+    }
+
+    pool = stir_shaken_intermediate_pool_copy();
+    if (!pool) {
+        status = STIR_SHAKEN_STATUS_FALSE;
+        goto done;
+    }
+
+    // Room for new cert
+    if (pool->index.n >= max) {
+        stir_shaken_intermediate_pool_evict(pool, max - 1);
+    }
+
+    status = stir_shaken_ca_index_add(&pool->index, x);
+    if (status == STIR_SHAKEN_STATUS_OK) {
+        stir_shaken_globals.intermediate_pool_fifo[(stir_shaken_globals.intermediate_pool_first + pool->index.n - 1) % STIR_SHAKEN_INTERMEDIATE_POOL_MAX] = x;
+        stir_shaken_intermediate_pool_swap(pool);
+    } else {
+        stir_shaken_intermediate_pool_put(pool);
+    }
+
+done:
+    pthread_mutex_unlock(&stir_shaken_globals.intermediate_pool_mutex);
+
+    if (status == STIR_SHAKEN_STATUS_FALSE) {
+        stir_shaken_set_error(ss, "Out of memory", STIR_SHAKEN_ERROR_GENERAL);
+    }
+
+    return status;
+}
+
+void stir_shaken_intermediate_pool_set_max(size_t max)
+{
+    stir_shaken_intermediate_pool_t *cur = NULL, *pool = NULL;
+
+    if (max > STIR_SHAKEN_INTERMEDIATE_POOL_MAX) max = STIR_SHAKEN_INTERMEDIATE_POOL_MAX;
+
+    pthread_mutex_lock(&stir_shaken_globals.intermediate_pool_mutex);
+
+    stir_shaken_globals.intermediate_pool_max = max;
+    cur = stir_shaken_globals.intermediate_pool;
+
+    if (cur && cur->index.n > max && (pool = stir_shaken_intermediate_pool_copy())) {
+        stir_shaken_intermediate_pool_evict(pool, max);
+        stir_shaken_intermediate_pool_swap(pool);
+    }
+
+    pthread_mutex_unlock(&stir_shaken_globals.intermediate_pool_mutex);
+}
+
+size_t stir_shaken_intermediate_pool_size(void)
+{
+    stir_shaken_intermediate_pool_t *pool = stir_shaken_intermediate_pool_get();
+    size_t n = pool ? pool->index.n : 0;
+
+    stir_shaken_intermediate_pool_put(pool);
+    return n;
+}
+
+void stir_shaken_intermediate_pool_flush(void)
+{
+    pthread_mutex_lock(&stir_shaken_globals.intermediate_pool_mutex);
+    stir_shaken_intermediate_pool_swap(NULL);
+    memset(stir_shaken_globals.intermediate_pool_fifo, 0, sizeof(stir_shaken_globals.intermediate_pool_fifo));
+    stir_shaken_globals.intermediate_pool_first = 0;
+    pthread_mutex_unlock(&stir_shaken_globals.intermediate_pool_mutex);
+}
+
+// Intermediates from validated path @chain (leaf and trust anchor excluded) not in @pool snapshot yet
+static void stir_shaken_intermediate_pool_learn(stir_shaken_intermediate_pool_t *pool, STACK_OF(X509) *chain)
+{
+    int i = 0, n = chain ? sk_X509_num(chain) : 0;
+    X509 *x = NULL;
+
+    for (i = 1; i + 1 < n; i++) {
+
+        x = sk_X509_value(chain, i);
+        if (pool && stir_shaken_ca_index_has(&pool->index, x, X509_NAME_hash(X509_get_subject_name(x)))) continue;
+
+        stir_shaken_intermediate_pool_add(NULL, x);
+    }
+}
+
+/*
+ * Untrusted certs for building path of @x: @xchain, plus issuers of @x (and of theirs) found in @pool snapshot and not in @xchain.
+ * Returns @xchain if pool has nothing to add, otherwise new stack (holding references) which must be freed with sk_X509_pop_free.
+ */
+static STACK_OF(X509)* stir_shaken_intermediate_pool_untrusted(stir_shaken_intermediate_pool_t *pool, X509 *x, STACK_OF(X509) *xchain)
+{
+    STACK_OF(X509) *untrusted = NULL;
+    X509 *c = x, *issuer = NULL;
+    int i = 0, depth = 0;
+
+    if (!x || !pool) return xchain;
+
+    for (depth = 0; depth < STIR_SHAKEN_INTERMEDIATE_CHAIN_MAX; depth++) {
+
+        if (X509_check_issued(c, c) == X509_V_OK) break;
+
+        issuer = NULL;
+        for (i = 0; xchain && i < sk_X509_num(xchain); i++) {
+            if (X509_check_issued(sk_X509_value(xchain, i), c) == X509_V_OK) {
+                issuer = sk_X509_value(xchain, i);
+                break;
+            }
+        }
+
+        if (!issuer) {
+
+            if (!(issuer = stir_shaken_ca_index_find_issuer(&pool->index, c))) break;
+
+            if (!untrusted) {
+                if (!(untrusted = sk_X509_new_null())) break;
+                for (i = 0; xchain && i < sk_X509_num(xchain); i++) {
+                    X509_up_ref(sk_X509_value(xchain, i));
+                    if (!sk_X509_push(untrusted, sk_X509_value(xchain, i))) X509_free(sk_X509_value(xchain, i));
+                }
+            }
+
+            X509_up_ref(issuer);
+            if (!sk_X509_push(untrusted, issuer)) {
+                X509_free(issuer);
+                break;
+            }
+        }
+
+        c = issuer;
+    }
+
+    ERR_clear_error();
+
+    return untrusted ? untrusted : xchain;
+}
+
+/*
+ * CRL issued by intermediate CA: pool cert with CRL issuer's name (allowed to sign CRLs) whose key verifies @crl
+ * and whose own path, built through the pool, validates in @store.
+ */
+static stir_shaken_status_t stir_shaken_intermediate_pool_verify_crl(X509_STORE *store, X509_CRL *crl)
+{
+    stir_shaken_intermediate_pool_t *pool = NULL;
+    stir_shaken_ca_index_entry_t *e = NULL;
+    STACK_OF(X509) *untrusted = NULL;
+    X509_STORE_CTX *verify_ctx = NULL;
+    X509_NAME *name = X509_CRL_get_issuer(crl);
+    unsigned long h = X509_NAME_hash(name);
+    stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+
+    if (!store || !(pool = stir_shaken_intermediate_pool_get())) return STIR_SHAKEN_STATUS_FALSE;
+
+    for (e = pool->index.buckets[h & (pool->index.capacity - 1)]; e && status != STIR_SHAKEN_STATUS_OK; e = e->next) {
+
+        if (e->name_hash != h || X509_NAME_cmp(X509_get_subject_name(e->x), name)) continue;
+
+        if (!(X509_get_key_usage(e->x) & KU_CRL_SIGN) || X509_CRL_verify(crl, X509_get0_pubkey(e->x)) != 1) continue;
+
+        if (!(verify_ctx = X509_STORE_CTX_new())) break;
+
+        untrusted = stir_shaken_intermediate_pool_untrusted(pool, e->x, NULL);
+
+        if (X509_STORE_CTX_init(verify_ctx, store, e->x, untrusted) == 1 && X509_verify_cert(verify_ctx) == 1) {
+            status = STIR_SHAKEN_STATUS_OK;
+        }
+
+        X509_STORE_CTX_free(verify_ctx);
+        sk_X509_pop_free(untrusted, X509_free);
+    }
+
+    stir_shaken_intermediate_pool_put(pool);
+    ERR_clear_error();
+
+    return status;
+}
+
+/*
+ * All certs from PEM file, NULL if file cannot be read. Certs are decoded and their extensions cached,
+ * so nothing is left to be done for them under a lock once they are being merged into the snapshot.
+ */
+static STACK_OF(X509)* stir_shaken_ca_file_read(const char *name)
+{
+    BIO *bio = NULL;
+    STACK_OF(X509) *certs = NULL;
+    X509 *x = NULL;
+
+    bio = BIO_new_file(name, "r");
+    if (!bio) {
+        ERR_clear_error();
+        return NULL;
+    }
+
+    certs = sk_X509_new_null();
+
+    while (certs && (x = PEM_read_bio_X509_AUX(bio, NULL, NULL, NULL))) {
+
+        X509_check_purpose(x, -1, 0);
+
+        if (!sk_X509_push(certs, x)) {
+            X509_free(x);
+            sk_X509_pop_free(certs, X509_free);
+            certs = NULL;
+        }
+    }
+
+    ERR_clear_error();
+    BIO_free(bio);
+
+    return certs;
+}
+
+// Certs into trust index. Index is the only issuer lookup path, X509_STORE itself holds no certs.
+static stir_shaken_status_t stir_shaken_ca_index_merge(stir_shaken_ca_index_t *index, STACK_OF(X509) *certs)
+{
+    int i = 0;
+
+    for (i = 0; i < sk_X509_num(certs); i++) {
+        if (stir_shaken_ca_index_add(index, sk_X509_value(certs, i)) == STIR_SHAKEN_STATUS_FALSE) {
+            return STIR_SHAKEN_STATUS_FALSE;
+        }
+    }
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+static stir_shaken_status_t stir_shaken_ca_index_merge_file(stir_shaken_context_t *ss, stir_shaken_ca_index_t *index, const char *name, STACK_OF(X509) *certs)
+{
+    char err_buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
+
+    if (!certs) {
+        snprintf(err_buf, sizeof(err_buf), "Cannot open CA file %s", name);
+        stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_LOAD_CA);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (stir_shaken_ca_index_merge(index, certs) != STIR_SHAKEN_STATUS_OK) {
+        stir_shaken_set_error(ss, "Cannot add CA to trust store", STIR_SHAKEN_ERROR_LOAD_CA);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (!sk_X509_num(certs)) {
+        snprintf(err_buf, sizeof(err_buf), "No certificate in CA file %s", name);
+        stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_LOAD_CA);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+// All certs from PEM file into trust index
+static stir_shaken_status_t stir_shaken_ca_index_load_file(stir_shaken_context_t *ss, stir_shaken_ca_index_t *index, const char *name)
+{
+    STACK_OF(X509) *certs = stir_shaken_ca_file_read(name);
+    stir_shaken_status_t status = stir_shaken_ca_index_merge_file(ss, index, name, certs);
+
+    sk_X509_pop_free(certs, X509_free);
+    return status;
+}
+
+// <subject name hash>.<n>, as created by c_rehash/openssl rehash (CRLs are <hash>.r<n>)
+static uint8_t stir_shaken_ca_index_is_hashed_name(const char *name)
+{
+    int i = 0;
+
+    for (i = 0; i < 8; i++) {
+        if (!isxdigit((unsigned char) name[i])) return 0;
+    }
+
+    if (name[i++] != '.' || !name[i]) return 0;
+
+    for (; name[i]; i++) {
+        if (!isdigit((unsigned char) name[i])) return 0;
+    }
+
+    return 1;
+}
+
+static void* stir_shaken_ca_load_worker(void *arg)
+{
+    stir_shaken_ca_load_t *load = arg;
+    size_t i = 0;
+
+    while ((i = __atomic_fetch_add(&load->next, 1, __ATOMIC_RELAXED)) < load->n) {
+        load->files[i].certs = stir_shaken_ca_file_read(load->files[i].name);
+    }
+
+    return NULL;
+}
+
+// Parse all files, on worker threads if there are many of them. Files are independent, each worker takes next one not taken yet.
+static void stir_shaken_ca_load_parse(stir_shaken_ca_load_t *load)
+{
+    pthread_t threads[STIR_SHAKEN_CA_LOAD_THREADS_MAX];
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    int n = 0, i = 0;
+
+    if (load->n >= STIR_SHAKEN_CA_LOAD_PARALLEL_MIN && cpus > 1) {
+
+        n = cpus < STIR_SHAKEN_CA_LOAD_THREADS_MAX ? cpus : STIR_SHAKEN_CA_LOAD_THREADS_MAX;
+
+        // Calling thread is a worker too
+        for (i = 0; i < n - 1; i++) {
+            if (pthread_create(&threads[i], NULL, stir_shaken_ca_load_worker, load) != 0) break;
+        }
+        n = i;
+    }
+
+    stir_shaken_ca_load_worker(load);
+
+    for (i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
+// Hashed CA directory, loaded eagerly. Only files named the way OpenSSL's directory lookup would find them are trusted.
+static stir_shaken_status_t stir_shaken_ca_index_load_dir(stir_shaken_context_t *ss, stir_shaken_ca_index_t *index, const char *dir)
+{
+    DIR *d = NULL;
+    struct dirent *de = NULL;
+    char name[STIR_SHAKEN_BUFLEN] = { 0 };
+    stir_shaken_ca_load_t load = { 0 };
+    stir_shaken_ca_load_file_t *files = NULL;
+    stir_shaken_context_t ss_file;
+    stir_shaken_status_t status = STIR_SHAKEN_STATUS_OK;
+    size_t capacity = 0, i = 0;
+
+    d = opendir(dir);
+    if (!d) {
+        stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_CERT_STORE, "STIR-Shaken: Cannot open CA dir %s, no CAs loaded from it\n", dir);
+        return STIR_SHAKEN_STATUS_OK;
+    }
+
+    while ((de = readdir(d))) {
+
+        if (!stir_shaken_ca_index_is_hashed_name(de->d_name)) continue;
+
+        if (load.n == capacity) {
+            capacity = capacity ? capacity * 2 : STIR_SHAKEN_CA_INDEX_MIN;
+            if (!(files = realloc(load.files, capacity * sizeof(*files)))) {
+                status = STIR_SHAKEN_STATUS_FALSE;
+                break;
+            }
+            load.files = files;
+        }
+
+        snprintf(name, sizeof(name), "%s/%s", dir, de->d_name);
+        load.files[load.n].certs = NULL;
+        if (!(load.files[load.n].name = strdup(name))) {
+            status = STIR_SHAKEN_STATUS_FALSE;
+            break;
+        }
+        load.n++;
+    }
+
+    closedir(d);
+
+    if (status == STIR_SHAKEN_STATUS_OK) {
+
+        stir_shaken_ca_load_parse(&load);
+
+        // Merged in directory order, on calling thread only
+        for (i = 0; i < load.n; i++) {
+
+            stir_shaken_clear_error(&ss_file);
+            if (stir_shaken_ca_index_merge_file(&ss_file, index, load.files[i].name, load.files[i].certs) != STIR_SHAKEN_STATUS_OK) {
+                stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_CERT_STORE, "STIR-Shaken: Skipping CA file %s: %s\n", load.files[i].name, stir_shaken_is_error_set(&ss_file) ? stir_shaken_get_error(&ss_file, NULL) : "");
+            }
+        }
+
+    } else {
+        stir_shaken_set_error(ss, "Out of memory", STIR_SHAKEN_ERROR_GENERAL);
+    }
+
+    for (i = 0; i < load.n; i++) {
+        free(load.files[i].name);
+        sk_X509_pop_free(load.files[i].certs, X509_free);
+    }
+    free(load.files);
+
+    return status;
+}
+
+// Index can be attached to published snapshot by stir_shaken_crl_add
+static stir_shaken_crl_index_t* stir_shaken_cert_store_crl_index(stir_shaken_cert_store_t *cert_store)
+{
+    return __atomic_load_n(&cert_store->crl_index, __ATOMIC_ACQUIRE);
+}
+
+static stir_shaken_status_t stir_shaken_cert_store_crl_apply(stir_shaken_context_t *ss, stir_shaken_cert_store_t *cert_store, X509_CRL *crl)
+{
+    stir_shaken_crl_index_t *index = NULL;
+    stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+
+    // First CRL for store which was loaded without any
+    index = stir_shaken_cert_store_crl_index(cert_store);
+    if (!index) {
+
+        stir_shaken_crl_index_t *expected = NULL;
+
+        index = stir_shaken_crl_index_create();
+        if (!index) {
+            stir_shaken_set_error(ss, "Out of memory", STIR_SHAKEN_ERROR_GENERAL);
+            return STIR_SHAKEN_STATUS_FALSE;
+        }
+
+        if (!__atomic_compare_exchange_n(&cert_store->crl_index, &expected, index, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            stir_shaken_crl_index_destroy(index);
+            index = expected;
+        }
+    }
+
+    pthread_rwlock_wrlock(&index->lock);
+    status = stir_shaken_crl_index_apply(ss, index, cert_store, crl);
+    pthread_rwlock_unlock(&index->lock);
+
+    return status;
+}
+
+// Keep @crl for snapshots built later. Full CRL supersedes CRLs kept for its issuer. Called with cert_store_crls_mutex held.
+static void stir_shaken_crl_retain(X509_CRL *crl)
+{
+    stir_shaken_globals_t *g = &stir_shaken_globals;
+    X509_CRL *kept = NULL;
+    int i = 0;
+
+    if (!g->cert_store_crls && !(g->cert_store_crls = sk_X509_CRL_new_null())) return;
+
+    if (stir_shaken_crl_get_number(crl, NID_delta_crl) < 0) {
+
+        for (i = sk_X509_CRL_num(g->cert_store_crls) - 1; i >= 0; i--) {
+
+            kept = sk_X509_CRL_value(g->cert_store_crls, i);
+            if (!X509_NAME_cmp(X509_CRL_get_issuer(kept), X509_CRL_get_issuer(crl))) {
+                (void) sk_X509_CRL_delete(g->cert_store_crls, i);
+                X509_CRL_free(kept);
+            }
+        }
+    }
+
+    if (X509_CRL_up_ref(crl) == 1 && !sk_X509_CRL_push(g->cert_store_crls, crl)) {
+        X509_CRL_free(crl);
+    }
+}
+
+stir_shaken_status_t stir_shaken_crl_add(stir_shaken_context_t *ss, X509_CRL *crl)
+{
+    stir_shaken_cert_store_t *cert_store = NULL;
+    stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+
+    if (!crl) {
+        stir_shaken_set_error(ss, "CRL not set", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    // Serialised with rebuilding trust store, so that CRL is either in snapshot being built, or applied to it once published
+    pthread_mutex_lock(&stir_shaken_globals.cert_store_crls_mutex);
+
+    cert_store = stir_shaken_cert_store_get();
+    if (!cert_store) {
+        pthread_mutex_unlock(&stir_shaken_globals.cert_store_crls_mutex);
+        stir_shaken_set_error(ss, "Cert store not set", STIR_SHAKEN_ERROR_CERT_STORE);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    status = stir_shaken_cert_store_crl_apply(ss, cert_store, crl);
+    if (status == STIR_SHAKEN_STATUS_OK) {
+        stir_shaken_crl_retain(crl);
+    }
+
+    pthread_mutex_unlock(&stir_shaken_globals.cert_store_crls_mutex);
+
+    stir_shaken_cert_store_put(cert_store);
+    return status;
+}
+
+stir_shaken_status_t stir_shaken_crl_load(stir_shaken_context_t *ss, const char *name)
+{
+    BIO *bio = NULL;
+    X509_CRL *crl = NULL;
+    int n = 0, failed = 0;
+
+    if (stir_shaken_zstr(name)) {
+        stir_shaken_set_error(ss, "CRL file name not set", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    bio = BIO_new_file(name, "rb");
+    if (!bio) {
+        stir_shaken_set_error(ss, "Cannot open CRL file", STIR_SHAKEN_ERROR_LOAD_CRL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    while ((crl = PEM_read_bio_X509_CRL(bio, NULL, NULL, NULL))) {
+        if (stir_shaken_crl_add(ss, crl) != STIR_SHAKEN_STATUS_OK) failed++;
+        X509_CRL_free(crl);
+        n++;
+    }
+
+    if (!n) {
+        (void) BIO_reset(bio);
+        if ((crl = d2i_X509_CRL_bio(bio, NULL))) {
+            if (stir_shaken_crl_add(ss, crl) != STIR_SHAKEN_STATUS_OK) failed++;
+            X509_CRL_free(crl);
+            n++;
+        }
+    }
+
+    ERR_clear_error();
+    BIO_free(bio);
+
+    if (!n) {
+        stir_shaken_set_error(ss, "No CRL in file", STIR_SHAKEN_ERROR_LOAD_CRL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    return failed ? STIR_SHAKEN_STATUS_FALSE : STIR_SHAKEN_STATUS_OK;
+}
+
+static void stir_shaken_ocsp_cache_entry_destroy(stir_shaken_ocsp_cache_entry_t *e)
+{
+    if (!e) return;
+
+    free(e->id);
+    free(e);
+}
+
+// Must be called with ocsp_mutex locked
+static stir_shaken_ocsp_cache_entry_t* stir_shaken_ocsp_cache_find(const unsigned char *id, int id_len, uint32_t h)
+{
+    stir_shaken_ocsp_cache_entry_t *e = stir_shaken_globals.ocsp_cache[h % STIR_SHAKEN_OCSP_CACHE_BUCKETS];
+
+    while (e) {
+        if (e->hash == h && e->id_len == id_len && !memcmp(e->id, id, id_len)) {
+            return e;
+        }
+        e = e->next;
+    }
+
+    return NULL;
+}
+
+// Must be called with ocsp_mutex locked
+static void stir_shaken_ocsp_cache_unlink(stir_shaken_ocsp_cache_entry_t *e)
+{
+    stir_shaken_ocsp_cache_entry_t **pe = &stir_shaken_globals.ocsp_cache[e->hash % STIR_SHAKEN_OCSP_CACHE_BUCKETS];
+
+    while (*pe && *pe != e) {
+        pe = &(*pe)->next;
+    }
+
+    if (*pe) {
+        *pe = e->next;
+        stir_shaken_globals.ocsp_cache_n--;
+    }
+
+    stir_shaken_expiry_cancel(&stir_shaken_globals.ocsp_cache_expiry, &e->expiry);
+    stir_shaken_ocsp_cache_entry_destroy(e);
+}
+
+// Must be called with ocsp_mutex locked. Entries being looked up are kept, their owner still points to them.
+static void stir_shaken_ocsp_cache_remove(void)
+{
+    stir_shaken_ocsp_cache_entry_t *e = NULL, **pe = NULL;
+    int i = 0;
+
+    // Only entries which are not pending are scheduled
+    stir_shaken_expiry_destroy(&stir_shaken_globals.ocsp_cache_expiry);
+
+    for (i = 0; i < STIR_SHAKEN_OCSP_CACHE_BUCKETS; i++) {
+
+        pe = &stir_shaken_globals.ocsp_cache[i];
+        while ((e = *pe)) {
+
+            if (!e->pending) {
+                *pe = e->next;
+                stir_shaken_ocsp_cache_entry_destroy(e);
+                stir_shaken_globals.ocsp_cache_n--;
+            } else {
+                pe = &e->next;
+            }
+        }
+    }
+}
+
+/*
+ * Must be called with ocsp_mutex locked. Drop entries expired by @now, then ones expiring first while there are @max or more.
+ * Pending entries are never scheduled, so never dropped here.
+ */
+static void stir_shaken_ocsp_cache_evict(time_t now, int max)
+{
+    stir_shaken_expiry_node_t *node = NULL;
+
+    while ((node = stir_shaken_expiry_first(&stir_shaken_globals.ocsp_cache_expiry)) && (node->at <= now || stir_shaken_globals.ocsp_cache_n >= max)) {
+        stir_shaken_ocsp_cache_unlink(STIR_SHAKEN_EXPIRY_ENTRY(node, stir_shaken_ocsp_cache_entry_t, expiry));
+    }
+}
+
+void stir_shaken_ocsp_cache_expire(void)
+{
+    pthread_mutex_lock(&stir_shaken_globals.ocsp_mutex);
+    stir_shaken_ocsp_cache_evict(time(NULL), INT_MAX);
+    pthread_mutex_unlock(&stir_shaken_globals.ocsp_mutex);
+}
+
+// Must be called with ocsp_mutex locked. New entry is pending, NULL if cache is full.
+static stir_shaken_ocsp_cache_entry_t* stir_shaken_ocsp_cache_add(const unsigned char *id, int id_len, uint32_t h)
+{
+    stir_shaken_ocsp_cache_entry_t *e = NULL;
+    unsigned long b = h % STIR_SHAKEN_OCSP_CACHE_BUCKETS;
+
+    if (stir_shaken_globals.ocsp_cache_n >= STIR_SHAKEN_OCSP_CACHE_MAX) {
+        stir_shaken_ocsp_cache_evict(time(NULL), STIR_SHAKEN_OCSP_CACHE_MAX);
+        if (stir_shaken_globals.ocsp_cache_n >= STIR_SHAKEN_OCSP_CACHE_MAX) return NULL;
+    }
+
+    e = calloc(1, sizeof(*e));
+    if (!e) return NULL;
+
+    e->id = malloc(id_len);
+    if (!e->id) {
+        free(e);
+        return NULL;
+    }
+
+    memcpy(e->id, id, id_len);
+    e->id_len = id_len;
+    e->hash = h;
+    e->status = STIR_SHAKEN_OCSP_STATUS_FAILED;
+    e->pending = 1;
+    e->next = stir_shaken_globals.ocsp_cache[b];
+    stir_shaken_globals.ocsp_cache[b] = e;
+    stir_shaken_globals.ocsp_cache_n++;
+
+    return e;
+}
+
+// Responder configured or from AIA extension of @x, NULL if none. Must be freed.
+static char* stir_shaken_ocsp_responder(X509 *x)
+{
+    STACK_OF(OPENSSL_STRING) *urls = NULL;
+    char *url = NULL;
+
+    pthread_mutex_lock(&stir_shaken_globals.ocsp_mutex);
+    if (stir_shaken_globals.ocsp_responder) {
+        url = strdup(stir_shaken_globals.ocsp_responder);
+    }
+    pthread_mutex_unlock(&stir_shaken_globals.ocsp_mutex);
+
+    if (url) return url;
+
+    urls = X509_get1_ocsp(x);
+    if (urls && sk_OPENSSL_STRING_num(urls) > 0) {
+        url = strdup(sk_OPENSSL_STRING_value(urls, 0));
+    }
+    X509_email_free(urls);
+
+    return url;
+}
+
+// RFC 6960, A.1: {responder}/{url-encoding of base64 encoding of DER request}. Must be freed.
+static char* stir_shaken_ocsp_get_url(const char *responder, OCSP_REQUEST *req)
+{
+    unsigned char *der = NULL, *b64 = NULL;
+    char *url = NULL, *p = NULL;
+    int der_len = 0, b64_len = 0, i = 0;
+    size_t len = strlen(responder);
+
+    der_len = i2d_OCSP_REQUEST(req, &der);
+    if (der_len <= 0) return NULL;
+
+    b64 = malloc(4 * ((der_len + 2) / 3) + 1);
+    if (!b64) goto done;
+    b64_len = EVP_EncodeBlock(b64, der, der_len);
+
+    url = malloc(len + 1 + 3 * b64_len + 1);
+    if (!url) goto done;
+
+    p = url + sprintf(url, "%s%s", responder, (len && responder[len - 1] == '/') ? "" : "/");
+    for (i = 0; i < b64_len; i++) {
+        if (b64[i] == '+' || b64[i] == '/' || b64[i] == '=') {
+            p += sprintf(p, "%%%02X", b64[i]);
+        } else {
+            *p++ = b64[i];
+        }
+    }
+    *p = '\0';
+
+done:
+    OPENSSL_free(der);
+    free(b64);
+    return url;
+}
+
+// One round-trip to @responder. Certificate status or STIR_SHAKEN_OCSP_STATUS_FAILED, @expires is nextUpdate (0 if response has none).
+static int stir_shaken_ocsp_fetch(stir_shaken_context_t *ss, const char *responder, X509 *issuer, OCSP_CERTID *id, time_t *expires)
+{
+    stir_shaken_cert_store_t *cert_store = NULL;
+    stir_shaken_http_req_t http_req = { 0 };
+    OCSP_REQUEST *req = NULL;
+    OCSP_CERTID *req_id = NULL;
+    OCSP_RESPONSE *resp = NULL;
+    OCSP_BASICRESP *bs = NULL;
+    STACK_OF(X509) *certs = NULL;
+    ASN1_GENERALIZEDTIME *this_update = NULL, *next_update = NULL;
+    const unsigned char *p = NULL;
+    int status = STIR_SHAKEN_OCSP_STATUS_FAILED, cert_status = -1, reason = 0;
+    char err_buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
+    struct tm tm = { 0 };
+
+    *expires = 0;
+
+    // No nonce, so that response can be cached (and responder can serve pre-signed ones)
+    req = OCSP_REQUEST_new();
+    req_id = OCSP_CERTID_dup(id);
+    if (!req || !req_id || !OCSP_request_add0_id(req, req_id)) {
+        OCSP_CERTID_free(req_id);
+        stir_shaken_set_error(ss, "OCSP: Cannot create request", STIR_SHAKEN_ERROR_SSL);
+        goto done;
+    }
+
+    http_req.url = stir_shaken_ocsp_get_url(responder, req);
+    if (!http_req.url) {
+        stir_shaken_set_error(ss, "OCSP: Cannot encode request", STIR_SHAKEN_ERROR_SSL);
+        goto done;
+    }
+
+    if (stir_shaken_make_http_get_req(ss, &http_req) != STIR_SHAKEN_STATUS_OK || http_req.response.code != 200 || !http_req.response.mem.mem) {
+        snprintf(err_buf, sizeof(err_buf), "OCSP: No response from %s (HTTP code %ld)", responder, http_req.response.code);
+        stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_OCSP);
+        goto done;
+    }
+
+    p = (const unsigned char *) http_req.response.mem.mem;
+    resp = d2i_OCSP_RESPONSE(NULL, &p, http_req.response.mem.size);
+    if (!resp || OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL || !(bs = OCSP_response_get1_basic(resp))) {
+        stir_shaken_set_error(ss, "OCSP: Unsuccessful response", STIR_SHAKEN_ERROR_OCSP);
+        goto done;
+    }
+
+    // Signer must be the issuer or responder delegated by it, chaining up to trust store
+    cert_store = stir_shaken_cert_store_get();
+    certs = sk_X509_new_null();
+    if (!cert_store || !certs || !sk_X509_push(certs, issuer) || OCSP_basic_verify(bs, certs, cert_store->store, 0) != 1) {
+        stir_shaken_set_error(ss, "OCSP: Response signature does not verify", STIR_SHAKEN_ERROR_OCSP);
+        goto done;
+    }
+
+    if (OCSP_resp_find_status(bs, id, &cert_status, &reason, NULL, &this_update, &next_update) != 1) {
+        stir_shaken_set_error(ss, "OCSP: No status for certificate in response", STIR_SHAKEN_ERROR_OCSP);
+        goto done;
+    }
+
+    if (OCSP_check_validity(this_update, next_update, STIR_SHAKEN_OCSP_MAX_SKEW, -1) != 1) {
+        stir_shaken_set_error(ss, "OCSP: Response is not current", STIR_SHAKEN_ERROR_OCSP);
+        goto done;
+    }
+
+    if (next_update && ASN1_TIME_to_tm(next_update, &tm) == 1) {
+        *expires = timegm(&tm);
+    }
+    status = cert_status;
+
+done:
+    ERR_clear_error();
+    sk_X509_free(certs);
+    stir_shaken_cert_store_put(cert_store);
+    OCSP_BASICRESP_free(bs);
+    OCSP_RESPONSE_free(resp);
+    OCSP_REQUEST_free(req);
+    stir_shaken_destroy_http_request(&http_req);
+
+    return status;
+}
+
+stir_shaken_status_t stir_shaken_ocsp_check(stir_shaken_context_t *ss, X509 *x, X509 *issuer)
+{
+    stir_shaken_ocsp_cache_entry_t *e = NULL;
+    OCSP_CERTID *id = NULL;
+    unsigned char *der = NULL;
+    int der_len = 0, status = STIR_SHAKEN_OCSP_STATUS_FAILED;
+    uint32_t h = 0;
+    time_t expires = 0;
+    char *responder = NULL;
+    char err_buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
+    char subject[STIR_SHAKEN_SSL_BUF_LEN] = { 0 };
+    stir_shaken_context_t ss_ocsp;             // errors of the lookup, not to be mixed with caller's (soft fail leaves them untouched)
+
+    // Only count needs to be reset, entries are written before they are read
+    stir_shaken_clear_error(&ss_ocsp);
+
+    if (!x || !issuer) {
+        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    X509_NAME_oneline(X509_get_subject_name(x), subject, sizeof(subject));
+
+    responder = stir_shaken_ocsp_responder(x);
+    if (!responder) {
+        stir_shaken_log(STIR_SHAKEN_LOGLEVEL_HIGH, STIR_SHAKEN_LOG_OCSP, "STIR-Shaken: OCSP: No responder for %s, not checked\n", subject);
+        return STIR_SHAKEN_STATUS_OK;
+    }
+
+    id = OCSP_cert_to_id(EVP_sha1(), x, issuer);
+    if (!id || (der_len = i2d_OCSP_CERTID(id, &der)) <= 0) {
+        stir_shaken_set_error(ss, "OCSP: Cannot create certificate ID", STIR_SHAKEN_ERROR_SSL);
+        OCSP_CERTID_free(id);
+        free(responder);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+    h = stir_shaken_serial_hash(der, der_len);
+
+    pthread_mutex_lock(&stir_shaken_globals.ocsp_mutex);
+
+    // Same certificate is being looked up already, wait for its result
+    while ((e = stir_shaken_ocsp_cache_find(der, der_len, h)) && e->pending) {
+        pthread_cond_wait(&stir_shaken_globals.ocsp_cond, &stir_shaken_globals.ocsp_mutex);
+    }
+
+    if (e && e->expires > time(NULL)) {
+
+        status = e->status;
+        pthread_mutex_unlock(&stir_shaken_globals.ocsp_mutex);
+
+    } else {
+
+        if (e) {
+            stir_shaken_expiry_cancel(&stir_shaken_globals.ocsp_cache_expiry, &e->expiry);
+            e->pending = 1;
+        } else {
+            e = stir_shaken_ocsp_cache_add(der, der_len, h);
+        }
+        pthread_mutex_unlock(&stir_shaken_globals.ocsp_mutex);
+
+        status = stir_shaken_ocsp_fetch(&ss_ocsp, responder, issuer, id, &expires);
+
+        if (e) {
+            pthread_mutex_lock(&stir_shaken_globals.ocsp_mutex);
+            e->status = status;
+            e->expires = (status == STIR_SHAKEN_OCSP_STATUS_FAILED) ? time(NULL) + STIR_SHAKEN_OCSP_FAIL_TTL : expires;
+            e->pending = 0;
+            if (stir_shaken_expiry_schedule(&stir_shaken_globals.ocsp_cache_expiry, &e->expiry, e->expires) != STIR_SHAKEN_STATUS_OK) {
+                // Would never be evicted
+                stir_shaken_ocsp_cache_unlink(e);
+            }
+            pthread_cond_broadcast(&stir_shaken_globals.ocsp_cond);
+            pthread_mutex_unlock(&stir_shaken_globals.ocsp_mutex);
+        }
+    }
+
+    OPENSSL_free(der);
+    OCSP_CERTID_free(id);
+    free(responder);
+
+    if (status == V_OCSP_CERTSTATUS_GOOD) {
+        return STIR_SHAKEN_STATUS_OK;
+    }
+
+    if (status == V_OCSP_CERTSTATUS_REVOKED) {
+        snprintf(err_buf, sizeof(err_buf), "Certificate revoked (OCSP): %s", subject);
+        stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_CERT_REVOKED);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (stir_shaken_is_error_set(&ss_ocsp)) {
+        stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_OCSP, "STIR-Shaken: OCSP: Lookup for %s failed: %s\n", subject, stir_shaken_get_error(&ss_ocsp, NULL));
+    }
+
+    if (!__atomic_load_n(&stir_shaken_globals.ocsp_hard_fail, __ATOMIC_ACQUIRE)) {
+        stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_OCSP, "STIR-Shaken: OCSP: No status for %s, ignored\n", subject);
+        return STIR_SHAKEN_STATUS_OK;
+    }
+
+    snprintf(err_buf, sizeof(err_buf), "OCSP: No status for certificate: %s", subject);
+    stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_OCSP);
+    return STIR_SHAKEN_STATUS_FALSE;
+}
+
+// OCSP status of every certificate in built path @chain (each one issued by the next), but trust anchor
+static stir_shaken_status_t stir_shaken_ocsp_check_chain(stir_shaken_context_t *ss, STACK_OF(X509) *chain)
+{
+    int i = 0, n = chain ? sk_X509_num(chain) : 0;
+
+    for (i = 0; i + 1 < n; i++) {
+        if (stir_shaken_ocsp_check(ss, sk_X509_value(chain, i), sk_X509_value(chain, i + 1)) != STIR_SHAKEN_STATUS_OK) {
+            return STIR_SHAKEN_STATUS_FALSE;
+        }
+    }
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+// Like stir_shaken_ocsp_check_chain, for cert which has been validated before: walk issuers (from @untrusted or trust store) up to trust anchor
+static stir_shaken_status_t stir_shaken_ocsp_check_cert(stir_shaken_context_t *ss, stir_shaken_cert_store_t *cert_store, X509 *x, STACK_OF(X509) *untrusted)
+{
+    stir_shaken_status_t status = STIR_SHAKEN_STATUS_OK;
+    X509 *c = x, *issuer = NULL;
+    int i = 0, depth = 0;
+
+    for (depth = 0; depth < STIR_SHAKEN_OCSP_CHAIN_MAX && status == STIR_SHAKEN_STATUS_OK; depth++) {
+
+        if (X509_check_issued(c, c) == X509_V_OK) break;
+
+        issuer = NULL;
+        for (i = 0; untrusted && i < sk_X509_num(untrusted); i++) {
+            if (X509_check_issued(sk_X509_value(untrusted, i), c) == X509_V_OK) {
+                issuer = sk_X509_value(untrusted, i);
+                break;
+            }
+        }
+
+        if (!issuer && !(issuer = stir_shaken_ca_index_find_issuer(&cert_store->ca_index, c))) break;
+
+        status = stir_shaken_ocsp_check(ss, c, issuer);
+        c = issuer;
+    }
+
+    ERR_clear_error();
+    return status;
+}
+
+stir_shaken_status_t stir_shaken_ocsp_init(stir_shaken_context_t *ss)
+{
+    if (pthread_mutex_init(&stir_shaken_globals.ocsp_mutex, NULL) != 0) {
+        stir_shaken_set_error(ss, "Init OCSP mutex failed", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (pthread_cond_init(&stir_shaken_globals.ocsp_cond, NULL) != 0) {
+        pthread_mutex_destroy(&stir_shaken_globals.ocsp_mutex);
+        stir_shaken_set_error(ss, "Init OCSP condition failed", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+void stir_shaken_ocsp_cache_flush(void)
+{
+    pthread_mutex_lock(&stir_shaken_globals.ocsp_mutex);
+    stir_shaken_ocsp_cache_remove();
+    pthread_mutex_unlock(&stir_shaken_globals.ocsp_mutex);
+}
+
+void stir_shaken_ocsp_deinit(void)
+{
+    stir_shaken_ocsp_disable();
+    stir_shaken_ocsp_cache_flush();
+    pthread_cond_destroy(&stir_shaken_globals.ocsp_cond);
+    pthread_mutex_destroy(&stir_shaken_globals.ocsp_mutex);
+}
+
+stir_shaken_status_t stir_shaken_ocsp_enable(stir_shaken_context_t *ss, const char *responder, uint8_t hard_fail)
+{
+    char *r = NULL;
+
+    if (responder && !(r = strdup(responder))) {
+        stir_shaken_set_error(ss, "Out of memory", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    pthread_mutex_lock(&stir_shaken_globals.ocsp_mutex);
+
+    free(stir_shaken_globals.ocsp_responder);
+    stir_shaken_globals.ocsp_responder = r;
+    // Read without the lock on verification path
+    __atomic_store_n(&stir_shaken_globals.ocsp_hard_fail, hard_fail, __ATOMIC_RELEASE);
+    __atomic_store_n(&stir_shaken_globals.ocsp_enabled, 1, __ATOMIC_RELEASE);
+
+    // Statuses from other responder
+    stir_shaken_ocsp_cache_remove();
+
+    pthread_mutex_unlock(&stir_shaken_globals.ocsp_mutex);
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+void stir_shaken_ocsp_disable(void)
+{
+    pthread_mutex_lock(&stir_shaken_globals.ocsp_mutex);
+
+    __atomic_store_n(&stir_shaken_globals.ocsp_enabled, 0, __ATOMIC_RELEASE);
+    free(stir_shaken_globals.ocsp_responder);
+    stir_shaken_globals.ocsp_responder = NULL;
+
+    pthread_mutex_unlock(&stir_shaken_globals.ocsp_mutex);
+}
+
+static stir_shaken_status_t stir_shaken_x509_check_revocation(stir_shaken_context_t *ss, X509 *x, STACK_OF(X509) *xchain)
+{
+    stir_shaken_cert_store_t *cert_store = NULL;
+    stir_shaken_crl_index_t *index = NULL;
+    stir_shaken_intermediate_pool_t *pool = NULL;
+    STACK_OF(X509) *untrusted = NULL;
+    stir_shaken_status_t status = STIR_SHAKEN_STATUS_OK;
+
+    if (!x) {
+        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    // Path may have been built with intermediates from the pool
+    pool = stir_shaken_intermediate_pool_get();
+    untrusted = stir_shaken_intermediate_pool_untrusted(pool, x, xchain);
+    stir_shaken_intermediate_pool_put(pool);
+
+    cert_store = stir_shaken_cert_store_get();
+    if (cert_store && (index = stir_shaken_cert_store_crl_index(cert_store))) {
+        status = stir_shaken_crl_index_check_chain(ss, index, x, untrusted, 0);
+    }
+    if (status == STIR_SHAKEN_STATUS_OK && cert_store && __atomic_load_n(&stir_shaken_globals.ocsp_enabled, __ATOMIC_ACQUIRE)) {
+        status = stir_shaken_ocsp_check_cert(ss, cert_store, x, untrusted);
+    }
+    stir_shaken_cert_store_put(cert_store);
+
+    if (untrusted != xchain) sk_X509_pop_free(untrusted, X509_free);
+
+    return status;
+}
+
+stir_shaken_status_t stir_shaken_cert_check_revocation(stir_shaken_context_t *ss, stir_shaken_cert_t *cert)
+{
+    return stir_shaken_x509_check_revocation(ss, cert ? cert->x : NULL, cert ? cert->xchain : NULL);
+}
+
+stir_shaken_status_t stir_shaken_cert_ref_check_revocation(stir_shaken_context_t *ss, stir_shaken_cert_ref_t *ref)
+{
+    return stir_shaken_x509_check_revocation(ss, ref ? ref->x : NULL, ref ? ref->xchain : NULL);
+}
+
+/*
+ * Get reference to current trust store snapshot (NULL if not set). Must be released with stir_shaken_cert_store_put.
+ */
+stir_shaken_cert_store_t* stir_shaken_cert_store_get(void)
+{
+    stir_shaken_globals_t *g = &stir_shaken_globals;
+    stir_shaken_cert_store_t *cert_store = NULL;
+
+    pthread_mutex_lock(&g->cert_store_mutex);
+    cert_store = g->cert_store;
+    if (cert_store) {
+        __atomic_add_fetch(&cert_store->refs, 1, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&g->cert_store_mutex);
+
+    return cert_store;
+}
+
+void stir_shaken_cert_store_put(stir_shaken_cert_store_t *cert_store)
+{
+    if (!cert_store) return;
+
+    if (__atomic_sub_fetch(&cert_store->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        X509_STORE_free(cert_store->store);
+        stir_shaken_ca_index_clean(&cert_store->ca_index);
+        stir_shaken_crl_index_destroy(cert_store->crl_index);
+        free(cert_store);
+    }
+}
+
+// Publish @cert_store (may be NULL) as current snapshot, release the old one
+static void stir_shaken_cert_store_swap(stir_shaken_cert_store_t *cert_store)
+{
+    stir_shaken_globals_t *g = &stir_shaken_globals;
+    stir_shaken_cert_store_t *old = NULL;
+
+    pthread_mutex_lock(&g->cert_store_mutex);
+    old = g->cert_store;
+    g->cert_store = cert_store;
+    if (cert_store) {
+        cert_store->generation = __atomic_add_fetch(&g->cert_store_generation, 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&g->cert_store_mutex);
+
+    stir_shaken_cert_store_put(old);
+}
+
+uint64_t stir_shaken_cert_store_generation(void)
+{
+    return __atomic_load_n(&stir_shaken_globals.cert_store_generation, __ATOMIC_ACQUIRE);
+}
+
+static void stir_shaken_cert_store_set_location(char **location, const char *value)
+{
+    free(*location);
+    *location = value ? strdup(value) : NULL;
+}
+
+/*
+ * Build new trust store and swap it in. Verifications in progress finish with the snapshot they started with.
+ * On failure current snapshot is kept.
+ */
+stir_shaken_status_t stir_shaken_init_cert_store(stir_shaken_context_t *ss, const char *ca_list, const char *ca_dir, const char *crl_list, const char *crl_dir)
+{
+    stir_shaken_cert_store_t *cert_store = NULL;
+    stir_shaken_context_t ss_crl;
+    int i = 0;
+
+    cert_store = calloc(1, sizeof(*cert_store));
+    if (!cert_store) {
+        stir_shaken_set_error(ss, "Out of memory", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+    cert_store->refs = 1;
+
+    cert_store->store = X509_STORE_new();
+    if (!cert_store->store) {
+        stir_shaken_set_error(ss, "Failed to create X509_STORE", STIR_SHAKEN_ERROR_SSL);
+        goto fail;
+    }
+
+    X509_STORE_set_verify_cb_func(cert_store->store, stir_shaken_verify_callback);
+
+    // CAs are loaded into memory now rather than looked up in hashed dir during chain building
+    if (X509_STORE_set_ex_data(cert_store->store, stir_shaken_ca_index_ex_idx(), &cert_store->ca_index) != 1) {
+        stir_shaken_set_error(ss, "Failed to attach CA index to X509_STORE", STIR_SHAKEN_ERROR_SSL);
+        goto fail;
+    }
+    X509_STORE_set_get_issuer(cert_store->store, stir_shaken_ca_index_get_issuer);
+
+    if (ca_list || ca_dir) {
+
+        if (ca_list && stir_shaken_ca_index_load_file(ss, &cert_store->ca_index, ca_list) != STIR_SHAKEN_STATUS_OK) {
+            stir_shaken_set_error_if_clear(ss, "Failed to load trusted CAs", STIR_SHAKEN_ERROR_LOAD_CA);
+            goto fail;
+        }
+
+        if (ca_dir && stir_shaken_ca_index_load_dir(ss, &cert_store->ca_index, ca_dir) != STIR_SHAKEN_STATUS_OK) {
+            stir_shaken_set_error_if_clear(ss, "Failed to load trusted CAs", STIR_SHAKEN_ERROR_LOAD_CA);
+            goto fail;
+        }
+
+        if (STIR_SHAKEN_LOAD_CA_FROM_DEFAULT_OS_PATHS) {
+
+            stir_shaken_context_t ss_os = { 0 };
+
+            // Best effort, like X509_STORE_set_default_paths
+            stir_shaken_ca_index_load_file(&ss_os, &cert_store->ca_index, X509_get_default_cert_file());
+            stir_shaken_ca_index_load_dir(&ss_os, &cert_store->ca_index, X509_get_default_cert_dir());
+        }
+
+        stir_shaken_log(STIR_SHAKEN_LOGLEVEL_HIGH, STIR_SHAKEN_LOG_CERT_STORE, "STIR-Shaken: Loaded %zu trusted CAs\n", cert_store->ca_index.n);
+    }
+
+    // CRLs are not given to OpenSSL (which would scan them on every chain build),
+    // revoked serials are indexed per issuer and checked once the chain is built
+    if (crl_list || crl_dir) {
+
+        cert_store->crl_index = stir_shaken_crl_index_create();
+        if (!cert_store->crl_index) {
+            stir_shaken_set_error(ss, "Out of memory", STIR_SHAKEN_ERROR_GENERAL);
+            goto fail;
+        }
+
+        if (crl_list && stir_shaken_crl_index_load_file(ss, cert_store->crl_index, cert_store, crl_list) != STIR_SHAKEN_STATUS_OK) {
+            stir_shaken_set_error_if_clear(ss, "Failed to load CRLs", STIR_SHAKEN_ERROR_LOAD_CRL);
+            goto fail;
+        }
+
+        if (crl_dir && stir_shaken_crl_index_load_dir(ss, cert_store->crl_index, cert_store, crl_dir) != STIR_SHAKEN_STATUS_OK) {
+            stir_shaken_set_error_if_clear(ss, "Failed to load CRLs", STIR_SHAKEN_ERROR_LOAD_CRL);
+            goto fail;
+        }
+    }
+
+    pthread_mutex_lock(&stir_shaken_globals.cert_store_crls_mutex);
+
+    // CRLs added at runtime, on top of those from files. Fails only if their issuer is gone from trust store.
+    for (i = 0; stir_shaken_globals.cert_store_crls && i < sk_X509_CRL_num(stir_shaken_globals.cert_store_crls); i++) {
+
+        stir_shaken_clear_error(&ss_crl);
+        stir_shaken_cert_store_crl_apply(&ss_crl, cert_store, sk_X509_CRL_value(stir_shaken_globals.cert_store_crls, i));
+    }
+
+    pthread_mutex_lock(&stir_shaken_globals.cert_store_mutex);
+    stir_shaken_cert_store_set_location(&stir_shaken_globals.cert_store_ca_list, ca_list);
+    stir_shaken_cert_store_set_location(&stir_shaken_globals.cert_store_ca_dir, ca_dir);
+    stir_shaken_cert_store_set_location(&stir_shaken_globals.cert_store_crl_list, crl_list);
+    stir_shaken_cert_store_set_location(&stir_shaken_globals.cert_store_crl_dir, crl_dir);
+    pthread_mutex_unlock(&stir_shaken_globals.cert_store_mutex);
+
+    stir_shaken_cert_store_swap(cert_store);
+
+    pthread_mutex_unlock(&stir_shaken_globals.cert_store_crls_mutex);
+
+    return STIR_SHAKEN_STATUS_OK;
+
+fail:
+    X509_STORE_free(cert_store->store);
+    stir_shaken_ca_index_clean(&cert_store->ca_index);
+    stir_shaken_crl_index_destroy(cert_store->crl_index);
+    free(cert_store);
+    return STIR_SHAKEN_STATUS_FALSE;
+}
+
+void stir_shaken_cert_store_cleanup(void)
+{
+    stir_shaken_cert_store_watch_stop();
+    stir_shaken_cert_store_swap(NULL);
+
+    pthread_mutex_lock(&stir_shaken_globals.cert_store_mutex);
+    stir_shaken_cert_store_set_location(&stir_shaken_globals.cert_store_ca_list, NULL);
+    stir_shaken_cert_store_set_location(&stir_shaken_globals.cert_store_ca_dir, NULL);
+    stir_shaken_cert_store_set_location(&stir_shaken_globals.cert_store_crl_list, NULL);
+    stir_shaken_cert_store_set_location(&stir_shaken_globals.cert_store_crl_dir, NULL);
+    pthread_mutex_unlock(&stir_shaken_globals.cert_store_mutex);
+
+    pthread_mutex_lock(&stir_shaken_globals.cert_store_crls_mutex);
+    sk_X509_CRL_pop_free(stir_shaken_globals.cert_store_crls, X509_CRL_free);
+    stir_shaken_globals.cert_store_crls = NULL;
+    pthread_mutex_unlock(&stir_shaken_globals.cert_store_crls_mutex);
+}
+
+stir_shaken_status_t stir_shaken_cert_store_reload(stir_shaken_context_t *ss)
+{
+    stir_shaken_globals_t *g = &stir_shaken_globals;
+    char *ca_list = NULL, *ca_dir = NULL, *crl_list = NULL, *crl_dir = NULL;
+    stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+
+    pthread_mutex_lock(&g->cert_store_mutex);
+    stir_shaken_cert_store_set_location(&ca_list, g->cert_store_ca_list);
+    stir_shaken_cert_store_set_location(&ca_dir, g->cert_store_ca_dir);
+    stir_shaken_cert_store_set_location(&crl_list, g->cert_store_crl_list);
+    stir_shaken_cert_store_set_location(&crl_dir, g->cert_store_crl_dir);
+    pthread_mutex_unlock(&g->cert_store_mutex);
+
+    status = stir_shaken_init_cert_store(ss, ca_list, ca_dir, crl_list, crl_dir);
+    if (status == STIR_SHAKEN_STATUS_OK) {
+        stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_CERT_STORE, "STIR-Shaken: Cert store reloaded (generation %" PRIu64 ")\n", stir_shaken_cert_store_generation());
+    }
+
+    free(ca_list);
+    free(ca_dir);
+    free(crl_list);
+    free(crl_dir);
+
+    return status;
+}
+
+#ifdef __linux__
+
+// Watch @path if it's a dir, or dir @path is in if it's a file
+static void stir_shaken_cert_store_watch_add(int fd, const char *path)
+{
+    char buf[STIR_SHAKEN_BUFLEN] = { 0 };
+    uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_ATTRIB;
+
+    if (stir_shaken_zstr(path)) return;
+
+    if (stir_shaken_dir_exists(path) == STIR_SHAKEN_STATUS_OK) {
+        inotify_add_watch(fd, path, mask);
+        return;
+    }
+
+    snprintf(buf, sizeof(buf), "%s", path);
+    inotify_add_watch(fd, dirname(buf), mask);
+}
+
+static void* stir_shaken_cert_store_watch_thread(void *arg)
+{
+    stir_shaken_globals_t *g = &stir_shaken_globals;
+    long debounce_ms = (long) (intptr_t) arg;
+    struct pollfd fds[2] = { { 0 } };
+    char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    uint8_t pending = 0;
+    uint64_t reload_at = 0, now = 0;
+    int fd = g->cert_store_watch_fd, timeout = -1;
+
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = g->cert_store_watch_pipe[0];
+    fds[1].events = POLLIN;
+
+    while (1) {
+
+        timeout = -1;
+        if (pending) {
+            now = stir_shaken_now_ms();
+            timeout = reload_at > now ? (int) (reload_at - now) : 0;
+        }
+
+        if (poll(fds, 2, timeout) < 0) continue;
+
+        // Stop
+        if (fds[1].revents) break;
+
+        if (fds[0].revents & POLLIN) {
+
+            // Drain events, which file changed doesn't matter, whole store is rebuilt
+            while (read(fd, buf, sizeof(buf)) > 0);
+
+            pending = 1;
+            reload_at = stir_shaken_now_ms() + debounce_ms;
+            continue;
+        }
+
+        if (pending && stir_shaken_now_ms() >= reload_at) {
+
+            stir_shaken_context_t ss = { 0 };
+
+            pending = 0;
+            if (stir_shaken_cert_store_reload(&ss) != STIR_SHAKEN_STATUS_OK) {
+                stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_CERT_STORE, "STIR-Shaken: Cert store watcher: reload failed, keeping current store\n");
+            }
+        }
+    }
+
+    return NULL;
+}
+
+stir_shaken_status_t stir_shaken_cert_store_watch_start(stir_shaken_context_t *ss, long debounce_ms)
+{
+    stir_shaken_globals_t *g = &stir_shaken_globals;
+
+    if (g->cert_store_watching) {
+        stir_shaken_set_error(ss, "Cert store watcher already running", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_NOOP;
+    }
+
+    // Watches are in place before this returns, so no change made after is missed
+    g->cert_store_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (g->cert_store_watch_fd < 0) {
+        stir_shaken_set_error(ss, "Cannot init inotify", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    pthread_mutex_lock(&g->cert_store_mutex);
+    stir_shaken_cert_store_watch_add(g->cert_store_watch_fd, g->cert_store_ca_list);
+    stir_shaken_cert_store_watch_add(g->cert_store_watch_fd, g->cert_store_ca_dir);
+    stir_shaken_cert_store_watch_add(g->cert_store_watch_fd, g->cert_store_crl_list);
+    stir_shaken_cert_store_watch_add(g->cert_store_watch_fd, g->cert_store_crl_dir);
+    pthread_mutex_unlock(&g->cert_store_mutex);
+
+    if (pipe(g->cert_store_watch_pipe) != 0) {
+        close(g->cert_store_watch_fd);
+        stir_shaken_set_error(ss, "Cannot create cert store watcher pipe", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (pthread_create(&g->cert_store_watcher, NULL, stir_shaken_cert_store_watch_thread, (void *) (intptr_t) (debounce_ms > 0 ? debounce_ms : 0)) != 0) {
+        close(g->cert_store_watch_fd);
+        close(g->cert_store_watch_pipe[0]);
+        close(g->cert_store_watch_pipe[1]);
+        stir_shaken_set_error(ss, "Cannot start cert store watcher thread", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    g->cert_store_watching = 1;
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+void stir_shaken_cert_store_watch_stop(void)
+{
+    stir_shaken_globals_t *g = &stir_shaken_globals;
+
+    if (!g->cert_store_watching) return;
+
+    if (write(g->cert_store_watch_pipe[1], "x", 1) != 1) {
+        stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_CERT_STORE, "STIR-Shaken: Cert store watcher: cannot signal stop\n");
+    }
+    pthread_join(g->cert_store_watcher, NULL);
+
+    close(g->cert_store_watch_fd);
+    close(g->cert_store_watch_pipe[0]);
+    close(g->cert_store_watch_pipe[1]);
+    g->cert_store_watching = 0;
+}
+
+#else
+
+stir_shaken_status_t stir_shaken_cert_store_watch_start(stir_shaken_context_t *ss, long debounce_ms)
+{
+    stir_shaken_set_error(ss, "Cert store watcher not supported on this platform, use stir_shaken_cert_store_reload", STIR_SHAKEN_ERROR_GENERAL);
+    return STIR_SHAKEN_STATUS_FALSE;
+}
+
+void stir_shaken_cert_store_watch_stop(void)
+{
+}
+
+#endif
+
+// Latest notBefore and earliest notAfter of certs in @chain, @until is 0 if any of them cannot be read
+static void stir_shaken_x509_chain_validity(STACK_OF(X509) *chain, int64_t *from, int64_t *until)
+{
+    struct tm tm = { 0 };
+    int64_t t = 0;
+    int i = 0;
+
+    *from = 0;
+    *until = 0;
+
+    for (i = 0; i < sk_X509_num(chain); i++) {
+
+        X509 *c = sk_X509_value(chain, i);
+
+        if (ASN1_TIME_to_tm(X509_get0_notBefore(c), &tm) != 1) goto fail;
+        t = timegm(&tm);
+        if (t > *from) *from = t;
+
+        if (ASN1_TIME_to_tm(X509_get0_notAfter(c), &tm) != 1) goto fail;
+        t = timegm(&tm);
+        if (!*until || t < *until) *until = t;
+    }
+
+    return;
+
+fail:
+    *until = 0;
+}
+
+/*
+ * X509 cert path validation of @x (with untrusted @xchain) against current trust store, @generation is set to its generation if passed.
+ * @valid_from and @valid_until (if not NULL) are set to validity window of the validated path.
+ */
+static stir_shaken_status_t stir_shaken_verify_x509_path(stir_shaken_context_t *ss, X509 *x, STACK_OF(X509) *xchain, uint64_t *generation, int64_t *valid_from, int64_t *valid_until)
+{
+    X509_STORE_CTX  *verify_ctx = NULL;
+    stir_shaken_cert_store_t *cert_store = NULL;
+    stir_shaken_crl_index_t *index = NULL;
+    stir_shaken_intermediate_pool_t *pool = NULL;
+    STACK_OF(X509) *untrusted = NULL;
+    int rc = 1;
+    char err_buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
+    int verify_error = -1;
+    FILE *file = NULL; // set to something if want verification callback to print to it
+
+    *generation = 0;
+
+    // Snapshot is immutable, no lock needed while verifying
+    cert_store = stir_shaken_cert_store_get();
+    if (!cert_store) {
+        stir_shaken_set_error(ss, "Cert store not set", STIR_SHAKEN_ERROR_CERT_STORE);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    if (!(verify_ctx = X509_STORE_CTX_new())) {
+        stir_shaken_set_error(ss, "Failed to create X509_STORE_CTX object", STIR_SHAKEN_ERROR_SSL);
+        stir_shaken_cert_store_put(cert_store);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    // One pool snapshot for building the path and learning from it
+    pool = stir_shaken_intermediate_pool_get();
+    untrusted = stir_shaken_intermediate_pool_untrusted(pool, x, xchain);
+
+    if (X509_STORE_CTX_init(verify_ctx, cert_store->store, x, untrusted) != 1) {
+
+        X509_STORE_CTX_free(verify_ctx);
+        if (untrusted != xchain) sk_X509_pop_free(untrusted, X509_free);
+        stir_shaken_intermediate_pool_put(pool);
+        stir_shaken_set_error(ss, "SSL: Error initializing verification context", STIR_SHAKEN_ERROR_SSL);
+
+        stir_shaken_cert_store_put(cert_store);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    X509_STORE_CTX_set_ex_data(verify_ctx, 0, file);
+
+    rc = X509_verify_cert(verify_ctx);
+    if (rc != 1) {
+        // TODO double check if it's a good idea to read verification error from ctx here, outside of verification callback
+        verify_error = X509_STORE_CTX_get_error(verify_ctx);
+        sprintf(err_buf, "SSL: Bad X509 certificate path: SSL reason: %s\n", X509_verify_cert_error_string(verify_error));
+        stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_CERT_INVALID);
+
+    } else if ((index = stir_shaken_cert_store_crl_index(cert_store))) {
+
+        // Whole path, but trust anchor
+        if (stir_shaken_crl_index_check_chain(ss, index, NULL, X509_STORE_CTX_get0_chain(verify_ctx), 1) != STIR_SHAKEN_STATUS_OK) {
+            rc = 0;
+        }
+    }
+
+    if (rc == 1 && __atomic_load_n(&stir_shaken_globals.ocsp_enabled, __ATOMIC_ACQUIRE)) {
+
+        if (stir_shaken_ocsp_check_chain(ss, X509_STORE_CTX_get0_chain(verify_ctx)) != STIR_SHAKEN_STATUS_OK) {
+            rc = 0;
+        }
+    }
+
+    if (rc == 1) {
+        stir_shaken_intermediate_pool_learn(pool, X509_STORE_CTX_get0_chain(verify_ctx));
+
+        if (valid_from && valid_until) {
+            stir_shaken_x509_chain_validity(X509_STORE_CTX_get0_chain(verify_ctx), valid_from, valid_until);
+        }
+    }
+
+    X509_STORE_CTX_cleanup(verify_ctx);
+    X509_STORE_CTX_free(verify_ctx);
+    if (untrusted != xchain) sk_X509_pop_free(untrusted, X509_free);
+    stir_shaken_intermediate_pool_put(pool);
+
+    if (rc == 1) {
+        *generation = cert_store->generation;
+    }
+
+    stir_shaken_cert_store_put(cert_store);
+    return rc == 1 ? STIR_SHAKEN_STATUS_OK : STIR_SHAKEN_STATUS_FALSE;
+}
+
+stir_shaken_status_t stir_shaken_verify_cert_path(stir_shaken_context_t *ss, stir_shaken_cert_t *cert)
+{
+    stir_shaken_clear_error(ss);
+
+    if (!cert) {
+        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    if (cert->verify_ctx) {
+        X509_STORE_CTX_cleanup(cert->verify_ctx);
+        X509_STORE_CTX_free(cert->verify_ctx);
+        cert->verify_ctx = NULL;
+    }
+
+    return stir_shaken_verify_x509_path(ss, cert->x, cert->xchain, &cert->verified_generation, NULL, NULL);
+}
+
+stir_shaken_status_t stir_shaken_cert_ref_verify_path(stir_shaken_context_t *ss, stir_shaken_cert_ref_t *ref)
+{
+    stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+    uint64_t generation = 0;
+    int64_t valid_from = 0, valid_until = 0;
+
+    stir_shaken_clear_error(ss);
+
+    if (!ref) {
+        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    status = stir_shaken_verify_x509_path(ss, ref->x, ref->xchain, &generation, &valid_from, &valid_until);
+    if (status == STIR_SHAKEN_STATUS_OK) {
+
+        // Published by generation store. Racing validations may mix windows of two paths, both were valid at the time
+        // so each bound still holds for one of them (and time only moves past notBefore).
+        __atomic_store_n(&ref->valid_from, valid_from, __ATOMIC_RELAXED);
+        __atomic_store_n(&ref->valid_until, valid_until, __ATOMIC_RELAXED);
+        __atomic_store_n(&ref->verified_generation, generation, __ATOMIC_RELEASE);
+    }
+
+    return status;
+}
+
+// Validation done against older trust store, or outside of validity window of the validated path (expired intermediate or root), doesn't count
+int stir_shaken_cert_ref_path_verified(stir_shaken_cert_ref_t *ref)
+{
+    uint64_t generation = 0;
+    int64_t now = 0;
+
+    if (!ref) return 0;
+
+    generation = __atomic_load_n(&ref->verified_generation, __ATOMIC_ACQUIRE);
+    if (!generation || generation != stir_shaken_cert_store_generation()) return 0;
+
+    now = time(NULL);
+    return now >= __atomic_load_n(&ref->valid_from, __ATOMIC_RELAXED) && now < __atomic_load_n(&ref->valid_until, __ATOMIC_RELAXED);
+}
+
+stir_shaken_status_t stir_shaken_register_tnauthlist_extension(stir_shaken_context_t *ss, int *nidp)
+{
+    int nid = NID_undef;
+
+    nid = OBJ_ln2nid(TN_AUTH_LIST_LN);
+
+    if (nid == NID_undef) {
+
+        // TNAuthList is not registered yet, register
+
+        nid = OBJ_create(TN_AUTH_LIST_OID, TN_AUTH_LIST_SN, TN_AUTH_LIST_LN);
+        if (nid == NID_undef) {
+            stir_shaken_set_error(ss, "Cannot register TNAuthList extension (OID 1.3.6.1.5.5.7.1.26: http://oid-info.com/get/1.3.6.1.5.5.7.1.26)", STIR_SHAKEN_ERROR_TNAUTHLIST);
+            return STIR_SHAKEN_STATUS_FALSE;
+        }
+        X509V3_EXT_add_alias(nid, NID_netscape_comment);
+    }
+
+    *nidp = nid;
+    //stir_shaken_globals.tn_authlist_obj = OBJ_nid2obj(nid);
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+// Key of @tn (digits only, at most STIR_SHAKEN_TN_MAX_DIGITS), -1 if it has other characters
+static int stir_shaken_tn_to_key(const char *tn, size_t len, uint64_t *key)
+{
+    uint64_t value = 0;
+    size_t i = 0;
+
+    if (len == 0 || len > STIR_SHAKEN_TN_MAX_DIGITS) return -1;
+
+    for (i = 0; i < len; i++) {
+        if (!isdigit((unsigned char) tn[i])) return -1;
+        value = value * 10 + (tn[i] - '0');
+    }
+
+    *key = STIR_SHAKEN_TN_KEY(len, value);
+    return 0;
+}
+
+// Highest key of TNs having @len digits
+static uint64_t stir_shaken_tn_key_max(size_t len)
+{
+    uint64_t max = 1;
+    size_t i = 0;
+
+    for (i = 0; i < len; i++) max *= 10;
+
+    return STIR_SHAKEN_TN_KEY(len, max - 1);
+}
+
+static stir_shaken_status_t stir_shaken_tn_authlist_add_range(stir_shaken_tn_authlist_t *tn_authlist, int *capacity, uint64_t first, uint64_t last)
+{
+    uint64_t *ranges = NULL;
+
+    if (tn_authlist->ranges_n == *capacity) {
+
+        ranges = realloc(tn_authlist->ranges, 2 * sizeof(uint64_t) * (*capacity ? 2 * *capacity : 8));
+        if (!ranges) return STIR_SHAKEN_STATUS_TERM;
+
+        tn_authlist->ranges = ranges;
+        *capacity = *capacity ? 2 * *capacity : 8;
+    }
+
+    tn_authlist->ranges[2 * tn_authlist->ranges_n] = first;
+    tn_authlist->ranges[2 * tn_authlist->ranges_n + 1] = last;
+    tn_authlist->ranges_n++;
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+static int stir_shaken_tn_range_cmp(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+    return x < y ? -1 : (x > y);
+}
+
+// Read IA5String at *@pp (up to @end), @pp is moved past it
+static char* stir_shaken_asn1_read_ia5(const unsigned char **pp, const unsigned char *end)
+{
+    const unsigned char *p = *pp;
+    long len = 0;
+    int tag = 0, xclass = 0;
+
+    if (ASN1_get_object(&p, &len, &tag, &xclass, end - p) & 0x80) return NULL;
+    if (tag != V_ASN1_IA5STRING || xclass != V_ASN1_UNIVERSAL) return NULL;
+
+    *pp = p + len;
+    return strndup((const char *) p, len);
+}
+
+/*
+ * TNAuthorizationList ::= SEQUENCE SIZE (1..MAX) OF TNEntry
+ * TNEntry ::= CHOICE { spc [0] ServiceProviderCode, range [1] TelephoneNumberRange, one [2] TelephoneNumber }
+ * TelephoneNumberRange ::= SEQUENCE { start TelephoneNumber, count INTEGER (2..MAX) }
+ *
+ * Tags are EXPLICIT in RFC 8226 module, implicitly tagged entries are accepted as well.
+ */
+static stir_shaken_status_t stir_shaken_tn_authlist_decode_entries(stir_shaken_tn_authlist_t *tn_authlist, const unsigned char *p, const unsigned char *end)
+{
+    const unsigned char *q = NULL, *entry_end = NULL, *inner_end = NULL;
+    long len = 0, inner_len = 0;
+    int tag = 0, xclass = 0, inner_tag = 0, inner_class = 0, ret = 0;
+    int capacity = 0;
+    char *tn = NULL, **spc = NULL;
+    ASN1_INTEGER *count = NULL;
+    int64_t n = 0;
+    uint64_t first = 0;
+
+    while (p < end) {
+
+        ret = ASN1_get_object(&p, &len, &tag, &xclass, end - p);
+        if ((ret & 0x80) || xclass != V_ASN1_CONTEXT_SPECIFIC) return STIR_SHAKEN_STATUS_FALSE;
+        entry_end = p + len;
+
+        switch (tag) {
+
+            case 0:
+            case 2:
+
+                if (ret & V_ASN1_CONSTRUCTED) {
+                    tn = stir_shaken_asn1_read_ia5(&p, entry_end);
+                } else {
+                    tn = strndup((const char *) p, len);
+                }
+                if (!tn) return STIR_SHAKEN_STATUS_FALSE;
+
+                if (tag == 0) {
+
+                    spc = realloc(tn_authlist->spc, sizeof(char *) * (tn_authlist->spc_n + 1));
+                    if (!spc) {
+                        free(tn);
+                        return STIR_SHAKEN_STATUS_TERM;
+                    }
+                    tn_authlist->spc = spc;
+                    tn_authlist->spc[tn_authlist->spc_n++] = tn;
+                    break;
+                }
+
+                if (!stir_shaken_tn_to_key(tn, strlen(tn), &first)
+                        && stir_shaken_tn_authlist_add_range(tn_authlist, &capacity, first, first) != STIR_SHAKEN_STATUS_OK) {
+                    free(tn);
+                    return STIR_SHAKEN_STATUS_TERM;
+                }
+                free(tn);
+                break;
+
+            case 1:
+
+                if (!(ret & V_ASN1_CONSTRUCTED)) return STIR_SHAKEN_STATUS_FALSE;
+
+                // Explicit tag wraps SEQUENCE, implicit tag replaces it
+                q = p;
+                inner_end = entry_end;
+                if ((ASN1_get_object(&q, &inner_len, &inner_tag, &inner_class, entry_end - q) & 0x80) == 0
+                        && inner_tag == V_ASN1_SEQUENCE && inner_class == V_ASN1_UNIVERSAL) {
+                    p = q;
+                    inner_end = q + inner_len;
+                }
+
+                if (!(tn = stir_shaken_asn1_read_ia5(&p, inner_end))) return STIR_SHAKEN_STATUS_FALSE;
+
+                if (!(count = d2i_ASN1_INTEGER(NULL, &p, inner_end - p)) || !ASN1_INTEGER_get_int64(&n, count) || n < 2) {
+                    ASN1_INTEGER_free(count);
+                    free(tn);
+                    return STIR_SHAKEN_STATUS_FALSE;
+                }
+                ASN1_INTEGER_free(count);
+
+                if (!stir_shaken_tn_to_key(tn, strlen(tn), &first)) {
+
+                    // Range does not spill over to longer numbers
+                    uint64_t last = stir_shaken_tn_key_max(strlen(tn));
+
+                    if ((uint64_t) n - 1 < last - first) last = first + n - 1;
+
+                    if (stir_shaken_tn_authlist_add_range(tn_authlist, &capacity, first, last) != STIR_SHAKEN_STATUS_OK) {
+                        free(tn);
+                        return STIR_SHAKEN_STATUS_TERM;
+                    }
+                }
+                free(tn);
+                break;
+
+            default:
+                return STIR_SHAKEN_STATUS_FALSE;
+        }
+
+        p = entry_end;
+    }
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_tn_authlist_t* stir_shaken_tn_authlist_decode(stir_shaken_context_t *ss, X509 *x)
+{
+    stir_shaken_tn_authlist_t *tn_authlist = NULL;
+    X509_EXTENSION *ext = NULL;
+    ASN1_OCTET_STRING *data = NULL;
+    const unsigned char *p = NULL, *end = NULL;
+    char *value = NULL;
+    long len = 0;
+    int tag = 0, xclass = 0, i = 0, j = 0;
+
+    if (!x) {
+        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
+        return NULL;
+    }
+
+    i = X509_get_ext_by_NID(x, stir_shaken_globals.tn_authlist_nid, -1);
+    if (i == -1 || !(ext = X509_get_ext(x, i)) || !(data = X509_EXTENSION_get_data(ext))) {
+        stir_shaken_set_error(ss, "Cert must have ext-tnAuthList extension (OID 1.3.6.1.5.5.7.1.26: http://oid-info.com/get/1.3.6.1.5.5.7.1.26) but it is missing", STIR_SHAKEN_ERROR_TNAUTHLIST);
+        return NULL;
+    }
+
+    tn_authlist = calloc(1, sizeof(*tn_authlist));
+    if (!tn_authlist) {
+        stir_shaken_set_error(ss, "Cannot allocate TNAuthList", STIR_SHAKEN_ERROR_GENERAL);
+        return NULL;
+    }
+
+    p = ASN1_STRING_get0_data(data);
+    end = p + ASN1_STRING_length(data);
+
+    if (ASN1_get_object(&p, &len, &tag, &xclass, end - p) & 0x80) {
+        goto fail;
+    }
+
+    if (tag == V_ASN1_IA5STRING && xclass == V_ASN1_UNIVERSAL) {
+
+        // Made by this library: authority check URL, or SPC (in CSR)
+        if (!(value = strndup((const char *) p, len))) goto fail;
+
+        if (strstr(value, "://")) {
+            tn_authlist->uri = value;
+        } else if ((tn_authlist->spc = malloc(sizeof(char *)))) {
+            tn_authlist->spc[0] = value;
+            tn_authlist->spc_n = 1;
+        } else {
+            free(value);
+            goto fail;
+        }
+
+        return tn_authlist;
+    }
+
+    if (tag != V_ASN1_SEQUENCE || xclass != V_ASN1_UNIVERSAL || stir_shaken_tn_authlist_decode_entries(tn_authlist, p, p + len) != STIR_SHAKEN_STATUS_OK) {
+        goto fail;
+    }
+
+    // Sort and merge overlapping or adjacent ranges
+    if (tn_authlist->ranges_n > 1) {
+
+        qsort(tn_authlist->ranges, tn_authlist->ranges_n, 2 * sizeof(uint64_t), stir_shaken_tn_range_cmp);
+
+        for (i = 1, j = 0; i < tn_authlist->ranges_n; i++) {
+
+            if (tn_authlist->ranges[2 * i] <= tn_authlist->ranges[2 * j + 1] + 1) {
+
+                if (tn_authlist->ranges[2 * i + 1] > tn_authlist->ranges[2 * j + 1]) {
+                    tn_authlist->ranges[2 * j + 1] = tn_authlist->ranges[2 * i + 1];
+                }
+                continue;
+            }
+
+            j++;
+            tn_authlist->ranges[2 * j] = tn_authlist->ranges[2 * i];
+            tn_authlist->ranges[2 * j + 1] = tn_authlist->ranges[2 * i + 1];
+        }
+        tn_authlist->ranges_n = j + 1;
+    }
+
+    return tn_authlist;
+
+fail:
+    stir_shaken_tn_authlist_destroy(tn_authlist);
+    stir_shaken_set_error(ss, "Cannot decode TNAuthList extension", STIR_SHAKEN_ERROR_TNAUTHLIST);
+    return NULL;
+}
+
+void stir_shaken_tn_authlist_destroy(stir_shaken_tn_authlist_t *tn_authlist)
+{
+    int i = 0;
+
+    if (!tn_authlist) return;
+
+    for (i = 0; i < tn_authlist->spc_n; i++) {
+        free(tn_authlist->spc[i]);
+    }
+    free(tn_authlist->spc);
+    free(tn_authlist->uri);
+    free(tn_authlist->ranges);
+    free(tn_authlist);
+}
+
+stir_shaken_status_t stir_shaken_tn_authlist_covers_tn(stir_shaken_context_t *ss, const stir_shaken_tn_authlist_t *tn_authlist, const char *tn)
+{
+    uint64_t key = 0;
+    int lo = 0, hi = 0, mid = 0;
+
+    if (!tn_authlist || !tn) {
+        stir_shaken_set_error(ss, "Bad params", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    if (*tn == '+') tn++;
+
+    if (stir_shaken_tn_to_key(tn, strlen(tn), &key)) {
+        stir_shaken_set_error(ss, "Not a telephone number", STIR_SHAKEN_ERROR_TNAUTHLIST);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    // Last range starting at or before key
+    lo = 0;
+    hi = tn_authlist->ranges_n - 1;
+    while (lo <= hi) {
+
+        mid = lo + (hi - lo) / 2;
+
+        if (tn_authlist->ranges[2 * mid] <= key) {
+            lo = mid + 1;
+        } else {
+            hi = mid - 1;
+        }
+    }
+
+    if (hi >= 0 && key <= tn_authlist->ranges[2 * hi + 1]) {
+        return STIR_SHAKEN_STATUS_OK;
+    }
+
+    stir_shaken_set_error(ss, "Telephone number is not covered by cert's TNAuthList", STIR_SHAKEN_ERROR_TNAUTHLIST);
+    return STIR_SHAKEN_STATUS_FALSE;
+}
+
+const stir_shaken_tn_authlist_t* stir_shaken_cert_get_tn_authlist(stir_shaken_context_t *ss, stir_shaken_cert_t *cert)
+{
+    if (!cert || !cert->x) {
+        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
+        return NULL;
+    }
+
+    if (cert->ref && cert->ref->x == cert->x) {
+        return stir_shaken_cert_ref_get_tn_authlist(ss, cert->ref);
+    }
+
+    if (!cert->tn_authlist) {
+        cert->tn_authlist = stir_shaken_tn_authlist_decode(ss, cert->x);
+    }
+
+    return cert->tn_authlist;
+}
+
+stir_shaken_status_t stir_shaken_verify_cert_tn_authlist_extension(stir_shaken_context_t *ss, stir_shaken_cert_t *cert)
+{
+    stir_shaken_clear_error(ss);
+
+    if (!cert || !cert->x) {
+
+        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    if (!stir_shaken_cert_get_tn_authlist(ss, cert)) {
+
+        stir_shaken_set_error_if_clear(ss, "Cert must have ext-tnAuthList extension (OID 1.3.6.1.5.5.7.1.26: http://oid-info.com/get/1.3.6.1.5.5.7.1.26) but it is missing", STIR_SHAKEN_ERROR_TNAUTHLIST);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_verify_cert(stir_shaken_context_t *ss, stir_shaken_cert_t *cert)
+{
+    X509            *x = NULL;
+
+    stir_shaken_clear_error(ss);
+
+    if (!cert) {
+        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    if (STIR_SHAKEN_STATUS_OK != stir_shaken_verify_cert_tn_authlist_extension(ss, cert)) {
+        stir_shaken_set_error(ss, "Cert must have ext-tnAuthList extension (OID 1.3.6.1.5.5.7.1.26: http://oid-info.com/get/1.3.6.1.5.5.7.1.26) but it is missing", STIR_SHAKEN_ERROR_TNAUTHLIST);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (!STIR_SHAKEN_MOCK_VERIFY_CERT_CHAIN 
+            && (STIR_SHAKEN_STATUS_OK != stir_shaken_verify_cert_path(ss, cert))) {
+        stir_shaken_set_error_if_clear(ss, "Cert did not pass X509 path validation against CA list and CRL", STIR_SHAKEN_ERROR_CERT_INVALID);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+char* stir_shaken_cert_get_serialHex(stir_shaken_cert_t *cert)
+{
+    if (!cert) return NULL;
+    stir_shaken_cert_read_serial(cert);
+    return cert->serialHex;
+}
+
+char* stir_shaken_cert_get_serialDec(stir_shaken_cert_t *cert)
+{
+    if (!cert) return NULL;
+    stir_shaken_cert_read_serial(cert);
+    return cert->serialDec;
+}
+
+char* stir_shaken_cert_get_notBefore(stir_shaken_cert_t *cert)
+{
+    if (!cert) return NULL;
+    if (!cert->notBefore[0] && cert->x) {
+        stir_shaken_convert_ASN1TIME(NULL, X509_get_notBefore(cert->x), cert->notBefore, ASN1_DATE_LEN);
+    }
+    return cert->notBefore;
+}
+
+char* stir_shaken_cert_get_notAfter(stir_shaken_cert_t *cert)
+{
+    if (!cert) return NULL;
+    if (!cert->notAfter[0] && cert->x) {
+        stir_shaken_convert_ASN1TIME(NULL, X509_get_notAfter(cert->x), cert->notAfter, ASN1_DATE_LEN);
+    }
+    return cert->notAfter;
+}
+
+char* stir_shaken_cert_get_issuer(stir_shaken_cert_t *cert)
+{
+    if (!cert) return NULL;
+    if (!cert->issuer[0] && cert->x) {
+        X509_NAME_oneline(X509_get_issuer_name(cert->x), cert->issuer, sizeof(cert->issuer));
+    }
+    return cert->issuer;
+}
+
+char* stir_shaken_cert_get_subject(stir_shaken_cert_t *cert)
+{
+    if (!cert) return NULL;
+    if (!cert->subject[0] && cert->x) {
+        X509_NAME_oneline(X509_get_subject_name(cert->x), cert->subject, sizeof(cert->subject));
+    }
+    return cert->subject;
+}
+
+int stir_shaken_cert_get_version(stir_shaken_cert_t *cert)
+{
+    if (!cert) return -1;
+    if (!cert->version && cert->x) {
+        cert->version = ((int) X509_get_version(cert->x)) + 1;
+    }
+    return cert->version;
+}
+
+/**
+ * @buf - (out) will contain fingerprint, must be of size at least 3*EVP_MAX_MD_SIZE bytes
+ * @buflen - (out) will contain string len including '\0'
+ */
+stir_shaken_status_t stir_shaken_extract_fingerprint(stir_shaken_context_t *ss, X509* x509, const char *digest_name, char *buf, unsigned int *buflen)
+{
+    const EVP_MD *evp = NULL;
+    unsigned int i = 0, j = 0;
+    uint8_t raw[EVP_MAX_MD_SIZE] = { 0 };
+
+    if (!x509 || !buf || !buflen || !(evp = EVP_get_digestbyname(digest_name))) {
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (X509_digest(x509, evp, raw, buflen) != 1 ||  buflen <= 0) {
+
+        stir_shaken_set_error(ss, "Extract_fingerprint: Error in SSL while extracting digest", STIR_SHAKEN_ERROR_SSL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    for (i = 0, j = 0; i < *buflen; ++i, j += 3) {
+        sprintf((char*) &buf[j], (i == (*buflen - 1)) ? "%.2X" : "%.2X:", raw[i] & 0xff);
+    }
+    *(&buf[j - 1]) = '\0';
+
+    *buflen = j;
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+X509* stir_shaken_make_cert_from_public_key(stir_shaken_context_t *ss, EVP_PKEY *pkey)
+{
+    X509 *x = X509_new();
+    if (!x) {
+
+        stir_shaken_set_error(ss, "Make cert from public key: Failed to  create new X509 certificate", STIR_SHAKEN_ERROR_SSL);
+        return NULL;
+    }
+
+    X509_set_pubkey(x, pkey);
+    return x;
+}
+
+stir_shaken_status_t stir_shaken_x509_to_disk(stir_shaken_context_t *ss, X509 *x, const char *cert_full_name)
+{
+    int				i = 0;
+    char			err_buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
+    FILE			*fp = NULL;
+
+    if (!x || !cert_full_name) goto fail;	
+
+    stir_shaken_clear_error(ss);
+
+    if (cert_full_name) {
+
+        fp = fopen(cert_full_name, "w");
+        if (!fp) {
+            sprintf(err_buf, "Failed to create file %s", cert_full_name);
+            stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_GENERAL);
+            goto fail;
+        }
+
+        i = PEM_write_X509(fp, x);
         if (i == 0) {
 
             sprintf(err_buf, "Error writing certificate to file %s", cert_full_name);
@@ -1785,7 +4302,170 @@ void stir_shaken_destroy_cert(stir_shaken_cert_t *cert)
             X509_STORE_CTX_free(cert->verify_ctx);
             cert->verify_ctx = NULL;
         }
+
+        if (cert->xchain) {
+            sk_X509_pop_free(cert->xchain, X509_free);
+            cert->xchain = NULL;
+        }
+
+        if (cert->ref) {
+            stir_shaken_cert_ref_put(cert->ref);
+            cert->ref = NULL;
+        }
+
+        if (cert->tn_authlist) {
+            stir_shaken_tn_authlist_destroy(cert->tn_authlist);
+            cert->tn_authlist = NULL;
+        }
+    }
+}
+
+// Raw public key of compact cert
+typedef struct stir_shaken_pub_raw_s {
+    int             len;
+    unsigned char   key[];
+} stir_shaken_pub_raw_t;
+
+stir_shaken_cert_ref_t* stir_shaken_cert_ref_create(stir_shaken_context_t *ss, X509 *x, STACK_OF(X509) *xchain, size_t len)
+{
+    stir_shaken_cert_ref_t *ref = NULL;
+
+    if (!x) {
+        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
+        return NULL;
+    }
+
+    ref = calloc(1, sizeof(*ref));
+    if (!ref) {
+        stir_shaken_set_error(ss, "Cannot allocate cert", STIR_SHAKEN_ERROR_GENERAL);
+        return NULL;
+    }
+
+    ref->x = x;
+    ref->xchain = xchain;
+    ref->len = len;
+    ref->refs = 1;
+
+    return ref;
+}
+
+stir_shaken_cert_ref_t* stir_shaken_cert_ref_get(stir_shaken_cert_ref_t *ref)
+{
+    if (ref) {
+        __atomic_add_fetch(&ref->refs, 1, __ATOMIC_RELAXED);
+    }
+
+    return ref;
+}
+
+void stir_shaken_cert_ref_put(stir_shaken_cert_ref_t *ref)
+{
+    if (!ref) return;
+
+    if (__atomic_sub_fetch(&ref->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+        X509_free(ref->x);
+        sk_X509_pop_free(ref->xchain, X509_free);
+        free(ref->pub_raw);
+        stir_shaken_tn_authlist_destroy(ref->tn_authlist);
+        free(ref);
+    }
+}
+
+stir_shaken_status_t stir_shaken_cert_ref_get_pubkey_raw(stir_shaken_context_t *ss, stir_shaken_cert_ref_t *ref, const unsigned char **key, int *key_len)
+{
+    stir_shaken_pub_raw_t *pub_raw = NULL, *expected = NULL;
+    unsigned char buf[STIR_SHAKEN_PUB_KEY_RAW_BUF_LEN] = { 0 };
+    int len = STIR_SHAKEN_PUB_KEY_RAW_BUF_LEN;
+    EVP_PKEY *pk = NULL;
+    stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+
+    if (!ref || !key || !key_len) return STIR_SHAKEN_STATUS_TERM;
+
+    pub_raw = __atomic_load_n((stir_shaken_pub_raw_t **) &ref->pub_raw, __ATOMIC_ACQUIRE);
+    if (!pub_raw) {
+
+        if (!(pk = X509_get0_pubkey(ref->x))) {
+            stir_shaken_set_error(ss, "Get pubkey raw: Failed to read EVP_PKEY from cert", STIR_SHAKEN_ERROR_SSL);
+            return STIR_SHAKEN_STATUS_RESTART;
+        }
+
+        status = stir_shaken_pubkey_to_raw(ss, pk, buf, &len);
+        if (status != STIR_SHAKEN_STATUS_OK) {
+            return status;
+        }
+
+        // 0-terminated, as PEM in zeroed buffer would be
+        if (!(pub_raw = malloc(sizeof(*pub_raw) + len + 1))) {
+            stir_shaken_set_error(ss, "Cannot allocate public key", STIR_SHAKEN_ERROR_GENERAL);
+            return STIR_SHAKEN_STATUS_TERM;
+        }
+        pub_raw->len = len;
+        memcpy(pub_raw->key, buf, len);
+        pub_raw->key[len] = '\0';
+
+        // Other thread may have made it meanwhile, use that one
+        if (!__atomic_compare_exchange_n((stir_shaken_pub_raw_t **) &ref->pub_raw, &expected, pub_raw, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            free(pub_raw);
+            pub_raw = expected;
+        }
+    }
+
+    *key = pub_raw->key;
+    *key_len = pub_raw->len;
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+const stir_shaken_tn_authlist_t* stir_shaken_cert_ref_get_tn_authlist(stir_shaken_context_t *ss, stir_shaken_cert_ref_t *ref)
+{
+    stir_shaken_tn_authlist_t *tn_authlist = NULL, *expected = NULL;
+
+    if (!ref) {
+        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
+        return NULL;
+    }
+
+    tn_authlist = __atomic_load_n(&ref->tn_authlist, __ATOMIC_ACQUIRE);
+    if (!tn_authlist) {
+
+        if (!(tn_authlist = stir_shaken_tn_authlist_decode(ss, ref->x))) {
+            return NULL;
+        }
+
+        // Other thread may have decoded it meanwhile, use that one
+        if (!__atomic_compare_exchange_n(&ref->tn_authlist, &expected, tn_authlist, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            stir_shaken_tn_authlist_destroy(tn_authlist);
+            tn_authlist = expected;
+        }
     }
+
+    return tn_authlist;
+}
+
+stir_shaken_cert_t* stir_shaken_cert_ref_to_cert(stir_shaken_context_t *ss, stir_shaken_cert_ref_t *ref)
+{
+    stir_shaken_cert_t *cert = NULL;
+
+    if (!ref) {
+        stir_shaken_set_error(ss, "Cert not set", STIR_SHAKEN_ERROR_GENERAL);
+        return NULL;
+    }
+
+    cert = calloc(1, sizeof(*cert));
+    if (!cert) {
+        stir_shaken_set_error(ss, "Cannot allocate cert", STIR_SHAKEN_ERROR_GENERAL);
+        return NULL;
+    }
+
+    X509_up_ref(ref->x);
+    cert->x = ref->x;
+    cert->xchain = ref->xchain ? X509_chain_up_ref(ref->xchain) : NULL;
+    cert->len = ref->len;
+    cert->path_verified = stir_shaken_cert_ref_path_verified(ref);
+    cert->verified_generation = __atomic_load_n(&ref->verified_generation, __ATOMIC_ACQUIRE);
+    cert->ref = stir_shaken_cert_ref_get(ref);
+
+    return cert;
 }
 
 // TODO
@@ -1803,82 +4483,187 @@ void stir_shaken_destroy_cert(stir_shaken_cert_t *cert)
 //
 // see: https://stackoverflow.com/questions/3810058/read-certificate-files-from-memory-instead-of-a-file-using-openssl
 //
-stir_shaken_status_t stir_shaken_load_x509_from_mem(stir_shaken_context_t *ss, X509 **x, STACK_OF(X509) **xchain, void *mem)
+// End-entity cert of unordered bundle: the one which did not issue any other, first if there is no such
+static int stir_shaken_x509_bundle_leaf(STACK_OF(X509) *certs)
 {
-    stir_shaken_status_t ss_status = STIR_SHAKEN_STATUS_OK;
-    BIO	*cbio = NULL;
-    STACK_OF(X509)		*stack = NULL;
-    STACK_OF(X509_INFO)	*sk = NULL;
-    X509_INFO			*xi = NULL;
+    int i = 0, j = 0, n = sk_X509_num(certs);
 
-    stir_shaken_clear_error(ss);
+    for (i = 0; i < n; i++) {
 
-    cbio = BIO_new_mem_buf(mem, -1);
-    if (!cbio) {
-        stir_shaken_set_error(ss, "(SSL) Failed to create BIO", STIR_SHAKEN_ERROR_SSL);
-        return STIR_SHAKEN_STATUS_TERM;
+        for (j = 0; j < n; j++) {
+            if (i != j && X509_check_issued(sk_X509_value(certs, i), sk_X509_value(certs, j)) == X509_V_OK) break;
+        }
+
+        if (j == n) return i;
     }
 
-    // Load end-entity certificate
-    *x = PEM_read_bio_X509(cbio, NULL, NULL, NULL);
-    if (!*x) {
-        stir_shaken_set_error(ss, "(SSL) Failed to read X509 from BIO", STIR_SHAKEN_ERROR_SSL);
-        ss_status = STIR_SHAKEN_STATUS_TERM;
-        goto exit;
+    return 0;
+}
+
+// PKCS#7 signed-data (certs-only, application/pkcs7-mime), DER or PEM
+static STACK_OF(X509)* stir_shaken_x509_bundle_from_pkcs7(PKCS7 *p7)
+{
+    STACK_OF(X509) *certs = NULL, *stack = NULL;
+    int i = 0;
+
+    if (!p7 || !PKCS7_type_is_signed(p7) || !p7->d.sign || !(certs = p7->d.sign->cert)) return NULL;
+
+    stack = sk_X509_new_null();
+    if (!stack) return NULL;
+
+    for (i = 0; i < sk_X509_num(certs); i++) {
+
+        X509 *c = sk_X509_value(certs, i);
+
+        if (!X509_up_ref(c) || !sk_X509_push(stack, c)) {
+            X509_free(c);
+            sk_X509_pop_free(stack, X509_free);
+            return NULL;
+        }
     }
 
-    if (xchain) {
+    return stack;
+}
+
+// One or more concatenated DER certificates (application/pkix-cert)
+static STACK_OF(X509)* stir_shaken_x509_bundle_from_der(const unsigned char *p, size_t len)
+{
+    const unsigned char *end = p + len;
+    STACK_OF(X509) *stack = NULL;
+    X509 *c = NULL;
 
-        // Parse untrusted certificate chain
+    stack = sk_X509_new_null();
+    if (!stack) return NULL;
 
-        stack = sk_X509_new_null();
-        if (!stack) {
-            stir_shaken_set_error(ss, "Failed to allocate cert stack", STIR_SHAKEN_ERROR_SSL);
-            X509_free(*x);
-            ss_status = STIR_SHAKEN_STATUS_TERM;
-            goto exit;
+    while (p < end && (c = d2i_X509(NULL, &p, end - p))) {
+        if (!sk_X509_push(stack, c)) {
+            X509_free(c);
+            break;
         }
+    }
 
-        sk = PEM_X509_INFO_read_bio(cbio, NULL, NULL, NULL);
-        if (!sk) {
-            stir_shaken_set_error(ss, "Error reading certificate stack", STIR_SHAKEN_ERROR_SSL);
-            X509_free(*x);
-            sk_X509_free(stack);
-            ss_status = STIR_SHAKEN_STATUS_FALSE;
-            goto exit;
+    return stack;
+}
+
+static STACK_OF(X509)* stir_shaken_x509_bundle_from_pem(BIO *bio)
+{
+    STACK_OF(X509) *stack = NULL;
+    X509 *c = NULL;
+
+    stack = sk_X509_new_null();
+    if (!stack) return NULL;
+
+    while ((c = PEM_read_bio_X509(bio, NULL, NULL, NULL))) {
+        if (!sk_X509_push(stack, c)) {
+            X509_free(c);
+            break;
         }
+    }
+
+    return stack;
+}
 
-        while (sk_X509_INFO_num(sk)) {
+// DER: SEQUENCE whose first element is OID (ContentInfo, PKCS#7) or SEQUENCE (Certificate)
+static int stir_shaken_der_first_inner_tag(const unsigned char *p, size_t len)
+{
+    size_t n = 0;
 
-            xi = sk_X509_INFO_shift(sk);
+    if (len < 4 || p[0] != 0x30) return -1;
 
-            if (xi->x509 != NULL) {
+    if (p[1] < 0x80) {
+        n = 2;
+    } else {
+        n = 2 + (p[1] & 0x7f);
+    }
 
-                sk_X509_push(stack, xi->x509);
-                xi->x509 = NULL;
-            }
+    return n < len ? p[n] : -1;
+}
+
+stir_shaken_status_t stir_shaken_load_x509_from_mem_ex(stir_shaken_context_t *ss, X509 **x, STACK_OF(X509) **xchain, const void *mem, size_t len)
+{
+    const unsigned char *p = (const unsigned char *) mem, *end = p + len;
+    STACK_OF(X509) *stack = NULL;
+    BIO *cbio = NULL;
+    PKCS7 *p7 = NULL;
+    uint8_t unordered = 0;
+
+    stir_shaken_clear_error(ss);
+
+    if (!x || !mem || !len || len > INT_MAX) {
+        stir_shaken_set_error(ss, "Bad params", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    while (p < end && isspace(*p)) p++;
+
+    if (p < end && *p == 0x30) {
+
+        switch (stir_shaken_der_first_inner_tag(p, end - p)) {
 
-            X509_INFO_free(xi);
+            case 0x06:
+                p7 = d2i_PKCS7(NULL, &p, end - p);
+                stack = stir_shaken_x509_bundle_from_pkcs7(p7);
+                unordered = 1;
+                break;
+
+            case 0x30:
+                stack = stir_shaken_x509_bundle_from_der(p, end - p);
+                break;
+
+            default:
+                break;
         }
 
-        if (!sk_X509_num(stack)) {
+    } else {
 
-            sk_X509_free(stack);
+        // PEM, read in place (no copy, no need for terminating 0). PEM reader skips any text before "-----BEGIN".
+        cbio = BIO_new_mem_buf(mem, (int) len);
+        if (!cbio) {
+            stir_shaken_set_error(ss, "(SSL) Failed to create BIO", STIR_SHAKEN_ERROR_SSL);
+            return STIR_SHAKEN_STATUS_TERM;
+        }
 
-        } else {
+        stack = stir_shaken_x509_bundle_from_pem(cbio);
+
+        if ((!stack || !sk_X509_num(stack)) && BIO_reset(cbio) == 1) {
 
-            *xchain = stack;
+            sk_X509_free(stack);
+            p7 = PEM_read_bio_PKCS7(cbio, NULL, NULL, NULL);
+            stack = stir_shaken_x509_bundle_from_pkcs7(p7);
+            unordered = 1;
         }
+    }
+
+    ERR_clear_error();
+    PKCS7_free(p7);
+    BIO_free(cbio);
 
-        sk_X509_INFO_free(sk);
+    if (!stack || !sk_X509_num(stack)) {
+        sk_X509_free(stack);
+        stir_shaken_set_error(ss, "(SSL) Failed to read X509 from BIO", STIR_SHAKEN_ERROR_SSL);
+        return STIR_SHAKEN_STATUS_TERM;
     }
 
-exit:
-    if (cbio) {
-        BIO_free(cbio);
-        cbio = NULL;
+    // PEM and DER list end-entity cert first, PKCS#7 certs are a set
+    *x = sk_X509_delete(stack, unordered ? stir_shaken_x509_bundle_leaf(stack) : 0);
+
+    if (xchain && sk_X509_num(stack)) {
+        *xchain = stack;
+    } else {
+        sk_X509_pop_free(stack, X509_free);
     }
-    return ss_status;
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_load_x509_from_mem(stir_shaken_context_t *ss, X509 **x, STACK_OF(X509) **xchain, void *mem)
+{
+    if (!mem) {
+        stir_shaken_set_error(ss, "Bad params", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    return stir_shaken_load_x509_from_mem_ex(ss, x, xchain, mem, strlen(mem));
 }
 
 X509* stir_shaken_load_x509_from_file(stir_shaken_context_t *ss, const char *name)
@@ -2229,7 +5014,7 @@ stir_shaken_status_t stir_shaken_generate_keys(stir_shaken_context_t *ss, EC_KEY
         goto fail;
     }
 
-    fprintif(STIR_SHAKEN_LOGLEVEL_HIGH, "STIR-Shaken: SSL: Got new private/public EC key pair\n");
+    stir_shaken_log(STIR_SHAKEN_LOGLEVEL_HIGH, STIR_SHAKEN_LOG_SSL, "STIR-Shaken: SSL: Got new private/public EC key pair\n");
 
     if (!EC_KEY_check_key(ec_key)) {
         stir_shaken_set_error(ss, "Generate keys: SSL ERR: EC key pair is invalid", STIR_SHAKEN_ERROR_SSL);
@@ -2794,6 +5579,25 @@ stir_shaken_status_t stir_shaken_get_pubkey_raw_from_cert(stir_shaken_context_t
 
     if (!cert || !key || !key_len) return STIR_SHAKEN_STATUS_TERM;
 
+    if (cert->ref && cert->ref->x == cert->x) {
+
+        const unsigned char *raw = NULL;
+        int raw_len = 0;
+
+        if ((ret = stir_shaken_cert_ref_get_pubkey_raw(ss, cert->ref, &raw, &raw_len)) != STIR_SHAKEN_STATUS_OK) {
+            return ret;
+        }
+
+        if (raw_len > *key_len) {
+            stir_shaken_set_error(ss, "Get pubkey raw: Buffer too short", STIR_SHAKEN_ERROR_GENERAL);
+            return STIR_SHAKEN_STATUS_TERM;
+        }
+
+        memcpy(key, raw, raw_len);
+        *key_len = raw_len;
+        return STIR_SHAKEN_STATUS_OK;
+    }
+
     if (!(pk = X509_get_pubkey(cert->x))) {
 
         stir_shaken_set_error(ss, "Get pubkey raw: Failed to read EVP_PKEY from cert", STIR_SHAKEN_ERROR_SSL);
@@ -2964,7 +5768,7 @@ stir_shaken_status_t stir_shaken_init_ssl(stir_shaken_context_t *ss, const char
 
     }
 
-    fprintif(STIR_SHAKEN_LOGLEVEL_HIGH, "SSL: Using (%s [%d]) eliptic curve\n", curve->comment, curve->nid);
+    stir_shaken_log(STIR_SHAKEN_LOGLEVEL_HIGH, STIR_SHAKEN_LOG_SSL, "SSL: Using (%s [%d]) eliptic curve\n", curve->comment, curve->nid);
 
     stir_shaken_globals.curve_nid = curve_nid;
 
@@ -2973,10 +5777,10 @@ stir_shaken_status_t stir_shaken_init_ssl(stir_shaken_context_t *ss, const char
         goto fail;
     }
 
-    fprintif(STIR_SHAKEN_LOGLEVEL_HIGH, "Using TNAuthList extension with nid %d\n", stir_shaken_globals.tn_authlist_nid);
+    stir_shaken_log(STIR_SHAKEN_LOGLEVEL_HIGH, STIR_SHAKEN_LOG_SSL, "Using TNAuthList extension with nid %d\n", stir_shaken_globals.tn_authlist_nid);
 
-    // TODO pass CAs list and revocation list
-    if (STIR_SHAKEN_STATUS_OK != stir_shaken_init_cert_store(ss, NULL, ca_dir, NULL, NULL)) {
+    // TODO pass CAs list
+    if (STIR_SHAKEN_STATUS_OK != stir_shaken_init_cert_store(ss, NULL, ca_dir, NULL, crl_dir)) {
         sprintf(err_buf, "Cannot init x509 cert store (with: CA list: %s, CRL: %s", ca_dir ? ca_dir : "(null)", crl_dir ? crl_dir : "(null)");
         stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_CERT_STORE); 
         goto fail;
@@ -3018,13 +5822,23 @@ void stir_shaken_deinit_ssl(void)
 
 stir_shaken_status_t stir_shaken_cert_to_authority_check_url(stir_shaken_context_t *ss, stir_shaken_cert_t *cert, char *authority_check_url, int buflen)
 {
+    const stir_shaken_tn_authlist_t *tn_authlist = NULL;
+
     if (!cert || !authority_check_url || buflen == 0) {
         stir_shaken_set_error(ss, "Bad params", STIR_SHAKEN_ERROR_GENERAL);
         return STIR_SHAKEN_STATUS_TERM;
     }
 
-    // TODO Get authority check URL from cert
-    strncpy(authority_check_url, "http://190.102.98.199/sti-ca/authority-over-the-number-check/0", buflen);
+    tn_authlist = stir_shaken_cert_get_tn_authlist(ss, cert);
+    if (!tn_authlist || stir_shaken_zstr(tn_authlist->uri)) {
+        stir_shaken_set_error_if_clear(ss, "Cert has no authority check URL", STIR_SHAKEN_ERROR_TNAUTHLIST);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (snprintf(authority_check_url, buflen, "%s", tn_authlist->uri) >= buflen) {
+        stir_shaken_set_error(ss, "Authority check URL too long", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
 
     return STIR_SHAKEN_STATUS_OK;
 }
@@ -1,26 +1,23 @@
 #include "stir_shaken.h"
 #include <curl/curl.h>
+#include <limits.h>
 
 #undef BUFSIZE
 #define BUFSIZE 1024*8
 
 
-stir_shaken_status_t stir_shaken_basic_cert_check(stir_shaken_context_t *ss, stir_shaken_cert_t *cert)
+static stir_shaken_status_t stir_shaken_basic_check(stir_shaken_context_t *ss, int version, const ASN1_TIME *notBefore, const ASN1_TIME *notAfter)
 {
-    int version = -1;
     int res = 0;
     char					err_buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
 
-    if (!cert) return STIR_SHAKEN_STATUS_TERM;
-
-    version = stir_shaken_cert_get_version(cert);
     if (version < 1) {
         snprintf(err_buf, STIR_SHAKEN_ERROR_BUF_LEN, "Invalid STI cert: wrong version: %d", version);
         stir_shaken_set_error(ss, err_buf, STIR_SHAKEN_ERROR_CERT_VERSION);
         return STIR_SHAKEN_STATUS_FALSE;
     }
 
-    res = X509_cmp_current_time(cert->notBefore_ASN1);
+    res = X509_cmp_current_time(notBefore);
     if (res == 0) {
         stir_shaken_set_error(ss, "Error validating STI Cert's notBefore timestamp", STIR_SHAKEN_ERROR_SSL);
         return STIR_SHAKEN_STATUS_FALSE;
@@ -31,7 +28,7 @@ stir_shaken_status_t stir_shaken_basic_cert_check(stir_shaken_context_t *ss, sti
         return STIR_SHAKEN_STATUS_FALSE;
     }
 
-    res = X509_cmp_current_time(cert->notAfter_ASN1);
+    res = X509_cmp_current_time(notAfter);
     if (res == 0) {
         stir_shaken_set_error(ss, "Error validating STI Cert's notAfter timestamp", STIR_SHAKEN_ERROR_SSL);
         return STIR_SHAKEN_STATUS_FALSE;
@@ -45,6 +42,13 @@ stir_shaken_status_t stir_shaken_basic_cert_check(stir_shaken_context_t *ss, sti
     return STIR_SHAKEN_STATUS_OK;
 }
 
+stir_shaken_status_t stir_shaken_basic_cert_check(stir_shaken_context_t *ss, stir_shaken_cert_t *cert)
+{
+    if (!cert) return STIR_SHAKEN_STATUS_TERM;
+
+    return stir_shaken_basic_check(ss, stir_shaken_cert_get_version(cert), cert->notBefore_ASN1, cert->notAfter_ASN1);
+}
+
 stir_shaken_status_t stir_shaken_vs_verify_stica_against_list(stir_shaken_context_t *ss, stir_shaken_cert_t *cert)
 {
     if (!cert) return STIR_SHAKEN_STATUS_FALSE;
@@ -103,31 +107,6 @@ static stir_shaken_status_t stir_shaken_jwt_sih_to_jwt_encoded(stir_shaken_conte
     return STIR_SHAKEN_STATUS_OK;
 }
 
-static size_t curl_callback(void *contents, size_t size, size_t nmemb, void *p)
-{
-    char *m = NULL;
-    size_t realsize = size * nmemb;
-    mem_chunk_t *mem = (mem_chunk_t *) p;
-
-
-    stir_shaken_clear_error(mem->ss);
-
-    fprintif(STIR_SHAKEN_LOGLEVEL_HIGH, "STIR-Shaken: CURL: Download progress: got %zu bytes (%zu total)\n", realsize, realsize + mem->size);
-
-    m = realloc(mem->mem, mem->size + realsize + 1);
-    if(!m) {
-        stir_shaken_set_error(mem->ss, "realloc returned NULL", STIR_SHAKEN_ERROR_GENERAL);
-        return 0;
-    }
-
-    mem->mem = m;
-    memcpy(&(mem->mem[mem->size]), contents, realsize);
-    mem->size += realsize;
-    mem->mem[mem->size] = 0;
-
-    return realsize;
-}
-
 stir_shaken_status_t stir_shaken_download_cert(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req)
 {
     stir_shaken_status_t ss_status = STIR_SHAKEN_STATUS_FALSE;
@@ -142,7 +121,11 @@ stir_shaken_status_t stir_shaken_download_cert(stir_shaken_context_t *ss, stir_s
         return STIR_SHAKEN_STATUS_TERM;
     }
 
-    if (STIR_SHAKEN_STATUS_OK != stir_shaken_make_http_get_req(ss, http_req)) {
+    if (!http_req->max_response_size) {
+        http_req->max_response_size = STIR_SHAKEN_CERT_MAX_SIZE;
+    }
+
+    if (STIR_SHAKEN_STATUS_OK != stir_shaken_make_http_get_req_hedged(ss, http_req)) {
         stir_shaken_set_error(ss, "Cannot connect to URL", STIR_SHAKEN_ERROR_HTTP_GENERAL);
         return STIR_SHAKEN_STATUS_FALSE;
     }
@@ -155,15 +138,330 @@ stir_shaken_status_t stir_shaken_download_cert(stir_shaken_context_t *ss, stir_s
     return STIR_SHAKEN_STATUS_OK;
 }
 
+static unsigned long stir_shaken_x5u_cache_hash(const char *url)
+{
+    unsigned long h = 5381;
+
+    while (*url) {
+        h = h * 33 + (unsigned char) *url++;
+    }
+
+    return h % STIR_SHAKEN_X5U_CACHE_BUCKETS;
+}
+
+static void stir_shaken_x5u_cache_entry_destroy(stir_shaken_x5u_cache_entry_t *e)
+{
+    if (!e) return;
+
+    stir_shaken_cert_ref_put(e->ref);
+    free(e->url);
+    free(e->etag);
+    free(e->last_modified);
+    free(e);
+}
+
+// Must be called with x5u_cache_mutex locked
+static stir_shaken_x5u_cache_entry_t* stir_shaken_x5u_cache_find(const char *url)
+{
+    stir_shaken_x5u_cache_entry_t *e = stir_shaken_globals.x5u_cache[stir_shaken_x5u_cache_hash(url)];
+
+    while (e && strcmp(e->url, url)) {
+        e = e->next;
+    }
+
+    return e;
+}
+
+// Must be called with x5u_cache_mutex locked
+static void stir_shaken_x5u_cache_unlink(stir_shaken_x5u_cache_entry_t *e)
+{
+    stir_shaken_x5u_cache_entry_t **pe = &stir_shaken_globals.x5u_cache[stir_shaken_x5u_cache_hash(e->url)];
+
+    while (*pe && *pe != e) {
+        pe = &(*pe)->next;
+    }
+
+    if (*pe) {
+        *pe = e->next;
+        stir_shaken_globals.x5u_cache_n--;
+    }
+
+    stir_shaken_expiry_cancel(&stir_shaken_globals.x5u_cache_expiry, &e->expiry);
+    stir_shaken_x5u_cache_entry_destroy(e);
+}
+
 /*
- * cert - (in/out)
+ * Must be called with x5u_cache_mutex locked. Stale entry is useless unless it can be revalidated with conditional GET,
+ * then it is kept until its cert expires. Entry dropped at once if it would never be served again.
  */
-stir_shaken_status_t stir_shaken_jwt_download_cert(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_t **cert_out, jwt_t **jwt_out)
+static void stir_shaken_x5u_cache_schedule(stir_shaken_x5u_cache_entry_t *e, time_t now)
+{
+    time_t at = e->not_after;
+
+    if (!e->etag && !e->last_modified && e->expires < at) {
+        at = e->expires;
+    }
+
+    if (at <= now || stir_shaken_expiry_schedule(&stir_shaken_globals.x5u_cache_expiry, &e->expiry, at) != STIR_SHAKEN_STATUS_OK) {
+        stir_shaken_x5u_cache_unlink(e);
+    }
+}
+
+// Must be called with x5u_cache_mutex locked. Drop entries due by @now, then ones due first while there are @max or more.
+static void stir_shaken_x5u_cache_evict(time_t now, int max)
+{
+    stir_shaken_expiry_node_t *node = NULL;
+
+    while ((node = stir_shaken_expiry_first(&stir_shaken_globals.x5u_cache_expiry)) && (node->at <= now || stir_shaken_globals.x5u_cache_n >= max)) {
+        stir_shaken_x5u_cache_unlink(STIR_SHAKEN_EXPIRY_ENTRY(node, stir_shaken_x5u_cache_entry_t, expiry));
+    }
+}
+
+void stir_shaken_x5u_cache_expire(void)
+{
+    pthread_mutex_lock(&stir_shaken_globals.x5u_cache_mutex);
+    stir_shaken_x5u_cache_evict(time(NULL), INT_MAX);
+    pthread_mutex_unlock(&stir_shaken_globals.x5u_cache_mutex);
+}
+
+// notAfter of @x, 0 if it cannot be read (entry is not cached then)
+static time_t stir_shaken_x5u_cache_not_after(X509 *x)
+{
+    struct tm tm = { 0 };
+
+    if (!x || ASN1_TIME_to_tm(X509_get0_notAfter(x), &tm) != 1) return 0;
+
+    return timegm(&tm);
+}
+
+static int stir_shaken_x5u_cache_max(void)
+{
+    return stir_shaken_globals.x5u_cache_max ? stir_shaken_globals.x5u_cache_max : STIR_SHAKEN_X5U_CACHE_MAX;
+}
+
+static void stir_shaken_x5u_cache_put(stir_shaken_cert_ref_t *ref, const char *url, const char *etag, const char *last_modified)
+{
+    stir_shaken_x5u_cache_entry_t *e = NULL;
+    time_t now = time(NULL);
+
+    pthread_mutex_lock(&stir_shaken_globals.x5u_cache_mutex);
+
+    // Drop old entry for this URL, expired entries, and make room if full
+    if ((e = stir_shaken_x5u_cache_find(url))) {
+        stir_shaken_x5u_cache_unlink(e);
+    }
+    stir_shaken_x5u_cache_evict(now, stir_shaken_x5u_cache_max());
+
+    e = calloc(1, sizeof(*e));
+    if (!e) {
+        pthread_mutex_unlock(&stir_shaken_globals.x5u_cache_mutex);
+        return;
+    }
+
+    e->url = strdup(url);
+    e->etag = etag ? strdup(etag) : NULL;
+    e->last_modified = last_modified ? strdup(last_modified) : NULL;
+    e->ref = stir_shaken_cert_ref_get(ref);
+    e->expires = now + stir_shaken_globals.x5u_cache_ttl;
+    e->not_after = stir_shaken_x5u_cache_not_after(ref->x);
+
+    if (!e->url) {
+        stir_shaken_x5u_cache_entry_destroy(e);
+        pthread_mutex_unlock(&stir_shaken_globals.x5u_cache_mutex);
+        return;
+    }
+
+    e->next = stir_shaken_globals.x5u_cache[stir_shaken_x5u_cache_hash(url)];
+    stir_shaken_globals.x5u_cache[stir_shaken_x5u_cache_hash(url)] = e;
+    stir_shaken_globals.x5u_cache_n++;
+
+    stir_shaken_x5u_cache_schedule(e, now);
+
+    pthread_mutex_unlock(&stir_shaken_globals.x5u_cache_mutex);
+}
+
+stir_shaken_status_t stir_shaken_x5u_cache_init(stir_shaken_context_t *ss)
+{
+    if (pthread_mutex_init(&stir_shaken_globals.x5u_cache_mutex, NULL) != 0) {
+        stir_shaken_set_error(ss, "Init x5u cache mutex failed", STIR_SHAKEN_ERROR_GENERAL);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+void stir_shaken_x5u_cache_flush(void)
+{
+    stir_shaken_x5u_cache_entry_t *e = NULL;
+    int i = 0;
+
+    pthread_mutex_lock(&stir_shaken_globals.x5u_cache_mutex);
+
+    stir_shaken_expiry_destroy(&stir_shaken_globals.x5u_cache_expiry);
+
+    for (i = 0; i < STIR_SHAKEN_X5U_CACHE_BUCKETS; i++) {
+
+        while ((e = stir_shaken_globals.x5u_cache[i])) {
+            stir_shaken_globals.x5u_cache[i] = e->next;
+            stir_shaken_x5u_cache_entry_destroy(e);
+        }
+    }
+    stir_shaken_globals.x5u_cache_n = 0;
+
+    pthread_mutex_unlock(&stir_shaken_globals.x5u_cache_mutex);
+}
+
+void stir_shaken_x5u_cache_deinit(void)
+{
+    stir_shaken_x5u_cache_flush();
+    pthread_mutex_destroy(&stir_shaken_globals.x5u_cache_mutex);
+}
+
+void stir_shaken_x5u_cache_set_ttl(time_t ttl)
+{
+    stir_shaken_globals.x5u_cache_ttl = ttl;
+
+    if (!ttl) {
+        stir_shaken_x5u_cache_flush();
+    }
+}
+
+void stir_shaken_x5u_cache_set_max(int max)
+{
+    pthread_mutex_lock(&stir_shaken_globals.x5u_cache_mutex);
+
+    stir_shaken_globals.x5u_cache_max = max;
+
+    // Down to new max
+    stir_shaken_x5u_cache_evict(time(NULL), stir_shaken_x5u_cache_max() + 1);
+
+    pthread_mutex_unlock(&stir_shaken_globals.x5u_cache_mutex);
+}
+
+/*
+ * Download cert from @http_req->url into @ref_out, use x5u cache if enabled.
+ * Fresh entry is served without HTTP request, stale entry is revalidated with conditional GET if possible.
+ * Cert served from cache is shared with the cache, no parsing is done.
+ */
+static stir_shaken_status_t stir_shaken_download_cert_cached(stir_shaken_context_t *ss, stir_shaken_http_req_t *http_req, stir_shaken_cert_ref_t **ref_out)
+{
+    stir_shaken_x5u_cache_entry_t *e = NULL;
+    stir_shaken_cert_ref_t *ref = NULL;
+    X509 *x = NULL;
+    STACK_OF(X509) *xchain = NULL;
+    stir_shaken_status_t ss_status = STIR_SHAKEN_STATUS_FALSE;
+    char validator[STIR_SHAKEN_BUFLEN] = { 0 };
+    const char *url = http_req->url;
+    uint8_t conditional = 0;
+
+    if (stir_shaken_globals.x5u_cache_ttl) {
+
+        pthread_mutex_lock(&stir_shaken_globals.x5u_cache_mutex);
+
+        e = stir_shaken_x5u_cache_find(url);
+
+        // Cert expired, even if entry itself would still be fresh or could be revalidated
+        if (e && time(NULL) >= e->not_after) {
+            stir_shaken_x5u_cache_unlink(e);
+            e = NULL;
+        }
+
+        if (e && time(NULL) < e->expires) {
+
+            *ref_out = stir_shaken_cert_ref_get(e->ref);
+            pthread_mutex_unlock(&stir_shaken_globals.x5u_cache_mutex);
+            return STIR_SHAKEN_STATUS_OK;
+        }
+
+        if (e && e->etag) {
+            snprintf(validator, sizeof(validator), "If-None-Match: %s", e->etag);
+            stir_shaken_http_add_header(http_req, validator);
+            conditional = 1;
+        }
+
+        if (e && e->last_modified) {
+            snprintf(validator, sizeof(validator), "If-Modified-Since: %s", e->last_modified);
+            stir_shaken_http_add_header(http_req, validator);
+            conditional = 1;
+        }
+
+        pthread_mutex_unlock(&stir_shaken_globals.x5u_cache_mutex);
+    }
+
+    if (!conditional) {
+        ss_status = stir_shaken_download_cert(ss, http_req);
+        if (STIR_SHAKEN_STATUS_OK != ss_status) {
+            return ss_status;
+        }
+    } else {
+
+        if (!http_req->max_response_size) {
+            http_req->max_response_size = STIR_SHAKEN_CERT_MAX_SIZE;
+        }
+
+        if (STIR_SHAKEN_STATUS_OK != stir_shaken_make_http_get_req_hedged(ss, http_req)) {
+            stir_shaken_set_error(ss, "Cannot connect to URL", STIR_SHAKEN_ERROR_HTTP_GENERAL);
+            return STIR_SHAKEN_STATUS_FALSE;
+        }
+
+        if (http_req->response.code == 304) {
+
+            pthread_mutex_lock(&stir_shaken_globals.x5u_cache_mutex);
+
+            if ((e = stir_shaken_x5u_cache_find(url)) && time(NULL) < e->not_after) {
+
+                // Not modified, keep parsed (and possibly validated) cert
+                e->expires = time(NULL) + stir_shaken_globals.x5u_cache_ttl;
+                *ref_out = stir_shaken_cert_ref_get(e->ref);
+                stir_shaken_x5u_cache_schedule(e, time(NULL));
+                pthread_mutex_unlock(&stir_shaken_globals.x5u_cache_mutex);
+                return STIR_SHAKEN_STATUS_OK;
+            }
+
+            pthread_mutex_unlock(&stir_shaken_globals.x5u_cache_mutex);
+
+            // Entry flushed meanwhile
+            curl_slist_free_all(http_req->tx_headers);
+            http_req->tx_headers = NULL;
+            return stir_shaken_download_cert_cached(ss, http_req, ref_out);
+        }
+
+        if (http_req->response.code != 200 && http_req->response.code != 201) {
+            stir_shaken_set_error(ss, "HTTP request rejected", STIR_SHAKEN_ERROR_HTTP_GENERAL);
+            return STIR_SHAKEN_STATUS_FALSE;
+        }
+    }
+
+    ss_status = stir_shaken_load_x509_from_mem_ex(ss, &x, &xchain, http_req->response.mem.mem, http_req->response.mem.size);
+    if (STIR_SHAKEN_STATUS_OK != ss_status) {
+        stir_shaken_set_error(ss, "Error while loading cert from memory", STIR_SHAKEN_ERROR_GENERAL);
+        return ss_status;
+    }
+
+    ref = stir_shaken_cert_ref_create(ss, x, xchain, http_req->response.mem.size);
+    if (!ref) {
+        X509_free(x);
+        sk_X509_pop_free(xchain, X509_free);
+        return STIR_SHAKEN_STATUS_TERM;
+    }
+
+    if (stir_shaken_globals.x5u_cache_ttl) {
+        stir_shaken_x5u_cache_put(ref, url, stir_shaken_get_http_header(http_req, "ETag"), stir_shaken_get_http_header(http_req, "Last-Modified"));
+    }
+
+    *ref_out = ref;
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+/*
+ * ref_out - (out) cert, must be released with stir_shaken_cert_ref_put
+ * deadline_ms - if not 0, download must complete by this time (stir_shaken_now_ms)
+ */
+static stir_shaken_status_t stir_shaken_jwt_download_cert_ref(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_ref_t **ref_out, jwt_t **jwt_out, uint64_t deadline_ms)
 {
     stir_shaken_status_t	ss_status = STIR_SHAKEN_STATUS_FALSE;
     stir_shaken_http_req_t	http_req = { 0 };
-    long					res = CURLE_OK;
-    stir_shaken_cert_t		*cert = NULL;
+    stir_shaken_cert_ref_t	*ref = NULL;
     const char				*cert_url = NULL;
     jwt_t					*jwt = NULL;
 
@@ -175,7 +473,7 @@ stir_shaken_status_t stir_shaken_jwt_download_cert(stir_shaken_context_t *ss, co
         goto fail;
     }
 
-    if (!cert_out) {
+    if (!ref_out) {
         stir_shaken_set_error(ss, "Bad params: Pointer to result cert is NULL", STIR_SHAKEN_ERROR_SIP_436_BAD_IDENTITY_INFO);
         goto fail;
     }
@@ -191,33 +489,16 @@ stir_shaken_status_t stir_shaken_jwt_download_cert(stir_shaken_context_t *ss, co
         goto fail;
     }
     http_req.url = strdup(cert_url);
+    http_req.deadline_ms = deadline_ms;
 
-    jwt_free(jwt);
-    jwt = NULL;
-
-    ss_status = stir_shaken_download_cert(ss, &http_req);
+    ss_status = stir_shaken_download_cert_cached(ss, &http_req, &ref);
     if (STIR_SHAKEN_STATUS_OK != ss_status) {
         stir_shaken_set_error(ss, "Cannot download certificate", STIR_SHAKEN_ERROR_SIP_436_BAD_IDENTITY_INFO);
         goto fail;
     }
 
-    cert = malloc(sizeof(stir_shaken_cert_t));
-    if (!cert) {
-        stir_shaken_set_error(ss, "Cannot allocate cert", STIR_SHAKEN_ERROR_GENERAL);
-        goto fail;
-    }
-    memset(cert, 0, sizeof(stir_shaken_cert_t));
-
-    ss_status = stir_shaken_load_x509_from_mem(ss, &cert->x, &cert->xchain, http_req.response.mem.mem);
-    if (STIR_SHAKEN_STATUS_OK != ss_status) {
-        stir_shaken_set_error(ss, "Error while loading cert from memory", STIR_SHAKEN_ERROR_GENERAL);
-        goto fail;
-    }
-
-    cert->len = http_req.response.mem.size;
-
-    // Note, cert must be destroyed by caller
-    *cert_out = cert;
+    // Note, cert must be released by caller
+    *ref_out = ref;
     if (jwt_out) {
         *jwt_out = jwt;
     } else {
@@ -233,12 +514,7 @@ fail:
 
     stir_shaken_set_error_if_clear(ss, "Unknown error while verifying JWT", STIR_SHAKEN_ERROR_SIP_438_INVALID_IDENTITY_HEADER);
 
-    if (cert) {
-        stir_shaken_destroy_cert(cert);
-        free(cert);
-        cert = NULL;
-    }
-
+    stir_shaken_cert_ref_put(ref);
     if (jwt) jwt_free(jwt);
 
     stir_shaken_destroy_http_request(&http_req);
@@ -246,6 +522,55 @@ fail:
     return STIR_SHAKEN_STATUS_FALSE;
 }
 
+// Wrap @ref into @cert_out if requested, @ref is released
+static stir_shaken_status_t stir_shaken_cert_ref_out(stir_shaken_context_t *ss, stir_shaken_cert_ref_t *ref, stir_shaken_cert_t **cert_out)
+{
+    stir_shaken_cert_t *cert = NULL;
+
+    if (cert_out) {
+        cert = stir_shaken_cert_ref_to_cert(ss, ref);
+    }
+    stir_shaken_cert_ref_put(ref);
+
+    if (cert_out) {
+
+        if (!cert) return STIR_SHAKEN_STATUS_TERM;
+
+        // Note, cert must be destroyed by caller
+        *cert_out = cert;
+    }
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_jwt_download_cert(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_t **cert_out, jwt_t **jwt_out)
+{
+    stir_shaken_cert_ref_t *ref = NULL;
+    jwt_t *jwt = NULL;
+
+    if (!cert_out) {
+        stir_shaken_set_error(ss, "Bad params: Pointer to result cert is NULL", STIR_SHAKEN_ERROR_SIP_436_BAD_IDENTITY_INFO);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (STIR_SHAKEN_STATUS_OK != stir_shaken_jwt_download_cert_ref(ss, token, &ref, &jwt, 0)) {
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (STIR_SHAKEN_STATUS_OK != stir_shaken_cert_ref_out(ss, ref, cert_out)) {
+        jwt_free(jwt);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (jwt_out) {
+        *jwt_out = jwt;
+    } else {
+        jwt_free(jwt);
+    }
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
 stir_shaken_status_t stir_shaken_sih_verify_with_cert(stir_shaken_context_t *ss, const char *identity_header, stir_shaken_cert_t *cert, stir_shaken_passport_t *passport)
 {
     unsigned char key[STIR_SHAKEN_PUB_KEY_RAW_BUF_LEN] = { 0 };
@@ -275,14 +600,13 @@ stir_shaken_status_t stir_shaken_sih_verify_with_cert(stir_shaken_context_t *ss,
     return STIR_SHAKEN_STATUS_OK;
 }
 
-stir_shaken_status_t stir_shaken_jwt_verify(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_t **cert_out, jwt_t **jwt_out)
+static stir_shaken_status_t stir_shaken_jwt_verify_ref(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_ref_t **ref_out, jwt_t **jwt_out, uint64_t deadline_ms)
 {
     stir_shaken_status_t	ss_status = STIR_SHAKEN_STATUS_FALSE;
-    long					res = CURLE_OK;
-    stir_shaken_cert_t		*cert = NULL;
+    stir_shaken_cert_ref_t	*ref = NULL;
     jwt_t					*jwt = NULL;
-    unsigned char key[STIR_SHAKEN_PUB_KEY_RAW_BUF_LEN] = { 0 };
-    int key_len = STIR_SHAKEN_PUB_KEY_RAW_BUF_LEN;
+    const unsigned char		*key = NULL;
+    int						key_len = 0;
 
     stir_shaken_clear_error(ss);
 
@@ -291,28 +615,27 @@ stir_shaken_status_t stir_shaken_jwt_verify(stir_shaken_context_t *ss, const cha
         goto fail;
     }
 
-    ss_status = stir_shaken_jwt_download_cert(ss, token, &cert, &jwt);
+    ss_status = stir_shaken_jwt_download_cert_ref(ss, token, &ref, NULL, deadline_ms);
     if (STIR_SHAKEN_STATUS_OK != ss_status) {
         stir_shaken_set_error(ss, "Failed to download certificate", STIR_SHAKEN_ERROR_CERT_DOWNLOAD);
         goto fail;
     }
 
-    if (stir_shaken_get_pubkey_raw_from_cert(ss, cert, key, &key_len) != STIR_SHAKEN_STATUS_OK) {
+    // Made once per cert, shared by all verifications using it
+    if (stir_shaken_cert_ref_get_pubkey_raw(ss, ref, &key, &key_len) != STIR_SHAKEN_STATUS_OK) {
         stir_shaken_set_error(ss, "Failed to get public key in raw format from certificate", STIR_SHAKEN_ERROR_SSL);
         goto fail;
     }
 
-    if (jwt_decode(&jwt, token, key, key_len)) {
+    if (jwt_decode(&jwt, token, (unsigned char *) key, key_len)) {
         stir_shaken_set_error(ss, "JWT did not pass verification", STIR_SHAKEN_ERROR_SIP_438_INVALID_IDENTITY_HEADER);
         goto fail;
     }
 
-    if (cert_out) {
-        *cert_out = cert;
+    if (ref_out) {
+        *ref_out = ref;
     } else {
-        stir_shaken_destroy_cert(cert);
-        free(cert);
-        cert = NULL;
+        stir_shaken_cert_ref_put(ref);
     }
 
     if (jwt_out) {
@@ -327,52 +650,81 @@ fail:
 
     stir_shaken_set_error_if_clear(ss, "Unknown error while verifying JWT", STIR_SHAKEN_ERROR_SIP_438_INVALID_IDENTITY_HEADER);
 
-    if (cert) {
-        stir_shaken_destroy_cert(cert);
-    }
+    stir_shaken_cert_ref_put(ref);
     if (jwt) jwt_free(jwt);
     return STIR_SHAKEN_STATUS_FALSE;
 }
 
-stir_shaken_status_t stir_shaken_jwt_verify_and_check_x509_cert_path(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_t **cert_out, jwt_t **jwt_out)
+stir_shaken_status_t stir_shaken_jwt_verify_ex(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_t **cert_out, jwt_t **jwt_out, uint64_t deadline_ms)
+{
+    stir_shaken_cert_ref_t *ref = NULL;
+    jwt_t *jwt = NULL;
+
+    if (STIR_SHAKEN_STATUS_OK != stir_shaken_jwt_verify_ref(ss, token, &ref, &jwt, deadline_ms)) {
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (STIR_SHAKEN_STATUS_OK != stir_shaken_cert_ref_out(ss, ref, cert_out)) {
+        jwt_free(jwt);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (jwt_out) {
+        *jwt_out = jwt;
+    } else {
+        jwt_free(jwt);
+    }
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_jwt_verify(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_t **cert_out, jwt_t **jwt_out)
+{
+    return stir_shaken_jwt_verify_ex(ss, token, cert_out, jwt_out, 0);
+}
+
+stir_shaken_status_t stir_shaken_jwt_verify_and_check_x509_cert_path_ref(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_ref_t **ref_out, jwt_t **jwt_out, uint64_t deadline_ms)
 {
     stir_shaken_status_t	ss_status = STIR_SHAKEN_STATUS_FALSE;
-    stir_shaken_http_req_t	http_req = { 0 };
-    long					res = CURLE_OK;
-    stir_shaken_cert_t		*cert = NULL;
-    const char				*cert_url = NULL;
+    stir_shaken_cert_ref_t	*ref = NULL;
     jwt_t					*jwt = NULL;
 
     stir_shaken_clear_error(ss);
-    memset(&http_req, 0, sizeof(http_req));
 
     if (!token) {
         stir_shaken_set_error(ss, "Bad params: JWT token is missing", STIR_SHAKEN_ERROR_SIP_436_BAD_IDENTITY_INFO);
         goto fail;
     }
 
-    ss_status = stir_shaken_jwt_verify(ss, token, &cert, &jwt);
+    ss_status = stir_shaken_jwt_verify_ref(ss, token, &ref, &jwt, deadline_ms);
     if (STIR_SHAKEN_STATUS_OK != ss_status) {
         stir_shaken_set_error(ss, "JWT did not pass verification", STIR_SHAKEN_ERROR_SIP_438_INVALID_IDENTITY_HEADER);
         goto fail;
     }
 
-    ss_status = stir_shaken_read_cert_fields(ss, cert);
-    if (STIR_SHAKEN_STATUS_OK != ss_status) {
-        stir_shaken_set_error(ss, "Error parsing certificate", STIR_SHAKEN_ERROR_GENERAL);
-        goto fail;
-    }
-
-    ss_status = stir_shaken_basic_cert_check(ss, cert);
+    ss_status = stir_shaken_basic_check(ss, ((int) X509_get_version(ref->x)) + 1, X509_get0_notBefore(ref->x), X509_get0_notAfter(ref->x));
     if (STIR_SHAKEN_STATUS_OK != ss_status) {
         stir_shaken_set_error(ss, "Cert did not pass basic check (wrong version or expired)", STIR_SHAKEN_ERROR_CERT_INVALID);
         goto fail;
     }
 
-    ss_status = stir_shaken_verify_cert_path(ss, cert);
-    if (STIR_SHAKEN_STATUS_OK != ss_status) {
-        stir_shaken_set_error(ss, "Cert did not pass X509 path validation", STIR_SHAKEN_ERROR_CERT_INVALID);
-        goto fail;
+    if (!stir_shaken_cert_ref_path_verified(ref)) {
+
+        ss_status = stir_shaken_cert_ref_verify_path(ss, ref);
+        if (STIR_SHAKEN_STATUS_OK != ss_status) {
+            stir_shaken_error_t error = stir_shaken_is_error_set(ss) ? stir_shaken_get_error_code(ss) : STIR_SHAKEN_ERROR_CERT_INVALID;
+
+            stir_shaken_set_error(ss, "Cert did not pass X509 path validation", (error == STIR_SHAKEN_ERROR_CERT_REVOKED || error == STIR_SHAKEN_ERROR_OCSP) ? error : STIR_SHAKEN_ERROR_CERT_INVALID);
+            goto fail;
+        }
+
+    } else {
+
+        // Path validated before against this trust store, but revocation status may have changed since (CRL updates, OCSP)
+        ss_status = stir_shaken_cert_ref_check_revocation(ss, ref);
+        if (STIR_SHAKEN_STATUS_OK != ss_status) {
+            goto fail;
+        }
     }
 
     if (jwt_out) {
@@ -382,16 +734,14 @@ stir_shaken_status_t stir_shaken_jwt_verify_and_check_x509_cert_path(stir_shaken
         jwt = NULL;
     }
 
-    if (cert_out) {
+    if (ref_out) {
 
-        // Note, cert must be destroyed by caller
-        *cert_out = cert;
+        // Note, cert must be released by caller
+        *ref_out = ref;
 
     } else {
 
-        stir_shaken_destroy_cert(cert);
-        free(cert);
-        cert = NULL;
+        stir_shaken_cert_ref_put(ref);
     }
     return STIR_SHAKEN_STATUS_OK;
 
@@ -399,18 +749,49 @@ fail:
 
     stir_shaken_set_error_if_clear(ss, "Unknown error while verifying JWT", STIR_SHAKEN_ERROR_SIP_438_INVALID_IDENTITY_HEADER);
 
-    stir_shaken_destroy_cert(cert);
-    stir_shaken_destroy_http_request(&http_req);
+    stir_shaken_cert_ref_put(ref);
     if (jwt) jwt_free(jwt);
-    if (cert) {
-        free(cert);
-    }
     return STIR_SHAKEN_STATUS_FALSE;
 }
 
+stir_shaken_status_t stir_shaken_jwt_verify_and_check_x509_cert_path_ex(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_t **cert_out, jwt_t **jwt_out, uint64_t deadline_ms)
+{
+    stir_shaken_cert_ref_t *ref = NULL;
+    jwt_t *jwt = NULL;
+
+    if (STIR_SHAKEN_STATUS_OK != stir_shaken_jwt_verify_and_check_x509_cert_path_ref(ss, token, &ref, &jwt, deadline_ms)) {
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (STIR_SHAKEN_STATUS_OK != stir_shaken_cert_ref_out(ss, ref, cert_out)) {
+        jwt_free(jwt);
+        return STIR_SHAKEN_STATUS_FALSE;
+    }
+
+    if (cert_out) {
+
+        // Same state as cert read and verified in place would have
+        stir_shaken_read_cert_fields(ss, *cert_out);
+    }
+
+    if (jwt_out) {
+        *jwt_out = jwt;
+    } else {
+        jwt_free(jwt);
+    }
+
+    return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_jwt_verify_and_check_x509_cert_path(stir_shaken_context_t *ss, const char *token, stir_shaken_cert_t **cert_out, jwt_t **jwt_out)
+{
+    return stir_shaken_jwt_verify_and_check_x509_cert_path_ex(ss, token, cert_out, jwt_out, 0);
+}
+
 stir_shaken_status_t stir_shaken_check_authority_over_number(stir_shaken_context_t *ss, stir_shaken_cert_t *cert, stir_shaken_passport_t *passport)
 {
-    char *origin_identity = NULL;
+    const stir_shaken_tn_authlist_t *tn_authlist = NULL;
+    const char *origin_identity = NULL;
     char authority_check_url[STIR_SHAKEN_BUFLEN] = { 0 };
     int is_tn = 0;
 
@@ -419,14 +800,27 @@ stir_shaken_status_t stir_shaken_check_authority_over_number(stir_shaken_context
         return STIR_SHAKEN_STATUS_TERM;
     }
 
-    if ((STIR_SHAKEN_STATUS_OK != stir_shaken_cert_to_authority_check_url(ss, cert, authority_check_url, STIR_SHAKEN_BUFLEN)) || stir_shaken_zstr(authority_check_url)) {
-        stir_shaken_set_error(ss, "Cannot get SPC from certificate", STIR_SHAKEN_ERROR_GENERAL);
+    origin_identity = stir_shaken_passport_get_tn_or_uri(ss, passport, "orig", &is_tn);
+    if (stir_shaken_zstr(origin_identity)) {
+        stir_shaken_set_error(ss, "PASSporT has no identity claim", STIR_SHAKEN_ERROR_GENERAL);
         return STIR_SHAKEN_STATUS_RESTART;
     }
 
-    origin_identity = stir_shaken_passport_get_identity(ss, passport, &is_tn);
-    if (stir_shaken_zstr(origin_identity)) {
-        stir_shaken_set_error(ss, "PASSporT has no identity claim", STIR_SHAKEN_ERROR_GENERAL);
+    // Answered locally if cert lists TNs or TN ranges
+    tn_authlist = stir_shaken_cert_get_tn_authlist(ss, cert);
+    if (tn_authlist && tn_authlist->ranges_n > 0) {
+
+        if (!is_tn || STIR_SHAKEN_STATUS_OK != stir_shaken_tn_authlist_covers_tn(ss, tn_authlist, origin_identity)) {
+            stir_shaken_set_error(ss, "Caller has no authority over the number", STIR_SHAKEN_ERROR_GENERAL);
+            return STIR_SHAKEN_STATUS_FALSE;
+        }
+
+        return STIR_SHAKEN_STATUS_OK;
+    }
+    stir_shaken_clear_error(ss);
+
+    if ((STIR_SHAKEN_STATUS_OK != stir_shaken_cert_to_authority_check_url(ss, cert, authority_check_url, STIR_SHAKEN_BUFLEN)) || stir_shaken_zstr(authority_check_url)) {
+        stir_shaken_set_error(ss, "Cannot get SPC from certificate", STIR_SHAKEN_ERROR_GENERAL);
         return STIR_SHAKEN_STATUS_RESTART;
     }
 
@@ -501,11 +895,12 @@ stir_shaken_status_t stir_shaken_check_authority_over_number(stir_shaken_context
 // STIR_SHAKEN_ERROR_PASSPORT_INVALID							- Bad Identity Header, specifically: PASSporT is missing some mandatory fields
 // STIR_SHAKEN_ERROR_SIP_436_BAD_IDENTITY_INFO					- Cannot download referenced certificate
 //
-stir_shaken_status_t stir_shaken_sih_verify(stir_shaken_context_t *ss, const char *sih, stir_shaken_passport_t *passport, stir_shaken_cert_t **cert_out, time_t iat_freshness)
+stir_shaken_status_t stir_shaken_sih_verify_ex(stir_shaken_context_t *ss, const char *sih, stir_shaken_passport_t *passport, stir_shaken_cert_t **cert_out, time_t iat_freshness, uint64_t deadline_ms)
 {
     stir_shaken_status_t	ss_status = STIR_SHAKEN_STATUS_FALSE;
     stir_shaken_http_req_t	http_req = { 0 };
     long					res = CURLE_OK;
+    stir_shaken_cert_ref_t	*ref = NULL;
     stir_shaken_cert_t		*cert = NULL;
 
     unsigned char jwt_encoded[STIR_SHAKEN_PUB_KEY_RAW_BUF_LEN] = { 0 };
@@ -531,7 +926,7 @@ stir_shaken_status_t stir_shaken_sih_verify(stir_shaken_context_t *ss, const cha
         goto end;
     }
 
-    ss_status = stir_shaken_jwt_verify_and_check_x509_cert_path(ss, (char *) jwt_encoded, &cert, &jwt);
+    ss_status = stir_shaken_jwt_verify_and_check_x509_cert_path_ref(ss, (char *) jwt_encoded, &ref, &jwt, deadline_ms);
     if (ss_status != STIR_SHAKEN_STATUS_OK) {
         stir_shaken_set_error(ss, "JWT verification with X509 cert path check unsuccessful", STIR_SHAKEN_ERROR_SIP_438_INVALID_IDENTITY_HEADER);
         goto end;
@@ -539,6 +934,17 @@ stir_shaken_status_t stir_shaken_sih_verify(stir_shaken_context_t *ss, const cha
 
     stir_shaken_jwt_move_to_passport(jwt, passport);
 
+    // Full cert only if it is needed
+    if (cert_out || STIR_SHAKEN_CHECK_AUTHORITY_OVER_NUMBER) {
+
+        cert = stir_shaken_cert_ref_to_cert(ss, ref);
+        if (!cert) {
+            ss_status = STIR_SHAKEN_STATUS_TERM;
+            goto end;
+        }
+        stir_shaken_read_cert_fields(ss, cert);
+    }
+
     // TODO move it outside as an optional check
 #if STIR_SHAKEN_CHECK_AUTHORITY_OVER_NUMBER
 
@@ -553,9 +959,19 @@ stir_shaken_status_t stir_shaken_sih_verify(stir_shaken_context_t *ss, const cha
 end:
 
     if (STIR_SHAKEN_STATUS_OK != ss_status) {
+
+        if (deadline_ms && stir_shaken_now_ms() >= deadline_ms
+                && (stir_shaken_is_error_recorded(ss, STIR_SHAKEN_ERROR_HTTP_TIMEOUT) || stir_shaken_is_error_recorded(ss, STIR_SHAKEN_ERROR_CERT_DOWNLOAD))) {
+
+            // Cert could not be fetched in time. Any other failure keeps its own (403/437/438...) code.
+            stir_shaken_set_error(ss, "Verification deadline expired (application should reply with SIP 436 BAD IDENTITY INFO error)", STIR_SHAKEN_ERROR_SIP_436_BAD_IDENTITY_INFO);
+        }
+
         stir_shaken_set_error_if_clear(ss, "Unknown error while processing request", STIR_SHAKEN_ERROR_GENERAL);
     }
 
+    stir_shaken_cert_ref_put(ref);
+
     if (cert_out) {
 
         // Note, cert must be destroyed by caller
@@ -571,6 +987,11 @@ end:
     return ss_status;
 }
 
+stir_shaken_status_t stir_shaken_sih_verify(stir_shaken_context_t *ss, const char *sih, stir_shaken_passport_t *passport, stir_shaken_cert_t **cert_out, time_t iat_freshness)
+{
+    return stir_shaken_sih_verify_ex(ss, sih, passport, cert_out, iat_freshness, 0);
+}
+
 stir_shaken_status_t stir_shaken_passport_validate(stir_shaken_context_t *ss, stir_shaken_passport_t *passport, time_t iat_freshness)
 {
     stir_shaken_status_t ss_status = STIR_SHAKEN_STATUS_OK;
@@ -0,0 +1,200 @@
+#include <stir_shaken.h>
+
+const char *path = "./test/run";
+const char *x5u = "https://sp.example.com/cert.pem";
+const char *attest = "B";
+const char *desttn_key = "uri";
+const char *desttn_val = "sip:bob@example.com";
+int iat = 1234567890;
+const char *origtn_key = "";
+const char *origtn_val = "12155551212";
+const char *origid = "ab\"c\n";
+
+const char *canonical_header = "{\"alg\":\"ES256\",\"ppt\":\"shaken\",\"typ\":\"passport\",\"x5u\":\"https://sp.example.com/cert.pem\"}";
+const char *canonical_payload = "{\"attest\":\"B\",\"dest\":{\"uri\":[\"sip:bob@example.com\"]},\"iat\":1234567890,\"orig\":{\"tn\":\"12155551212\"},\"origid\":\"ab\\\"c\\n\"}";
+
+// Same claims, reverse order
+const char *headers_json = "{\"x5u\":\"https://sp.example.com/cert.pem\",\"typ\":\"passport\",\"ppt\":\"shaken\"}";
+const char *grants_json = "{\"origid\":\"ab\\\"c\\n\",\"orig\":{\"tn\":\"12155551212\"},\"iat\":1234567890,\"dest\":{\"uri\":[\"sip:bob@example.com\"]},\"attest\":\"B\"}";
+const char *grants_no_iat_json = "{\"origid\":\"ref\",\"orig\":{\"tn\":\"12155551212\"},\"dest\":{\"tn\":[\"12155551213\"]},\"attest\":\"B\"}";
+
+/*
+ * Decode base64url segment of @len bytes.
+ */
+static void test_b64url_decode(const char *in, size_t len, char *out, size_t olen)
+{
+	char seg[STIR_SHAKEN_BUFLEN] = { 0 };
+	size_t i = 0;
+
+	for (i = 0; i < len && i < sizeof(seg) - 1; i++) {
+		seg[i] = in[i] == '-' ? '+' : (in[i] == '_' ? '/' : in[i]);
+	}
+
+	stir_shaken_b64_decode(seg, out, olen);
+}
+
+
+stir_shaken_status_t stir_shaken_unit_test_passport_canonical_json(void)
+{
+	stir_shaken_passport_t passport = { 0 };
+	stir_shaken_passport_t passport2 = { 0 };
+	stir_shaken_passport_t passport3 = { 0 };
+	jwt_t *jwt = NULL;
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	stir_shaken_context_t ss = { 0 };
+	const char *error_description = NULL;
+	stir_shaken_error_t error_code = STIR_SHAKEN_ERROR_GENERAL;
+	char buf[STIR_SHAKEN_BUFLEN] = { 0 };
+	char buf2[STIR_SHAKEN_BUFLEN] = { 0 };
+	char small[16] = { 0 };
+	size_t len = 0, len2 = 0;
+	char *encoded = NULL, *dot = NULL, *dot2 = NULL;
+
+	stir_shaken_passport_params_t params = { .x5u = x5u, .attest = attest, .desttn_key = desttn_key, .desttn_val = desttn_val, .iat = iat, .origtn_key = origtn_key, .origtn_val = origtn_val, .origid = origid };
+
+	char private_key_name[300] = { 0 };
+	char public_key_name[300] = { 0 };
+
+	EC_KEY *ec_key = NULL;
+	EVP_PKEY *private_key = NULL;
+	EVP_PKEY *public_key = NULL;
+
+	unsigned char	priv_raw[STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN] = { 0 };
+	uint32_t		priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+
+
+	sprintf(private_key_name, "%s%c%s", path, '/', "u16_private_key.pem");
+	sprintf(public_key_name, "%s%c%s", path, '/', "u16_public_key.pem");
+
+	printf("=== Unit testing: STIR/Shaken PASSporT canonical JSON\n\n");
+
+	status = stir_shaken_generate_keys(&ss, &ec_key, &private_key, &public_key, private_key_name, public_key_name, priv_raw, &priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate keys...");
+
+	// PASSporT from params
+	status = stir_shaken_passport_init(&ss, &passport, &params, priv_raw, priv_raw_len);
+	if (stir_shaken_is_error_set(&ss)) {
+		error_description = stir_shaken_get_error(&ss, &error_code);
+		printf("Error description is: '%s'\n", error_description);
+		printf("Error code is: '%d'\n", error_code);
+	}
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "PASSporT has not been created");
+
+	status = stir_shaken_passport_canonical_header(&ss, &passport, buf, sizeof(buf), &len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Failed to serialize header");
+	printf("Header:  %s\n", buf);
+	stir_shaken_assert(!strcmp(buf, canonical_header), "Wrong canonical header");
+	stir_shaken_assert(len == strlen(canonical_header), "Wrong canonical header length");
+
+	status = stir_shaken_passport_canonical_payload(&ss, &passport, buf, sizeof(buf), &len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Failed to serialize payload");
+	printf("Payload: %s\n", buf);
+	stir_shaken_assert(!strcmp(buf, canonical_payload), "Wrong canonical payload");
+	stir_shaken_assert(len == strlen(canonical_payload), "Wrong canonical payload length");
+
+	// PASSporT from JSON with claims in different order
+	jwt = stir_shaken_passport_jwt_create_new(&ss);
+	stir_shaken_assert(jwt != NULL, "Failed to create JWT");
+	status = stir_shaken_passport_jwt_init_from_json(&ss, jwt, headers_json, grants_json, priv_raw, priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Failed to init JWT from JSON");
+	stir_shaken_jwt_move_to_passport(jwt, &passport2);
+
+	status = stir_shaken_passport_canonical_header(&ss, &passport2, buf2, sizeof(buf2), &len2);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Failed to serialize header");
+	stir_shaken_assert(!strcmp(buf2, canonical_header), "Canonical header depends on claims order");
+
+	status = stir_shaken_passport_canonical_payload(&ss, &passport2, buf2, sizeof(buf2), &len2);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Failed to serialize payload");
+	stir_shaken_assert(len2 == len && !memcmp(buf, buf2, len), "Canonical payload depends on claims order");
+
+	// Buffer too small
+	status = stir_shaken_passport_canonical_payload(&ss, &passport, small, sizeof(small), &len2);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_FALSE, "Should fail on too small buffer");
+	stir_shaken_assert(len2 == len, "Should return needed length");
+	stir_shaken_assert(small[sizeof(small) - 1] == '\0', "Result should be 0-terminated");
+	stir_shaken_clear_error(&ss);
+
+	// Signed by libjwt, same bytes as canonical form
+	status = stir_shaken_passport_sign(&ss, &passport2, priv_raw, priv_raw_len, &encoded);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK && encoded, "Failed to sign");
+	printf("Signed:  %s\n", encoded);
+	dot = strchr(encoded, '.');
+	stir_shaken_assert(dot && (dot2 = strchr(dot + 1, '.')) && strlen(dot2 + 1) == 86, "Wrong JWS");
+	test_b64url_decode(encoded, dot - encoded, buf2, sizeof(buf2));
+	stir_shaken_assert(!strcmp(buf2, canonical_header), "Signed header should be canonical");
+	test_b64url_decode(dot + 1, dot2 - dot - 1, buf2, sizeof(buf2));
+	stir_shaken_assert(!strcmp(buf2, canonical_payload), "Signed payload should be canonical");
+	stir_shaken_assert(!strchr(encoded, '=') && !strchr(encoded, '+') && !strchr(encoded, '/'), "JWS should be base64url without padding");
+	jwt_free_str(encoded);
+	encoded = NULL;
+
+	// Claims outside the canonical set are signed too, but not serialized in canonical form
+	stir_shaken_assert(jwt_add_grant(passport2.jwt, "div", "12155551214") == 0, "Failed to add grant");
+	status = stir_shaken_passport_sign(&ss, &passport2, NULL, 0, &encoded);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK && encoded, "Failed to sign");
+	dot = strchr(encoded, '.');
+	stir_shaken_assert(dot && (dot2 = strchr(dot + 1, '.')), "Wrong JWS");
+	memset(buf2, 0, sizeof(buf2));
+	test_b64url_decode(dot + 1, dot2 - dot - 1, buf2, sizeof(buf2));
+	stir_shaken_assert(strstr(buf2, "\"div\":\"12155551214\"") != NULL, "Signed payload should keep all grants");
+	jwt_free_str(encoded);
+	encoded = NULL;
+	status = stir_shaken_passport_canonical_payload(&ss, &passport2, buf2, sizeof(buf2), &len2);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Failed to serialize payload");
+	stir_shaken_assert(!strcmp(buf2, canonical_payload), "Canonical payload should skip other claims");
+
+	// @iat negative
+	params.iat = -1;
+	status = stir_shaken_passport_init(&ss, &passport3, &params, priv_raw, priv_raw_len);
+	stir_shaken_assert(status != STIR_SHAKEN_STATUS_OK, "Should refuse negative @iat");
+	stir_shaken_assert(stir_shaken_get_error_code(&ss) == STIR_SHAKEN_ERROR_PASSPORT_INVALID, "Wrong error code");
+	stir_shaken_passport_destroy(&passport3);
+	stir_shaken_clear_error(&ss);
+
+	// @iat not set
+	jwt = stir_shaken_passport_jwt_create_new(&ss);
+	stir_shaken_assert(jwt != NULL, "Failed to create JWT");
+	status = stir_shaken_passport_jwt_init_from_json(&ss, jwt, headers_json, grants_no_iat_json, priv_raw, priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Failed to init JWT from JSON");
+	stir_shaken_jwt_move_to_passport(jwt, &passport3);
+	status = stir_shaken_passport_canonical_payload(&ss, &passport3, buf2, sizeof(buf2), &len2);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_FALSE, "Should refuse PASSporT without @iat");
+	stir_shaken_clear_error(&ss);
+	status = stir_shaken_passport_sign(&ss, &passport3, priv_raw, priv_raw_len, &encoded);
+	stir_shaken_assert(status != STIR_SHAKEN_STATUS_OK && !encoded, "Should not sign PASSporT without @iat");
+	stir_shaken_assert(stir_shaken_get_error_code(&ss) == STIR_SHAKEN_ERROR_PASSPORT_INVALID, "Wrong error code");
+	stir_shaken_clear_error(&ss);
+
+	stir_shaken_passport_destroy(&passport);
+	stir_shaken_passport_destroy(&passport2);
+	stir_shaken_passport_destroy(&passport3);
+	stir_shaken_destroy_keys_ex(&ec_key, &private_key, &public_key);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_HIGH), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	if (stir_shaken_unit_test_passport_canonical_json() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
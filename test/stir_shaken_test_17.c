@@ -0,0 +1,391 @@
+#include <stir_shaken.h>
+#include <mongoose.h>
+#include <curl/curl.h>
+
+/*
+ * Concurrent (batch) HTTP requests through stir_shaken_make_http_reqs, against local HTTP server.
+ *
+ * NOTE: HTTP/2 multiplexing is not tested here (see test 34). Mongoose server speaks HTTP/1.1 only and HTTP/2 is negotiated over TLS (ALPN),
+ * so with plain http these requests go over HTTP/1.1 and the batch gets parallel connections, not multiplexed streams.
+ */
+
+static char test_port[8];		// ephemeral, assigned by OS on bind, so it cannot collide with other tests
+#define TEST_REQ_N		32
+#define TEST_ROUNDS		20
+
+static volatile int server_running = 1;
+
+// First request to /slow is answered after TEST_SLOW_MS, next ones immediately
+#define TEST_SLOW_MS	1000
+static struct mg_connection *slow_nc = NULL;
+static double slow_t = 0;
+static volatile int slow_n = 0;
+
+static double test_now(void);
+
+static void test_event_handler(struct mg_connection *nc, int event, void *ev_data, void *d)
+{
+	struct http_message *hm = (struct http_message *) ev_data;
+
+	if (event == MG_EV_CLOSE && nc == slow_nc) {
+		slow_nc = NULL;
+		return;
+	}
+
+	if (event != MG_EV_HTTP_REQUEST) return;
+
+	if (mg_vcmp(&hm->uri, "/slow") == 0) {
+
+		if (slow_n++ == 0) {
+			slow_nc = nc;
+			slow_t = test_now();
+			return;
+		}
+
+		mg_printf(nc, "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nfast");
+		return;
+	}
+
+	if (mg_vcmp(&hm->uri, "/headers") == 0) {
+
+		int i = 0;
+
+		// More headers than fit in response header index
+		mg_printf(nc, "HTTP/1.1 200 OK\r\nContent-Length: 0\r\nreplay-nonce:  abc \r\n");
+		for (i = 0; i < STIR_SHAKEN_HTTP_HEADER_INDEX_SIZE; i++) {
+			mg_printf(nc, "X-Test-%d: %d\r\n", i, i);
+		}
+		mg_printf(nc, "Replay-Nonce: oFvnlFP1wIhRlYS2jTaXbA\r\n\r\n");
+		return;
+	}
+
+	// Echo URI in body
+	mg_printf(nc, "HTTP/1.1 200 OK\r\nContent-Length: %d\r\nContent-Type: text/plain\r\n\r\n%.*s", (int) hm->uri.len, (int) hm->uri.len, hm->uri.p);
+}
+
+static void* test_server_thread(void *arg)
+{
+	struct mg_mgr *mgr = (struct mg_mgr *) arg;
+
+	while (server_running) {
+
+		mg_mgr_poll(mgr, 50);
+
+		if (slow_nc && test_now() - slow_t >= TEST_SLOW_MS / 1000.0) {
+			mg_printf(slow_nc, "HTTP/1.1 200 OK\r\nContent-Length: 4\r\n\r\nslow");
+			slow_nc = NULL;
+		}
+	}
+
+	return NULL;
+}
+
+static double test_now(void)
+{
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_http_batch(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_http_req_t reqs[TEST_REQ_N];
+	stir_shaken_http_req_t *preqs[TEST_REQ_N];
+	char url[STIR_SHAKEN_BUFLEN] = { 0 };
+	char path[100] = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	double t = 0, t_seq = 0, t_batch = 0;
+	int i = 0, r = 0;
+
+	printf("=== Unit testing: STIR/Shaken HTTP batch requests\n\n");
+
+	for (r = 0; r < TEST_ROUNDS; r++) {
+
+		// Sequential
+		t = test_now();
+		for (i = 0; i < TEST_REQ_N; i++) {
+			memset(&reqs[i], 0, sizeof(reqs[i]));
+			snprintf(url, sizeof(url), "http://127.0.0.1:%s/cert/%d", test_port, i);
+			reqs[i].url = strdup(url);
+			reqs[i].remote_port = atoi(test_port);
+			status = stir_shaken_make_http_get_req(&ss, &reqs[i]);
+			stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "HTTP GET failed");
+			stir_shaken_assert(reqs[i].response.code == 200, "Bad HTTP response code");
+			stir_shaken_destroy_http_request(&reqs[i]);
+		}
+		t_seq += test_now() - t;
+
+		// Batch
+		t = test_now();
+		for (i = 0; i < TEST_REQ_N; i++) {
+			memset(&reqs[i], 0, sizeof(reqs[i]));
+			snprintf(url, sizeof(url), "http://127.0.0.1:%s/cert/%d", test_port, i);
+			reqs[i].url = strdup(url);
+			reqs[i].remote_port = atoi(test_port);
+			reqs[i].type = STIR_SHAKEN_HTTP_REQ_TYPE_GET;
+			preqs[i] = &reqs[i];
+		}
+
+		status = stir_shaken_make_http_reqs(&ss, preqs, TEST_REQ_N);
+		stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "HTTP batch failed");
+		t_batch += test_now() - t;
+
+		for (i = 0; i < TEST_REQ_N; i++) {
+			snprintf(path, sizeof(path), "/cert/%d", i);
+			stir_shaken_assert(reqs[i].response.code == 200, "Bad HTTP response code");
+			stir_shaken_assert(reqs[i].response.mem.mem && !strcmp(reqs[i].response.mem.mem, path), "Response mixed up");
+			stir_shaken_destroy_http_request(&reqs[i]);
+		}
+	}
+
+	printf("%d x %d requests: sequential %.3f s, batch %.3f s\n", TEST_ROUNDS, TEST_REQ_N, t_seq, t_batch);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+static size_t test_curl_write_callback(void *contents, size_t size, size_t nmemb, void *p)
+{
+	return size * nmemb;
+}
+
+/*
+ * Sequential requests: new CURL handle for each request (curl_easy_init/cleanup, no connection reuse, as before the handle pool)
+ * versus library's pooled handle. Both numbers are printed, run the test to compare.
+ */
+stir_shaken_status_t stir_shaken_unit_test_http_handle_pool(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_http_req_t http_req = { 0 };
+	char url[STIR_SHAKEN_BUFLEN] = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	CURL *curl_handle = NULL;
+	long code = 0;
+	double t = 0, t_new = 0, t_pooled = 0;
+	int i = 0;
+
+	printf("=== Unit testing: STIR/Shaken HTTP handle pool\n\n");
+
+	snprintf(url, sizeof(url), "http://127.0.0.1:%s/cert/0", test_port);
+
+	// Warm up
+	http_req.url = strdup(url);
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "HTTP GET failed");
+	stir_shaken_destroy_http_request(&http_req);
+
+	// Before: handle per request
+	t = test_now();
+	for (i = 0; i < TEST_ROUNDS * TEST_REQ_N; i++) {
+		curl_handle = curl_easy_init();
+		stir_shaken_assert(curl_handle != NULL, "Cannot create CURL handle");
+		curl_easy_setopt(curl_handle, CURLOPT_URL, url);
+		curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1L);
+		curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, test_curl_write_callback);
+		stir_shaken_assert(curl_easy_perform(curl_handle) == CURLE_OK, "HTTP GET failed");
+		curl_easy_getinfo(curl_handle, CURLINFO_RESPONSE_CODE, &code);
+		stir_shaken_assert(code == 200, "Bad HTTP response code");
+		curl_easy_cleanup(curl_handle);
+	}
+	t_new = test_now() - t;
+
+	// After: pooled handle
+	t = test_now();
+	for (i = 0; i < TEST_ROUNDS * TEST_REQ_N; i++) {
+		http_req.url = strdup(url);
+		status = stir_shaken_make_http_get_req(&ss, &http_req);
+		stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "HTTP GET failed");
+		stir_shaken_assert(http_req.response.code == 200, "Bad HTTP response code");
+		stir_shaken_destroy_http_request(&http_req);
+	}
+	t_pooled = test_now() - t;
+
+	printf("Sequential request, new CURL handle per request: %.1f us\n", t_new * 1e6 / (TEST_ROUNDS * TEST_REQ_N));
+	printf("Sequential request, pooled CURL handle: %.1f us\n", t_pooled * 1e6 / (TEST_ROUNDS * TEST_REQ_N));
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_http_response_buffer(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_http_req_t http_req = { 0 };
+	char url[STIR_SHAKEN_BUFLEN] = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	char *mem = NULL;
+
+	printf("=== Unit testing: STIR/Shaken HTTP response buffer\n\n");
+
+	snprintf(url, sizeof(url), "http://127.0.0.1:%s/cert/response/buffer", test_port);
+	http_req.url = strdup(url);
+	http_req.remote_port = atoi(test_port);
+
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "HTTP GET failed");
+	stir_shaken_assert(http_req.response.mem.mem && !strcmp(http_req.response.mem.mem, "/cert/response/buffer"), "Bad response");
+	stir_shaken_assert(http_req.response.mem.capacity >= STIR_SHAKEN_HTTP_RESPONSE_BUF_MIN, "Buffer should be preallocated");
+
+	// Same buffer reused
+	http_req.reuse_buffer = 1;
+	mem = http_req.response.mem.mem;
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "HTTP GET failed");
+	stir_shaken_assert(http_req.response.mem.mem == mem, "Buffer not reused");
+	stir_shaken_assert(!strcmp(http_req.response.mem.mem, "/cert/response/buffer"), "Bad response");
+
+	// Response bigger than allowed
+	http_req.max_response_size = 5;
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status != STIR_SHAKEN_STATUS_OK, "Too big response should be rejected");
+	stir_shaken_assert(stir_shaken_is_error_set(&ss), "Error should be set");
+	stir_shaken_clear_error(&ss);
+
+	stir_shaken_destroy_http_request(&http_req);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_http_response_headers(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_http_req_t http_req = { 0 };
+	char url[STIR_SHAKEN_BUFLEN] = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	char *v = NULL;
+
+	printf("=== Unit testing: STIR/Shaken HTTP response headers\n\n");
+
+	snprintf(url, sizeof(url), "http://127.0.0.1:%s/cert/0", test_port);
+	http_req.url = strdup(url);
+	http_req.remote_port = atoi(test_port);
+
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "HTTP GET failed");
+
+	v = stir_shaken_get_http_header(&http_req, "content-type");
+	stir_shaken_assert(v && !strcmp(v, "text/plain"), "Header lookup should be case insensitive");
+	v = stir_shaken_get_http_header(&http_req, "Content-Length");
+	stir_shaken_assert(v && !strcmp(v, "7"), "Bad Content-Length");
+	stir_shaken_assert(stir_shaken_get_http_header(&http_req, "Location") == NULL, "Header should not be found");
+	stir_shaken_destroy_http_request(&http_req);
+
+	// Repeated header and index overflow
+	snprintf(url, sizeof(url), "http://127.0.0.1:%s/headers", test_port);
+	http_req.url = strdup(url);
+	http_req.remote_port = atoi(test_port);
+
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "HTTP GET failed");
+
+	v = stir_shaken_get_http_header(&http_req, "Replay-Nonce");
+	stir_shaken_assert(v && !strcmp(v, "oFvnlFP1wIhRlYS2jTaXbA"), "Repeated header should return last value");
+	v = stir_shaken_get_http_header(&http_req, "X-Test-1");
+	stir_shaken_assert(v && !strcmp(v, "1"), "Bad header value");
+	snprintf(url, sizeof(url), "X-Test-%d", STIR_SHAKEN_HTTP_HEADER_INDEX_SIZE - 1);
+	v = stir_shaken_get_http_header(&http_req, url);
+	snprintf(url, sizeof(url), "%d", STIR_SHAKEN_HTTP_HEADER_INDEX_SIZE - 1);
+	stir_shaken_assert(v && !strcmp(v, url), "Header not indexed should still be found");
+	stir_shaken_destroy_http_request(&http_req);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_http_hedging(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_http_req_t http_req = { 0 };
+	char url[STIR_SHAKEN_BUFLEN] = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	double t = 0;
+
+	printf("=== Unit testing: STIR/Shaken HTTP request hedging\n\n");
+
+	snprintf(url, sizeof(url), "http://127.0.0.1:%s/slow", test_port);
+
+	// Hedge after default delay, hedge for every request allowed
+	stir_shaken_http_set_hedging(1, 95, 50, 1);
+
+	http_req.url = strdup(url);
+	t = test_now();
+	status = stir_shaken_make_http_get_req_hedged(&ss, &http_req);
+	t = test_now() - t;
+	printf("Hedged request took %.3f s\n", t);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "HTTP GET failed");
+	stir_shaken_assert(http_req.response.code == 200, "Bad HTTP response code");
+	stir_shaken_assert(http_req.response.mem.mem && !strcmp(http_req.response.mem.mem, "fast"), "Hedge should win");
+	stir_shaken_assert(stir_shaken_get_http_header(&http_req, "Content-Length") != NULL, "Hedge headers should be moved");
+	stir_shaken_assert(slow_n == 2, "Request should be hedged");
+	stir_shaken_assert(t < TEST_SLOW_MS / 2000.0, "Hedge should cut latency");
+	stir_shaken_destroy_http_request(&http_req);
+
+	// No budget, no hedge
+	stir_shaken_http_set_hedging(1, 95, 50, 0);
+	slow_n = 0;
+	http_req.url = strdup(url);
+	status = stir_shaken_make_http_get_req_hedged(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "HTTP GET failed");
+	stir_shaken_assert(http_req.response.mem.mem && !strcmp(http_req.response.mem.mem, "slow"), "Request should not be hedged");
+	stir_shaken_assert(slow_n == 1, "Request should not be hedged");
+	stir_shaken_destroy_http_request(&http_req);
+
+	stir_shaken_http_set_hedging(0, 0, -1, -1);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	struct mg_mgr mgr;
+	struct mg_connection *nc = NULL;
+	pthread_t server = 0;
+
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	mg_mgr_init(&mgr, NULL);
+	nc = mg_bind(&mgr, "127.0.0.1:0", test_event_handler, NULL);
+	stir_shaken_assert(nc != NULL, "Cannot start HTTP server");
+	mg_conn_addr_to_str(nc, test_port, sizeof(test_port), MG_SOCK_STRINGIFY_PORT);
+	stir_shaken_assert(atoi(test_port) > 0, "Cannot get HTTP server port");
+	mg_set_protocol_http_websocket(nc);
+	stir_shaken_assert(pthread_create(&server, NULL, test_server_thread, &mgr) == 0, "Cannot start HTTP server thread");
+
+	if (stir_shaken_unit_test_http_batch() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	if (stir_shaken_unit_test_http_handle_pool() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	if (stir_shaken_unit_test_http_response_buffer() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	if (stir_shaken_unit_test_http_response_headers() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	if (stir_shaken_unit_test_http_hedging() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	server_running = 0;
+	pthread_join(server, NULL);
+	mg_mgr_free(&mgr);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
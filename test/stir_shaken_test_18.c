@@ -0,0 +1,173 @@
+#include <stir_shaken.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * HTTP timeouts and verification deadline, against "black hole" server (accepts TCP connections, never replies).
+ */
+
+const char *path = "./test/run";
+
+#define BLACK_HOLE_PORT 8097
+
+static int black_hole_start(void)
+{
+	struct sockaddr_in addr = { 0 };
+	int fd = -1, one = 1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(BLACK_HOLE_PORT);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	// Never accept, kernel completes handshakes and requests are never answered
+	return fd;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_http_timeout(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_http_req_t http_req = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	stir_shaken_error_t error_code = STIR_SHAKEN_ERROR_GENERAL;
+	char url[STIR_SHAKEN_BUFLEN] = { 0 };
+	uint64_t t = 0;
+
+	printf("=== Unit testing: STIR/Shaken HTTP timeouts\n\n");
+
+	snprintf(url, sizeof(url), "http://127.0.0.1:%d/cert.pem", BLACK_HOLE_PORT);
+
+	// Per request timeout
+	http_req.url = strdup(url);
+	http_req.remote_port = BLACK_HOLE_PORT;
+	http_req.timeout_ms = 300;
+
+	t = stir_shaken_now_ms();
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	t = stir_shaken_now_ms() - t;
+	printf("Request timed out after %" PRIu64 " ms\n", t);
+	stir_shaken_assert(status != STIR_SHAKEN_STATUS_OK, "Request should time out");
+	stir_shaken_get_error(&ss, &error_code);
+	stir_shaken_assert(error_code == STIR_SHAKEN_ERROR_HTTP_TIMEOUT, "Error should be HTTP_TIMEOUT");
+	stir_shaken_assert(t < 2000, "Per request timeout not respected");
+	stir_shaken_destroy_http_request(&http_req);
+
+	// Expired deadline
+	stir_shaken_clear_error(&ss);
+	http_req.url = strdup(url);
+	http_req.remote_port = BLACK_HOLE_PORT;
+	http_req.deadline_ms = stir_shaken_now_ms() - 1;
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status != STIR_SHAKEN_STATUS_OK, "Request past deadline should not be made");
+	stir_shaken_destroy_http_request(&http_req);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_sih_verify_deadline(void)
+{
+	stir_shaken_passport_t passport = { 0 };
+	stir_shaken_passport_t passport_out = { 0 };
+	stir_shaken_cert_t *cert = NULL;
+	char x5u[STIR_SHAKEN_BUFLEN] = { 0 };
+	char *sih = NULL;
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	stir_shaken_context_t ss = { 0 };
+	const char *error_description = NULL;
+	stir_shaken_error_t error_code = STIR_SHAKEN_ERROR_GENERAL;
+	stir_shaken_passport_params_t params = { .attest = "B", .desttn_key = "tn", .desttn_val = "12155551213", .iat = time(NULL), .origtn_key = "tn", .origtn_val = "12155551212", .origid = "ref" };
+	char private_key_name[300] = { 0 };
+	char public_key_name[300] = { 0 };
+	EC_KEY *ec_key = NULL;
+	EVP_PKEY *private_key = NULL;
+	EVP_PKEY *public_key = NULL;
+	unsigned char	priv_raw[STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN] = { 0 };
+	uint32_t		priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	uint64_t t = 0;
+
+	printf("=== Unit testing: STIR/Shaken verification deadline\n\n");
+
+	snprintf(x5u, sizeof(x5u), "http://127.0.0.1:%d/cert.pem", BLACK_HOLE_PORT);
+	params.x5u = x5u;
+
+	sprintf(private_key_name, "%s%c%s", path, '/', "u18_private_key.pem");
+	sprintf(public_key_name, "%s%c%s", path, '/', "u18_public_key.pem");
+
+	status = stir_shaken_generate_keys(&ss, &ec_key, &private_key, &public_key, private_key_name, public_key_name, priv_raw, &priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate keys...");
+
+	status = stir_shaken_jwt_authenticate_keep_passport(&ss, &sih, &params, priv_raw, priv_raw_len, &passport);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Failed to create SIP Identity Header");
+	stir_shaken_assert(sih != NULL, "Failed to create SIP Identity Header");
+
+	t = stir_shaken_now_ms();
+	status = stir_shaken_sih_verify_ex(&ss, sih, &passport_out, &cert, 900, t + 500);
+	t = stir_shaken_now_ms() - t;
+	printf("Verification ended after %" PRIu64 " ms\n", t);
+
+	stir_shaken_assert(status != STIR_SHAKEN_STATUS_OK, "Verification should fail");
+	stir_shaken_assert(stir_shaken_is_error_set(&ss), "Error should be set");
+	error_description = stir_shaken_get_error(&ss, &error_code);
+	printf("Error description is: '%s'\n", error_description);
+	stir_shaken_assert(error_code == STIR_SHAKEN_ERROR_SIP_436_BAD_IDENTITY_INFO, "Error should be 436 Bad Identity Info");
+	stir_shaken_assert(t < 2000, "Deadline not respected");
+
+	free(sih);
+	stir_shaken_passport_destroy(&passport);
+	stir_shaken_passport_destroy(&passport_out);
+	if (cert) {
+		stir_shaken_destroy_cert(cert);
+		free(cert);
+	}
+	stir_shaken_destroy_keys_ex(&ec_key, &private_key, &public_key);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	int fd = -1;
+
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	fd = black_hole_start();
+	stir_shaken_assert(fd >= 0, "Cannot start black hole server");
+
+	if (stir_shaken_unit_test_http_timeout() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	if (stir_shaken_unit_test_sih_verify_deadline() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	close(fd);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,211 @@
+#include <stir_shaken.h>
+#include <mongoose.h>
+
+/*
+ * x5u certificate cache, revalidation of stale entries with conditional GET (ETag), against local HTTP server.
+ */
+
+const char *path = "./test/run";
+
+#define TEST_PORT		"8098"
+#define TEST_ETAG		"\"u19-v1\""
+
+static volatile int server_running = 1;
+static char *cert_pem = NULL;
+static int requests_n = 0;
+static int not_modified_n = 0;
+
+static void test_event_handler(struct mg_connection *nc, int event, void *ev_data, void *d)
+{
+	struct http_message *hm = (struct http_message *) ev_data;
+	struct mg_str *inm = NULL;
+
+	if (event != MG_EV_HTTP_REQUEST) return;
+
+	requests_n++;
+
+	inm = mg_get_http_header(hm, "If-None-Match");
+	if (inm && mg_vcmp(inm, TEST_ETAG) == 0) {
+		not_modified_n++;
+		mg_printf(nc, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nContent-Length: 0\r\n\r\n", TEST_ETAG);
+		return;
+	}
+
+	mg_printf(nc, "HTTP/1.1 200 OK\r\nETag: %s\r\nContent-Length: %d\r\nContent-Type: application/x-pem-file\r\n\r\n%s", TEST_ETAG, (int) strlen(cert_pem), cert_pem);
+}
+
+static void* test_server_thread(void *arg)
+{
+	struct mg_mgr *mgr = (struct mg_mgr *) arg;
+
+	while (server_running) {
+		mg_mgr_poll(mgr, 50);
+	}
+
+	return NULL;
+}
+
+static char* test_x509_to_pem(X509 *x)
+{
+	BIO *bio = BIO_new(BIO_s_mem());
+	char *data = NULL, *pem = NULL;
+	long len = 0;
+
+	if (!bio) return NULL;
+
+	if (PEM_write_bio_X509(bio, x) == 1) {
+
+		len = BIO_get_mem_data(bio, &data);
+		pem = malloc(len + 1);
+		if (pem) {
+			memcpy(pem, data, len);
+			pem[len] = '\0';
+		}
+	}
+
+	BIO_free(bio);
+	return pem;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_x5u_cache(void)
+{
+	stir_shaken_passport_t passport = { 0 };
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	stir_shaken_csr_t csr = { 0 };
+	stir_shaken_cert_t *cert = NULL, *cert2 = NULL;
+	char x5u[STIR_SHAKEN_BUFLEN] = { 0 };
+	char *sih = NULL, *token = NULL, *p = NULL;
+	X509 *x = NULL;
+	stir_shaken_passport_params_t params = { .attest = "B", .desttn_key = "tn", .desttn_val = "12155551213", .iat = time(NULL), .origtn_key = "tn", .origtn_val = "12155551212", .origid = "ref" };
+	char private_key_name[300] = { 0 };
+	char public_key_name[300] = { 0 };
+	EC_KEY *ec_key = NULL;
+	EVP_PKEY *private_key = NULL;
+	EVP_PKEY *public_key = NULL;
+	unsigned char	priv_raw[STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN] = { 0 };
+	uint32_t		priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+
+	printf("=== Unit testing: STIR/Shaken x5u cache\n\n");
+
+	snprintf(x5u, sizeof(x5u), "http://127.0.0.1:%s/sp.pem", TEST_PORT);
+	params.x5u = x5u;
+
+	sprintf(private_key_name, "%s%c%s", path, '/', "u19_private_key.pem");
+	sprintf(public_key_name, "%s%c%s", path, '/', "u19_public_key.pem");
+
+	status = stir_shaken_generate_keys(&ss, &ec_key, &private_key, &public_key, private_key_name, public_key_name, priv_raw, &priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate keys...");
+
+	status = stir_shaken_generate_csr(&ss, 1900, &csr.req, private_key, public_key, "US", "x5u cache test");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, generating CSR");
+	x = stir_shaken_generate_x509_cert_from_csr(&ss, 1900, csr.req, private_key, "US", "x5u cache test", 1, 365);
+	stir_shaken_assert(x != NULL, "Err, generating Cert");
+	X509_gmtime_adj(X509_getm_notAfter(x), 365 * 24 * 60 * 60);
+	stir_shaken_assert(X509_sign(x, private_key, EVP_sha256()) > 0, "Err, signing Cert");
+	cert_pem = test_x509_to_pem(x);
+	stir_shaken_assert(cert_pem != NULL, "Err, cert to PEM");
+
+	status = stir_shaken_jwt_authenticate_keep_passport(&ss, &sih, &params, priv_raw, priv_raw_len, &passport);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Failed to create SIP Identity Header");
+
+	// JWT is the part of SIP Identity Header before parameters
+	token = strdup(sih);
+	stir_shaken_assert(token != NULL, "Out of memory");
+	if ((p = strchr(token, ';'))) *p = '\0';
+
+	stir_shaken_x5u_cache_set_ttl(1);
+
+	// Miss, full download
+	status = stir_shaken_jwt_verify(&ss, token, &cert, NULL);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "JWT verification failed");
+	stir_shaken_assert(requests_n == 1, "Cert should be downloaded");
+
+	// Fresh, no request
+	status = stir_shaken_jwt_verify(&ss, token, &cert2, NULL);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "JWT verification failed");
+	stir_shaken_assert(requests_n == 1, "Cert should be served from cache");
+	stir_shaken_assert(cert2->x == cert->x, "Cached cert should not be parsed again");
+	stir_shaken_destroy_cert(cert2);
+	free(cert2);
+	cert2 = NULL;
+
+	// Stale, revalidated with conditional GET, server answers 304
+	sleep(2);
+	status = stir_shaken_jwt_verify(&ss, token, &cert2, NULL);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "JWT verification failed");
+	stir_shaken_assert(requests_n == 2, "Stale cert should be revalidated");
+	stir_shaken_assert(not_modified_n == 1, "Revalidation should be conditional");
+	stir_shaken_assert(cert2->x == cert->x, "Not modified cert should not be parsed again");
+	stir_shaken_destroy_cert(cert2);
+	free(cert2);
+	cert2 = NULL;
+
+	// Fresh again
+	status = stir_shaken_jwt_verify(&ss, token, &cert2, NULL);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "JWT verification failed");
+	stir_shaken_assert(requests_n == 2, "Revalidated cert should be served from cache");
+	stir_shaken_destroy_cert(cert2);
+	free(cert2);
+	cert2 = NULL;
+
+	// Cache disabled
+	stir_shaken_x5u_cache_set_ttl(0);
+	status = stir_shaken_jwt_verify(&ss, token, &cert2, NULL);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "JWT verification failed");
+	stir_shaken_assert(requests_n == 3 && not_modified_n == 1, "Cert should be downloaded");
+	stir_shaken_destroy_cert(cert2);
+	free(cert2);
+
+	stir_shaken_destroy_cert(cert);
+	free(cert);
+	X509_free(x);
+	stir_shaken_destroy_csr(&csr);
+	free(cert_pem);
+	free(token);
+	free(sih);
+	stir_shaken_passport_destroy(&passport);
+	stir_shaken_destroy_keys_ex(&ec_key, &private_key, &public_key);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	struct mg_mgr mgr;
+	struct mg_connection *nc = NULL;
+	pthread_t server = 0;
+
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	mg_mgr_init(&mgr, NULL);
+	nc = mg_bind(&mgr, TEST_PORT, test_event_handler, NULL);
+	stir_shaken_assert(nc != NULL, "Cannot start HTTP server");
+	mg_set_protocol_http_websocket(nc);
+	stir_shaken_assert(pthread_create(&server, NULL, test_server_thread, &mgr) == 0, "Cannot start HTTP server thread");
+
+	if (stir_shaken_unit_test_x5u_cache() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	server_running = 0;
+	pthread_join(server, NULL);
+	mg_mgr_free(&mgr);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,219 @@
+#include <stir_shaken.h>
+
+/*
+ * HTTP transports: in-memory (with injected latency and errors) and directory backed.
+ */
+
+const char *path = "./test/run";
+
+#define TEST_URL		"https://sti-cr.example.com/certs/sp.pem"
+#define TEST_BODY		"-----BEGIN CERTIFICATE-----\nMIIB\n-----END CERTIFICATE-----\n"
+#define TEST_REQ_N		100
+
+stir_shaken_status_t stir_shaken_unit_test_http_transport_memory(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_http_req_t http_req = { 0 };
+	stir_shaken_http_req_t reqs[4];
+	stir_shaken_http_req_t *preqs[4];
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	stir_shaken_error_t error_code = STIR_SHAKEN_ERROR_GENERAL;
+	uint64_t t = 0;
+	int i = 0, failed = 0;
+
+	printf("=== Unit testing: STIR/Shaken HTTP in-memory transport\n\n");
+
+	status = stir_shaken_http_transport_register_memory(&ss, "memory", 0, 0, 0, 1);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot register transport");
+	status = stir_shaken_http_transport_register_memory(&ss, "memory", 0, 0, 0, 1);
+	stir_shaken_assert(status != STIR_SHAKEN_STATUS_OK, "Transport name should be unique");
+	stir_shaken_clear_error(&ss);
+
+	status = stir_shaken_http_transport_memory_set(&ss, "memory", TEST_URL, 200, TEST_BODY, strlen(TEST_BODY));
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot set response");
+	status = stir_shaken_http_transport_use(&ss, "memory");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot use transport");
+
+	http_req.url = strdup(TEST_URL);
+	status = stir_shaken_download_cert(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Download failed");
+	stir_shaken_assert(http_req.response.code == 200, "Bad HTTP response code");
+	stir_shaken_assert(http_req.response.mem.mem && !strcmp(http_req.response.mem.mem, TEST_BODY), "Bad response");
+	stir_shaken_assert(http_req.response.mem.size == strlen(TEST_BODY), "Bad response size");
+	stir_shaken_assert(stir_shaken_get_http_header(&http_req, "Content-Length") != NULL, "Headers should be set");
+	stir_shaken_destroy_http_request(&http_req);
+
+	http_req.url = strdup("https://sti-cr.example.com/certs/none.pem");
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Request failed");
+	stir_shaken_assert(http_req.response.code == 404, "Unknown URL should be 404");
+	stir_shaken_destroy_http_request(&http_req);
+
+	// Batch goes through selected transport too
+	for (i = 0; i < 4; i++) {
+		memset(&reqs[i], 0, sizeof(reqs[i]));
+		reqs[i].url = strdup(TEST_URL);
+		preqs[i] = &reqs[i];
+	}
+	status = stir_shaken_make_http_reqs(&ss, preqs, 4);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Batch failed");
+	for (i = 0; i < 4; i++) {
+		stir_shaken_assert(reqs[i].response.code == 200, "Bad HTTP response code");
+		stir_shaken_destroy_http_request(&reqs[i]);
+	}
+
+	// Latency and timeout
+	status = stir_shaken_http_transport_register_memory(&ss, "slow", 200, 0, 0, 1);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot register transport");
+	stir_shaken_http_transport_memory_set(&ss, "slow", TEST_URL, 200, TEST_BODY, strlen(TEST_BODY));
+	stir_shaken_http_transport_use(&ss, "slow");
+
+	http_req.url = strdup(TEST_URL);
+	t = stir_shaken_now_ms();
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	t = stir_shaken_now_ms() - t;
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK && http_req.response.code == 200, "Request failed");
+	stir_shaken_assert(t >= 200, "Latency not injected");
+	stir_shaken_destroy_http_request(&http_req);
+
+	http_req.url = strdup(TEST_URL);
+	http_req.timeout_ms = 50;
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status != STIR_SHAKEN_STATUS_OK, "Request should time out");
+	stir_shaken_get_error(&ss, &error_code);
+	stir_shaken_assert(error_code == STIR_SHAKEN_ERROR_HTTP_TIMEOUT, "Error should be HTTP_TIMEOUT");
+	stir_shaken_destroy_http_request(&http_req);
+	stir_shaken_clear_error(&ss);
+
+	// Error rate
+	status = stir_shaken_http_transport_register_memory(&ss, "lossy", 0, 0, 0.5, 1);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot register transport");
+	stir_shaken_http_transport_memory_set(&ss, "lossy", TEST_URL, 200, TEST_BODY, strlen(TEST_BODY));
+	stir_shaken_http_transport_use(&ss, "lossy");
+
+	for (i = 0; i < TEST_REQ_N; i++) {
+		http_req.url = strdup(TEST_URL);
+		if (stir_shaken_make_http_get_req(&ss, &http_req) != STIR_SHAKEN_STATUS_OK) {
+			failed++;
+		}
+		stir_shaken_destroy_http_request(&http_req);
+	}
+	stir_shaken_clear_error(&ss);
+	printf("Failed %d/%d requests\n", failed, TEST_REQ_N);
+	stir_shaken_assert(failed > TEST_REQ_N / 5 && failed < TEST_REQ_N * 4 / 5, "Errors not injected at configured rate");
+
+	status = stir_shaken_http_transport_use(&ss, "curl");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot use curl");
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_http_transport_dir(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_http_req_t http_req = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	char name[STIR_SHAKEN_BUFLEN] = { 0 };
+	char url[STIR_SHAKEN_BUFLEN] = { 0 };
+	FILE *f = NULL;
+
+	printf("=== Unit testing: STIR/Shaken HTTP directory transport\n\n");
+
+	snprintf(name, sizeof(name), "%s/u20/sti-cr.example.com/certs", path);
+	stir_shaken_assert(stir_shaken_dir_create_recursive(name) == STIR_SHAKEN_STATUS_OK, "Cannot create dir");
+	snprintf(name, sizeof(name), "%s/u20/sti-cr.example.com/certs/sp.pem", path);
+	f = fopen(name, "w");
+	stir_shaken_assert(f != NULL, "Cannot create file");
+	fputs(TEST_BODY, f);
+	fclose(f);
+
+	snprintf(name, sizeof(name), "%s/u20", path);
+	status = stir_shaken_http_transport_register_dir(&ss, "dir", name);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot register transport");
+	stir_shaken_http_transport_use(&ss, "dir");
+
+	http_req.url = strdup("https://sti-cr.example.com:8443/certs/sp.pem");
+	status = stir_shaken_download_cert(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Download failed");
+	stir_shaken_assert(http_req.response.mem.mem && !strcmp(http_req.response.mem.mem, TEST_BODY), "Bad response");
+	stir_shaken_destroy_http_request(&http_req);
+
+	http_req.url = strdup("https://sti-cr.example.com/certs/none.pem");
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK && http_req.response.code == 404, "Missing file should be 404");
+	stir_shaken_destroy_http_request(&http_req);
+
+	http_req.url = strdup("https://sti-cr.example.com/certs/..");
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK && http_req.response.code == 403, "Trailing .. segment should be 403");
+	stir_shaken_destroy_http_request(&http_req);
+
+	http_req.url = strdup("https://sti-cr.example.com/../sti-cr.example.com/certs/sp.pem");
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK && http_req.response.code == 403, ".. segment should be 403");
+	stir_shaken_destroy_http_request(&http_req);
+
+	http_req.url = strdup("https://sti-cr.example.com/certs");
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK && http_req.response.code == 403, "Directory should be 403");
+	stir_shaken_destroy_http_request(&http_req);
+
+	snprintf(name, sizeof(name), "%s/u20/sti-cr.example.com/certs/fifo", path);
+	unlink(name);
+	if (mkfifo(name, 0600) == 0) {
+		http_req.url = strdup("https://sti-cr.example.com/certs/fifo");
+		status = stir_shaken_make_http_get_req(&ss, &http_req);
+		stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK && http_req.response.code == 403, "FIFO should be 403");
+		stir_shaken_destroy_http_request(&http_req);
+		unlink(name);
+	}
+
+	http_req.url = strdup("https://sti-cr.example.com/certs/..pem");
+	status = stir_shaken_make_http_get_req(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK && http_req.response.code == 404, "Name with dots is not .. segment");
+	stir_shaken_destroy_http_request(&http_req);
+
+	if (realpath(path, name)) {
+		snprintf(url, sizeof(url), "file://%s/u20/sti-cr.example.com/certs/sp.pem", name);
+		http_req.url = strdup(url);
+		status = stir_shaken_download_cert(&ss, &http_req);
+		stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Download of file:// URL failed");
+		stir_shaken_destroy_http_request(&http_req);
+	}
+
+	stir_shaken_http_transport_use(&ss, "curl");
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	if (stir_shaken_unit_test_http_transport_memory() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	if (stir_shaken_unit_test_http_transport_dir() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
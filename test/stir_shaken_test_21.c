@@ -0,0 +1,272 @@
+#include <stir_shaken.h>
+
+/*
+ * X509 cert path verification from many threads against shared trust store snapshot (scaling from 1 to N threads),
+ * trust store reloaded while verifications are in progress, reload on demand and by directory watcher.
+ */
+
+const char *path = "./test/run";
+
+#define CA_DIR				"./test/run/u21_ca"
+#define RELOAD_CA_DIR		"./test/run/u21_reload_ca"
+#define TEST_THREADS_MAX	8
+#define TEST_VERIFY_N		2000
+
+stir_shaken_ca_t ca;
+stir_shaken_sp_t sp;
+
+typedef struct test_worker_s {
+	pthread_t	thread;
+	int			n;
+	int			failed;
+} test_worker_t;
+
+static volatile int reload_running = 0;
+
+static double test_now(void)
+{
+	struct timespec ts = { 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void* test_verify_thread(void *arg)
+{
+	test_worker_t *w = (test_worker_t *) arg;
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_cert_t cert = { 0 };
+	int i = 0;
+
+	cert.x = X509_dup(sp.cert.x);
+	if (!cert.x) {
+		w->failed = w->n;
+		return NULL;
+	}
+
+	for (i = 0; i < w->n; i++) {
+		if (stir_shaken_verify_cert_path(&ss, &cert) != STIR_SHAKEN_STATUS_OK) {
+			w->failed++;
+		}
+	}
+
+	X509_free(cert.x);
+	return NULL;
+}
+
+static void* test_reload_thread(void *arg)
+{
+	stir_shaken_context_t ss = { 0 };
+	int *reloads = (int *) arg;
+
+	while (reload_running) {
+		if (stir_shaken_init_cert_store(&ss, NULL, CA_DIR, NULL, NULL) == STIR_SHAKEN_STATUS_OK) {
+			(*reloads)++;
+		}
+		usleep(1000);
+	}
+
+	return NULL;
+}
+
+static int test_run_workers(int threads, int n)
+{
+	test_worker_t workers[TEST_THREADS_MAX] = { 0 };
+	int i = 0, failed = 0;
+
+	for (i = 0; i < threads; i++) {
+		workers[i].n = n / threads;
+		stir_shaken_assert(pthread_create(&workers[i].thread, NULL, test_verify_thread, &workers[i]) == 0, "Cannot start thread");
+	}
+
+	for (i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+		failed += workers[i].failed;
+	}
+
+	return failed;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_cert_store_scaling(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	char hashstr[100] = { 0 };
+	unsigned long hash = 0;
+	pthread_t reloader = 0;
+	int threads = 0, failed = 0, reloads = 0;
+	double t = 0, t1 = 0;
+
+	printf("=== Unit testing: STIR/Shaken X509 cert store, parallel verification\n\n");
+
+	sprintf(ca.private_key_name, "%s%c%s", path, '/', "u21_ca_private_key.pem");
+	sprintf(ca.public_key_name, "%s%c%s", path, '/', "u21_ca_public_key.pem");
+	sprintf(sp.private_key_name, "%s%c%s", path, '/', "u21_sp_private_key.pem");
+	sprintf(sp.public_key_name, "%s%c%s", path, '/', "u21_sp_public_key.pem");
+
+	ca.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key, ca.private_key_name, ca.public_key_name, ca.keys.priv_raw, &ca.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate CA keys");
+
+	sp.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &sp.keys.ec_key, &sp.keys.private_key, &sp.keys.public_key, sp.private_key_name, sp.public_key_name, sp.keys.priv_raw, &sp.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate SP keys");
+
+	status = stir_shaken_generate_csr(&ss, 2100, &sp.csr.req, sp.keys.private_key, sp.keys.public_key, "US", "u21 SP");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, generating CSR");
+
+	ca.cert.x = stir_shaken_generate_x509_self_signed_ca_cert(&ss, ca.keys.private_key, ca.keys.public_key, "US", "u21 CA", 1, 90);
+	stir_shaken_assert(ca.cert.x, "Err, generating CA cert");
+
+	sp.cert.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, ca.cert.x, ca.keys.private_key, "US", "u21 CA", sp.csr.req, 1, 90, "http://ca.com/api");
+	stir_shaken_assert(sp.cert.x, "Err, generating SP cert");
+
+	// Trust anchor in hash.N form
+	hash = stir_shaken_get_cert_name_hashed(&ss, ca.cert.x);
+	stir_shaken_assert(hash != 0, "Err, hashing CA name");
+	stir_shaken_cert_name_hashed_2_string(hash, hashstr, sizeof(hashstr));
+	sprintf(ca.cert_name_hashed, "%s/%s.0", CA_DIR, hashstr);
+	stir_shaken_assert(stir_shaken_x509_to_disk(&ss, ca.cert.x, ca.cert_name_hashed) == STIR_SHAKEN_STATUS_OK, "Err, writing CA cert");
+
+	status = stir_shaken_init_cert_store(&ss, NULL, CA_DIR, NULL, NULL);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, init cert store");
+
+	status = stir_shaken_verify_cert_path(&ss, &sp.cert);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cert path verification failed");
+
+	// Scaling
+	for (threads = 1; threads <= TEST_THREADS_MAX; threads *= 2) {
+
+		t = test_now();
+		failed = test_run_workers(threads, TEST_VERIFY_N);
+		t = test_now() - t;
+		if (threads == 1) t1 = t;
+
+		printf("%d thread(s): %d verifications in %.3f s, %.0f/s, speedup %.2f\n", threads, TEST_VERIFY_N, t, TEST_VERIFY_N / t, t1 / t);
+		stir_shaken_assert(failed == 0, "Cert path verification failed");
+	}
+
+	// Reload under load, verifications in progress keep their snapshot
+	reload_running = 1;
+	stir_shaken_assert(pthread_create(&reloader, NULL, test_reload_thread, &reloads) == 0, "Cannot start thread");
+	failed = test_run_workers(TEST_THREADS_MAX, TEST_VERIFY_N);
+	reload_running = 0;
+	pthread_join(reloader, NULL);
+	printf("Reloaded cert store %d times during verification\n", reloads);
+	stir_shaken_assert(failed == 0, "Cert path verification failed during reload");
+
+	// No store
+	stir_shaken_cert_store_cleanup();
+	status = stir_shaken_verify_cert_path(&ss, &sp.cert);
+	stir_shaken_assert(status != STIR_SHAKEN_STATUS_OK, "Verification should fail without cert store");
+	stir_shaken_clear_error(&ss);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+static uint64_t test_wait_for_reload(uint64_t generation)
+{
+	int i = 0;
+
+	for (i = 0; i < 200 && stir_shaken_cert_store_generation() == generation; i++) {
+		usleep(10000);
+	}
+
+	return stir_shaken_cert_store_generation();
+}
+
+stir_shaken_status_t stir_shaken_unit_test_cert_store_reload(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	char hashstr[100] = { 0 };
+	char name[STIR_SHAKEN_BUFLEN] = { 0 };
+	uint64_t generation = 0;
+
+	printf("=== Unit testing: STIR/Shaken X509 cert store reload\n\n");
+
+	stir_shaken_assert(stir_shaken_dir_create_recursive(RELOAD_CA_DIR) == STIR_SHAKEN_STATUS_OK, "Cannot create CA dir");
+	stir_shaken_cert_name_hashed_2_string(stir_shaken_get_cert_name_hashed(&ss, ca.cert.x), hashstr, sizeof(hashstr));
+	snprintf(name, sizeof(name), "%s/%s.0", RELOAD_CA_DIR, hashstr);
+	unlink(name);
+
+	// No trust anchor yet
+	status = stir_shaken_init_cert_store(&ss, NULL, RELOAD_CA_DIR, NULL, NULL);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, init cert store");
+	status = stir_shaken_verify_cert_path(&ss, &sp.cert);
+	stir_shaken_assert(status != STIR_SHAKEN_STATUS_OK, "Verification should fail without CA");
+	stir_shaken_clear_error(&ss);
+
+	// Reload on demand picks up new CA
+	stir_shaken_assert(stir_shaken_x509_to_disk(&ss, ca.cert.x, name) == STIR_SHAKEN_STATUS_OK, "Err, writing CA cert");
+	generation = stir_shaken_cert_store_generation();
+	status = stir_shaken_cert_store_reload(&ss);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, reload cert store");
+	stir_shaken_assert(stir_shaken_cert_store_generation() > generation, "Generation should change on reload");
+	status = stir_shaken_verify_cert_path(&ss, &sp.cert);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Verification should pass after reload");
+	stir_shaken_assert(sp.cert.verified_generation == stir_shaken_cert_store_generation(), "Verified generation not set");
+
+	// Watcher reloads when CA is removed and added again
+	status = stir_shaken_cert_store_watch_start(&ss, 50);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot start watcher");
+
+	generation = stir_shaken_cert_store_generation();
+	unlink(name);
+	stir_shaken_assert(test_wait_for_reload(generation) > generation, "Watcher should reload store after CA removal");
+	status = stir_shaken_verify_cert_path(&ss, &sp.cert);
+	stir_shaken_assert(status != STIR_SHAKEN_STATUS_OK, "Verification should fail after CA removal");
+	stir_shaken_clear_error(&ss);
+
+	generation = stir_shaken_cert_store_generation();
+	stir_shaken_assert(stir_shaken_x509_to_disk(&ss, ca.cert.x, name) == STIR_SHAKEN_STATUS_OK, "Err, writing CA cert");
+	stir_shaken_assert(test_wait_for_reload(generation) > generation, "Watcher should reload store after CA install");
+	status = stir_shaken_verify_cert_path(&ss, &sp.cert);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Verification should pass after CA install");
+
+	stir_shaken_cert_store_watch_stop();
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	// Hashed CA is written into CA dir by the test
+	if (stir_shaken_dir_create_recursive(CA_DIR) != STIR_SHAKEN_STATUS_OK) {
+
+		printf("ERR: Cannot create CA dir\n");
+		return -1;
+	}
+
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, CA_DIR, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_unit_test_cert_store_scaling() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	if (stir_shaken_unit_test_cert_store_reload() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	stir_shaken_destroy_cert(&ca.cert);
+	stir_shaken_destroy_keys_ex(&ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key);
+	stir_shaken_sp_destroy(&sp);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,281 @@
+#include <stir_shaken.h>
+
+/*
+ * Revocation with CRLs: CRL dir loaded into per issuer index, delta CRLs applied incrementally, large CRL lookup.
+ */
+
+const char *path = "./test/run";
+
+#define CA_DIR			"./test/run/u22_ca"
+#define CRL_DIR			"./test/run/u22_crl"
+#define TEST_BIG_CRL_N	50000
+#define TEST_LOOKUP_N	100000
+
+stir_shaken_ca_t ca;
+stir_shaken_sp_t sp;
+stir_shaken_cert_t sp_cert2;
+long next_update_adj = 3600;	// seconds from now
+
+static X509_CRL* test_make_crl(EVP_PKEY *key, long number, long delta_base, long *serials, int *reasons, int n)
+{
+	X509_CRL *crl = X509_CRL_new();
+	ASN1_TIME *t = ASN1_TIME_new();
+	ASN1_INTEGER *i = ASN1_INTEGER_new();
+	int k = 0;
+
+	X509_CRL_set_version(crl, 1);
+	X509_CRL_set_issuer_name(crl, X509_get_subject_name(ca.cert.x));
+	X509_gmtime_adj(t, 0);
+	X509_CRL_set1_lastUpdate(crl, t);
+	X509_gmtime_adj(t, next_update_adj);
+	X509_CRL_set1_nextUpdate(crl, t);
+
+	ASN1_INTEGER_set(i, number);
+	X509_CRL_add1_ext_i2d(crl, NID_crl_number, i, 0, 0);
+	if (delta_base >= 0) {
+		ASN1_INTEGER_set(i, delta_base);
+		X509_CRL_add1_ext_i2d(crl, NID_delta_crl, i, 1, 0);
+	}
+
+	for (k = 0; k < n; k++) {
+
+		X509_REVOKED *r = X509_REVOKED_new();
+		ASN1_INTEGER *serial = ASN1_INTEGER_new();
+
+		ASN1_INTEGER_set(serial, serials[k]);
+		X509_REVOKED_set_serialNumber(r, serial);
+		X509_gmtime_adj(t, 0);
+		X509_REVOKED_set_revocationDate(r, t);
+
+		if (reasons) {
+			ASN1_ENUMERATED *reason = ASN1_ENUMERATED_new();
+			ASN1_ENUMERATED_set(reason, reasons[k]);
+			X509_REVOKED_add1_ext_i2d(r, NID_crl_reason, reason, 0, 0);
+			ASN1_ENUMERATED_free(reason);
+		}
+
+		X509_CRL_add0_revoked(crl, r);
+		ASN1_INTEGER_free(serial);
+	}
+
+	X509_CRL_sort(crl);
+	X509_CRL_sign(crl, key, EVP_sha256());
+
+	ASN1_INTEGER_free(i);
+	ASN1_TIME_free(t);
+	return crl;
+}
+
+static stir_shaken_status_t test_crl_to_disk(X509_CRL *crl, const char *name)
+{
+	BIO *bio = BIO_new_file(name, "w");
+	int ok = 0;
+
+	if (!bio) return STIR_SHAKEN_STATUS_FALSE;
+	ok = PEM_write_bio_X509_CRL(bio, crl);
+	BIO_free(bio);
+
+	return ok == 1 ? STIR_SHAKEN_STATUS_OK : STIR_SHAKEN_STATUS_FALSE;
+}
+
+static stir_shaken_error_t test_verify(stir_shaken_cert_t *cert)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_error_t error_code = STIR_SHAKEN_ERROR_GENERAL;
+
+	if (stir_shaken_verify_cert_path(&ss, cert) == STIR_SHAKEN_STATUS_OK) {
+		return 0;
+	}
+
+	stir_shaken_get_error(&ss, &error_code);
+	return error_code;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_crl(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	char hashstr[100] = { 0 };
+	char name[STIR_SHAKEN_BUFLEN] = { 0 };
+	long serials[2] = { 0 };
+	int reasons[2] = { 0 };
+	long *big = NULL, big_serial[1] = { 99 };
+	X509_CRL *crl = NULL;
+	EVP_PKEY *rogue_key = NULL;
+	EC_KEY *rogue_ec_key = NULL;
+	EVP_PKEY *rogue_public_key = NULL;
+	unsigned char rogue_raw[STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN] = { 0 };
+	uint32_t rogue_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	struct timespec t0 = { 0 }, t1 = { 0 };
+	double t = 0;
+	int i = 0;
+
+	printf("=== Unit testing: STIR/Shaken CRL revocation\n\n");
+
+	sprintf(ca.private_key_name, "%s%c%s", path, '/', "u22_ca_private_key.pem");
+	sprintf(ca.public_key_name, "%s%c%s", path, '/', "u22_ca_public_key.pem");
+	sprintf(sp.private_key_name, "%s%c%s", path, '/', "u22_sp_private_key.pem");
+	sprintf(sp.public_key_name, "%s%c%s", path, '/', "u22_sp_public_key.pem");
+
+	ca.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key, ca.private_key_name, ca.public_key_name, ca.keys.priv_raw, &ca.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate CA keys");
+
+	sp.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &sp.keys.ec_key, &sp.keys.private_key, &sp.keys.public_key, sp.private_key_name, sp.public_key_name, sp.keys.priv_raw, &sp.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate SP keys");
+
+	status = stir_shaken_generate_csr(&ss, 2200, &sp.csr.req, sp.keys.private_key, sp.keys.public_key, "US", "u22 SP");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, generating CSR");
+
+	stir_shaken_assert(stir_shaken_dir_create_recursive(CA_DIR) == STIR_SHAKEN_STATUS_OK, "Cannot create CA dir");
+	stir_shaken_assert(stir_shaken_dir_create_recursive(CRL_DIR) == STIR_SHAKEN_STATUS_OK, "Cannot create CRL dir");
+
+	ca.cert.x = stir_shaken_generate_x509_self_signed_ca_cert(&ss, ca.keys.private_key, ca.keys.public_key, "US", "u22 CA", 1, 90);
+	stir_shaken_assert(ca.cert.x, "Err, generating CA cert");
+
+	// Two certs, serials 10 and 11
+	sp.cert.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, ca.cert.x, ca.keys.private_key, "US", "u22 CA", sp.csr.req, 10, 90, "http://ca.com/api");
+	stir_shaken_assert(sp.cert.x, "Err, generating SP cert");
+	sp_cert2.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, ca.cert.x, ca.keys.private_key, "US", "u22 CA", sp.csr.req, 11, 90, "http://ca.com/api");
+	stir_shaken_assert(sp_cert2.x, "Err, generating SP cert");
+
+	stir_shaken_cert_name_hashed_2_string(stir_shaken_get_cert_name_hashed(&ss, ca.cert.x), hashstr, sizeof(hashstr));
+	snprintf(name, sizeof(name), "%s/%s.0", CA_DIR, hashstr);
+	stir_shaken_assert(stir_shaken_x509_to_disk(&ss, ca.cert.x, name) == STIR_SHAKEN_STATUS_OK, "Err, writing CA cert");
+
+	// Full CRL number 1 revokes 10
+	serials[0] = 10;
+	crl = test_make_crl(ca.keys.private_key, 1, -1, serials, NULL, 1);
+	snprintf(name, sizeof(name), "%s/%s.r0", CRL_DIR, hashstr);
+	stir_shaken_assert(test_crl_to_disk(crl, name) == STIR_SHAKEN_STATUS_OK, "Err, writing CRL");
+	X509_CRL_free(crl);
+
+	// Junk in CRL dir is skipped
+	snprintf(name, sizeof(name), "%s/README", CRL_DIR);
+	stir_shaken_assert(stir_shaken_save_to_file(&ss, "not a CRL", name) == STIR_SHAKEN_STATUS_OK, "Err, writing file");
+
+	status = stir_shaken_init_cert_store(&ss, NULL, CA_DIR, NULL, CRL_DIR);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, init cert store");
+
+	stir_shaken_assert(test_verify(&sp.cert) == STIR_SHAKEN_ERROR_CERT_REVOKED, "Cert 10 should be revoked");
+	stir_shaken_assert(test_verify(&sp_cert2) == 0, "Cert 11 should be valid");
+	stir_shaken_assert(stir_shaken_cert_check_revocation(&ss, &sp.cert) != STIR_SHAKEN_STATUS_OK, "Cert 10 should be revoked");
+	stir_shaken_clear_error(&ss);
+
+	// Delta on top of 1: revoke 11, remove 10 from CRL
+	serials[0] = 10; reasons[0] = CRL_REASON_REMOVE_FROM_CRL;
+	serials[1] = 11; reasons[1] = CRL_REASON_KEY_COMPROMISE;
+	crl = test_make_crl(ca.keys.private_key, 2, 1, serials, reasons, 2);
+	status = stir_shaken_crl_add(&ss, crl);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, applying delta CRL");
+	X509_CRL_free(crl);
+
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Cert 10 should be removed from CRL");
+	stir_shaken_assert(test_verify(&sp_cert2) == STIR_SHAKEN_ERROR_CERT_REVOKED, "Cert 11 should be revoked");
+
+	// Added CRLs survive reload (CRL dir only has CRL 1)
+	stir_shaken_assert(stir_shaken_cert_store_reload(&ss) == STIR_SHAKEN_STATUS_OK, "Err, reloading cert store");
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Delta CRL should be applied again after reload");
+	stir_shaken_assert(test_verify(&sp_cert2) == STIR_SHAKEN_ERROR_CERT_REVOKED, "Delta CRL should be applied again after reload");
+
+	// Older full CRL doesn't override newer state
+	serials[0] = 10;
+	crl = test_make_crl(ca.keys.private_key, 1, -1, serials, NULL, 1);
+	status = stir_shaken_crl_add(&ss, crl);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_NOOP, "Older CRL should be ignored");
+	X509_CRL_free(crl);
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Cert 10 should stay valid");
+
+	// Delta without its base
+	crl = test_make_crl(ca.keys.private_key, 9, 8, serials, NULL, 1);
+	status = stir_shaken_crl_add(&ss, crl);
+	stir_shaken_assert(status != STIR_SHAKEN_STATUS_OK, "Delta CRL without base should be rejected");
+	X509_CRL_free(crl);
+	stir_shaken_clear_error(&ss);
+
+	// CRL not signed by trusted CA
+	snprintf(name, sizeof(name), "%s/u22_rogue_private_key.pem", path);
+	snprintf(hashstr, sizeof(hashstr), "%s/u22_rogue_public_key.pem", path);
+	status = stir_shaken_generate_keys(&ss, &rogue_ec_key, &rogue_key, &rogue_public_key, name, hashstr, rogue_raw, &rogue_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate keys");
+	crl = test_make_crl(rogue_key, 100, -1, serials, NULL, 1);
+	status = stir_shaken_crl_add(&ss, crl);
+	stir_shaken_assert(status != STIR_SHAKEN_STATUS_OK, "CRL with bad signature should be rejected");
+	X509_CRL_free(crl);
+	stir_shaken_clear_error(&ss);
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Cert 10 should stay valid");
+
+	// Big CRL, lookups stay cheap
+	big = malloc(TEST_BIG_CRL_N * sizeof(long));
+	stir_shaken_assert(big != NULL, "Out of memory");
+	for (i = 0; i < TEST_BIG_CRL_N; i++) {
+		big[i] = 1000000 + i;
+	}
+	big[TEST_BIG_CRL_N - 1] = 10;
+	crl = test_make_crl(ca.keys.private_key, 3, -1, big, NULL, TEST_BIG_CRL_N);
+	status = stir_shaken_crl_add(&ss, crl);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, applying big CRL");
+	X509_CRL_free(crl);
+	free(big);
+
+	stir_shaken_assert(test_verify(&sp.cert) == STIR_SHAKEN_ERROR_CERT_REVOKED, "Cert 10 should be revoked by big CRL");
+	stir_shaken_assert(test_verify(&sp_cert2) == 0, "Cert 11 not in big CRL should be valid");
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < TEST_LOOKUP_N; i++) {
+		stir_shaken_assert(stir_shaken_cert_check_revocation(&ss, &sp_cert2) == STIR_SHAKEN_STATUS_OK, "Cert 11 should not be revoked");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	t = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	printf("%d revocation checks against %d entry CRL in %.3f s (%.0f ns each)\n", TEST_LOOKUP_N, TEST_BIG_CRL_N, t, t * 1e9 / TEST_LOOKUP_N);
+
+	// CRL past its nextUpdate: revocation status unknown
+	next_update_adj = -60;
+	crl = test_make_crl(ca.keys.private_key, 4, -1, big_serial, NULL, 1);
+	next_update_adj = 3600;
+	status = stir_shaken_crl_add(&ss, crl);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, applying CRL");
+	X509_CRL_free(crl);
+	stir_shaken_assert(test_verify(&sp_cert2) == STIR_SHAKEN_ERROR_CERT_INVALID, "Cert should fail with CRL past nextUpdate");
+
+	// Missing CRL dir is no CRLs
+	status = stir_shaken_init_cert_store(&ss, NULL, CA_DIR, NULL, CRL_DIR "_missing");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Missing CRL dir should not fail");
+	stir_shaken_assert(test_verify(&sp_cert2) == STIR_SHAKEN_ERROR_CERT_INVALID, "Added CRLs should be kept");
+
+	stir_shaken_destroy_keys_ex(&rogue_ec_key, &rogue_key, &rogue_public_key);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	if (stir_shaken_unit_test_crl() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	stir_shaken_destroy_cert(&ca.cert);
+	stir_shaken_destroy_cert(&sp_cert2);
+	stir_shaken_destroy_keys_ex(&ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key);
+	stir_shaken_sp_destroy(&sp);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
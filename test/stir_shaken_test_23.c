@@ -0,0 +1,348 @@
+#include <stir_shaken.h>
+#include <mongoose.h>
+
+/*
+ * OCSP status checking against local responder: good and revoked certs, response cache honoring nextUpdate,
+ * concurrent lookups coalesced into one request, responses not signed by trusted issuer.
+ */
+
+const char *path = "./test/run";
+
+#define CA_DIR				"./test/run/u23_ca"
+#define TEST_PORT			"8096"		// not used by other tests (18 uses 8097), so they can run in parallel
+#define TEST_SERIAL_GOOD	10
+#define TEST_SERIAL_REVOKED	11
+#define TEST_THREADS		8
+
+stir_shaken_ca_t ca;
+stir_shaken_sp_t sp;
+stir_shaken_cert_t sp_revoked;
+
+// Impostor responder
+EVP_PKEY *rogue_key = NULL;
+X509 *rogue_x = NULL;
+
+static volatile int server_running = 1;
+static volatile int requests_n = 0;
+static volatile int next_update_s = 3600;
+static volatile int delay_ms = 0;
+static volatile int rogue = 0;
+
+static unsigned char* test_ocsp_respond(const char *b64, int b64_len, int *len)
+{
+	unsigned char der[STIR_SHAKEN_BUFLEN] = { 0 };
+	unsigned char *out = NULL;
+	const unsigned char *p = der;
+	OCSP_REQUEST *req = NULL;
+	OCSP_BASICRESP *bs = NULL;
+	OCSP_RESPONSE *resp = NULL;
+	ASN1_TIME *now = NULL, *next = NULL;
+	int der_len = 0, i = 0;
+
+	*len = 0;
+
+	if (b64_len <= 0 || 3 * (b64_len / 4) > (int) sizeof(der)) return NULL;
+
+	der_len = EVP_DecodeBlock(der, (const unsigned char *) b64, b64_len);
+	if (der_len <= 0 || !(req = d2i_OCSP_REQUEST(NULL, &p, der_len))) return NULL;
+
+	bs = OCSP_BASICRESP_new();
+	now = X509_gmtime_adj(NULL, 0);
+	next = X509_gmtime_adj(NULL, next_update_s);
+
+	for (i = 0; i < OCSP_request_onereq_count(req); i++) {
+
+		OCSP_CERTID *id = OCSP_onereq_get0_id(OCSP_request_onereq_get0(req, i));
+		ASN1_INTEGER *serial = NULL;
+
+		OCSP_id_get0_info(NULL, NULL, NULL, &serial, id);
+
+		if (ASN1_INTEGER_get(serial) == TEST_SERIAL_REVOKED) {
+			OCSP_basic_add1_status(bs, id, V_OCSP_CERTSTATUS_REVOKED, OCSP_REVOKED_STATUS_KEYCOMPROMISE, now, now, next);
+		} else {
+			OCSP_basic_add1_status(bs, id, V_OCSP_CERTSTATUS_GOOD, 0, NULL, now, next);
+		}
+	}
+
+	if (rogue) {
+		OCSP_basic_sign(bs, rogue_x, rogue_key, EVP_sha256(), NULL, 0);
+	} else {
+		OCSP_basic_sign(bs, ca.cert.x, ca.keys.private_key, EVP_sha256(), NULL, 0);
+	}
+
+	resp = OCSP_response_create(OCSP_RESPONSE_STATUS_SUCCESSFUL, bs);
+	*len = i2d_OCSP_RESPONSE(resp, &out);
+
+	OCSP_RESPONSE_free(resp);
+	OCSP_BASICRESP_free(bs);
+	OCSP_REQUEST_free(req);
+	ASN1_TIME_free(now);
+	ASN1_TIME_free(next);
+
+	return out;
+}
+
+static void test_event_handler(struct mg_connection *nc, int event, void *ev_data, void *d)
+{
+	struct http_message *hm = (struct http_message *) ev_data;
+	char b64[STIR_SHAKEN_BUFLEN] = { 0 };
+	unsigned char *resp = NULL;
+	int n = 0, len = 0;
+
+	if (event != MG_EV_HTTP_REQUEST) return;
+
+	requests_n++;
+
+	if (delay_ms) {
+		usleep(delay_ms * 1000);
+	}
+
+	// GET /ocsp/{url-encoding of base64 encoding of DER request}
+	if (hm->uri.len > 6 && !strncmp(hm->uri.p, "/ocsp/", 6)) {
+		n = mg_url_decode(hm->uri.p + 6, hm->uri.len - 6, b64, sizeof(b64), 0);
+		resp = test_ocsp_respond(b64, n, &len);
+	}
+
+	if (!resp) {
+		mg_printf(nc, "HTTP/1.1 400 Bad Request\r\nContent-Length: 0\r\n\r\n");
+		return;
+	}
+
+	mg_printf(nc, "HTTP/1.1 200 OK\r\nContent-Type: application/ocsp-response\r\nContent-Length: %d\r\n\r\n", len);
+	mg_send(nc, resp, len);
+	OPENSSL_free(resp);
+}
+
+static void* test_server_thread(void *arg)
+{
+	struct mg_mgr *mgr = (struct mg_mgr *) arg;
+
+	while (server_running) {
+		mg_mgr_poll(mgr, 50);
+	}
+
+	return NULL;
+}
+
+static stir_shaken_error_t test_verify(stir_shaken_cert_t *cert)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_error_t error_code = STIR_SHAKEN_ERROR_GENERAL;
+
+	if (stir_shaken_verify_cert_path(&ss, cert) == STIR_SHAKEN_STATUS_OK) {
+		return 0;
+	}
+
+	stir_shaken_get_error(&ss, &error_code);
+	return error_code;
+}
+
+static void* test_verify_thread(void *arg)
+{
+	int *failed = (int *) arg;
+	stir_shaken_cert_t cert = { 0 };
+
+	cert.x = sp.cert.x;
+	if (test_verify(&cert) != 0) {
+		(*failed)++;
+	}
+
+	return NULL;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_ocsp(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	stir_shaken_error_t error_code = STIR_SHAKEN_ERROR_GENERAL;
+	char hashstr[100] = { 0 };
+	char name[STIR_SHAKEN_BUFLEN] = { 0 };
+	char name2[STIR_SHAKEN_BUFLEN] = { 0 };
+	pthread_t threads[TEST_THREADS];
+	int failed[TEST_THREADS] = { 0 };
+	EC_KEY *rogue_ec_key = NULL;
+	EVP_PKEY *rogue_public_key = NULL;
+	unsigned char rogue_raw[STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN] = { 0 };
+	uint32_t rogue_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	int n = 0, i = 0;
+
+	printf("=== Unit testing: STIR/Shaken OCSP\n\n");
+
+	sprintf(ca.private_key_name, "%s%c%s", path, '/', "u23_ca_private_key.pem");
+	sprintf(ca.public_key_name, "%s%c%s", path, '/', "u23_ca_public_key.pem");
+	sprintf(sp.private_key_name, "%s%c%s", path, '/', "u23_sp_private_key.pem");
+	sprintf(sp.public_key_name, "%s%c%s", path, '/', "u23_sp_public_key.pem");
+
+	ca.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key, ca.private_key_name, ca.public_key_name, ca.keys.priv_raw, &ca.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate CA keys");
+
+	sp.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &sp.keys.ec_key, &sp.keys.private_key, &sp.keys.public_key, sp.private_key_name, sp.public_key_name, sp.keys.priv_raw, &sp.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate SP keys");
+
+	status = stir_shaken_generate_csr(&ss, 2300, &sp.csr.req, sp.keys.private_key, sp.keys.public_key, "US", "u23 SP");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, generating CSR");
+
+	ca.cert.x = stir_shaken_generate_x509_self_signed_ca_cert(&ss, ca.keys.private_key, ca.keys.public_key, "US", "u23 CA", 1, 90);
+	stir_shaken_assert(ca.cert.x, "Err, generating CA cert");
+
+	sp.cert.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, ca.cert.x, ca.keys.private_key, "US", "u23 CA", sp.csr.req, TEST_SERIAL_GOOD, 90, "http://ca.com/api");
+	stir_shaken_assert(sp.cert.x, "Err, generating SP cert");
+	sp_revoked.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, ca.cert.x, ca.keys.private_key, "US", "u23 CA", sp.csr.req, TEST_SERIAL_REVOKED, 90, "http://ca.com/api");
+	stir_shaken_assert(sp_revoked.x, "Err, generating SP cert");
+
+	snprintf(name, sizeof(name), "%s/u23_rogue_private_key.pem", path);
+	snprintf(name2, sizeof(name2), "%s/u23_rogue_public_key.pem", path);
+	status = stir_shaken_generate_keys(&ss, &rogue_ec_key, &rogue_key, &rogue_public_key, name, name2, rogue_raw, &rogue_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate keys");
+	rogue_x = stir_shaken_generate_x509_self_signed_ca_cert(&ss, rogue_key, rogue_public_key, "US", "u23 CA", 1, 90);
+	stir_shaken_assert(rogue_x, "Err, generating rogue cert");
+
+	stir_shaken_assert(stir_shaken_dir_create_recursive(CA_DIR) == STIR_SHAKEN_STATUS_OK, "Cannot create CA dir");
+	stir_shaken_cert_name_hashed_2_string(stir_shaken_get_cert_name_hashed(&ss, ca.cert.x), hashstr, sizeof(hashstr));
+	snprintf(name, sizeof(name), "%s/%s.0", CA_DIR, hashstr);
+	stir_shaken_assert(stir_shaken_x509_to_disk(&ss, ca.cert.x, name) == STIR_SHAKEN_STATUS_OK, "Err, writing CA cert");
+
+	status = stir_shaken_init_cert_store(&ss, NULL, CA_DIR, NULL, NULL);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, init cert store");
+
+	// No responder for certs (no AIA), not checked
+	status = stir_shaken_ocsp_enable(&ss, NULL, 1);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot enable OCSP");
+	stir_shaken_assert(test_verify(&sp_revoked) == 0, "Cert without responder should not be checked");
+	stir_shaken_assert(requests_n == 0, "No OCSP request expected");
+
+	status = stir_shaken_ocsp_enable(&ss, "http://127.0.0.1:" TEST_PORT "/ocsp", 1);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot enable OCSP");
+
+	// Good, then from cache
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Cert should be good");
+	stir_shaken_assert(requests_n == 1, "OCSP request expected");
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Cert should be good");
+	stir_shaken_assert(requests_n == 1, "Status should be served from cache");
+
+	// Revoked, then from cache
+	stir_shaken_assert(test_verify(&sp_revoked) == STIR_SHAKEN_ERROR_CERT_REVOKED, "Cert should be revoked");
+	stir_shaken_assert(requests_n == 2, "OCSP request expected");
+	stir_shaken_assert(test_verify(&sp_revoked) == STIR_SHAKEN_ERROR_CERT_REVOKED, "Cert should be revoked");
+	stir_shaken_assert(requests_n == 2, "Status should be served from cache");
+
+	// Check outside of path validation, issuer from trust store
+	stir_shaken_assert(stir_shaken_cert_check_revocation(&ss, &sp_revoked) != STIR_SHAKEN_STATUS_OK, "Cert should be revoked");
+	stir_shaken_get_error(&ss, &error_code);
+	stir_shaken_assert(error_code == STIR_SHAKEN_ERROR_CERT_REVOKED, "Error should be CERT_REVOKED");
+	stir_shaken_clear_error(&ss);
+	stir_shaken_assert(stir_shaken_cert_check_revocation(&ss, &sp.cert) == STIR_SHAKEN_STATUS_OK, "Cert should be good");
+	stir_shaken_assert(requests_n == 2, "Status should be served from cache");
+
+	// Cached until nextUpdate
+	stir_shaken_ocsp_cache_flush();
+	next_update_s = 2;
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Cert should be good");
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Cert should be good");
+	stir_shaken_assert(requests_n == 3, "Status should be cached until nextUpdate");
+	stir_shaken_cache_maintenance();
+	stir_shaken_assert(stir_shaken_globals.ocsp_cache_n == 1, "Status should not be dropped before nextUpdate");
+	sleep(3);
+	stir_shaken_cache_maintenance();
+	stir_shaken_assert(stir_shaken_globals.ocsp_cache_n == 0, "Status should be dropped at nextUpdate");
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Cert should be good");
+	stir_shaken_assert(requests_n == 4, "Status past nextUpdate should be fetched again");
+	next_update_s = 3600;
+
+	// Concurrent lookups share one request
+	stir_shaken_ocsp_cache_flush();
+	delay_ms = 300;
+	n = requests_n;
+	for (i = 0; i < TEST_THREADS; i++) {
+		stir_shaken_assert(pthread_create(&threads[i], NULL, test_verify_thread, &failed[i]) == 0, "Cannot start thread");
+	}
+	for (i = 0; i < TEST_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+		stir_shaken_assert(failed[i] == 0, "Cert should be good");
+	}
+	printf("%d concurrent verifications made %d OCSP requests\n", TEST_THREADS, requests_n - n);
+	stir_shaken_assert(requests_n - n == 1, "Concurrent lookups should be coalesced");
+	delay_ms = 0;
+
+	// Response not signed by issuer nor its delegate
+	stir_shaken_ocsp_cache_flush();
+	rogue = 1;
+	n = requests_n;
+	stir_shaken_assert(test_verify(&sp.cert) == STIR_SHAKEN_ERROR_OCSP, "Forged response should fail validation (hard fail)");
+	stir_shaken_assert(test_verify(&sp.cert) == STIR_SHAKEN_ERROR_OCSP, "Forged response should fail validation (hard fail)");
+	stir_shaken_assert(requests_n - n == 1, "Failure should be remembered for a while");
+
+	status = stir_shaken_ocsp_enable(&ss, "http://127.0.0.1:" TEST_PORT "/ocsp", 0);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot enable OCSP");
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "No status should be ignored (soft fail)");
+	stir_shaken_assert(requests_n - n == 2, "OCSP request expected");
+
+	// Caller's error is left alone by OCSP lookup
+	stir_shaken_ocsp_cache_flush();
+	stir_shaken_clear_error(&ss);
+	stir_shaken_set_error(&ss, "Earlier error", STIR_SHAKEN_ERROR_CERT_INVALID);
+	stir_shaken_assert(stir_shaken_ocsp_check(&ss, sp.cert.x, ca.cert.x) == STIR_SHAKEN_STATUS_OK, "No status should be ignored (soft fail)");
+	stir_shaken_assert(ss.n == 1 && stir_shaken_get_error_code(&ss) == STIR_SHAKEN_ERROR_CERT_INVALID, "Soft fail should not touch caller's error");
+	rogue = 0;
+	stir_shaken_ocsp_cache_flush();
+	stir_shaken_assert(stir_shaken_ocsp_check(&ss, sp.cert.x, ca.cert.x) == STIR_SHAKEN_STATUS_OK, "Cert should be good");
+	stir_shaken_assert(ss.n == 1 && stir_shaken_get_error_code(&ss) == STIR_SHAKEN_ERROR_CERT_INVALID, "Good status should not clear caller's error");
+	stir_shaken_clear_error(&ss);
+
+	stir_shaken_ocsp_disable();
+	n = requests_n;
+	stir_shaken_assert(test_verify(&sp_revoked) == 0, "OCSP is disabled");
+	stir_shaken_assert(requests_n == n, "No OCSP request expected");
+
+	X509_free(rogue_x);
+	stir_shaken_destroy_keys_ex(&rogue_ec_key, &rogue_key, &rogue_public_key);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	struct mg_mgr mgr;
+	struct mg_connection *nc = NULL;
+	pthread_t server = 0;
+
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	mg_mgr_init(&mgr, NULL);
+	nc = mg_bind(&mgr, TEST_PORT, test_event_handler, NULL);
+	stir_shaken_assert(nc != NULL, "Cannot start OCSP responder");
+	mg_set_protocol_http_websocket(nc);
+	stir_shaken_assert(pthread_create(&server, NULL, test_server_thread, &mgr) == 0, "Cannot start OCSP responder thread");
+
+	if (stir_shaken_unit_test_ocsp() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	server_running = 0;
+	pthread_join(server, NULL);
+	mg_mgr_free(&mgr);
+
+	stir_shaken_destroy_cert(&ca.cert);
+	stir_shaken_destroy_cert(&sp_revoked);
+	stir_shaken_destroy_keys_ex(&ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key);
+	stir_shaken_sp_destroy(&sp);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,154 @@
+#include <stir_shaken.h>
+
+/*
+ * CA dir loaded into memory: verification does not need the dir anymore, only hashed file names are trusted,
+ * CAs sharing subject name are told apart by key.
+ */
+
+const char *path = "./test/run";
+
+#define CA_DIR			"./test/run/u24_ca"
+
+typedef struct test_ca_s {
+	stir_shaken_ca_t	ca;
+	char				name[STIR_SHAKEN_BUFLEN];
+} test_ca_t;
+
+test_ca_t ca1, ca2, ca3;
+stir_shaken_sp_t sp;
+stir_shaken_cert_t sp_cert2, sp_cert3;
+
+static stir_shaken_status_t test_make_ca(test_ca_t *t, const char *id, const char *cn)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_ca_t *ca = &t->ca;
+
+	sprintf(ca->private_key_name, "%s/u24_%s_private_key.pem", path, id);
+	sprintf(ca->public_key_name, "%s/u24_%s_public_key.pem", path, id);
+
+	ca->keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	if (stir_shaken_generate_keys(&ss, &ca->keys.ec_key, &ca->keys.private_key, &ca->keys.public_key, ca->private_key_name, ca->public_key_name, ca->keys.priv_raw, &ca->keys.priv_raw_len) != STIR_SHAKEN_STATUS_OK) {
+		return STIR_SHAKEN_STATUS_FALSE;
+	}
+
+	ca->cert.x = stir_shaken_generate_x509_self_signed_ca_cert(&ss, ca->keys.private_key, ca->keys.public_key, "US", cn, 1, 90);
+
+	return ca->cert.x ? STIR_SHAKEN_STATUS_OK : STIR_SHAKEN_STATUS_FALSE;
+}
+
+static stir_shaken_error_t test_verify(stir_shaken_cert_t *cert)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_error_t error_code = STIR_SHAKEN_ERROR_GENERAL;
+
+	if (stir_shaken_verify_cert_path(&ss, cert) == STIR_SHAKEN_STATUS_OK) {
+		return 0;
+	}
+
+	stir_shaken_get_error(&ss, &error_code);
+	return error_code;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_ca_index(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	char hashstr[100] = { 0 };
+	char moved[STIR_SHAKEN_BUFLEN] = { 0 };
+
+	printf("=== Unit testing: STIR/Shaken CA dir index\n\n");
+
+	// ca1 and ca2 share subject name (same hash), ca3 is not trusted
+	stir_shaken_assert(test_make_ca(&ca1, "ca1", "u24 CA") == STIR_SHAKEN_STATUS_OK, "Err, generating CA");
+	stir_shaken_assert(test_make_ca(&ca2, "ca2", "u24 CA") == STIR_SHAKEN_STATUS_OK, "Err, generating CA");
+	stir_shaken_assert(test_make_ca(&ca3, "ca3", "u24 CA 3") == STIR_SHAKEN_STATUS_OK, "Err, generating CA");
+
+	sprintf(sp.private_key_name, "%s/u24_sp_private_key.pem", path);
+	sprintf(sp.public_key_name, "%s/u24_sp_public_key.pem", path);
+	sp.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &sp.keys.ec_key, &sp.keys.private_key, &sp.keys.public_key, sp.private_key_name, sp.public_key_name, sp.keys.priv_raw, &sp.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate SP keys");
+	status = stir_shaken_generate_csr(&ss, 2400, &sp.csr.req, sp.keys.private_key, sp.keys.public_key, "US", "u24 SP");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, generating CSR");
+
+	sp.cert.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, ca1.ca.cert.x, ca1.ca.keys.private_key, "US", "u24 CA", sp.csr.req, 10, 90, "http://ca.com/api");
+	stir_shaken_assert(sp.cert.x, "Err, generating SP cert");
+	sp_cert2.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, ca2.ca.cert.x, ca2.ca.keys.private_key, "US", "u24 CA", sp.csr.req, 20, 90, "http://ca.com/api");
+	stir_shaken_assert(sp_cert2.x, "Err, generating SP cert");
+	sp_cert3.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, ca3.ca.cert.x, ca3.ca.keys.private_key, "US", "u24 CA 3", sp.csr.req, 30, 90, "http://ca.com/api");
+	stir_shaken_assert(sp_cert3.x, "Err, generating SP cert");
+
+	stir_shaken_assert(stir_shaken_dir_create_recursive(CA_DIR) == STIR_SHAKEN_STATUS_OK, "Cannot create CA dir");
+
+	stir_shaken_cert_name_hashed_2_string(stir_shaken_get_cert_name_hashed(&ss, ca1.ca.cert.x), hashstr, sizeof(hashstr));
+	snprintf(ca1.name, sizeof(ca1.name), "%s/%s.0", CA_DIR, hashstr);
+	snprintf(ca2.name, sizeof(ca2.name), "%s/%s.1", CA_DIR, hashstr);
+	stir_shaken_assert(stir_shaken_x509_to_disk(&ss, ca1.ca.cert.x, ca1.name) == STIR_SHAKEN_STATUS_OK, "Err, writing CA cert");
+	stir_shaken_assert(stir_shaken_x509_to_disk(&ss, ca2.ca.cert.x, ca2.name) == STIR_SHAKEN_STATUS_OK, "Err, writing CA cert");
+
+	// Not a hashed name, OpenSSL would not find it there either
+	snprintf(ca3.name, sizeof(ca3.name), "%s/ca3.pem", CA_DIR);
+	stir_shaken_assert(stir_shaken_x509_to_disk(&ss, ca3.ca.cert.x, ca3.name) == STIR_SHAKEN_STATUS_OK, "Err, writing CA cert");
+
+	status = stir_shaken_init_cert_store(&ss, NULL, CA_DIR, NULL, NULL);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, init cert store");
+
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Cert issued by CA 1 should verify");
+	stir_shaken_assert(test_verify(&sp_cert2) == 0, "Cert issued by CA 2 (same subject as CA 1) should verify");
+	stir_shaken_assert(test_verify(&sp_cert3) == STIR_SHAKEN_ERROR_CERT_INVALID, "CA 3 is not in hashed file and should not be trusted");
+
+	// Nothing is looked up on disk once loaded
+	snprintf(moved, sizeof(moved), "%s.moved", CA_DIR);
+	stir_shaken_assert(rename(CA_DIR, moved) == 0, "Cannot move CA dir");
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Cert should verify without CA dir");
+	stir_shaken_assert(test_verify(&sp_cert2) == 0, "Cert should verify without CA dir");
+
+	status = stir_shaken_init_cert_store(&ss, NULL, CA_DIR, NULL, NULL);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Missing CA dir should load as empty");
+	stir_shaken_assert(test_verify(&sp.cert) == STIR_SHAKEN_ERROR_CERT_INVALID, "Nothing should be trusted with missing CA dir");
+	stir_shaken_assert(rename(moved, CA_DIR) == 0, "Cannot move CA dir back");
+
+	// CA list file, loaded along with CA dir
+	status = stir_shaken_init_cert_store(&ss, ca3.name, CA_DIR, NULL, NULL);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, init cert store");
+	stir_shaken_assert(test_verify(&sp_cert3) == 0, "CA 3 from CA list should be trusted");
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Cert issued by CA 1 should verify");
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	if (stir_shaken_unit_test_ca_index() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	stir_shaken_destroy_cert(&ca1.ca.cert);
+	stir_shaken_destroy_cert(&ca2.ca.cert);
+	stir_shaken_destroy_cert(&ca3.ca.cert);
+	stir_shaken_destroy_cert(&sp_cert2);
+	stir_shaken_destroy_cert(&sp_cert3);
+	stir_shaken_destroy_keys_ex(&ca1.ca.keys.ec_key, &ca1.ca.keys.private_key, &ca1.ca.keys.public_key);
+	stir_shaken_destroy_keys_ex(&ca2.ca.keys.ec_key, &ca2.ca.keys.private_key, &ca2.ca.keys.public_key);
+	stir_shaken_destroy_keys_ex(&ca3.ca.keys.ec_key, &ca3.ca.keys.private_key, &ca3.ca.keys.public_key);
+	stir_shaken_sp_destroy(&sp);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,266 @@
+#include <stir_shaken.h>
+
+/*
+ * Loading certificates from memory in all formats x5u may serve: PEM chain, DER, PKCS#7 certs-only (DER and PEM),
+ * buffers which are not 0-terminated, and download through in-memory HTTP transport.
+ */
+
+const char *path = "./test/run";
+
+#define TEST_URL		"https://sti-cr.example.com/certs/sp.p7c"
+#define TEST_PARSE_N	10000
+
+stir_shaken_ca_t ca;
+stir_shaken_sp_t sp;
+
+typedef enum test_format_e {
+	TEST_FORMAT_PEM,
+	TEST_FORMAT_DER,
+	TEST_FORMAT_PKCS7_DER,
+	TEST_FORMAT_PKCS7_PEM
+} test_format_t;
+
+// Serialized @certs, exactly @len bytes, not 0-terminated
+static unsigned char* test_encode(STACK_OF(X509) *certs, test_format_t format, size_t *len)
+{
+	BIO *bio = BIO_new(BIO_s_mem());
+	PKCS7 *p7 = NULL;
+	char *data = NULL;
+	unsigned char *out = NULL;
+	long n = 0;
+	int i = 0;
+
+	if (!bio) return NULL;
+
+	switch (format) {
+
+		case TEST_FORMAT_PEM:
+			for (i = 0; i < sk_X509_num(certs); i++) PEM_write_bio_X509(bio, sk_X509_value(certs, i));
+			break;
+
+		case TEST_FORMAT_DER:
+			for (i = 0; i < sk_X509_num(certs); i++) i2d_X509_bio(bio, sk_X509_value(certs, i));
+			break;
+
+		case TEST_FORMAT_PKCS7_DER:
+		case TEST_FORMAT_PKCS7_PEM:
+			// Certs-only, as "openssl crl2pkcs7 -nocrl" makes it
+			p7 = PKCS7_new();
+			if (p7 && PKCS7_set_type(p7, NID_pkcs7_signed) && PKCS7_content_new(p7, NID_pkcs7_data)) {
+				for (i = 0; i < sk_X509_num(certs); i++) PKCS7_add_certificate(p7, sk_X509_value(certs, i));
+				if (format == TEST_FORMAT_PKCS7_DER) i2d_PKCS7_bio(bio, p7);
+				else PEM_write_bio_PKCS7(bio, p7);
+			}
+			PKCS7_free(p7);
+			break;
+	}
+
+	n = BIO_get_mem_data(bio, &data);
+	if (n > 0 && (out = malloc(n))) {
+		memcpy(out, data, n);
+		*len = n;
+	}
+
+	BIO_free(bio);
+	return out;
+}
+
+static stir_shaken_status_t test_load(STACK_OF(X509) *certs, test_format_t format, X509 *leaf, int chain_n)
+{
+	stir_shaken_context_t ss = { 0 };
+	STACK_OF(X509) *xchain = NULL;
+	X509 *x = NULL;
+	unsigned char *mem = NULL;
+	size_t len = 0;
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+
+	mem = test_encode(certs, format, &len);
+	stir_shaken_assert(mem != NULL, "Cannot encode certs");
+
+	if (stir_shaken_load_x509_from_mem_ex(&ss, &x, &xchain, mem, len) == STIR_SHAKEN_STATUS_OK
+			&& x && !X509_cmp(x, leaf) && (xchain ? sk_X509_num(xchain) : 0) == chain_n) {
+		status = STIR_SHAKEN_STATUS_OK;
+	}
+
+	X509_free(x);
+	sk_X509_pop_free(xchain, X509_free);
+	free(mem);
+
+	return status;
+}
+
+static double test_parse_time(STACK_OF(X509) *certs, test_format_t format)
+{
+	stir_shaken_context_t ss = { 0 };
+	STACK_OF(X509) *xchain = NULL;
+	X509 *x = NULL;
+	unsigned char *mem = NULL;
+	size_t len = 0;
+	struct timespec t0 = { 0 }, t1 = { 0 };
+	int i = 0;
+
+	mem = test_encode(certs, format, &len);
+	stir_shaken_assert(mem != NULL, "Cannot encode certs");
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < TEST_PARSE_N; i++) {
+		stir_shaken_assert(stir_shaken_load_x509_from_mem_ex(&ss, &x, &xchain, mem, len) == STIR_SHAKEN_STATUS_OK, "Failed to load certs");
+		X509_free(x);
+		sk_X509_pop_free(xchain, X509_free);
+		x = NULL;
+		xchain = NULL;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	free(mem);
+
+	return ((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9) * 1e6 / TEST_PARSE_N;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_load_x509_from_mem(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	stir_shaken_http_req_t http_req = { 0 };
+	stir_shaken_cert_t cert = { 0 };
+	STACK_OF(X509) *chain = NULL, *reversed = NULL, *single = NULL;
+	X509 *x = NULL;
+	unsigned char *mem = NULL;
+	char *pem = NULL;
+	size_t len = 0;
+
+	printf("=== Unit testing: STIR/Shaken load X509 from memory\n\n");
+
+	sprintf(ca.private_key_name, "%s%c%s", path, '/', "u25_ca_private_key.pem");
+	sprintf(ca.public_key_name, "%s%c%s", path, '/', "u25_ca_public_key.pem");
+	sprintf(sp.private_key_name, "%s%c%s", path, '/', "u25_sp_private_key.pem");
+	sprintf(sp.public_key_name, "%s%c%s", path, '/', "u25_sp_public_key.pem");
+
+	ca.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key, ca.private_key_name, ca.public_key_name, ca.keys.priv_raw, &ca.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate CA keys");
+
+	sp.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &sp.keys.ec_key, &sp.keys.private_key, &sp.keys.public_key, sp.private_key_name, sp.public_key_name, sp.keys.priv_raw, &sp.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate SP keys");
+
+	status = stir_shaken_generate_csr(&ss, 2500, &sp.csr.req, sp.keys.private_key, sp.keys.public_key, "US", "u25 SP");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, generating CSR");
+
+	ca.cert.x = stir_shaken_generate_x509_self_signed_ca_cert(&ss, ca.keys.private_key, ca.keys.public_key, "US", "u25 CA", 1, 90);
+	stir_shaken_assert(ca.cert.x, "Err, generating CA cert");
+
+	sp.cert.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, ca.cert.x, ca.keys.private_key, "US", "u25 CA", sp.csr.req, 10, 90, "http://ca.com/api");
+	stir_shaken_assert(sp.cert.x, "Err, generating SP cert");
+
+	chain = sk_X509_new_null();
+	reversed = sk_X509_new_null();
+	single = sk_X509_new_null();
+	stir_shaken_assert(chain && reversed && single, "Out of memory");
+	sk_X509_push(chain, sp.cert.x);
+	sk_X509_push(chain, ca.cert.x);
+	sk_X509_push(reversed, ca.cert.x);
+	sk_X509_push(reversed, sp.cert.x);
+	sk_X509_push(single, sp.cert.x);
+
+	stir_shaken_assert(test_load(single, TEST_FORMAT_PEM, sp.cert.x, 0) == STIR_SHAKEN_STATUS_OK, "PEM cert");
+	stir_shaken_assert(test_load(chain, TEST_FORMAT_PEM, sp.cert.x, 1) == STIR_SHAKEN_STATUS_OK, "PEM chain");
+	stir_shaken_assert(test_load(single, TEST_FORMAT_DER, sp.cert.x, 0) == STIR_SHAKEN_STATUS_OK, "DER cert");
+	stir_shaken_assert(test_load(chain, TEST_FORMAT_DER, sp.cert.x, 1) == STIR_SHAKEN_STATUS_OK, "DER chain");
+	stir_shaken_assert(test_load(single, TEST_FORMAT_PKCS7_DER, sp.cert.x, 0) == STIR_SHAKEN_STATUS_OK, "PKCS#7 cert");
+
+	// Certs in PKCS#7 are a set, end-entity cert is found whatever the order
+	stir_shaken_assert(test_load(chain, TEST_FORMAT_PKCS7_DER, sp.cert.x, 1) == STIR_SHAKEN_STATUS_OK, "PKCS#7 chain");
+	stir_shaken_assert(test_load(reversed, TEST_FORMAT_PKCS7_DER, sp.cert.x, 1) == STIR_SHAKEN_STATUS_OK, "PKCS#7 chain, CA first");
+	stir_shaken_assert(test_load(reversed, TEST_FORMAT_PKCS7_PEM, sp.cert.x, 1) == STIR_SHAKEN_STATUS_OK, "PEM PKCS#7 chain, CA first");
+
+	// Garbage and truncated input
+	stir_shaken_assert(stir_shaken_load_x509_from_mem_ex(&ss, &x, NULL, "garbage", 7) != STIR_SHAKEN_STATUS_OK, "Garbage should not load");
+	stir_shaken_clear_error(&ss);
+	mem = test_encode(single, TEST_FORMAT_DER, &len);
+	stir_shaken_assert(mem != NULL, "Cannot encode certs");
+	stir_shaken_assert(stir_shaken_load_x509_from_mem_ex(&ss, &x, NULL, mem, len / 2) != STIR_SHAKEN_STATUS_OK, "Truncated DER should not load");
+	stir_shaken_clear_error(&ss);
+	free(mem);
+
+	// 0-terminated PEM, old API
+	mem = test_encode(chain, TEST_FORMAT_PEM, &len);
+	stir_shaken_assert(mem != NULL, "Cannot encode certs");
+	pem = calloc(1, len + 1);
+	stir_shaken_assert(pem != NULL, "Out of memory");
+	memcpy(pem, mem, len);
+	stir_shaken_assert(stir_shaken_load_x509_from_mem(&ss, &x, NULL, pem) == STIR_SHAKEN_STATUS_OK && !X509_cmp(x, sp.cert.x), "PEM through old API");
+	X509_free(x);
+	x = NULL;
+	free(pem);
+
+	// PEM with text before it (e.g. "Bag Attributes" from openssl pkcs12, or openssl x509 -text)
+	pem = calloc(1, len + 64);
+	stir_shaken_assert(pem != NULL, "Out of memory");
+	snprintf(pem, len + 64, "subject=/C=US/CN=u25 SP\n");
+	memcpy(pem + strlen(pem), mem, len);
+	stir_shaken_assert(stir_shaken_load_x509_from_mem(&ss, &x, NULL, pem) == STIR_SHAKEN_STATUS_OK && !X509_cmp(x, sp.cert.x), "PEM after text");
+	X509_free(x);
+	x = NULL;
+	free(pem);
+	free(mem);
+
+	// x5u serving PKCS#7
+	mem = test_encode(reversed, TEST_FORMAT_PKCS7_DER, &len);
+	stir_shaken_assert(mem != NULL, "Cannot encode certs");
+	status = stir_shaken_http_transport_register_memory(&ss, "u25", 0, 0, 0, 1);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot register transport");
+	status = stir_shaken_http_transport_memory_set(&ss, "u25", TEST_URL, 200, (const char *) mem, len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot set response");
+	stir_shaken_http_transport_use(&ss, "u25");
+	free(mem);
+
+	http_req.url = strdup(TEST_URL);
+	status = stir_shaken_download_cert(&ss, &http_req);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Download failed");
+	status = stir_shaken_load_x509_from_mem_ex(&ss, &cert.x, &cert.xchain, http_req.response.mem.mem, http_req.response.mem.size);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Cannot load downloaded PKCS#7");
+	stir_shaken_assert(!X509_cmp(cert.x, sp.cert.x), "Wrong end-entity cert");
+	stir_shaken_destroy_cert(&cert);
+	stir_shaken_destroy_http_request(&http_req);
+	stir_shaken_http_transport_use(&ss, "curl");
+
+	printf("Parse time per chain: PEM %.1f us, DER %.1f us, PKCS#7 %.1f us\n",
+			test_parse_time(chain, TEST_FORMAT_PEM), test_parse_time(chain, TEST_FORMAT_DER), test_parse_time(chain, TEST_FORMAT_PKCS7_DER));
+
+	sk_X509_free(chain);
+	sk_X509_free(reversed);
+	sk_X509_free(single);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	if (stir_shaken_unit_test_load_x509_from_mem() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	stir_shaken_destroy_cert(&ca.cert);
+	stir_shaken_destroy_keys_ex(&ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key);
+	stir_shaken_sp_destroy(&sp);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,118 @@
+#include <stir_shaken.h>
+
+/*
+ * Cert fields: stir_shaken_read_cert_fields reads only what verification needs (version and validity),
+ * strings are formatted on first access with getters, and again after cert fields are destroyed.
+ */
+
+const char *path = "./test/run";
+
+#define TEST_READ_N	100000
+
+stir_shaken_ca_t ca;
+stir_shaken_sp_t sp;
+
+stir_shaken_status_t stir_shaken_unit_test_cert_fields(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	stir_shaken_cert_t cert = { 0 };
+	struct timespec t0 = { 0 }, t1 = { 0 };
+	char *serial = NULL;
+	int i = 0;
+
+	printf("=== Unit testing: STIR/Shaken cert fields\n\n");
+
+	sprintf(ca.private_key_name, "%s%c%s", path, '/', "u26_ca_private_key.pem");
+	sprintf(ca.public_key_name, "%s%c%s", path, '/', "u26_ca_public_key.pem");
+	sprintf(sp.private_key_name, "%s%c%s", path, '/', "u26_sp_private_key.pem");
+	sprintf(sp.public_key_name, "%s%c%s", path, '/', "u26_sp_public_key.pem");
+
+	ca.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key, ca.private_key_name, ca.public_key_name, ca.keys.priv_raw, &ca.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate CA keys");
+
+	sp.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &sp.keys.ec_key, &sp.keys.private_key, &sp.keys.public_key, sp.private_key_name, sp.public_key_name, sp.keys.priv_raw, &sp.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate SP keys");
+
+	status = stir_shaken_generate_csr(&ss, 2600, &sp.csr.req, sp.keys.private_key, sp.keys.public_key, "US", "u26 SP");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, generating CSR");
+
+	ca.cert.x = stir_shaken_generate_x509_self_signed_ca_cert(&ss, ca.keys.private_key, ca.keys.public_key, "US", "u26 CA", 1, 90);
+	stir_shaken_assert(ca.cert.x, "Err, generating CA cert");
+
+	sp.cert.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, ca.cert.x, ca.keys.private_key, "US", "u26 CA", sp.csr.req, 2600, 90, "http://ca.com/api");
+	stir_shaken_assert(sp.cert.x, "Err, generating SP cert");
+
+	cert.x = sp.cert.x;
+
+	status = stir_shaken_read_cert_fields(&ss, &cert);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, reading cert fields");
+	stir_shaken_assert(cert.version == 0, "Version should not be read yet");
+	stir_shaken_assert(stir_shaken_cert_get_version(&cert) == 3, "Wrong version");
+	stir_shaken_assert(cert.notBefore_ASN1 && cert.notAfter_ASN1, "Validity should be read");
+	stir_shaken_assert(stir_shaken_basic_cert_check(&ss, &cert) == STIR_SHAKEN_STATUS_OK, "Basic cert check failed");
+
+	// Nothing formatted until asked for
+	stir_shaken_assert(!cert.serialHex && !cert.serialDec, "Serial should not be formatted yet");
+	stir_shaken_assert(!cert.issuer[0] && !cert.subject[0] && !cert.notBefore[0] && !cert.notAfter[0], "Strings should not be formatted yet");
+
+	serial = stir_shaken_cert_get_serialHex(&cert);
+	stir_shaken_assert(serial && !strcmp(serial, "0A28"), "Wrong serial (hex)");
+	stir_shaken_assert(stir_shaken_cert_get_serialHex(&cert) == serial, "Serial should be formatted once");
+	stir_shaken_assert(!strcmp(stir_shaken_cert_get_serialDec(&cert), "2600"), "Wrong serial (dec)");
+	stir_shaken_assert(!strcmp(stir_shaken_cert_get_issuer(&cert), "/C=US/CN=u26 CA"), "Wrong issuer");
+	stir_shaken_assert(strstr(stir_shaken_cert_get_subject(&cert), "CN=u26 SP"), "Wrong subject");
+	stir_shaken_assert(strstr(stir_shaken_cert_get_notBefore(&cert), "GMT"), "Wrong notBefore");
+	stir_shaken_assert(strstr(stir_shaken_cert_get_notAfter(&cert), "GMT"), "Wrong notAfter");
+
+	// Formatted again after fields are reset
+	stir_shaken_destroy_cert_fields(&cert);
+	stir_shaken_assert(!cert.serialHex && !cert.issuer[0] && !cert.notAfter[0], "Fields should be reset");
+	stir_shaken_assert(!strcmp(stir_shaken_cert_get_serialDec(&cert), "2600"), "Wrong serial (dec)");
+	stir_shaken_assert(!strcmp(stir_shaken_cert_get_issuer(&cert), "/C=US/CN=u26 CA"), "Wrong issuer");
+	stir_shaken_destroy_cert_fields(&cert);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < TEST_READ_N; i++) {
+		stir_shaken_assert(stir_shaken_read_cert_fields(&ss, &cert) == STIR_SHAKEN_STATUS_OK, "Err, reading cert fields");
+		stir_shaken_assert(stir_shaken_basic_cert_check(&ss, &cert) == STIR_SHAKEN_STATUS_OK, "Basic cert check failed");
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	stir_shaken_destroy_cert_fields(&cert);
+
+	printf("Read cert fields and basic check: %.2f us\n", ((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9) * 1e6 / TEST_READ_N);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	if (stir_shaken_unit_test_cert_fields() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	stir_shaken_destroy_cert(&ca.cert);
+	stir_shaken_destroy_keys_ex(&ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key);
+	stir_shaken_sp_destroy(&sp);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+#include <stir_shaken.h>
+
+/*
+ * Compact reference counted cert: shared by threads, public key made once, path validation result shared
+ * until trust store changes or cert in the path expires, wrapped into stir_shaken_cert_t for API using it.
+ */
+
+const char *path = "./test/run";
+
+#define TEST_THREADS	8
+#define TEST_KEY_N		10000
+#define TEST_INTER_EXPIRY_S	1
+
+stir_shaken_ca_t ca;
+stir_shaken_sp_t sp;
+char ca_name[STIR_SHAKEN_BUFLEN];
+
+static void* test_thread(void *arg)
+{
+	stir_shaken_cert_ref_t *ref = arg;
+	stir_shaken_context_t ss = { 0 };
+	const unsigned char *key = NULL, *first = NULL;
+	int key_len = 0, i = 0;
+
+	for (i = 0; i < TEST_KEY_N; i++) {
+
+		stir_shaken_cert_ref_t *mine = stir_shaken_cert_ref_get(ref);
+
+		if (stir_shaken_cert_ref_get_pubkey_raw(&ss, mine, &key, &key_len) != STIR_SHAKEN_STATUS_OK) {
+			stir_shaken_cert_ref_put(mine);
+			return "Cannot get public key";
+		}
+
+		if (!first) first = key;
+		stir_shaken_cert_ref_put(mine);
+
+		if (key != first) return "Public key should be made once";
+	}
+
+	return NULL;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_cert_ref(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	stir_shaken_cert_ref_t *ref = NULL;
+	stir_shaken_cert_t *cert = NULL;
+	X509 *inter = NULL, *leaf = NULL;
+	STACK_OF(X509) *xchain = NULL;
+	pthread_t threads[TEST_THREADS];
+	unsigned char key[STIR_SHAKEN_PUB_KEY_RAW_BUF_LEN] = { 0 }, key2[STIR_SHAKEN_PUB_KEY_RAW_BUF_LEN] = { 0 };
+	int key_len = STIR_SHAKEN_PUB_KEY_RAW_BUF_LEN, key2_len = STIR_SHAKEN_PUB_KEY_RAW_BUF_LEN;
+	const unsigned char *raw = NULL;
+	int raw_len = 0;
+	void *res = NULL;
+	int i = 0;
+
+	printf("=== Unit testing: STIR/Shaken compact cert\n\n");
+
+	sprintf(ca.private_key_name, "%s%c%s", path, '/', "u27_ca_private_key.pem");
+	sprintf(ca.public_key_name, "%s%c%s", path, '/', "u27_ca_public_key.pem");
+	sprintf(sp.private_key_name, "%s%c%s", path, '/', "u27_sp_private_key.pem");
+	sprintf(sp.public_key_name, "%s%c%s", path, '/', "u27_sp_public_key.pem");
+	sprintf(ca_name, "%s%c%s", path, '/', "u27_ca.pem");
+
+	ca.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key, ca.private_key_name, ca.public_key_name, ca.keys.priv_raw, &ca.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate CA keys");
+
+	sp.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &sp.keys.ec_key, &sp.keys.private_key, &sp.keys.public_key, sp.private_key_name, sp.public_key_name, sp.keys.priv_raw, &sp.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate SP keys");
+
+	status = stir_shaken_generate_csr(&ss, 2700, &sp.csr.req, sp.keys.private_key, sp.keys.public_key, "US", "u27 SP");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, generating CSR");
+
+	ca.cert.x = stir_shaken_generate_x509_self_signed_ca_cert(&ss, ca.keys.private_key, ca.keys.public_key, "US", "u27 CA", 1, 90);
+	stir_shaken_assert(ca.cert.x, "Err, generating CA cert");
+	stir_shaken_assert(stir_shaken_x509_to_disk(&ss, ca.cert.x, ca_name) == STIR_SHAKEN_STATUS_OK, "Err, writing CA cert");
+
+	sp.cert.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, ca.cert.x, ca.keys.private_key, "US", "u27 CA", sp.csr.req, 10, 90, "http://ca.com/api");
+	stir_shaken_assert(sp.cert.x, "Err, generating SP cert");
+
+	X509_up_ref(sp.cert.x);
+	ref = stir_shaken_cert_ref_create(&ss, sp.cert.x, NULL, 1234);
+	stir_shaken_assert(ref, "Err, creating compact cert");
+	stir_shaken_assert(ref->refs == 1, "Wrong refcount");
+
+	// Same key as made from full cert
+	stir_shaken_assert(stir_shaken_get_pubkey_raw_from_cert(&ss, &sp.cert, key, &key_len) == STIR_SHAKEN_STATUS_OK, "Cannot get public key");
+	stir_shaken_assert(stir_shaken_cert_ref_get_pubkey_raw(&ss, ref, &raw, &raw_len) == STIR_SHAKEN_STATUS_OK, "Cannot get public key");
+	stir_shaken_assert(raw_len == key_len && !memcmp(raw, key, key_len), "Public keys differ");
+
+	for (i = 0; i < TEST_THREADS; i++) {
+		stir_shaken_assert(pthread_create(&threads[i], NULL, test_thread, ref) == 0, "Cannot create thread");
+	}
+	for (i = 0; i < TEST_THREADS; i++) {
+		pthread_join(threads[i], &res);
+		stir_shaken_assert(res == NULL, (char *) res);
+	}
+	stir_shaken_assert(ref->refs == 1, "Wrong refcount after threads");
+
+	// Wrapper shares X509 and public key
+	cert = stir_shaken_cert_ref_to_cert(&ss, ref);
+	stir_shaken_assert(cert, "Err, wrapping compact cert");
+	stir_shaken_assert(cert->x == ref->x && cert->len == 1234 && cert->ref == ref && ref->refs == 2, "Wrapper should share cert");
+	stir_shaken_assert(!cert->path_verified, "Cert should not be verified yet");
+	stir_shaken_assert(stir_shaken_get_pubkey_raw_from_cert(&ss, cert, key2, &key2_len) == STIR_SHAKEN_STATUS_OK, "Cannot get public key");
+	stir_shaken_assert(key2_len == key_len && !memcmp(key2, key, key_len), "Public keys differ");
+	stir_shaken_destroy_cert(cert);
+	free(cert);
+	stir_shaken_assert(ref->refs == 1, "Wrapper should release compact cert");
+
+	// Path validation result shared until trust store changes
+	stir_shaken_assert(stir_shaken_cert_ref_verify_path(&ss, ref) != STIR_SHAKEN_STATUS_OK, "Should fail without trust store");
+	stir_shaken_clear_error(&ss);
+	stir_shaken_assert(stir_shaken_init_cert_store(&ss, ca_name, NULL, NULL, NULL) == STIR_SHAKEN_STATUS_OK, "Err, init cert store");
+	stir_shaken_assert(!stir_shaken_cert_ref_path_verified(ref), "Cert should not be verified yet");
+	stir_shaken_assert(stir_shaken_cert_ref_verify_path(&ss, ref) == STIR_SHAKEN_STATUS_OK, "Cert should verify");
+	stir_shaken_assert(stir_shaken_cert_ref_path_verified(ref), "Cert should be verified");
+	stir_shaken_assert(stir_shaken_cert_ref_check_revocation(&ss, ref) == STIR_SHAKEN_STATUS_OK, "Cert should not be revoked");
+
+	cert = stir_shaken_cert_ref_to_cert(&ss, ref);
+	stir_shaken_assert(cert && cert->path_verified && cert->verified_generation == stir_shaken_cert_store_generation(), "Wrapper should be verified");
+	stir_shaken_destroy_cert(cert);
+	free(cert);
+
+	stir_shaken_assert(stir_shaken_init_cert_store(&ss, ca_name, NULL, NULL, NULL) == STIR_SHAKEN_STATUS_OK, "Err, reload cert store");
+	stir_shaken_assert(!stir_shaken_cert_ref_path_verified(ref), "Validation against old trust store should not count");
+
+	stir_shaken_cert_ref_put(ref);
+
+	// Path validation result doesn't outlive intermediate it was made with (compact cert owns both certs)
+	inter = stir_shaken_generate_x509_cross_ca_cert(&ss, ca.cert.x, ca.keys.private_key, sp.keys.public_key, "US", "u27 CA", "US", "u27 Intermediate", 2, 90);
+	stir_shaken_assert(inter, "Err, generating intermediate cert");
+	X509_gmtime_adj(X509_getm_notAfter(inter), TEST_INTER_EXPIRY_S);
+	stir_shaken_assert(X509_sign(inter, ca.keys.private_key, EVP_sha256()), "Err, signing intermediate cert");
+	leaf = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, inter, sp.keys.private_key, "US", "u27 Intermediate", sp.csr.req, 11, 90, "http://ca.com/api");
+	stir_shaken_assert(leaf, "Err, generating SP cert");
+
+	xchain = sk_X509_new_null();
+	stir_shaken_assert(xchain && sk_X509_push(xchain, inter), "Err, making chain");
+	ref = stir_shaken_cert_ref_create(&ss, leaf, xchain, 1234);
+	stir_shaken_assert(ref, "Err, creating compact cert");
+
+	stir_shaken_assert(stir_shaken_cert_ref_verify_path(&ss, ref) == STIR_SHAKEN_STATUS_OK, "Cert should verify");
+	stir_shaken_assert(stir_shaken_cert_ref_path_verified(ref), "Cert should be verified");
+	stir_shaken_assert(ref->valid_until < time(NULL) + TEST_INTER_EXPIRY_S + 2, "Validity should end with intermediate");
+
+	sleep(TEST_INTER_EXPIRY_S + 1);
+	stir_shaken_assert(!stir_shaken_cert_ref_path_verified(ref), "Validation should not count after intermediate expired");
+	stir_shaken_assert(stir_shaken_cert_ref_verify_path(&ss, ref) != STIR_SHAKEN_STATUS_OK, "Cert should not verify with expired intermediate");
+	stir_shaken_clear_error(&ss);
+
+	stir_shaken_cert_ref_put(ref);
+
+	printf("Size: cert %zu bytes, compact cert %zu bytes\n", sizeof(stir_shaken_cert_t), sizeof(stir_shaken_cert_ref_t));
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	if (stir_shaken_unit_test_cert_ref() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	stir_shaken_destroy_cert(&ca.cert);
+	stir_shaken_destroy_keys_ex(&ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key);
+	stir_shaken_sp_destroy(&sp);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
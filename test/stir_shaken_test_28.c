@@ -0,0 +1,270 @@
+#include <stir_shaken.h>
+
+/*
+ * TNAuthList decoded from cert (RFC 8226 SPC, TN ranges, TNs, and authority check URL form made by this library),
+ * coverage of TN answered locally from sorted ranges.
+ */
+
+const char *path = "./test/run";
+
+#define TEST_RANGES		1000
+#define TEST_LOOKUP_N	1000000
+
+stir_shaken_ca_t ca;
+stir_shaken_sp_t sp;
+
+typedef struct test_der_s {
+	unsigned char	buf[64 * 1024];
+	int				len;
+} test_der_t;
+
+// Append TLV, @content may be NULL (content appended by caller after)
+static void test_der_put(test_der_t *der, int constructed, int tag, int xclass, const void *content, int len)
+{
+	unsigned char *p = der->buf + der->len;
+
+	ASN1_put_object(&p, constructed, len, tag, xclass);
+	if (content) {
+		memcpy(p, content, len);
+		p += len;
+	}
+	der->len = p - der->buf;
+}
+
+static void test_der_ia5(test_der_t *der, const char *s)
+{
+	test_der_put(der, 0, V_ASN1_IA5STRING, V_ASN1_UNIVERSAL, s, strlen(s));
+}
+
+static void test_der_wrap(test_der_t *der, test_der_t *inner, int tag, int xclass)
+{
+	test_der_put(der, 1, tag, xclass, inner->buf, inner->len);
+}
+
+static void test_entry_spc(test_der_t *list, const char *spc)
+{
+	test_der_t e = { .len = 0 };
+
+	test_der_ia5(&e, spc);
+	test_der_wrap(list, &e, 0, V_ASN1_CONTEXT_SPECIFIC);
+}
+
+static void test_entry_one(test_der_t *list, const char *tn)
+{
+	test_der_t e = { .len = 0 };
+
+	test_der_ia5(&e, tn);
+	test_der_wrap(list, &e, 2, V_ASN1_CONTEXT_SPECIFIC);
+}
+
+static void test_entry_range(test_der_t *list, const char *start, long count, int implicit)
+{
+	test_der_t range = { .len = 0 }, seq = { .len = 0 };
+	ASN1_INTEGER *n = ASN1_INTEGER_new();
+	unsigned char *p = NULL;
+
+	test_der_ia5(&range, start);
+	ASN1_INTEGER_set(n, count);
+	p = range.buf + range.len;
+	range.len += i2d_ASN1_INTEGER(n, &p);
+	ASN1_INTEGER_free(n);
+
+	if (implicit) {
+		test_der_wrap(list, &range, 1, V_ASN1_CONTEXT_SPECIFIC);
+	} else {
+		test_der_wrap(&seq, &range, V_ASN1_SEQUENCE, V_ASN1_UNIVERSAL);
+		test_der_wrap(list, &seq, 1, V_ASN1_CONTEXT_SPECIFIC);
+	}
+}
+
+// End-entity cert with TNAuthList @value
+static X509* test_cert(const unsigned char *value, int len)
+{
+	stir_shaken_context_t ss = { 0 };
+	X509 *x = NULL;
+	X509_EXTENSION *ext = NULL;
+	ASN1_OCTET_STRING *data = ASN1_OCTET_STRING_new();
+
+	x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, ca.cert.x, ca.keys.private_key, "US", "u28 CA", sp.csr.req, 10, 90, NULL);
+	if (!x || !data) return NULL;
+
+	X509_delete_ext(x, X509_get_ext_by_NID(x, stir_shaken_globals.tn_authlist_nid, -1));
+	ASN1_OCTET_STRING_set(data, value, len);
+	ext = X509_EXTENSION_create_by_NID(NULL, stir_shaken_globals.tn_authlist_nid, 0, data);
+	X509_add_ext(x, ext, -1);
+	X509_EXTENSION_free(ext);
+	ASN1_OCTET_STRING_free(data);
+	X509_sign(x, ca.keys.private_key, EVP_sha256());
+
+	return x;
+}
+
+static int test_covers(const stir_shaken_tn_authlist_t *tn_authlist, const char *tn)
+{
+	stir_shaken_context_t ss = { 0 };
+
+	return stir_shaken_tn_authlist_covers_tn(&ss, tn_authlist, tn) == STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_tn_authlist(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	test_der_t list = { .len = 0 }, ext = { .len = 0 };
+	stir_shaken_cert_t cert = { 0 };
+	stir_shaken_cert_ref_t *ref = NULL;
+	const stir_shaken_tn_authlist_t *tn_authlist = NULL;
+	stir_shaken_tn_authlist_t *decoded = NULL;
+	char url[STIR_SHAKEN_BUFLEN] = { 0 };
+	char tn[32] = { 0 };
+	struct timespec t0 = { 0 }, t1 = { 0 };
+	unsigned char bad[] = { 0x30, 0x03, 0xa5, 0x01, 0x00 };
+	int i = 0, hits = 0;
+
+	printf("=== Unit testing: STIR/Shaken TNAuthList\n\n");
+
+	sprintf(ca.private_key_name, "%s%c%s", path, '/', "u28_ca_private_key.pem");
+	sprintf(ca.public_key_name, "%s%c%s", path, '/', "u28_ca_public_key.pem");
+	sprintf(sp.private_key_name, "%s%c%s", path, '/', "u28_sp_private_key.pem");
+	sprintf(sp.public_key_name, "%s%c%s", path, '/', "u28_sp_public_key.pem");
+
+	ca.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key, ca.private_key_name, ca.public_key_name, ca.keys.priv_raw, &ca.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate CA keys");
+
+	sp.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &sp.keys.ec_key, &sp.keys.private_key, &sp.keys.public_key, sp.private_key_name, sp.public_key_name, sp.keys.priv_raw, &sp.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate SP keys");
+
+	status = stir_shaken_generate_csr(&ss, 2800, &sp.csr.req, sp.keys.private_key, sp.keys.public_key, "US", "u28 SP");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, generating CSR");
+
+	ca.cert.x = stir_shaken_generate_x509_self_signed_ca_cert(&ss, ca.keys.private_key, ca.keys.public_key, "US", "u28 CA", 1, 90);
+	stir_shaken_assert(ca.cert.x, "Err, generating CA cert");
+
+	// Authority check URL form, as made by this library
+	sp.cert.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, ca.cert.x, ca.keys.private_key, "US", "u28 CA", sp.csr.req, 10, 90, "http://ca.com/api");
+	stir_shaken_assert(sp.cert.x, "Err, generating SP cert");
+	stir_shaken_assert(stir_shaken_verify_cert_tn_authlist_extension(&ss, &sp.cert) == STIR_SHAKEN_STATUS_OK, "TNAuthList should decode");
+	tn_authlist = stir_shaken_cert_get_tn_authlist(&ss, &sp.cert);
+	stir_shaken_assert(tn_authlist && tn_authlist->uri && !strcmp(tn_authlist->uri, "http://ca.com/api") && tn_authlist->ranges_n == 0, "Wrong URL form");
+	stir_shaken_assert(stir_shaken_cert_get_tn_authlist(&ss, &sp.cert) == tn_authlist, "TNAuthList should be decoded once");
+	stir_shaken_assert(stir_shaken_cert_to_authority_check_url(&ss, &sp.cert, url, sizeof(url)) == STIR_SHAKEN_STATUS_OK && !strcmp(url, "http://ca.com/api"), "Wrong authority check URL");
+
+	// RFC 8226
+	test_entry_spc(&list, "2800");
+	test_entry_range(&list, "12155550000", 10000, 0);
+	test_entry_range(&list, "12155559000", 2000, 0);		// overlaps previous one
+	test_entry_range(&list, "4420790000", 100, 1);			// implicitly tagged
+	test_entry_range(&list, "99999", 10, 0);				// would spill over to 6 digits
+	test_entry_one(&list, "12025551234");
+	test_entry_one(&list, "1202555#123");					// not indexed
+	test_der_wrap(&ext, &list, V_ASN1_SEQUENCE, V_ASN1_UNIVERSAL);
+
+	cert.x = test_cert(ext.buf, ext.len);
+	stir_shaken_assert(cert.x, "Err, generating SP cert");
+	tn_authlist = stir_shaken_cert_get_tn_authlist(&ss, &cert);
+	stir_shaken_assert(tn_authlist, "TNAuthList should decode");
+	stir_shaken_assert(tn_authlist->spc_n == 1 && !strcmp(tn_authlist->spc[0], "2800") && !tn_authlist->uri, "Wrong SPC");
+	stir_shaken_assert(tn_authlist->ranges_n == 4, "Overlapping ranges should be merged");
+
+	stir_shaken_assert(test_covers(tn_authlist, "12155550000"), "First TN of range");
+	stir_shaken_assert(test_covers(tn_authlist, "+12155555678"), "TN in range");
+	stir_shaken_assert(test_covers(tn_authlist, "12155560999"), "Last TN of merged range");
+	stir_shaken_assert(!test_covers(tn_authlist, "12155561000"), "TN after range");
+	stir_shaken_assert(!test_covers(tn_authlist, "12155549999"), "TN before range");
+	stir_shaken_assert(!test_covers(tn_authlist, "2155555678"), "TN with less digits");
+	stir_shaken_assert(test_covers(tn_authlist, "4420790099") && !test_covers(tn_authlist, "4420790100"), "Implicitly tagged range");
+	stir_shaken_assert(test_covers(tn_authlist, "99999") && !test_covers(tn_authlist, "100008"), "Range should end at 99999");
+	stir_shaken_assert(test_covers(tn_authlist, "12025551234") && !test_covers(tn_authlist, "12025551235"), "Single TN");
+	stir_shaken_assert(!test_covers(tn_authlist, "1202555#123") && !test_covers(tn_authlist, "sip:alice@example.com"), "Not a TN");
+	stir_shaken_assert(stir_shaken_cert_to_authority_check_url(&ss, &cert, url, sizeof(url)) != STIR_SHAKEN_STATUS_OK, "No authority check URL");
+	stir_shaken_clear_error(&ss);
+
+	// Compact cert decodes it once, for all holders
+	X509_up_ref(cert.x);
+	ref = stir_shaken_cert_ref_create(&ss, cert.x, NULL, 0);
+	stir_shaken_assert(ref, "Err, creating compact cert");
+	tn_authlist = stir_shaken_cert_ref_get_tn_authlist(&ss, ref);
+	stir_shaken_assert(tn_authlist && tn_authlist->ranges_n == 4, "TNAuthList should decode");
+	stir_shaken_assert(stir_shaken_cert_ref_get_tn_authlist(&ss, ref) == tn_authlist, "TNAuthList should be decoded once");
+	stir_shaken_cert_ref_put(ref);
+	stir_shaken_destroy_cert(&cert);
+
+	// Malformed
+	cert.x = test_cert(bad, sizeof(bad));
+	stir_shaken_assert(cert.x, "Err, generating SP cert");
+	stir_shaken_assert(stir_shaken_verify_cert_tn_authlist_extension(&ss, &cert) != STIR_SHAKEN_STATUS_OK, "Malformed TNAuthList should not decode");
+	stir_shaken_assert(stir_shaken_get_error(&ss, NULL) != NULL, "Error should be set");
+	stir_shaken_clear_error(&ss);
+	stir_shaken_destroy_cert(&cert);
+
+	// Range count must be at least 2
+	list.len = 0;
+	ext.len = 0;
+	test_entry_range(&list, "12155550000", 1, 0);
+	test_der_wrap(&ext, &list, V_ASN1_SEQUENCE, V_ASN1_UNIVERSAL);
+	cert.x = test_cert(ext.buf, ext.len);
+	stir_shaken_assert(cert.x, "Err, generating SP cert");
+	stir_shaken_assert(!stir_shaken_cert_get_tn_authlist(&ss, &cert), "Range with count 1 should not decode");
+	stir_shaken_clear_error(&ss);
+	stir_shaken_destroy_cert(&cert);
+
+	// Many ranges
+	list.len = 0;
+	ext.len = 0;
+	for (i = 0; i < TEST_RANGES; i++) {
+		snprintf(tn, sizeof(tn), "1%03d5550000", i);
+		test_entry_range(&list, tn, 1000, 0);
+	}
+	test_der_wrap(&ext, &list, V_ASN1_SEQUENCE, V_ASN1_UNIVERSAL);
+	cert.x = test_cert(ext.buf, ext.len);
+	stir_shaken_assert(cert.x, "Err, generating SP cert");
+	decoded = stir_shaken_tn_authlist_decode(&ss, cert.x);
+	stir_shaken_assert(decoded && decoded->ranges_n == TEST_RANGES, "Wrong number of ranges");
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < TEST_LOOKUP_N; i++) {
+		snprintf(tn, sizeof(tn), "1%03d555%04d", i % TEST_RANGES, i % 2000);
+		hits += test_covers(decoded, tn);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	stir_shaken_assert(hits == TEST_LOOKUP_N / 2, "Wrong number of covered TNs");
+
+	printf("TN lookup in %d ranges: %.3f us\n", TEST_RANGES, ((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9) * 1e6 / TEST_LOOKUP_N);
+
+	stir_shaken_tn_authlist_destroy(decoded);
+	stir_shaken_destroy_cert(&cert);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	if (stir_shaken_unit_test_tn_authlist() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	stir_shaken_destroy_cert(&ca.cert);
+	stir_shaken_destroy_keys_ex(&ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key);
+	stir_shaken_sp_destroy(&sp);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,258 @@
+#include <stir_shaken.h>
+
+/*
+ * Intermediate pool: intermediates from validated paths are used to build paths of certs downloaded
+ * without them, pool is bounded (oldest evicted) and never trusted by itself. CRLs issued by intermediates verify through the pool.
+ */
+
+const char *path = "./test/run";
+
+stir_shaken_ca_t ca, inter;
+stir_shaken_sp_t sp;
+char ca_name[STIR_SHAKEN_BUFLEN];
+X509 *inter2, *inter3;
+int writer_stop;
+
+#define TEST_THREADS	4
+#define TEST_VERIFY_N	500
+
+static stir_shaken_error_t test_verify(stir_shaken_cert_t *cert)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_error_t error_code = STIR_SHAKEN_ERROR_GENERAL;
+
+	if (stir_shaken_verify_cert_path(&ss, cert) == STIR_SHAKEN_STATUS_OK) {
+		return 0;
+	}
+
+	stir_shaken_get_error(&ss, &error_code);
+	return error_code;
+}
+
+static X509_CRL* test_make_crl(X509 *issuer, EVP_PKEY *key, long serial)
+{
+	X509_CRL *crl = X509_CRL_new();
+	X509_REVOKED *r = X509_REVOKED_new();
+	ASN1_TIME *t = ASN1_TIME_new();
+	ASN1_INTEGER *i = ASN1_INTEGER_new();
+
+	X509_CRL_set_version(crl, 1);
+	X509_CRL_set_issuer_name(crl, X509_get_subject_name(issuer));
+	X509_gmtime_adj(t, 0);
+	X509_CRL_set1_lastUpdate(crl, t);
+	X509_gmtime_adj(t, 3600);
+	X509_CRL_set1_nextUpdate(crl, t);
+
+	ASN1_INTEGER_set(i, 1);
+	X509_CRL_add1_ext_i2d(crl, NID_crl_number, i, 0, 0);
+
+	ASN1_INTEGER_set(i, serial);
+	X509_REVOKED_set_serialNumber(r, i);
+	X509_gmtime_adj(t, 0);
+	X509_REVOKED_set_revocationDate(r, t);
+	X509_CRL_add0_revoked(crl, r);
+
+	X509_CRL_sort(crl);
+	X509_CRL_sign(crl, key, EVP_sha256());
+
+	ASN1_INTEGER_free(i);
+	ASN1_TIME_free(t);
+	return crl;
+}
+
+static void* test_verify_thread(void *arg)
+{
+	stir_shaken_cert_t *cert = arg;
+	int i = 0;
+
+	for (i = 0; i < TEST_VERIFY_N; i++) {
+		if (test_verify(cert) != 0) return "Cert with chain should verify";
+	}
+
+	return NULL;
+}
+
+static void* test_writer_thread(void *arg)
+{
+	stir_shaken_context_t ss = { 0 };
+
+	while (!__atomic_load_n(&writer_stop, __ATOMIC_ACQUIRE)) {
+		stir_shaken_intermediate_pool_add(&ss, inter2);
+		stir_shaken_intermediate_pool_add(&ss, inter3);
+		stir_shaken_intermediate_pool_set_max(1);
+		stir_shaken_intermediate_pool_set_max(STIR_SHAKEN_INTERMEDIATE_POOL_MAX);
+		stir_shaken_intermediate_pool_flush();
+	}
+
+	return NULL;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_intermediate_pool(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	stir_shaken_cert_t leaf = { 0 }, full = { 0 };
+	X509_CRL *crl = NULL;
+	stir_shaken_cert_t certs[TEST_THREADS] = { 0 };
+	pthread_t threads[TEST_THREADS], writer;
+	void *res = NULL;
+	int i = 0;
+
+	printf("=== Unit testing: STIR/Shaken intermediate pool\n\n");
+
+	sprintf(ca.private_key_name, "%s%c%s", path, '/', "u29_ca_private_key.pem");
+	sprintf(ca.public_key_name, "%s%c%s", path, '/', "u29_ca_public_key.pem");
+	sprintf(inter.private_key_name, "%s%c%s", path, '/', "u29_inter_private_key.pem");
+	sprintf(inter.public_key_name, "%s%c%s", path, '/', "u29_inter_public_key.pem");
+	sprintf(sp.private_key_name, "%s%c%s", path, '/', "u29_sp_private_key.pem");
+	sprintf(sp.public_key_name, "%s%c%s", path, '/', "u29_sp_public_key.pem");
+	sprintf(ca_name, "%s%c%s", path, '/', "u29_ca.pem");
+
+	ca.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key, ca.private_key_name, ca.public_key_name, ca.keys.priv_raw, &ca.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate CA keys");
+
+	inter.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &inter.keys.ec_key, &inter.keys.private_key, &inter.keys.public_key, inter.private_key_name, inter.public_key_name, inter.keys.priv_raw, &inter.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate intermediate keys");
+
+	sp.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &sp.keys.ec_key, &sp.keys.private_key, &sp.keys.public_key, sp.private_key_name, sp.public_key_name, sp.keys.priv_raw, &sp.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate SP keys");
+
+	status = stir_shaken_generate_csr(&ss, 2900, &sp.csr.req, sp.keys.private_key, sp.keys.public_key, "US", "u29 SP");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, generating CSR");
+
+	ca.cert.x = stir_shaken_generate_x509_self_signed_ca_cert(&ss, ca.keys.private_key, ca.keys.public_key, "US", "u29 CA", 1, 90);
+	stir_shaken_assert(ca.cert.x, "Err, generating CA cert");
+	stir_shaken_assert(stir_shaken_x509_to_disk(&ss, ca.cert.x, ca_name) == STIR_SHAKEN_STATUS_OK, "Err, writing CA cert");
+
+	// Intermediate issued by CA, other two share its key and are issued by CA too (same issuer of SP cert as far as key goes)
+	inter.cert.x = stir_shaken_generate_x509_cross_ca_cert(&ss, ca.cert.x, ca.keys.private_key, inter.keys.public_key, "US", "u29 CA", "US", "u29 Intermediate", 2, 90);
+	stir_shaken_assert(inter.cert.x, "Err, generating intermediate cert");
+	inter2 = stir_shaken_generate_x509_cross_ca_cert(&ss, ca.cert.x, ca.keys.private_key, inter.keys.public_key, "US", "u29 CA", "US", "u29 Intermediate 2", 3, 90);
+	stir_shaken_assert(inter2, "Err, generating intermediate cert");
+	inter3 = stir_shaken_generate_x509_cross_ca_cert(&ss, ca.cert.x, ca.keys.private_key, inter.keys.public_key, "US", "u29 CA", "US", "u29 Intermediate 3", 4, 90);
+	stir_shaken_assert(inter3, "Err, generating intermediate cert");
+
+	sp.cert.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, inter.cert.x, inter.keys.private_key, "US", "u29 Intermediate", sp.csr.req, 10, 90, "http://ca.com/api");
+	stir_shaken_assert(sp.cert.x, "Err, generating SP cert");
+
+	status = stir_shaken_init_cert_store(&ss, ca_name, NULL, NULL, NULL);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, init cert store");
+
+	// x5u with end entity cert only, and with the chain
+	leaf.x = sp.cert.x;
+	full.x = sp.cert.x;
+	full.xchain = sk_X509_new_null();
+	stir_shaken_assert(full.xchain && sk_X509_push(full.xchain, inter.cert.x), "Err, making chain");
+
+	stir_shaken_assert(stir_shaken_intermediate_pool_size() == 0, "Pool should be empty");
+	stir_shaken_assert(test_verify(&leaf) == STIR_SHAKEN_ERROR_CERT_INVALID, "Cert without chain should not verify yet");
+
+	stir_shaken_assert(test_verify(&full) == 0, "Cert with chain should verify");
+	stir_shaken_assert(stir_shaken_intermediate_pool_size() == 1, "Intermediate should be learnt");
+	stir_shaken_assert(test_verify(&full) == 0, "Cert with chain should verify");
+	stir_shaken_assert(stir_shaken_intermediate_pool_size() == 1, "Intermediate should be learnt once");
+
+	stir_shaken_assert(test_verify(&leaf) == 0, "Cert without chain should verify with intermediate from pool");
+	stir_shaken_assert(stir_shaken_cert_check_revocation(&ss, &leaf) == STIR_SHAKEN_STATUS_OK, "Cert should not be revoked");
+
+	stir_shaken_intermediate_pool_flush();
+	stir_shaken_assert(stir_shaken_intermediate_pool_size() == 0, "Pool should be empty after flush");
+	stir_shaken_assert(test_verify(&leaf) == STIR_SHAKEN_ERROR_CERT_INVALID, "Cert without chain should not verify after flush");
+
+	// Only intermediates, pool is not a trust store
+	stir_shaken_assert(stir_shaken_intermediate_pool_add(&ss, ca.cert.x) == STIR_SHAKEN_STATUS_NOOP, "Self-signed cert should not be added");
+	stir_shaken_assert(stir_shaken_intermediate_pool_add(&ss, sp.cert.x) == STIR_SHAKEN_STATUS_NOOP, "End entity cert should not be added");
+	stir_shaken_assert(stir_shaken_intermediate_pool_size() == 0, "Pool should be empty");
+
+	// Bounded, oldest evicted
+	stir_shaken_intermediate_pool_set_max(2);
+	stir_shaken_assert(stir_shaken_intermediate_pool_add(&ss, inter.cert.x) == STIR_SHAKEN_STATUS_OK, "Err, adding intermediate");
+	stir_shaken_assert(stir_shaken_intermediate_pool_add(&ss, inter2) == STIR_SHAKEN_STATUS_OK, "Err, adding intermediate");
+	stir_shaken_assert(test_verify(&leaf) == 0, "Cert without chain should verify with intermediate from pool");
+	stir_shaken_assert(stir_shaken_intermediate_pool_add(&ss, inter3) == STIR_SHAKEN_STATUS_OK, "Err, adding intermediate");
+	stir_shaken_assert(stir_shaken_intermediate_pool_size() == 2, "Pool should be bounded");
+	stir_shaken_assert(test_verify(&leaf) == STIR_SHAKEN_ERROR_CERT_INVALID, "Oldest intermediate should be evicted");
+
+	// Known cert doesn't push anything out
+	stir_shaken_assert(stir_shaken_intermediate_pool_add(&ss, inter3) == STIR_SHAKEN_STATUS_NOOP, "Known intermediate should not be added again");
+	stir_shaken_assert(stir_shaken_intermediate_pool_add(&ss, inter.cert.x) == STIR_SHAKEN_STATUS_OK, "Err, adding intermediate");
+	stir_shaken_assert(stir_shaken_intermediate_pool_size() == 2, "Pool should be bounded");
+	stir_shaken_assert(test_verify(&leaf) == 0, "Cert without chain should verify with intermediate from pool");
+
+	// Disabled
+	stir_shaken_intermediate_pool_set_max(0);
+	stir_shaken_assert(stir_shaken_intermediate_pool_size() == 0, "Disabled pool should be empty");
+	stir_shaken_assert(test_verify(&full) == 0, "Cert with chain should verify");
+	stir_shaken_assert(stir_shaken_intermediate_pool_size() == 0, "Disabled pool should not learn");
+	stir_shaken_assert(test_verify(&leaf) == STIR_SHAKEN_ERROR_CERT_INVALID, "Cert without chain should not verify with pool disabled");
+	stir_shaken_intermediate_pool_set_max(STIR_SHAKEN_INTERMEDIATE_POOL_MAX);
+
+	// Verifications use pool snapshot while it changes (each thread with its own cert struct, sharing X509)
+	stir_shaken_assert(pthread_create(&writer, NULL, test_writer_thread, NULL) == 0, "Cannot create thread");
+	for (i = 0; i < TEST_THREADS; i++) {
+		certs[i].x = full.x;
+		certs[i].xchain = full.xchain;
+		stir_shaken_assert(pthread_create(&threads[i], NULL, test_verify_thread, &certs[i]) == 0, "Cannot create thread");
+	}
+	for (i = 0; i < TEST_THREADS; i++) {
+		pthread_join(threads[i], &res);
+		stir_shaken_assert(res == NULL, (char *) res);
+	}
+	__atomic_store_n(&writer_stop, 1, __ATOMIC_RELEASE);
+	pthread_join(writer, NULL);
+
+	// CRL issued by intermediate verifies through the pool (kept for the rest of the test, so it goes last)
+	stir_shaken_intermediate_pool_flush();
+	crl = test_make_crl(inter.cert.x, inter.keys.private_key, 10);
+	stir_shaken_assert(stir_shaken_crl_add(&ss, crl) != STIR_SHAKEN_STATUS_OK, "CRL from unknown intermediate should be rejected");
+	stir_shaken_clear_error(&ss);
+
+	// Verification learns the intermediate
+	stir_shaken_assert(test_verify(&full) == 0, "Cert should not be revoked");
+	stir_shaken_assert(stir_shaken_intermediate_pool_size() == 1, "Intermediate should be learnt");
+	stir_shaken_assert(stir_shaken_crl_add(&ss, crl) == STIR_SHAKEN_STATUS_OK, "CRL from intermediate in pool should be applied");
+	X509_CRL_free(crl);
+	stir_shaken_assert(test_verify(&full) == STIR_SHAKEN_ERROR_CERT_REVOKED, "Cert should be revoked by intermediate's CRL");
+	stir_shaken_assert(test_verify(&leaf) == STIR_SHAKEN_ERROR_CERT_REVOKED, "Cert should be revoked by intermediate's CRL");
+
+	sk_X509_free(full.xchain);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	if (stir_shaken_unit_test_intermediate_pool() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	stir_shaken_destroy_cert(&ca.cert);
+	stir_shaken_destroy_cert(&inter.cert);
+	X509_free(inter2);
+	X509_free(inter3);
+	stir_shaken_destroy_keys_ex(&ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key);
+	stir_shaken_destroy_keys_ex(&inter.keys.ec_key, &inter.keys.private_key, &inter.keys.public_key);
+	stir_shaken_sp_destroy(&sp);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
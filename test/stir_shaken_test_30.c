@@ -0,0 +1,145 @@
+#include <stir_shaken.h>
+
+/*
+ * Large CA dir: files are parsed on worker threads (with enough of them) and merged into trust store,
+ * unreadable files are skipped.
+ */
+
+const char *path = "./test/run";
+
+#define CA_DIR		"./test/run/u30_ca"
+#define TEST_CA_N	(4 * STIR_SHAKEN_CA_LOAD_PARALLEL_MIN)
+
+stir_shaken_ca_t ca;
+stir_shaken_sp_t sp;
+X509 *cas[TEST_CA_N];
+stir_shaken_cert_t sp_cert2;
+
+static stir_shaken_error_t test_verify(stir_shaken_cert_t *cert)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_error_t error_code = STIR_SHAKEN_ERROR_GENERAL;
+
+	if (stir_shaken_verify_cert_path(&ss, cert) == STIR_SHAKEN_STATUS_OK) {
+		return 0;
+	}
+
+	stir_shaken_get_error(&ss, &error_code);
+	return error_code;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_ca_dir_load(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	char cn[STIR_SHAKEN_BUFLEN] = { 0 };
+	char hashstr[100] = { 0 };
+	char name[STIR_SHAKEN_BUFLEN] = { 0 };
+	struct timespec t0 = { 0 }, t1 = { 0 };
+	unsigned long hashes[TEST_CA_N] = { 0 };
+	FILE *f = NULL;
+	int i = 0, j = 0, n = 0;
+
+	printf("=== Unit testing: STIR/Shaken CA dir load\n\n");
+
+	sprintf(ca.private_key_name, "%s%c%s", path, '/', "u30_ca_private_key.pem");
+	sprintf(ca.public_key_name, "%s%c%s", path, '/', "u30_ca_public_key.pem");
+	sprintf(sp.private_key_name, "%s%c%s", path, '/', "u30_sp_private_key.pem");
+	sprintf(sp.public_key_name, "%s%c%s", path, '/', "u30_sp_public_key.pem");
+
+	ca.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key, ca.private_key_name, ca.public_key_name, ca.keys.priv_raw, &ca.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate CA keys");
+
+	sp.keys.priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	status = stir_shaken_generate_keys(&ss, &sp.keys.ec_key, &sp.keys.private_key, &sp.keys.public_key, sp.private_key_name, sp.public_key_name, sp.keys.priv_raw, &sp.keys.priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate SP keys");
+
+	status = stir_shaken_generate_csr(&ss, 3000, &sp.csr.req, sp.keys.private_key, sp.keys.public_key, "US", "u30 SP");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, generating CSR");
+
+	stir_shaken_assert(stir_shaken_dir_create_recursive(CA_DIR) == STIR_SHAKEN_STATUS_OK, "Cannot create CA dir");
+
+	// CAs share key, each in own hashed file
+	for (i = 0; i < TEST_CA_N; i++) {
+
+		snprintf(cn, sizeof(cn), "u30 CA %d", i);
+		cas[i] = stir_shaken_generate_x509_self_signed_ca_cert(&ss, ca.keys.private_key, ca.keys.public_key, "US", cn, i + 1, 90);
+		stir_shaken_assert(cas[i], "Err, generating CA cert");
+
+		// Same names on every run (files from previous run are overwritten), .<n> tells apart CAs whose names hash the same
+		hashes[i] = stir_shaken_get_cert_name_hashed(&ss, cas[i]);
+		for (j = 0, n = 0; j < i; j++) {
+			if (hashes[j] == hashes[i]) n++;
+		}
+		stir_shaken_cert_name_hashed_2_string(hashes[i], hashstr, sizeof(hashstr));
+		snprintf(name, sizeof(name), "%s/%s.%d", CA_DIR, hashstr, n);
+		stir_shaken_assert(stir_shaken_x509_to_disk(&ss, cas[i], name) == STIR_SHAKEN_STATUS_OK, "Err, writing CA cert");
+	}
+
+	// Not a cert, skipped
+	snprintf(name, sizeof(name), "%s/%s", CA_DIR, "00000000.0");
+	f = fopen(name, "w");
+	stir_shaken_assert(f, "Cannot create file");
+	fprintf(f, "not a cert\n");
+	fclose(f);
+
+	sp.cert.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, cas[0], ca.keys.private_key, "US", "u30 CA 0", sp.csr.req, 10, 90, "http://ca.com/api");
+	stir_shaken_assert(sp.cert.x, "Err, generating SP cert");
+	snprintf(cn, sizeof(cn), "u30 CA %d", TEST_CA_N - 1);
+	sp_cert2.x = stir_shaken_generate_x509_end_entity_cert_from_csr(&ss, cas[TEST_CA_N - 1], ca.keys.private_key, "US", cn, sp.csr.req, 20, 90, "http://ca.com/api");
+	stir_shaken_assert(sp_cert2.x, "Err, generating SP cert");
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	status = stir_shaken_init_cert_store(&ss, NULL, CA_DIR, NULL, NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, init cert store");
+
+	printf("Loaded %d CA files: %.1f ms\n", TEST_CA_N, ((t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6));
+
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Cert issued by first CA should verify");
+	stir_shaken_assert(test_verify(&sp_cert2) == 0, "Cert issued by last CA should verify");
+
+	// Reload gives the same trust store
+	status = stir_shaken_cert_store_reload(&ss);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, reload cert store");
+	stir_shaken_assert(test_verify(&sp.cert) == 0, "Cert issued by first CA should verify after reload");
+	stir_shaken_assert(test_verify(&sp_cert2) == 0, "Cert issued by last CA should verify after reload");
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	int i = 0;
+
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	if (stir_shaken_unit_test_ca_dir_load() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	for (i = 0; i < TEST_CA_N; i++) {
+		X509_free(cas[i]);
+	}
+	stir_shaken_destroy_cert(&sp_cert2);
+	stir_shaken_destroy_keys_ex(&ca.keys.ec_key, &ca.keys.private_key, &ca.keys.public_key);
+	stir_shaken_sp_destroy(&sp);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
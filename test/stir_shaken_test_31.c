@@ -0,0 +1,371 @@
+#include <stir_shaken.h>
+#include <mongoose.h>
+
+/*
+ * Expiry scheduler: entries come out in order of expiry, whatever order they were scheduled, rescheduled
+ * or cancelled in, so caches evict what is due without scanning.
+ * x5u cache against local HTTP server: entries are never served past notAfter of their cert, full cache drops
+ * entry due first, maintenance drops what is due.
+ */
+
+const char *path = "./test/run";
+
+#define TEST_ENTRIES_N	10000
+#define TEST_PORT		"8095"
+#define TEST_ETAG		"\"u31\""
+#define TEST_CERTS_N	4
+
+// Cert served (with ETag) at /<i>.pem
+typedef struct test_cert_s {
+	char	*pem;
+	int		requests_n;
+	int		not_modified_n;
+} test_cert_t;
+
+typedef struct test_entry_s {
+	int							id;
+	stir_shaken_expiry_node_t	expiry;
+} test_entry_t;
+
+test_entry_t entries[TEST_ENTRIES_N];
+
+static volatile int server_running = 1;
+static test_cert_t certs[TEST_CERTS_N];
+static pthread_mutex_t certs_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static EC_KEY *ec_key = NULL;
+static EVP_PKEY *private_key = NULL;
+static EVP_PKEY *public_key = NULL;
+static unsigned char priv_raw[STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN] = { 0 };
+static uint32_t priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+static stir_shaken_csr_t csr = { 0 };
+
+static void test_event_handler(struct mg_connection *nc, int event, void *ev_data, void *d)
+{
+	struct http_message *hm = (struct http_message *) ev_data;
+	struct mg_str *inm = NULL;
+	test_cert_t *c = NULL;
+	int i = -1;
+
+	if (event != MG_EV_HTTP_REQUEST) return;
+
+	if (sscanf(hm->uri.p, "/%d.pem", &i) != 1 || i < 0 || i >= TEST_CERTS_N) {
+		mg_printf(nc, "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n");
+		return;
+	}
+
+	pthread_mutex_lock(&certs_mutex);
+
+	c = &certs[i];
+	c->requests_n++;
+
+	inm = mg_get_http_header(hm, "If-None-Match");
+	if (inm && mg_vcmp(inm, TEST_ETAG) == 0) {
+		c->not_modified_n++;
+		mg_printf(nc, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nContent-Length: 0\r\n\r\n", TEST_ETAG);
+	} else {
+		mg_printf(nc, "HTTP/1.1 200 OK\r\nETag: %s\r\nContent-Length: %d\r\nContent-Type: application/x-pem-file\r\n\r\n%s", TEST_ETAG, (int) strlen(c->pem), c->pem);
+	}
+
+	pthread_mutex_unlock(&certs_mutex);
+}
+
+static void* test_server_thread(void *arg)
+{
+	struct mg_mgr *mgr = (struct mg_mgr *) arg;
+
+	while (server_running) {
+		mg_mgr_poll(mgr, 50);
+	}
+
+	return NULL;
+}
+
+// Cert served at /@i.pem, valid for @seconds from now
+static stir_shaken_status_t test_cert_set(int i, long seconds)
+{
+	stir_shaken_context_t ss = { 0 };
+	BIO *bio = NULL;
+	X509 *x = NULL;
+	char *data = NULL, *pem = NULL;
+	long len = 0;
+
+	x = stir_shaken_generate_x509_cert_from_csr(&ss, 3100 + i, csr.req, private_key, "US", "x5u cache expiry test", 1 + i, 365);
+	if (!x) return STIR_SHAKEN_STATUS_FALSE;
+
+	// Short lived
+	X509_gmtime_adj(X509_getm_notAfter(x), seconds);
+	X509_sign(x, private_key, EVP_sha256());
+
+	bio = BIO_new(BIO_s_mem());
+	if (bio && PEM_write_bio_X509(bio, x) == 1) {
+
+		len = BIO_get_mem_data(bio, &data);
+		if ((pem = malloc(len + 1))) {
+			memcpy(pem, data, len);
+			pem[len] = '\0';
+		}
+	}
+	BIO_free(bio);
+	X509_free(x);
+
+	if (!pem) return STIR_SHAKEN_STATUS_FALSE;
+
+	pthread_mutex_lock(&certs_mutex);
+	free(certs[i].pem);
+	certs[i].pem = pem;
+	certs[i].requests_n = 0;
+	certs[i].not_modified_n = 0;
+	pthread_mutex_unlock(&certs_mutex);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+static int test_requests(int i)
+{
+	int n = 0;
+
+	pthread_mutex_lock(&certs_mutex);
+	n = certs[i].requests_n;
+	pthread_mutex_unlock(&certs_mutex);
+
+	return n;
+}
+
+static int test_not_modified(int i)
+{
+	int n = 0;
+
+	pthread_mutex_lock(&certs_mutex);
+	n = certs[i].not_modified_n;
+	pthread_mutex_unlock(&certs_mutex);
+
+	return n;
+}
+
+// Verify PASSporT signed with key of the cert at /@i.pem (x5u)
+static stir_shaken_status_t test_verify(int i)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_passport_t passport = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	stir_shaken_cert_t *cert = NULL;
+	char x5u[STIR_SHAKEN_BUFLEN] = { 0 };
+	char *sih = NULL, *p = NULL;
+	stir_shaken_passport_params_t params = { .attest = "B", .desttn_key = "tn", .desttn_val = "12155551213", .iat = time(NULL), .origtn_key = "tn", .origtn_val = "12155551212", .origid = "ref" };
+
+	snprintf(x5u, sizeof(x5u), "http://127.0.0.1:%s/%d.pem", TEST_PORT, i);
+	params.x5u = x5u;
+
+	status = stir_shaken_jwt_authenticate_keep_passport(&ss, &sih, &params, priv_raw, priv_raw_len, &passport);
+	if (status != STIR_SHAKEN_STATUS_OK) return status;
+
+	// JWT is the part of SIP Identity Header before parameters
+	if ((p = strchr(sih, ';'))) *p = '\0';
+
+	status = stir_shaken_jwt_verify(&ss, sih, &cert, NULL);
+
+	stir_shaken_destroy_cert(cert);
+	free(cert);
+	free(sih);
+	stir_shaken_passport_destroy(&passport);
+
+	return status;
+}
+
+// Drops all due by @now, returns how many, fails if out of order
+static int test_evict(stir_shaken_expiry_t *expiry, time_t now)
+{
+	stir_shaken_expiry_node_t *node = NULL;
+	time_t last = 0;
+	int n = 0;
+
+	while ((node = stir_shaken_expiry_first(expiry)) && node->at <= now) {
+
+		if (node->at < last) return -1;
+
+		last = node->at;
+		stir_shaken_expiry_cancel(expiry, node);
+		if (node->pos) return -1;
+		n++;
+	}
+
+	return n;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_expiry(void)
+{
+	stir_shaken_expiry_t expiry = { 0 };
+	struct timespec t0 = { 0 }, t1 = { 0 };
+	int i = 0, n = 0, cancelled = 0;
+
+	printf("=== Unit testing: STIR/Shaken expiry scheduler\n\n");
+
+	srandom(31);
+
+	for (i = 0; i < TEST_ENTRIES_N; i++) {
+		entries[i].id = i;
+		stir_shaken_assert(stir_shaken_expiry_schedule(&expiry, &entries[i].expiry, 1 + random() % 1000) == STIR_SHAKEN_STATUS_OK, "Cannot schedule");
+	}
+	stir_shaken_assert(expiry.n == TEST_ENTRIES_N, "All should be scheduled");
+	stir_shaken_assert(STIR_SHAKEN_EXPIRY_ENTRY(&entries[7].expiry, test_entry_t, expiry) == &entries[7], "Wrong entry from node");
+
+	// Reschedule some (later and earlier), cancel some
+	for (i = 0; i < TEST_ENTRIES_N; i += 3) {
+		stir_shaken_assert(stir_shaken_expiry_schedule(&expiry, &entries[i].expiry, 1 + random() % 1000) == STIR_SHAKEN_STATUS_OK, "Cannot reschedule");
+	}
+	for (i = 0; i < TEST_ENTRIES_N; i += 7) {
+		stir_shaken_expiry_cancel(&expiry, &entries[i].expiry);
+		stir_shaken_expiry_cancel(&expiry, &entries[i].expiry);
+		cancelled++;
+	}
+	stir_shaken_assert(expiry.n == TEST_ENTRIES_N - cancelled, "Cancelled should not be scheduled");
+
+	// Nothing due yet
+	stir_shaken_assert(test_evict(&expiry, 0) == 0, "Nothing should be due");
+
+	// Only what is due, in order
+	n = test_evict(&expiry, 500);
+	stir_shaken_assert(n > 0, "Eviction out of order");
+	for (i = 0; i < TEST_ENTRIES_N; i++) {
+		stir_shaken_assert(!entries[i].expiry.pos || entries[i].expiry.at > 500, "Due entry left");
+		stir_shaken_assert(!entries[i].expiry.pos || expiry.heap[entries[i].expiry.pos - 1] == &entries[i].expiry, "Wrong position");
+	}
+	stir_shaken_assert(test_evict(&expiry, 1000) == TEST_ENTRIES_N - cancelled - n, "Eviction out of order");
+	stir_shaken_assert(expiry.n == 0 && !stir_shaken_expiry_first(&expiry), "All should be evicted");
+
+	// Destroy leaves nodes unscheduled
+	stir_shaken_assert(stir_shaken_expiry_schedule(&expiry, &entries[0].expiry, 10) == STIR_SHAKEN_STATUS_OK, "Cannot schedule");
+	stir_shaken_expiry_destroy(&expiry);
+	stir_shaken_assert(!entries[0].expiry.pos && !expiry.heap && !expiry.n, "Should be destroyed");
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < TEST_ENTRIES_N; i++) {
+		stir_shaken_expiry_schedule(&expiry, &entries[i].expiry, random());
+	}
+	stir_shaken_assert(test_evict(&expiry, 0x7fffffff) == TEST_ENTRIES_N, "Eviction out of order");
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	stir_shaken_expiry_destroy(&expiry);
+
+	printf("Schedule and evict: %.3f us per entry\n", ((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9) * 1e6 / TEST_ENTRIES_N);
+
+	// Nothing to evict from empty caches
+	stir_shaken_cache_maintenance();
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_x5u_cache_expiry(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	char private_key_name[300] = { 0 };
+	char public_key_name[300] = { 0 };
+	int i = 0;
+
+	printf("=== Unit testing: STIR/Shaken x5u cache expiry\n\n");
+
+	sprintf(private_key_name, "%s%c%s", path, '/', "u31_private_key.pem");
+	sprintf(public_key_name, "%s%c%s", path, '/', "u31_public_key.pem");
+
+	status = stir_shaken_generate_keys(&ss, &ec_key, &private_key, &public_key, private_key_name, public_key_name, priv_raw, &priv_raw_len);
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, failed to generate keys...");
+	status = stir_shaken_generate_csr(&ss, 3100, &csr.req, private_key, public_key, "US", "x5u cache expiry test");
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "Err, generating CSR");
+
+	// Fresh entry is not served past notAfter, maintenance drops it then
+	stir_shaken_x5u_cache_set_ttl(60);
+	stir_shaken_assert(test_cert_set(0, 2) == STIR_SHAKEN_STATUS_OK, "Err, generating cert");
+	stir_shaken_assert(test_verify(0) == STIR_SHAKEN_STATUS_OK && test_requests(0) == 1, "Cert should be downloaded");
+	stir_shaken_assert(test_verify(0) == STIR_SHAKEN_STATUS_OK && test_requests(0) == 1, "Cert should be served from cache");
+	stir_shaken_cache_maintenance();
+	stir_shaken_assert(stir_shaken_globals.x5u_cache_n == 1, "Entry should not be dropped before notAfter");
+	sleep(3);
+	stir_shaken_cache_maintenance();
+	stir_shaken_assert(stir_shaken_globals.x5u_cache_n == 0, "Entry should be dropped at notAfter");
+	stir_shaken_assert(test_verify(0) == STIR_SHAKEN_STATUS_OK && test_requests(0) == 2, "Cert past notAfter should not be served from cache");
+	stir_shaken_assert(test_verify(0) == STIR_SHAKEN_STATUS_OK && test_requests(0) == 3, "Cert past notAfter should not be cached");
+	stir_shaken_assert(test_not_modified(0) == 0, "Cert past notAfter should not be revalidated");
+
+	// Stale entry is revalidated (304) only until notAfter
+	stir_shaken_x5u_cache_set_ttl(1);
+	stir_shaken_assert(test_cert_set(1, 3) == STIR_SHAKEN_STATUS_OK, "Err, generating cert");
+	stir_shaken_assert(test_verify(1) == STIR_SHAKEN_STATUS_OK && test_requests(1) == 1, "Cert should be downloaded");
+	sleep(2);
+	stir_shaken_assert(test_verify(1) == STIR_SHAKEN_STATUS_OK && test_requests(1) == 2 && test_not_modified(1) == 1, "Stale cert should be revalidated");
+	sleep(2);
+	stir_shaken_assert(test_verify(1) == STIR_SHAKEN_STATUS_OK && test_requests(1) == 3 && test_not_modified(1) == 1, "Cert past notAfter should be downloaded, not revalidated");
+
+	// Full cache drops entry due first, whatever order entries were added in
+	stir_shaken_x5u_cache_flush();
+	stir_shaken_x5u_cache_set_ttl(60);
+	stir_shaken_x5u_cache_set_max(2);
+	stir_shaken_assert(test_cert_set(1, 100) == STIR_SHAKEN_STATUS_OK, "Err, generating cert");
+	stir_shaken_assert(test_cert_set(2, 50) == STIR_SHAKEN_STATUS_OK, "Err, generating cert");
+	stir_shaken_assert(test_cert_set(3, 200) == STIR_SHAKEN_STATUS_OK, "Err, generating cert");
+	for (i = 1; i < TEST_CERTS_N; i++) {
+		stir_shaken_assert(test_verify(i) == STIR_SHAKEN_STATUS_OK && test_requests(i) == 1, "Cert should be downloaded");
+	}
+	stir_shaken_assert(stir_shaken_globals.x5u_cache_n == 2, "Cache should be full");
+	stir_shaken_assert(test_verify(1) == STIR_SHAKEN_STATUS_OK && test_requests(1) == 1, "Entry due later should be kept");
+	stir_shaken_assert(test_verify(3) == STIR_SHAKEN_STATUS_OK && test_requests(3) == 1, "Entry due later should be kept");
+	stir_shaken_assert(test_verify(2) == STIR_SHAKEN_STATUS_OK && test_requests(2) == 2, "Entry due first should be dropped");
+
+	stir_shaken_x5u_cache_set_max(0);
+	stir_shaken_x5u_cache_set_ttl(0);
+
+	for (i = 0; i < TEST_CERTS_N; i++) {
+		free(certs[i].pem);
+		certs[i].pem = NULL;
+	}
+	stir_shaken_destroy_csr(&csr);
+	stir_shaken_destroy_keys_ex(&ec_key, &private_key, &public_key);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	struct mg_mgr mgr;
+	struct mg_connection *nc = NULL;
+	pthread_t server = 0;
+
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	if (stir_shaken_dir_exists(path) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(path) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	if (stir_shaken_unit_test_expiry() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	mg_mgr_init(&mgr, NULL);
+	nc = mg_bind(&mgr, TEST_PORT, test_event_handler, NULL);
+	stir_shaken_assert(nc != NULL, "Cannot start HTTP server");
+	mg_set_protocol_http_websocket(nc);
+	stir_shaken_assert(pthread_create(&server, NULL, test_server_thread, &mgr) == 0, "Cannot start HTTP server thread");
+
+	if (stir_shaken_unit_test_x5u_cache_expiry() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	server_running = 0;
+	pthread_join(server, NULL);
+	mg_mgr_free(&mgr);
+
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,110 @@
+#include <stir_shaken.h>
+
+/*
+ * Error context: errors are recorded (code, description, file, line) in a small ring and formatted
+ * only by stir_shaken_get_error, clearing is a single store. Context holds no pointers into itself,
+ * so its copy keeps the errors.
+ */
+
+#define TEST_ERROR_N	1000000
+
+static void test_fail_static(stir_shaken_context_t *ss)
+{
+	stir_shaken_set_error(ss, "Static", STIR_SHAKEN_ERROR_CERT_INVALID);
+}
+
+stir_shaken_status_t stir_shaken_unit_test_error(void)
+{
+	stir_shaken_context_t ss = { 0 }, ss_copy = { 0 };
+	stir_shaken_error_t error = STIR_SHAKEN_ERROR_GENERAL;
+	struct timespec t0 = { 0 }, t1 = { 0 };
+	char buf[STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
+	char longbuf[2 * STIR_SHAKEN_ERROR_BUF_LEN] = { 0 };
+	const char *err = NULL;
+	int i = 0;
+
+	printf("=== Unit testing: STIR/Shaken error context\n\n");
+
+	stir_shaken_assert(!stir_shaken_is_error_set(&ss), "Error should not be set");
+	stir_shaken_assert(!stir_shaken_get_error(&ss, &error), "Error should not be set");
+
+	// String literal is kept by pointer, anything else is copied
+	test_fail_static(&ss);
+	stir_shaken_assert(stir_shaken_is_error_set(&ss), "Error should be set");
+	stir_shaken_assert(!strcmp(ss.errors[0].description, "Static"), "Wrong description");
+#if defined(__GNUC__)
+	stir_shaken_assert(ss.errors[0].description != ss.errors[0].text && !ss.errors[0].text[0], "String literal should not be copied");
+#endif
+
+	snprintf(buf, sizeof(buf), "Dynamic %d", 1);
+	stir_shaken_set_error(&ss, buf, STIR_SHAKEN_ERROR_SIP_403_STALE_DATE);
+	buf[0] = '\0';
+	stir_shaken_assert(!ss.errors[1].description && !strcmp(ss.errors[1].text, "Dynamic 1"), "Dynamic description should be copied");
+
+	err = stir_shaken_get_error(&ss, &error);
+	stir_shaken_assert(error == STIR_SHAKEN_ERROR_SIP_403_STALE_DATE, "Wrong error code");
+	stir_shaken_assert(err && strstr(err, "Error stack (top to bottom):\n[ERR 0] "), "Wrong error string");
+	stir_shaken_assert(strstr(err, ": Dynamic 1\n[ERR 1] ") && strstr(err, ": Static\n"), "Errors should be listed most recent first");
+
+	// Copy outlives original
+	ss_copy = ss;
+	memset(&ss, 0, sizeof(ss));
+	err = stir_shaken_get_error(&ss_copy, &error);
+	stir_shaken_assert(error == STIR_SHAKEN_ERROR_SIP_403_STALE_DATE && err && strstr(err, ": Dynamic 1\n[ERR 1] ") && strstr(err, ": Static\n"), "Copied context should keep errors");
+	ss = ss_copy;
+
+	stir_shaken_set_error_if_clear(&ss, "Not set", STIR_SHAKEN_ERROR_GENERAL);
+	stir_shaken_assert(stir_shaken_get_error_code(&ss) == STIR_SHAKEN_ERROR_SIP_403_STALE_DATE, "Error should not be overwritten");
+
+	stir_shaken_clear_error(&ss);
+	stir_shaken_assert(!stir_shaken_is_error_set(&ss), "Error should be cleared");
+	stir_shaken_set_error_if_clear(&ss, "Set", STIR_SHAKEN_ERROR_GENERAL);
+	err = stir_shaken_get_error(&ss, &error);
+	stir_shaken_assert(error == STIR_SHAKEN_ERROR_GENERAL && err && !strstr(err, "Error stack") && strstr(err, "[ERR 0] ") && strstr(err, ": Set\n"), "Single error should not be listed as stack");
+
+	// Long description is truncated
+	memset(longbuf, 'x', sizeof(longbuf) - 1);
+	stir_shaken_set_error(&ss, longbuf, STIR_SHAKEN_ERROR_GENERAL);
+	stir_shaken_assert(strlen(ss.errors[1].text) == STIR_SHAKEN_ERROR_TEXT_LEN - 1, "Long description should be truncated");
+
+	// Only most recent errors are kept
+	stir_shaken_clear_error(&ss);
+	for (i = 0; i < 3 * STIR_SHAKEN_ERROR_RING + 1; i++) {
+		snprintf(buf, sizeof(buf), "Error %d", i);
+		stir_shaken_set_error(&ss, buf, i);
+	}
+	err = stir_shaken_get_error(&ss, &error);
+	stir_shaken_assert(error == 3 * STIR_SHAKEN_ERROR_RING, "Wrong error code");
+	snprintf(buf, sizeof(buf), ": Error %d\n", 3 * STIR_SHAKEN_ERROR_RING);
+	stir_shaken_assert(strstr(err, buf) && strstr(err, "[ERR 0] ") < strstr(err, buf), "Most recent error should be first");
+	snprintf(buf, sizeof(buf), "[ERR %d] ", STIR_SHAKEN_ERROR_RING - 1);
+	stir_shaken_assert(strstr(err, buf), "Ring should be full");
+	snprintf(buf, sizeof(buf), ": Error %d\n", 2 * STIR_SHAKEN_ERROR_RING);
+	stir_shaken_assert(!strstr(err, buf), "Oldest errors should be dropped");
+	stir_shaken_assert(stir_shaken_is_error_recorded(&ss, 2 * STIR_SHAKEN_ERROR_RING + 1) && !stir_shaken_is_error_recorded(&ss, 2 * STIR_SHAKEN_ERROR_RING), "Only kept errors should be found");
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (i = 0; i < TEST_ERROR_N; i++) {
+		stir_shaken_clear_error(&ss);
+		test_fail_static(&ss);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	stir_shaken_assert(stir_shaken_get_error_code(&ss) == STIR_SHAKEN_ERROR_CERT_INVALID, "Wrong error code");
+
+	printf("Clear and set error: %.1f ns, context %zu bytes\n", ((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9) * 1e9 / TEST_ERROR_N, sizeof(stir_shaken_context_t));
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	if (stir_shaken_unit_test_error() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	printf("OK\n");
+
+	return 0;
+}
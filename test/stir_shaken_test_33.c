@@ -0,0 +1,249 @@
+#include <stir_shaken.h>
+
+/*
+ * Logging: records are delivered on logging thread until background writer is started. Then records logged
+ * by threads into their own rings are delivered by writer to callback, structured (level, subsystem, call id).
+ * Writer sleeps when rings are empty and is woken by next record. Records which do not fit are dropped and reported.
+ * Writer can be stopped and started while threads log, their rings are kept.
+ */
+
+#define TEST_THREADS		8
+#define TEST_THREAD_LOG_N	100
+#define TEST_RESTART_LOG_N	20000
+#define TEST_LOG_N			100000
+#define TEST_BATCH			(STIR_SHAKEN_LOG_RING_SIZE / 2)
+
+typedef struct test_log_s {
+	pthread_mutex_t		mutex;
+	pthread_mutex_t		block;		// held by test to stall delivery
+	uint8_t				blocking;
+	size_t				n;
+	size_t				per_call[TEST_THREADS + 1];
+	size_t				dropped;
+	pthread_t			thread;
+	stir_shaken_log_record_t	last;
+} test_log_t;
+
+test_log_t test_log;
+
+static void test_log_callback(const stir_shaken_log_record_t *record, void *user_data)
+{
+	test_log_t *t = user_data;
+	unsigned long long dropped = 0;
+
+	if (__atomic_load_n(&t->blocking, __ATOMIC_ACQUIRE)) {
+		pthread_mutex_lock(&t->block);
+		pthread_mutex_unlock(&t->block);
+	}
+
+	pthread_mutex_lock(&t->mutex);
+
+	__atomic_add_fetch(&t->n, 1, __ATOMIC_RELEASE);
+	t->thread = pthread_self();
+	if (record->call_id <= TEST_THREADS) {
+		t->per_call[record->call_id]++;
+	}
+	if (sscanf(record->msg, "STIR-Shaken: Log: dropped %llu records", &dropped) == 1) {
+		t->dropped += dropped;
+	}
+	t->last = *record;
+
+	pthread_mutex_unlock(&t->mutex);
+}
+
+static void test_log_reset(void)
+{
+	stir_shaken_log_flush();
+	pthread_mutex_lock(&test_log.mutex);
+	test_log.n = 0;
+	test_log.dropped = 0;
+	memset(test_log.per_call, 0, sizeof(test_log.per_call));
+	pthread_mutex_unlock(&test_log.mutex);
+}
+
+static void* test_thread(void *arg)
+{
+	uint64_t call_id = (uint64_t) (uintptr_t) arg;
+	int i = 0;
+
+	stir_shaken_log_set_call_id(call_id);
+
+	for (i = 0; i < TEST_THREAD_LOG_N; i++) {
+		stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_VERIFY, "Call %" PRIu64 ": record %d\n", call_id, i);
+	}
+
+	return NULL;
+}
+
+static void* test_thread_restart(void *arg)
+{
+	uint64_t call_id = (uint64_t) (uintptr_t) arg;
+	int i = 0;
+
+	stir_shaken_log_set_call_id(call_id);
+
+	for (i = 0; i < TEST_RESTART_LOG_N; i++) {
+		stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_VERIFY, "Call %" PRIu64 ": record %d\n", call_id, i);
+	}
+
+	return NULL;
+}
+
+static double test_elapsed_ns(struct timespec *t0, struct timespec *t1)
+{
+	return (t1->tv_sec - t0->tv_sec) * 1e9 + (t1->tv_nsec - t0->tv_nsec);
+}
+
+stir_shaken_status_t stir_shaken_unit_test_log(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_log_ring_t *ring = NULL;
+	pthread_t threads[TEST_THREADS];
+	struct timespec t0 = { 0 }, t1 = { 0 };
+	double async_ns = 0, sync_ns = 0;
+	char msg[2 * STIR_SHAKEN_LOG_MSG_LEN] = { 0 };
+	size_t i = 0, j = 0;
+
+	printf("=== Unit testing: STIR/Shaken logging\n\n");
+
+	// Writer is opt-in, until started records are delivered on logging thread
+	stir_shaken_assert(!stir_shaken_globals.log_running, "Writer should not be started by init");
+	test_log_reset();
+	stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_GENERAL, "Before start\n");
+	stir_shaken_assert(test_log.n == 1 && pthread_equal(test_log.thread, pthread_self()), "Record should be delivered on logging thread");
+	stir_shaken_assert(stir_shaken_log_start(&ss) == STIR_SHAKEN_STATUS_OK, "Cannot start writer");
+
+	// Writer sleeps when there is nothing to deliver
+	for (i = 0; i < 1000 && !__atomic_load_n(&stir_shaken_globals.log_sleeping, __ATOMIC_ACQUIRE); i++) {
+		usleep(1000);
+	}
+	stir_shaken_assert(stir_shaken_globals.log_sleeping, "Writer should sleep when idle");
+
+	// Woken by record, delivered on writer thread, structured
+	test_log_reset();
+	stir_shaken_log_set_call_id(7);
+	stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_HTTP, "HTTP %d\n", 200);
+	stir_shaken_log(STIR_SHAKEN_LOGLEVEL_HIGH + 1, STIR_SHAKEN_LOG_HTTP, "Not logged\n");
+	for (i = 0; i < 1000 && !__atomic_load_n(&test_log.n, __ATOMIC_ACQUIRE); i++) {
+		usleep(1000);
+	}
+	stir_shaken_assert(test_log.n == 1, "Record should be delivered by woken writer");
+	stir_shaken_log_flush();
+	stir_shaken_assert(test_log.n == 1, "Record should be delivered");
+	stir_shaken_assert(!pthread_equal(test_log.thread, pthread_self()), "Record should be delivered on writer thread");
+	stir_shaken_assert(test_log.last.level == STIR_SHAKEN_LOGLEVEL_BASIC && test_log.last.subsystem == STIR_SHAKEN_LOG_HTTP && test_log.last.call_id == 7, "Wrong record");
+	stir_shaken_assert(!strcmp(test_log.last.msg, "HTTP 200\n") && test_log.last.len == 9 && test_log.last.line > 0 && strstr(test_log.last.file, "stir_shaken_test_33.c"), "Wrong record");
+	stir_shaken_log_set_call_id(0);
+
+	// Long message is truncated in ring
+	memset(msg, 'x', sizeof(msg) - 1);
+	stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_GENERAL, "%s", msg);
+	stir_shaken_log_flush();
+	stir_shaken_assert(test_log.last.len == STIR_SHAKEN_LOG_MSG_LEN - 1 && strlen(test_log.last.msg) == STIR_SHAKEN_LOG_MSG_LEN - 1, "Long message should be truncated");
+
+	// Threads log into own rings, nothing is lost, rings of exited threads are freed
+	test_log_reset();
+	for (i = 0; i < TEST_THREADS; i++) {
+		stir_shaken_assert(pthread_create(&threads[i], NULL, test_thread, (void *) (uintptr_t) (i + 1)) == 0, "Cannot create thread");
+	}
+	for (i = 0; i < TEST_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	stir_shaken_log_flush();
+	stir_shaken_assert(test_log.n == TEST_THREADS * TEST_THREAD_LOG_N, "All records should be delivered");
+	for (i = 1; i <= TEST_THREADS; i++) {
+		stir_shaken_assert(test_log.per_call[i] == TEST_THREAD_LOG_N, "Records should carry call id");
+	}
+	stir_shaken_assert(stir_shaken_globals.log_rings && !stir_shaken_globals.log_rings->next, "Rings of exited threads should be freed");
+
+	// Ring full while delivery is stalled: records are dropped and reported, caller is not blocked
+	test_log_reset();
+	pthread_mutex_lock(&test_log.block);
+	__atomic_store_n(&test_log.blocking, 1, __ATOMIC_RELEASE);
+	for (i = 0; i < 3 * STIR_SHAKEN_LOG_RING_SIZE; i++) {
+		stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_GENERAL, "Record %zu\n", i);
+	}
+	__atomic_store_n(&test_log.blocking, 0, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&test_log.block);
+	stir_shaken_log_flush();
+	stir_shaken_assert(test_log.dropped > 0, "Records should be dropped");
+	stir_shaken_assert(test_log.n - 1 + test_log.dropped == 3 * STIR_SHAKEN_LOG_RING_SIZE, "Delivered and dropped records should add up");
+
+	// Cost on logging thread
+	for (j = 0; j < TEST_LOG_N / TEST_BATCH; j++) {
+		clock_gettime(CLOCK_MONOTONIC, &t0);
+		for (i = 0; i < TEST_BATCH; i++) {
+			stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_HTTP, "STIR-Shaken: making HTTP (%s) call:\nurl:\t%s\nport:\t%u\n", "GET", "https://sp.example.com/sp.pem", 443);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &t1);
+		async_ns += test_elapsed_ns(&t0, &t1);
+		stir_shaken_log_flush();
+	}
+
+	// Stopped: delivered on logging thread, ring is kept
+	ring = stir_shaken_globals.log_rings;
+	stir_shaken_log_stop();
+	stir_shaken_assert(stir_shaken_globals.log_rings == ring && !ring->next, "Ring of live thread should be kept");
+	test_log_reset();
+	stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_GENERAL, "Sync\n");
+	stir_shaken_assert(test_log.n == 1 && pthread_equal(test_log.thread, pthread_self()), "Record should be delivered on logging thread");
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for (j = 0; j < TEST_LOG_N; j++) {
+		stir_shaken_log(STIR_SHAKEN_LOGLEVEL_MEDIUM, STIR_SHAKEN_LOG_HTTP, "STIR-Shaken: making HTTP (%s) call:\nurl:\t%s\nport:\t%u\n", "GET", "https://sp.example.com/sp.pem", 443);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	sync_ns = test_elapsed_ns(&t0, &t1);
+
+	// Started again: thread keeps its ring
+	stir_shaken_assert(stir_shaken_log_start(&ss) == STIR_SHAKEN_STATUS_OK, "Cannot restart writer");
+	test_log_reset();
+	stir_shaken_log(STIR_SHAKEN_LOGLEVEL_BASIC, STIR_SHAKEN_LOG_GENERAL, "Async\n");
+	stir_shaken_log_flush();
+	stir_shaken_assert(test_log.n == 1 && stir_shaken_globals.log_rings == ring && !ring->next, "Record should be delivered after restart");
+
+	// Writer stopped and started while threads log: no ring is freed under them, records are delivered or reported dropped
+	test_log_reset();
+	for (i = 0; i < TEST_THREADS; i++) {
+		stir_shaken_assert(pthread_create(&threads[i], NULL, test_thread_restart, (void *) (uintptr_t) (i + 1)) == 0, "Cannot create thread");
+	}
+	for (i = 0; i < 200; i++) {
+		stir_shaken_log_stop();
+		stir_shaken_assert(stir_shaken_log_start(&ss) == STIR_SHAKEN_STATUS_OK, "Cannot restart writer");
+	}
+	for (i = 0; i < TEST_THREADS; i++) {
+		pthread_join(threads[i], NULL);
+	}
+	stir_shaken_log_flush();
+	for (i = 1, j = 0; i <= TEST_THREADS; i++) {
+		j += test_log.per_call[i];
+	}
+	stir_shaken_assert(j + test_log.dropped == TEST_THREADS * TEST_RESTART_LOG_N, "Records should be delivered or reported dropped");
+	stir_shaken_assert(stir_shaken_globals.log_rings == ring && !ring->next, "Rings of exited threads should be freed");
+
+	printf("Log record on calling thread: async %.1f ns, sync callback %.1f ns\n", async_ns / (TEST_LOG_N / TEST_BATCH * TEST_BATCH), sync_ns / TEST_LOG_N);
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	pthread_mutex_init(&test_log.mutex, NULL);
+	pthread_mutex_init(&test_log.block, NULL);
+	stir_shaken_log_set_callback(test_log_callback, &test_log);
+
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_HIGH), "Cannot init lib");
+
+	if (stir_shaken_unit_test_log() != STIR_SHAKEN_STATUS_OK) {
+
+		printf("Fail\n");
+		return -2;
+	}
+
+	stir_shaken_do_deinit();
+	stir_shaken_log_set_callback(NULL, NULL);
+
+	printf("OK\n");
+
+	return 0;
+}
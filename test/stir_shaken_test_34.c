@@ -0,0 +1,251 @@
+#include <stir_shaken.h>
+#include <curl/curl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <signal.h>
+
+/*
+ * HTTP/2 multiplexing: concurrent requests made with stir_shaken_make_http_reqs to the same origin share single connection.
+ *
+ * Server is nghttpd (nghttp2), HTTP/2 over TLS negotiated with ALPN, with self-signed certificate made here.
+ * Test is skipped (exit code 77) if nghttpd is not installed.
+ */
+
+const char *path = "./test/run";
+
+#define TEST_REQ_N			16
+#define TEST_SKIP			77
+#define TEST_BODY			"u34 h2 body"
+
+static char test_port[8];
+static pid_t server_pid = -1;
+
+// Find free port, nghttpd binds it right after
+static int test_free_port(void)
+{
+	struct sockaddr_in addr = { 0 };
+	socklen_t len = sizeof(addr);
+	int fd = -1, port = -1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0 && getsockname(fd, (struct sockaddr *) &addr, &len) == 0) {
+		port = ntohs(addr.sin_port);
+	}
+
+	close(fd);
+	return port;
+}
+
+static int test_server_connect(void)
+{
+	struct sockaddr_in addr = { 0 };
+	int fd = -1, res = -1;
+
+	fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) return -1;
+
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons(atoi(test_port));
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	res = connect(fd, (struct sockaddr *) &addr, sizeof(addr));
+
+	close(fd);
+	return res;
+}
+
+/*
+ * Start nghttpd serving @htdocs. Returns 0 when server accepts connections, TEST_SKIP if nghttpd cannot be run.
+ */
+static int test_server_start(const char *htdocs, const char *key, const char *cert)
+{
+	int i = 0, st = 0;
+
+	server_pid = fork();
+	if (server_pid < 0) return -1;
+
+	if (server_pid == 0) {
+
+		int fd = open("/dev/null", O_WRONLY);
+
+		if (fd >= 0) {
+			dup2(fd, STDOUT_FILENO);
+			dup2(fd, STDERR_FILENO);
+		}
+
+		execlp("nghttpd", "nghttpd", "-d", htdocs, test_port, key, cert, (char *) NULL);
+		_exit(127);
+	}
+
+	for (i = 0; i < 100; i++) {
+
+		if (waitpid(server_pid, &st, WNOHANG) == server_pid) {
+			server_pid = -1;
+			return TEST_SKIP;
+		}
+
+		if (test_server_connect() == 0) {
+			return 0;
+		}
+
+		usleep(50000);
+	}
+
+	return -1;
+}
+
+static void test_server_stop(void)
+{
+	if (server_pid > 0) {
+		kill(server_pid, SIGTERM);
+		waitpid(server_pid, NULL, 0);
+		server_pid = -1;
+	}
+}
+
+/*
+ * Self-signed certificate for 127.0.0.1, trusted by the test with stir_shaken_http_set_ca_file.
+ */
+static stir_shaken_status_t test_make_cert(const char *key_name, const char *pub_name, const char *cert_name)
+{
+	stir_shaken_context_t ss = { 0 };
+	EC_KEY *ec_key = NULL;
+	EVP_PKEY *private_key = NULL;
+	EVP_PKEY *public_key = NULL;
+	unsigned char priv_raw[STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN] = { 0 };
+	uint32_t priv_raw_len = STIR_SHAKEN_PRIV_KEY_RAW_BUF_LEN;
+	X509 *x = NULL;
+	X509_EXTENSION *ext = NULL;
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+
+	if (stir_shaken_generate_keys(&ss, &ec_key, &private_key, &public_key, key_name, pub_name, priv_raw, &priv_raw_len) != STIR_SHAKEN_STATUS_OK) {
+		return STIR_SHAKEN_STATUS_FALSE;
+	}
+
+	x = stir_shaken_generate_x509_cert(&ss, public_key, "US", "127.0.0.1", "US", "127.0.0.1", 1, 1);
+	if (!x) goto done;
+
+	ext = X509V3_EXT_conf_nid(NULL, NULL, NID_subject_alt_name, "IP:127.0.0.1");
+	if (!ext || !X509_add_ext(x, ext, -1)) goto done;
+	if (stir_shaken_sign_x509_cert(&ss, x, private_key) != STIR_SHAKEN_STATUS_OK) goto done;
+
+	status = stir_shaken_x509_to_disk(&ss, x, cert_name);
+
+done:
+	if (ext) X509_EXTENSION_free(ext);
+	if (x) X509_free(x);
+	stir_shaken_destroy_keys_ex(&ec_key, &private_key, &public_key);
+	return status;
+}
+
+stir_shaken_status_t stir_shaken_unit_test_http2_multiplexing(void)
+{
+	stir_shaken_context_t ss = { 0 };
+	stir_shaken_http_req_t reqs[TEST_REQ_N];
+	stir_shaken_http_req_t *preqs[TEST_REQ_N];
+	char url[STIR_SHAKEN_BUFLEN] = { 0 };
+	stir_shaken_status_t status = STIR_SHAKEN_STATUS_FALSE;
+	long connects = 0;
+	int i = 0;
+
+	printf("=== Unit testing: STIR/Shaken HTTP/2 multiplexing\n\n");
+
+	snprintf(url, sizeof(url), "https://127.0.0.1:%s/cert.pem", test_port);
+
+	stir_shaken_http_set_http2(1);
+
+	for (i = 0; i < TEST_REQ_N; i++) {
+		memset(&reqs[i], 0, sizeof(reqs[i]));
+		reqs[i].url = strdup(url);
+		reqs[i].type = STIR_SHAKEN_HTTP_REQ_TYPE_GET;
+		preqs[i] = &reqs[i];
+	}
+
+	status = stir_shaken_make_http_reqs(&ss, preqs, TEST_REQ_N);
+	if (stir_shaken_is_error_set(&ss)) {
+		printf("Error description is: '%s'\n", stir_shaken_get_error(&ss, NULL));
+	}
+	stir_shaken_assert(status == STIR_SHAKEN_STATUS_OK, "HTTP batch failed");
+
+	for (i = 0; i < TEST_REQ_N; i++) {
+		stir_shaken_assert(reqs[i].response.code == 200, "Bad HTTP response code");
+		stir_shaken_assert(reqs[i].response.mem.mem && !strcmp(reqs[i].response.mem.mem, TEST_BODY), "Bad response");
+		stir_shaken_assert(reqs[i].response.http_version == CURL_HTTP_VERSION_2_0, "HTTP/2 should be negotiated");
+		connects += reqs[i].response.num_connects;
+		stir_shaken_destroy_http_request(&reqs[i]);
+	}
+
+	printf("%d concurrent requests made %ld connection(s)\n", TEST_REQ_N, connects);
+	stir_shaken_assert(connects == 1, "Requests should be multiplexed over single connection");
+
+	return STIR_SHAKEN_STATUS_OK;
+}
+
+int main(void)
+{
+	char htdocs[300] = { 0 };
+	char key_name[300] = { 0 };
+	char pub_name[300] = { 0 };
+	char cert_name[300] = { 0 };
+	char body_name[400] = { 0 };
+	FILE *fp = NULL;
+	int port = 0, res = 0;
+
+	stir_shaken_assert(STIR_SHAKEN_STATUS_OK == stir_shaken_do_init(NULL, NULL, NULL, STIR_SHAKEN_LOGLEVEL_NOTHING), "Cannot init lib");
+
+	snprintf(htdocs, sizeof(htdocs), "%s/u34_htdocs", path);
+
+	if (stir_shaken_dir_exists(htdocs) != STIR_SHAKEN_STATUS_OK) {
+
+		if (stir_shaken_dir_create_recursive(htdocs) != STIR_SHAKEN_STATUS_OK) {
+
+			printf("ERR: Cannot create test dir\n");
+			return -1;
+		}
+	}
+
+	snprintf(key_name, sizeof(key_name), "%s/u34_private_key.pem", path);
+	snprintf(pub_name, sizeof(pub_name), "%s/u34_public_key.pem", path);
+	snprintf(cert_name, sizeof(cert_name), "%s/u34_cert.pem", path);
+	snprintf(body_name, sizeof(body_name), "%s/cert.pem", htdocs);
+
+	stir_shaken_assert(test_make_cert(key_name, pub_name, cert_name) == STIR_SHAKEN_STATUS_OK, "Cannot create server certificate");
+	stir_shaken_assert((fp = fopen(body_name, "w")) != NULL, "Cannot create served file");
+	fputs(TEST_BODY, fp);
+	fclose(fp);
+
+	port = test_free_port();
+	stir_shaken_assert(port > 0, "Cannot get free port");
+	snprintf(test_port, sizeof(test_port), "%d", port);
+
+	res = test_server_start(htdocs, key_name, cert_name);
+	if (res == TEST_SKIP) {
+		printf("SKIP: nghttpd not available\n");
+		stir_shaken_do_deinit();
+		return TEST_SKIP;
+	}
+	stir_shaken_assert(res == 0, "Cannot start HTTP/2 server");
+
+	stir_shaken_http_set_ca_file(cert_name);
+
+	if (stir_shaken_unit_test_http2_multiplexing() != STIR_SHAKEN_STATUS_OK) {
+
+		test_server_stop();
+		printf("Fail\n");
+		return -2;
+	}
+
+	test_server_stop();
+	stir_shaken_do_deinit();
+
+	printf("OK\n");
+
+	return 0;
+}
@@ -15,6 +15,7 @@ static int test_passport_data(stir_shaken_passport_t *passport)
 {
 	const char *p = NULL;
 	long int iat_ = -1;
+	int is_tn = -1;
 
     // test JWT header
     p = stir_shaken_passport_get_header(passport, "alg");
@@ -40,6 +41,13 @@ static int test_passport_data(stir_shaken_passport_t *passport)
     
     p = stir_shaken_passport_get_grant(passport, "dest");
     stir_shaken_assert(p != NULL, "PASSporT is missing param");
+    stir_shaken_assert(!strcmp(p, desttn_val), "ERROR: wrong param value");
+    
+    stir_shaken_assert(stir_shaken_passport_get_grant_json(NULL, passport, "dest") != NULL, "PASSporT is missing param");
+    p = stir_shaken_passport_get_tn_or_uri(NULL, passport, "dest", &is_tn);
+    stir_shaken_assert(p != NULL, "PASSporT is missing param");
+    stir_shaken_assert(!strcmp(p, desttn_val), "ERROR: wrong param value");
+    stir_shaken_assert(is_tn == 0, "ERROR: @dest should be in 'uri' form");
     
     iat_ = stir_shaken_passport_get_grant_int(passport, "iat");
     stir_shaken_assert(errno != ENOENT, "PASSporT is missing param");
@@ -47,6 +55,13 @@ static int test_passport_data(stir_shaken_passport_t *passport)
     
     p = stir_shaken_passport_get_grant(passport, "orig");
     stir_shaken_assert(p != NULL, "PASSporT is missing param");
+    stir_shaken_assert(!strcmp(p, origtn_val), "ERROR: wrong param value");
+    
+    stir_shaken_assert(stir_shaken_passport_get_grant_json(NULL, passport, "orig") != NULL, "PASSporT is missing param");
+    p = stir_shaken_passport_get_tn_or_uri(NULL, passport, "orig", &is_tn);
+    stir_shaken_assert(p != NULL, "PASSporT is missing param");
+    stir_shaken_assert(!strcmp(p, origtn_val), "ERROR: wrong param value");
+    stir_shaken_assert(is_tn == 1, "ERROR: @orig should be in 'tn' form");
     
     p = stir_shaken_passport_get_grant(passport, "origid");
     stir_shaken_assert(p != NULL, "PASSporT is missing param");